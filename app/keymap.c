@@ -0,0 +1,77 @@
+#include <string.h>
+#include "keymap.h"
+
+// A full size layout, one matrix row per line, see keymap.h.
+const uint8_t Keymap[MATRIX_ROWS][MATRIX_COLS] = {
+	// Esc F1-F12 PrintScreen ScrollLock Pause
+	{ 0x29, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f, 0x40, 0x41, 0x42, 0x43,
+	  0x44, 0x45, 0x46, 0x47, 0x48 },
+	// ` 1-0 - = Backspace Insert Home
+	{ 0x35, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27,
+	  0x2d, 0x2e, 0x2a, 0x49, 0x4a },
+	// Tab Q-P [ ] \ Delete End
+	{ 0x2b, 0x14, 0x1a, 0x08, 0x15, 0x17, 0x1c, 0x18, 0x0c, 0x12, 0x13,
+	  0x2f, 0x30, 0x31, 0x4c, 0x4d },
+	// CapsLock A-L ; ' Enter PageUp PageDown NumLock
+	{ 0x39, 0x04, 0x16, 0x07, 0x09, 0x0a, 0x0b, 0x0d, 0x0e, 0x0f, 0x33,
+	  0x34, 0x28, 0x4b, 0x4e, 0x53 },
+	// LeftShift Z-M , . / RightShift Up KP/ KP* KP-
+	{ 0xe1, 0x1d, 0x1b, 0x06, 0x19, 0x05, 0x11, 0x10, 0x36, 0x37, 0x38,
+	  0xe5, 0x52, 0x54, 0x55, 0x56 },
+	// LeftCtrl LeftGUI LeftAlt Space RightAlt RightGUI Menu RightCtrl
+	// Left Down Right KP7 KP8 KP9 KP+
+	{ 0xe0, 0xe3, 0xe2, 0x2c, 0xe6, 0xe7, 0x65, 0xe4, 0x50, 0x51, 0x4f,
+	  0x5f, 0x60, 0x61, 0x57 },
+	// KP4 KP5 KP6 KP1 KP2 KP3 KP0 KP. KPEnter
+	{ 0x5c, 0x5d, 0x5e, 0x59, 0x5a, 0x5b, 0x62, 0x63, 0x58 },
+	// the ISO keys, NonUS\ NonUS#
+	{ 0x64, 0x32 },
+};
+
+// Takes a matrix event, returns nonzero if the keys held changed.
+int keymap_apply(struct keymap_state *k, int ev)
+{
+	int key = ev & ~MATRIX_DOWN;
+	int down = ev & MATRIX_DOWN;
+	uint8_t usage = Keymap[key / MATRIX_COLS][key % MATRIX_COLS];
+	uint8_t mods = k->mods;
+	int i;
+	if (usage == 0) {
+		return 0;
+	}
+	if (usage >= HID_USAGE_LCTRL) {
+		if (down) {
+			k->mods |= 1 << (usage - HID_USAGE_LCTRL);
+		} else {
+			k->mods &= ~(1 << (usage - HID_USAGE_LCTRL));
+		}
+		return k->mods != mods;
+	}
+	for (i = 0; i < k->n && k->held[i] != usage; i++) {
+	}
+	if (down) {
+		if (i < k->n || k->n == KEYMAP_HELD) {
+			return 0;
+		}
+		k->held[k->n++] = usage;
+		return 1;
+	}
+	if (i == k->n) {
+		return 0;
+	}
+	k->n--;
+	memmove(&k->held[i], &k->held[i + 1], k->n - i);
+	return 1;
+}
+
+void keymap_report(const struct keymap_state *k, uint8_t *report)
+{
+	report[0] = k->mods;
+	report[1] = 0;
+	if (k->n > KEYMAP_ROLLOVER) {
+		memset(&report[2], HID_USAGE_ROLLOVER, KEYMAP_ROLLOVER);
+		return;
+	}
+	memcpy(&report[2], k->held, k->n);
+	memset(&report[2 + k->n], 0, KEYMAP_ROLLOVER - k->n);
+}
@@ -0,0 +1,30 @@
+#ifndef _KEYMAP_H_
+#define _KEYMAP_H_
+#include <stdint.h>
+#include "matrix.h"
+
+// Matrix keys to HID usages, and the keys held as a boot keyboard
+// report: the modifier bits, a reserved byte, then up to six usages in
+// the order they went down. With more than six down all six read
+// ErrorRollOver, as the HID usage tables have it. Usage 0 is no key.
+
+enum {
+	KEYMAP_REPORT_LEN = 8,
+	KEYMAP_ROLLOVER = 6, // usages a report holds
+	KEYMAP_HELD = 16, // usages kept track of, more are ignored
+	HID_USAGE_ROLLOVER = 0x01,
+	HID_USAGE_LCTRL = 0xe0, // up to 0xe7 RightGUI, the modifier bits
+};
+
+struct keymap_state {
+	uint8_t mods;
+	uint8_t n;
+	uint8_t held[KEYMAP_HELD]; // in the order they went down
+};
+
+extern const uint8_t Keymap[MATRIX_ROWS][MATRIX_COLS];
+
+int keymap_apply(struct keymap_state *k, int ev);
+void keymap_report(const struct keymap_state *k, uint8_t *report);
+
+#endif
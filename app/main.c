@@ -2,6 +2,10 @@
 #include "CH58xBLE_LIB.h"
 #include "CONFIG.h"
 #include "HAL.h"
+#include "uart1.h"
+#ifdef SF_BENCH
+#include "sf_bench.h"
+#endif
 
 #define DBG_PRINT(...) PRINT(__VA_ARGS__)
 
@@ -25,21 +29,26 @@ int main(void)
 #endif
 	SetSysClock(CLK_SOURCE_PLL_60MHz);
 #if (defined(HAL_SLEEP)) && (HAL_SLEEP == TRUE)
+	// no pin left floating in sleep, matrix_init() takes the rows and
+	// columns from here and parks them with the columns as wake-up pins
 	GPIOA_ModeCfg(GPIO_Pin_All, GPIO_ModeIN_PU);
 	GPIOB_ModeCfg(GPIO_Pin_All, GPIO_ModeIN_PU);
 #endif
 #ifdef DEBUG
 	GPIOA_SetBits(bTXD1);
 	GPIOA_ModeCfg(bTXD1, GPIO_ModeOut_PP_5mA);
+	GPIOA_ModeCfg(bRXD1, GPIO_ModeIN_PU);
 	UART1_DefInit();
 #endif
-	UART1_BaudRateCfg(921600);
+	UART1_BaudRateCfg(UART1_BAUD);
+	uart1_init();
+	// from here on output is queued, the radio comes up meanwhile
+	uint8_t sync[130];
 	int i;
-	for (i = 0; i < 128; i++) {
-		UART1_SendByte(0x55);
-	}
-	UART1_SendByte('\n');
-	UART1_SendByte('\r');
+	memset(sync, 0x55, 128);
+	sync[128] = '\n';
+	sync[129] = '\r';
+	uart1_write(sync, sizeof(sync));
 	DBG_PRINT("RUN ON CH5%02X\n\r", R8_CHIP_ID);
 	DBG_PRINT("CHIP UID: ");
 	GET_UNIQUE_ID(chip_uid);
@@ -49,6 +58,18 @@ int main(void)
 	}
 	DBG_PRINT("\n\r");
 	DBG_PRINT("%s\n\r", VER_LIB);
+#ifdef SF_BENCH
+	{
+		struct sf_bench_result r[SF_BENCH_NUM];
+		char line[SF_BENCH_LINE];
+
+		sf_bench_run(r, 3);
+		for (i = 0; i < SF_BENCH_NUM; i++) {
+			sf_bench_format(&r[i], line, sizeof(line));
+			DBG_PRINT("%s\r", line);
+		}
+	}
+#endif
 	CH58X_BLEInit();
 	HAL_Init();
 	GAPRole_PeripheralInit();
@@ -0,0 +1,176 @@
+#include "CONFIG.h"
+#include "HAL.h"
+#include "mcycle.h"
+#include "matrix.h"
+
+// Key matrix, see matrix.h. A scan is eight port reads and the counters
+// for all 128 keys in four word steps, no loop over keys. Only keys that
+// changed are looked at one by one, to queue their events.
+
+struct matrix Matrix;
+
+static uint8_t matrix_event_buf[MATRIX_EVENTS];
+
+#ifdef __riscv
+#define matrix_select(r) (R32_PA_CLR = 1 << (r))
+#define matrix_release(r) (R32_PA_OUT |= 1 << (r))
+#define matrix_sense() (R32_PB_PIN)
+#define matrix_park_rows(on)                       \
+	((on) ? (R32_PA_CLR = MATRIX_ROW_PINS) :   \
+		(R32_PA_OUT |= MATRIX_ROW_PINS))
+#define matrix_irq(on)                                                   \
+	((on) ? GPIOB_ITModeCfg(MATRIX_COL_PINS, GPIO_ITMode_FallEdge) : \
+		(void)(R16_PB_INT_EN &= ~MATRIX_COL_PINS))
+#else
+#define matrix_select(r) host_matrix_select(r)
+#define matrix_release(r) host_matrix_release(r)
+#define matrix_sense() host_matrix_sense()
+#define matrix_park_rows(on) host_matrix_park(on)
+#define matrix_irq(on) host_matrix_irq(on)
+#endif
+
+void matrix_init(void)
+{
+	memset(&Matrix, 0, sizeof(Matrix));
+	spsc_init(&Matrix.events, matrix_event_buf, sizeof(matrix_event_buf));
+#ifdef __riscv
+	GPIOA_SetBits(MATRIX_ROW_PINS);
+	GPIOA_ModeCfg(MATRIX_ROW_PINS, GPIO_ModeOut_PP_5mA);
+	GPIOB_ModeCfg(MATRIX_COL_PINS, GPIO_ModeIN_PU);
+	PWR_PeriphWakeUpCfg(ENABLE, RB_SLP_GPIO_WAKE, Long_Delay);
+	PFIC_EnableIRQ(GPIO_B_IRQn);
+#endif
+	matrix_irq(0);
+	matrix_park_rows(0);
+}
+
+// Counts to MATRIX_DEBOUNCE in cnt1:cnt0 for the keys whose raw bit
+// differs from the debounced one and clears the count of the others, a
+// key toggles as its count wraps to 0, or at once for a press in the
+// scan after a wake. Returns nonzero while any key is down or counting.
+__HIGH_CODE
+int matrix_debounce(const uint32_t *raw)
+{
+	struct matrix *m = &Matrix;
+	uint32_t delta, toggle, busy = 0;
+	int w, key, down;
+	for (w = 0; w < MATRIX_WORDS; w++) {
+		delta = raw[w] ^ m->state[w];
+		m->cnt1[w] = (m->cnt1[w] ^ m->cnt0[w]) & delta;
+		m->cnt0[w] = ~m->cnt0[w] & delta;
+		toggle = delta & ~(m->cnt0[w] | m->cnt1[w]);
+		if (m->eager) {
+			toggle |= delta & raw[w];
+			m->cnt0[w] &= ~raw[w];
+			m->cnt1[w] &= ~raw[w];
+		}
+		m->state[w] ^= toggle;
+		busy |= m->state[w] | delta;
+		if (toggle) {
+			m->last = RTC_GetCycle32k();
+		}
+		while (toggle) {
+			key = w * 32 + __builtin_ctz(toggle);
+			toggle &= toggle - 1;
+			down = m->state[w] >> (key & 31) & 1;
+			if (!spsc_push(&m->events,
+				       key | (down ? MATRIX_DOWN : 0))) {
+				m->dropped++;
+			}
+			m->changes++;
+		}
+	}
+	m->scans++;
+	m->eager = 0;
+	m->quiet = busy ? 0 : MIN(m->quiet + 1, 0xffff);
+	return busy != 0;
+}
+
+// the columns need a moment to come back up after a row with a key down
+__HIGH_CODE
+int matrix_scan(void)
+{
+	uint32_t raw[MATRIX_WORDS] = { 0 };
+	uint32_t cols;
+	int r;
+#ifdef __riscv
+	uint32_t t;
+#endif
+	for (r = 0; r < MATRIX_ROWS; r++) {
+		matrix_select(r);
+#ifdef __riscv
+		for (t = mcycle(); mcycle() - t < MATRIX_SETTLE;) {
+		}
+#endif
+		cols = MATRIX_COLS_OF(matrix_sense());
+		matrix_release(r);
+		raw[r >> 1] |= cols << (r & 1) * 16;
+	}
+	return matrix_debounce(raw);
+}
+
+// the next change, or -1
+int matrix_event(void)
+{
+	return spsc_pop(&Matrix.events);
+}
+
+// The first key after parking, right from the wake-up: one scan that
+// takes what is down, the main loop debounces from the next one on.
+// With interrupts off.
+__HIGH_CODE
+static void matrix_woken(void)
+{
+	struct matrix *m = &Matrix;
+	if (!m->parked) {
+		return;
+	}
+	matrix_irq(0);
+	matrix_park_rows(0);
+	m->parked = 0;
+	m->wakes++;
+	m->eager = 1;
+	matrix_scan();
+	if (m->wake) {
+		m->wake();
+	}
+}
+
+__INTERRUPT
+__HIGH_CODE
+void GPIOB_IRQHandler(void)
+{
+#ifdef __riscv
+	R16_PB_INT_IF = MATRIX_COL_PINS;
+#endif
+	matrix_woken();
+}
+
+// Rows all low, so any key pulls its column down and interrupts. A key
+// already down by then makes no edge and wakes at once.
+void matrix_park(void (*wake)(void))
+{
+	struct matrix *m = &Matrix;
+	uint32_t irq_status;
+	m->wake = wake;
+	SYS_DisableAllIrq(&irq_status);
+	matrix_park_rows(1);
+	m->parked = 1;
+	matrix_irq(1);
+	if (MATRIX_COLS_OF(matrix_sense())) {
+		matrix_woken();
+	}
+	SYS_RecoverIrq(irq_status);
+}
+
+void matrix_unpark(void)
+{
+	uint32_t irq_status;
+	SYS_DisableAllIrq(&irq_status);
+	if (Matrix.parked) {
+		matrix_irq(0);
+		matrix_park_rows(0);
+		Matrix.parked = 0;
+	}
+	SYS_RecoverIrq(irq_status);
+}
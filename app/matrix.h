@@ -0,0 +1,77 @@
+#ifndef _MATRIX_H_
+#define _MATRIX_H_
+#include <stdint.h>
+#include "spsc.h"
+
+// Key matrix scan. Rows are driven low one at a time and the columns
+// are read as one port, so a row costs a single load. Every key is one
+// bit of the key words, key = row * MATRIX_COLS + col, and debouncing
+// runs on the words with a two bit vertical counter per key: a key
+// changes state once it read the other way on MATRIX_DEBOUNCE scans in a
+// row. Only the changes go into the event ring, one byte each, the key
+// with MATRIX_DOWN set on a press. Scan and read from the main loop.
+//
+// Between bursts of typing the matrix is parked: every row driven low
+// and a falling edge on any column interrupts, which wakes the chip from
+// sleep. The interrupt scans once and takes the keys it finds down at
+// once rather than after MATRIX_DEBOUNCE scans, then calls wake to have
+// the main loop scan on until the keys were all up for a while.
+//
+// Wiring: rows on PA0-PA7, push-pull, columns on PB0-PB15 with pull-ups,
+// the pins with interrupts. USB is not used, PB10/PB11 are columns too.
+// Diodes from column to row, so more keys down in a row do not ghost.
+
+enum {
+	MATRIX_ROWS = 8,
+	MATRIX_COLS = 16, // one half word of the key words per row
+	MATRIX_KEYS = MATRIX_ROWS * MATRIX_COLS,
+	MATRIX_WORDS = MATRIX_KEYS / 32,
+	MATRIX_DEBOUNCE = 4, // scans, what the counter counts to
+	MATRIX_EVENTS = 64, // a power of two
+	MATRIX_DOWN = 0x80,
+	MATRIX_SCAN_TICKS = 1, // x 0.625ms, 1.6kHz while keys are in use
+	MATRIX_PARK_SCANS = 160, // all up this long, 100ms, parks
+	MATRIX_SETTLE = 24, // cycles, for the column pull-ups after a row
+};
+
+#define MATRIX_ROW_PINS 0x000000ff
+#define MATRIX_COL_PINS 0x0000ffff
+// the column port down to MATRIX_COLS bits, 1 for closed
+#define MATRIX_COLS_OF(pin) (~(pin) & MATRIX_COL_PINS)
+
+struct matrix {
+	uint32_t state[MATRIX_WORDS]; // debounced, 1 for down
+	uint32_t cnt0[MATRIX_WORDS]; // vertical counters, low bit
+	uint32_t cnt1[MATRIX_WORDS];
+	struct spsc events;
+	uint32_t scans;
+	uint32_t changes;
+	uint32_t dropped; // the event ring was full
+	uint32_t last; // RTC at the last change
+	uint32_t wakes; // times a key ended parking
+	uint16_t quiet; // scans in a row with every key up and settled
+	uint8_t eager; // the next scan takes presses at once
+	volatile uint8_t parked;
+	void (*wake)(void); // from the interrupt, scan from here on
+};
+
+extern struct matrix Matrix;
+
+void matrix_init(void);
+int matrix_scan(void);
+int matrix_debounce(const uint32_t *raw);
+int matrix_event(void);
+void matrix_park(void (*wake)(void));
+void matrix_unpark(void);
+void GPIOB_IRQHandler(void);
+
+#ifndef __riscv
+// the GPIO ports, provided by the host port
+void host_matrix_select(int row);
+void host_matrix_release(int row);
+uint32_t host_matrix_sense(void);
+void host_matrix_park(int on);
+void host_matrix_irq(int on);
+#endif
+
+#endif
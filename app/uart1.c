@@ -0,0 +1,207 @@
+#include "CONFIG.h"
+#include "HAL.h"
+#include "uart1.h"
+
+// UART1 rings, see uart1.h. The writer pushes and the interrupt pops,
+// and the other way round for received bytes, the rings themselves need
+// no locking. Only dropping the oldest bytes moves the head from the
+// writer's side, that and topping up the hardware fifo run with
+// interrupts off.
+
+struct uart1_tx Uart1Tx;
+struct uart1_rx Uart1Rx;
+
+static uint8_t uart1_buf[UART1_TX_SIZE];
+static uint8_t uart1_rx_buf[UART1_RX_SIZE];
+static volatile uint8_t uart1_flow; // XON or XOFF, goes ahead of the ring
+
+#ifdef __riscv
+#define uart1_room() (R8_UART1_TFC < UART_FIFO_SIZE)
+#define uart1_put(c) (R8_UART1_THR = (c))
+#define uart1_irq(on)                                        \
+	((on) ? (R8_UART1_IER |= RB_IER_THR_EMPTY) :         \
+		(R8_UART1_IER &= ~RB_IER_THR_EMPTY))
+#define uart1_received() (R8_UART1_RFC)
+#define uart1_get() (R8_UART1_RBR)
+#else
+#define uart1_room() host_uart1_room()
+#define uart1_put(c) host_uart1_put(c)
+#define uart1_irq(on) host_uart1_irq(on)
+#define uart1_received() host_uart1_received()
+#define uart1_get() host_uart1_get()
+#endif
+
+// the interrupt stays on while bytes are left for it
+__HIGH_CODE
+static void uart1_fill(void)
+{
+	struct uart1_tx *u = &Uart1Tx;
+	int c;
+	if (uart1_flow && uart1_room()) {
+		uart1_put(uart1_flow);
+		uart1_flow = 0;
+	}
+	while (uart1_room() && (c = spsc_pop(&u->ring)) >= 0) {
+		uart1_put(c);
+		u->sent++;
+	}
+	u->busy = spsc_used(&u->ring) != 0 || uart1_flow;
+	uart1_irq(u->busy);
+}
+
+// with interrupts off
+__HIGH_CODE
+static void uart1_send_flow(uint8_t c)
+{
+	uart1_flow = c;
+	uart1_fill();
+}
+
+__HIGH_CODE
+static void uart1_receive(void)
+{
+	struct uart1_rx *r = &Uart1Rx;
+	int n = 0;
+	uint8_t c;
+	while (uart1_received()) {
+		c = uart1_get();
+		if (spsc_push(&r->ring, c)) {
+			n++;
+		} else {
+			r->overrun++;
+		}
+	}
+	if (n == 0) {
+		return;
+	}
+	r->received += n;
+	r->last = RTC_GetCycle32k();
+	if (!r->stopped && spsc_free(&r->ring) <= UART1_RX_HEADROOM) {
+		r->stopped = 1;
+		uart1_send_flow(UART1_XOFF);
+	}
+	if (r->wake) {
+		r->wake();
+	}
+}
+
+__INTERRUPT
+__HIGH_CODE
+void UART1_IRQHandler(void)
+{
+#ifdef __riscv
+	switch (R8_UART1_IIR & RB_IIR_INT_MASK) {
+	case UART_II_RECV_RDY:
+	case UART_II_RECV_TOUT:
+		uart1_receive();
+		break;
+	case UART_II_THR_EMPTY:
+		uart1_fill();
+		break;
+	case UART_II_LINE_STAT:
+		(void)R8_UART1_LSR;
+		break;
+	}
+#else
+	// the port does not tell which, both are cheap to check
+	uart1_receive();
+	uart1_fill();
+#endif
+}
+
+void uart1_init(void)
+{
+	spsc_init(&Uart1Tx.ring, uart1_buf, sizeof(uart1_buf));
+	Uart1Tx.sent = 0;
+	Uart1Tx.dropped = 0;
+	Uart1Tx.busy = 0;
+#ifdef __riscv
+	R8_UART1_MCR |= RB_MCR_INT_OE;
+	PFIC_EnableIRQ(UART1_IRQn);
+#endif
+}
+
+// Queue len bytes and start sending, never waits. Returns len, the bytes
+// that did not fit are the oldest ones and counted in dropped.
+int uart1_write(const uint8_t *p, int len)
+{
+	struct uart1_tx *u = &Uart1Tx;
+	uint32_t irq_status;
+	int ret = len, over;
+	if (len > UART1_TX_SIZE) {
+		u->dropped += len - UART1_TX_SIZE;
+		p += len - UART1_TX_SIZE;
+		len = UART1_TX_SIZE;
+	}
+	SYS_DisableAllIrq(&irq_status);
+	over = len - spsc_free(&u->ring);
+	if (over > 0) {
+		spsc_skip(&u->ring, over);
+		u->dropped += over;
+	}
+	SYS_RecoverIrq(irq_status);
+	spsc_push_buf(&u->ring, p, len);
+	if (!u->busy) {
+		SYS_DisableAllIrq(&irq_status);
+		uart1_fill();
+		SYS_RecoverIrq(irq_status);
+	}
+	return ret;
+}
+
+int uart1_free(void)
+{
+	return spsc_free(&Uart1Tx.ring);
+}
+
+// bytes still in the ring, the hardware fifo empties on its own
+int uart1_pending(void)
+{
+	return spsc_used(&Uart1Tx.ring);
+}
+
+// Take received bytes from here on, wake is called from the interrupt
+// and may only flag work for the main loop.
+void uart1_rx_start(void (*wake)(void))
+{
+	spsc_init(&Uart1Rx.ring, uart1_rx_buf, sizeof(uart1_rx_buf));
+	Uart1Rx.received = 0;
+	Uart1Rx.overrun = 0;
+	Uart1Rx.last = RTC_GetCycle32k();
+	Uart1Rx.stopped = 0;
+	Uart1Rx.wake = wake;
+#ifdef __riscv
+	R8_UART1_IER |= RB_IER_RECV_RDY;
+#endif
+}
+
+// the sender goes on once the ring is down to a quarter
+int uart1_read(uint8_t *p, int len)
+{
+	struct uart1_rx *r = &Uart1Rx;
+	uint32_t irq_status;
+	len = spsc_pop_buf(&r->ring, p, len);
+	if (r->stopped && spsc_used(&r->ring) <= UART1_RX_SIZE / 4) {
+		SYS_DisableAllIrq(&irq_status);
+		if (r->stopped) {
+			r->stopped = 0;
+			uart1_send_flow(UART1_XON);
+		}
+		SYS_RecoverIrq(irq_status);
+	}
+	return len;
+}
+
+int uart1_readable(void)
+{
+	return spsc_used(&Uart1Rx.ring);
+}
+
+#ifdef __riscv
+// printf() of the vendor runtime ends up here, see -Wl,--wrap=_write in
+// the Makefile
+__attribute__((used)) int __wrap__write(int fd, char *buf, int size)
+{
+	return uart1_write((const uint8_t *)buf, size);
+}
+#endif
@@ -0,0 +1,65 @@
+#ifndef _UART1_H_
+#define _UART1_H_
+#include <stdint.h>
+#include "spsc.h"
+
+// Interrupt driven transmit on the debug UART. Writers queue into a RAM
+// ring and return at once, the THR empty interrupt refills the 8 byte
+// hardware fifo from it while the CPU does other things. A write that
+// does not fit pushes out the oldest bytes still queued, they are counted
+// in dropped. Write from the main loop only, not from interrupts.
+//
+// Received bytes go the other way, the receive interrupt empties the
+// hardware fifo into a ring for uart1_read() and calls the wake callback.
+// The ring asks the sender to pause with XOFF when it runs short of room
+// and to go on with XON once it drained.
+
+enum {
+	UART1_TX_SIZE = 1024,
+	UART1_RX_SIZE = 512,
+	UART1_RX_HEADROOM = 128, // bytes the sender may still get out past XOFF
+	UART1_RX_TRIGGER = 4, // hardware fifo level the interrupt comes at
+	UART1_BAUD = 921600,
+	UART1_FIFO = 8,
+	UART1_XON = 0x11,
+	UART1_XOFF = 0x13,
+};
+
+struct uart1_tx {
+	struct spsc ring;
+	uint32_t sent; // bytes handed to the hardware fifo
+	uint32_t dropped; // queued bytes given up for newer ones
+	volatile uint8_t busy; // THR empty interrupt enabled
+};
+
+struct uart1_rx {
+	struct spsc ring;
+	uint32_t received;
+	uint32_t overrun; // lost to a full ring
+	uint32_t last; // RTC at the last byte
+	volatile uint8_t stopped; // XOFF sent
+	void (*wake)(void); // from the interrupt, something to read
+};
+
+extern struct uart1_tx Uart1Tx;
+extern struct uart1_rx Uart1Rx;
+
+void uart1_init(void);
+int uart1_write(const uint8_t *p, int len);
+int uart1_free(void);
+int uart1_pending(void);
+void uart1_rx_start(void (*wake)(void));
+int uart1_read(uint8_t *p, int len);
+int uart1_readable(void);
+void UART1_IRQHandler(void);
+
+#ifndef __riscv
+// the hardware fifos, provided by the host port
+int host_uart1_room(void);
+void host_uart1_put(uint8_t c);
+void host_uart1_irq(int on);
+int host_uart1_received(void);
+uint8_t host_uart1_get(void);
+#endif
+
+#endif
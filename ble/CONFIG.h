@@ -82,7 +82,7 @@
 #define DCDC_ENABLE                         TRUE
 #endif
 #ifndef HAL_SLEEP
-#define HAL_SLEEP                           FALSE
+#define HAL_SLEEP                           TRUE
 #endif
 #ifndef SLEEP_RTC_MIN_TIME                   
 #define SLEEP_RTC_MIN_TIME                  US_TO_RTC(1000)
@@ -127,13 +127,13 @@
 #define BLE_MEMHEAP_SIZE                    (1024*6)
 #endif
 #ifndef BLE_BUFF_MAX_LEN
-#define BLE_BUFF_MAX_LEN                    27
+#define BLE_BUFF_MAX_LEN                    251
 #endif
 #ifndef BLE_BUFF_NUM
 #define BLE_BUFF_NUM                        5
 #endif
 #ifndef BLE_TX_NUM_EVENT
-#define BLE_TX_NUM_EVENT                    1
+#define BLE_TX_NUM_EVENT                    4
 #endif
 #ifndef BLE_TX_POWER
 #define BLE_TX_POWER                        LL_TX_POWEER_6_DBM
@@ -1,8 +1,15 @@
 #include <stdarg.h>
 #include "CH58xBLE_LIB.h"
 #include "CONFIG.h"
+#include "HAL.h"
 #include "fifo8.h"
 #include "stepforth.h"
+#include "sf_dict.h"
+#include "sf_native.h"
+#include "sf_outer.h"
+#include "sf_sched.h"
+#include "uart1.h"
+#include "matrix.h"
 #include "ble.h"
 
 enum {
@@ -15,57 +22,93 @@ enum {
 	PARAM_UPDATE_DELAY = 6400, // x 0.625ms
 	PHY_UPDATE_DELAY = 3200, // x 0.625ms
 	PERIOD_READ_RSSI = 3200, // x 0.625ms
-	FORTH_DELAY = 2,
+	PERIOD_BATTERY = 96000, // x 0.625ms = 60s
+	FORTH_PASS_CYCLES = 300 * 60, // 300us per SBP_FORTH_EVT
+	LL_DATA_LEN_MIN = 27, // octets, before any data length update
+	CONN_IDLE_TIMEOUT = 8000, // x 0.625ms = 5s quiet before idling
+	CONN_PARAM_ANSWER = 3200, // x 0.625ms, not applied by then is refused
+	CONN_BACKOFF_MIN = 3200, // x 0.625ms, doubled per refusal in a row
+	CONN_BACKOFF_SHIFT_MAX = 6, // up to 2s << 6 = 128s
+	PERI_TRACE_SIZE = 512, // bytes, a power of two
+	PERI_TRACE_RETRY = 1, // x 0.625ms, while the UART ring is full
+	PERI_UARTCON_RETRY = 1, // x 0.625ms, the same for console output
+};
+
+static const struct conn_profile {
+	uint16_t interval_min; // x 1.25ms
+	uint16_t interval_max;
+	uint16_t latency; // connection events the peripheral may sleep through
+	uint16_t timeout; // x 10ms
+} conn_profiles[CONN_PROFILE_NUM] = {
+	[CONN_PROFILE_ACTIVE] = { 6, 9, 0, 200 }, // 7.5ms
+	[CONN_PROFILE_IDLE] = { 80, 100, 9, 600 }, // 100ms, wakes once a second
 };
 
 __attribute__((aligned(4))) uint32_t MEM_BUF[BLE_MEMHEAP_SIZE / 4];
 extern uint8_t chip_uid[8];
 extern uint16_t chip_uid_sum;
+extern int peripheralConsoleOpen(int slotp);
+extern void peripheralConsoleClose(int slotp);
 
 struct ble_peri_slot ble_peri_slots[PERIPHERAL_MAX_CONNECTION];
 
 enum {
 	STATE_DEV_CONNECTED = (1 << 0),
+	STATE_CONSOLE_TX = (1 << 1), // SBP_CONSOLE_TX_EVT is in flight
+	STATE_CONSOLE_TX_HIGH = (1 << 2), // raised again past the high water
 };
 
+#if PERIPHERAL_MAX_CONNECTION > 32
+#error "slot_free_map holds 32 slots"
+#endif
+
+enum {
+	// the link layer hands out connection handles from 0 up, the ones
+	// below this map straight to their slot
+	SLOT_HANDLE_MAP = 32,
+};
+
+// The slot table is kept current on link up and down, so the lookups on
+// every GATT callback and TMOS event are constant time: a bit per free
+// slot, slot + 1 per connection handle, and the slot tasks registered
+// back to back from slot_task_base.
+static uint32_t slot_free_map;
+static uint8_t slot_used_num;
+static uint8_t slot_by_handle[SLOT_HANDLE_MAP];
+static uint8_t slot_task_base;
+
 int ble_peri_slots_find_free(void)
 {
-	int slotp;
-	for (slotp = 0; slotp < PERIPHERAL_MAX_CONNECTION; slotp++) {
-		if (ble_peri_slots[slotp].state == 0) {
-			return slotp;
-		}
+	if (slot_free_map == 0) {
+		return -1;
 	}
-	return -1;
+	return __builtin_ctz(slot_free_map);
 }
 
 int ble_peri_slots_is_full(void)
 {
-	return (ble_peri_slots_find_free() < 0);
+	return (slot_free_map == 0);
 }
 
 int ble_peri_slots_used(void)
 {
-	int slotp;
-	int count = 0;
-	for (slotp = 0; slotp < PERIPHERAL_MAX_CONNECTION; slotp++) {
-		if (ble_peri_slots[slotp].state != 0) {
-			count++;
-		}
-	}
-	return count;
+	return slot_used_num;
 }
 
 int ble_peri_slots_free(void)
 {
-	return (PERIPHERAL_MAX_CONNECTION - ble_peri_slots_used());
+	return (PERIPHERAL_MAX_CONNECTION - slot_used_num);
 }
 
 int ble_peri_slots_find_by_connHandle(int connHandle)
 {
 	int slotp;
+	if ((unsigned)connHandle < SLOT_HANDLE_MAP) {
+		return slot_by_handle[connHandle] - 1;
+	}
 	for (slotp = 0; slotp < PERIPHERAL_MAX_CONNECTION; slotp++) {
-		if (ble_peri_slots[slotp].connHandle == connHandle) {
+		if (ble_peri_slots[slotp].state != 0 &&
+		    ble_peri_slots[slotp].connHandle == connHandle) {
 			return slotp;
 		}
 	}
@@ -74,7 +117,11 @@ int ble_peri_slots_find_by_connHandle(int connHandle)
 
 int ble_peri_slots_find_by_taskID(int task_id)
 {
-	int slotp;
+	int slotp = task_id - slot_task_base;
+	if (slotp >= 0 && slotp < PERIPHERAL_MAX_CONNECTION &&
+	    ble_peri_slots[slotp].taskID == task_id) {
+		return slotp;
+	}
 	for (slotp = 0; slotp < PERIPHERAL_MAX_CONNECTION; slotp++) {
 		if (ble_peri_slots[slotp].taskID == task_id) {
 			return slotp;
@@ -83,18 +130,217 @@ int ble_peri_slots_find_by_taskID(int task_id)
 	return -1;
 }
 
+static int ble_peri_slots_take(uint16_t connHandle)
+{
+	int slotp = ble_peri_slots_find_free();
+	if (slotp < 0) {
+		return -1;
+	}
+	slot_free_map &= ~(1u << slotp);
+	slot_used_num++;
+	ble_peri_slots[slotp].connHandle = connHandle;
+	if (connHandle < SLOT_HANDLE_MAP) {
+		slot_by_handle[connHandle] = slotp + 1;
+	}
+	return slotp;
+}
+
+static void ble_peri_slots_put(int slotp)
+{
+	uint16_t connHandle = ble_peri_slots[slotp].connHandle;
+	if (connHandle < SLOT_HANDLE_MAP) {
+		slot_by_handle[connHandle] = 0;
+	}
+	ble_peri_slots[slotp].state = 0;
+	ble_peri_slots[slotp].connHandle = GAP_CONNHANDLE_INIT;
+	slot_free_map |= 1u << slotp;
+	slot_used_num--;
+}
+
 static uint8_t Peripheral_TaskID = INVALID_TASK_ID;
 
 // Peripheral Task Events
 enum {
 	SBP_START_DEVICE_EVT = (1 << 0),
-	SBP_PERIODIC_EVT = (1 << 1),
-	SBP_READ_RSSI_EVT = (1 << 2),
 	SBP_PARAM_UPDATE_EVT = (1 << 3),
 	SBP_PHY_UPDATE_EVT = (1 << 4),
 	SBP_FORTH_EVT = (1 << 5),
+	SBP_CONSOLE_TX_EVT = (1 << 6),
+	SBP_TIMER_EVT = (1 << 7),
+	SBP_TRACE_EVT = (1 << 8),
+	SBP_MATRIX_EVT = (1 << 9),
+	SBP_HID_EVT = (1 << 10),
 };
 
+// Periodic per-link work runs off soft timers behind the one
+// SBP_TIMER_EVT of the global task. Timers of one period fall due on
+// the same ticks, so every link's RSSI read or clock notification of a
+// round shares a single wakeup.
+struct stimer_list peri_timers;
+
+// cycles per event handler and GATT callback, read over sysinfo
+struct prof_site PeriProf[PROF_SITES];
+
+static uint8_t peri_trace_buf[PERI_TRACE_SIZE];
+
+// as much as the UART1 ring takes, the frames left wait in the trace
+// ring rather than push out other output. Escaped, the line carries the
+// console's XON/XOFF too.
+static int peripheralTraceWrite(const uint8_t *p, int len)
+{
+	uint8_t buf[TRACE_FRAME_MAX * 2];
+	int n, taken, done = 0;
+	while (done < len) {
+		n = trace_escape(p + done, len - done, buf,
+				 MIN(sizeof(buf), uart1_free()), &taken);
+		if (taken == 0) {
+			break;
+		}
+		uart1_write(buf, n);
+		done += taken;
+	}
+	return done;
+}
+
+static void peripheralTimerArm(void)
+{
+	uint32_t delay;
+	if (!stimer_next(&peri_timers, TMOS_GetSystemClock(), &delay)) {
+		tmos_stop_task(Peripheral_TaskID, SBP_TIMER_EVT);
+	} else if (delay == 0) {
+		tmos_set_event(Peripheral_TaskID, SBP_TIMER_EVT);
+	} else {
+		tmos_start_task(Peripheral_TaskID, SBP_TIMER_EVT, delay);
+	}
+}
+
+static void peripheralTimerStart(struct stimer *t, uint32_t period,
+				 uint32_t slack)
+{
+	stimer_start(&peri_timers, t, TMOS_GetSystemClock(), period, slack);
+	peripheralTimerArm();
+}
+
+static void peripheralTimerStop(struct stimer *t)
+{
+	stimer_stop(&peri_timers, t);
+	peripheralTimerArm();
+}
+
+static int peripheralRssiTimer(int slotp)
+{
+	GAPRole_ReadRssiCmd(ble_peri_slots[slotp].connHandle);
+	return 1;
+}
+
+// Connection parameter manager. A link runs the ACTIVE profile while
+// keys or console traffic flow and asks for IDLE once it has been quiet
+// for CONN_IDLE_TIMEOUT; going back is asked for on the first byte, the
+// two thresholds being the hysteresis. A request the central does not
+// apply within CONN_PARAM_ANSWER, or a change it forces outside both
+// profiles, counts as refused and backs this link off.
+
+static int conn_profile_of(uint16_t interval, uint16_t latency)
+{
+	int profile;
+	for (profile = CONN_PROFILE_ACTIVE; profile < CONN_PROFILE_NUM;
+	     profile++) {
+		const struct conn_profile *p = &conn_profiles[profile];
+		if (interval >= p->interval_min &&
+		    interval <= p->interval_max && latency <= p->latency) {
+			return profile;
+		}
+	}
+	return CONN_PROFILE_NONE;
+}
+
+static void peripheralConnParamRequest(int slotp, int profile)
+{
+	struct ble_peri_slot *slot = &ble_peri_slots[slotp];
+	const struct conn_profile *p = &conn_profiles[profile];
+	PERI_DBG_PRINT("Slot %d request profile %d\n\r", slotp, profile);
+	slot->cp.target = profile;
+	slot->cp.requests++;
+	GAPRole_PeripheralConnParamUpdateReq(slot->connHandle, p->interval_min,
+					     p->interval_max, p->latency,
+					     p->timeout, slot->taskID);
+	tmos_start_task(slot->taskID, SBP_PARAM_UPDATE_EVT, CONN_PARAM_ANSWER);
+}
+
+static void peripheralConnParamBackoff(int slotp)
+{
+	struct ble_peri_slot *slot = &ble_peri_slots[slotp];
+	slot->cp.rejected++;
+	if (slot->cp.rejects < UINT8_MAX) {
+		slot->cp.rejects++;
+	}
+	tmos_start_task(slot->taskID, SBP_PARAM_UPDATE_EVT,
+			CONN_BACKOFF_MIN << MIN(slot->cp.rejects - 1,
+						CONN_BACKOFF_SHIFT_MAX));
+}
+
+static void peripheralConnParamEvt(int slotp)
+{
+	struct ble_peri_slot *slot = &ble_peri_slots[slotp];
+	uint32_t quiet = TMOS_GetSystemClock() - slot->cp.active_at;
+	int want;
+	if (slot->cp.target != slot->cp.profile) {
+		// the answer did not come
+		slot->cp.target = slot->cp.profile;
+		peripheralConnParamBackoff(slotp);
+		return;
+	}
+	want = quiet < CONN_IDLE_TIMEOUT ? CONN_PROFILE_ACTIVE :
+					   CONN_PROFILE_IDLE;
+	if (want != slot->cp.profile) {
+		peripheralConnParamRequest(slotp, want);
+	} else if (want == CONN_PROFILE_ACTIVE) {
+		tmos_start_task(slot->taskID, SBP_PARAM_UPDATE_EVT,
+				CONN_IDLE_TIMEOUT - quiet);
+	}
+}
+
+static void peripheralConnParamUpdated(int slotp, uint16_t interval,
+				       uint16_t latency, uint16_t timeout)
+{
+	struct ble_peri_slot *slot = &ble_peri_slots[slotp];
+	int profile = conn_profile_of(interval, latency);
+	int asked = slot->cp.target != slot->cp.profile;
+	slot->cp.latency = latency;
+	slot->cp.timeout = timeout;
+	if (profile != slot->cp.profile) {
+		slot->cp.to_active += profile == CONN_PROFILE_ACTIVE;
+		slot->cp.to_idle += profile == CONN_PROFILE_IDLE;
+	}
+	slot->cp.profile = profile;
+	if (asked && profile != slot->cp.target) {
+		// something else than asked for, the answer timer backs off
+		return;
+	}
+	slot->cp.target = profile;
+	if (profile == CONN_PROFILE_NONE) {
+		peripheralConnParamBackoff(slotp);
+		return;
+	}
+	slot->cp.rejects = 0;
+	// ACTIVE looks for the quiet again, IDLE waits for activity
+	tmos_stop_task(slot->taskID, SBP_PARAM_UPDATE_EVT);
+	if (profile == CONN_PROFILE_ACTIVE) {
+		peripheralConnParamEvt(slotp);
+	}
+}
+
+// Input or output on a link, cheap while it is ACTIVE already.
+void ble_peri_conn_activity(int slotp)
+{
+	struct ble_peri_slot *slot = &ble_peri_slots[slotp];
+	slot->cp.active_at = TMOS_GetSystemClock();
+	if (slot->cp.profile != CONN_PROFILE_ACTIVE &&
+	    slot->cp.target == slot->cp.profile && slot->cp.rejects == 0) {
+		tmos_set_event(slot->taskID, SBP_PARAM_UPDATE_EVT);
+	}
+}
+
 static void Peripheral_LinkEstablished(gapRoleEvent_t *pEvent)
 {
 	PERI_DBG_PRINT("Connected\n\r");
@@ -105,13 +351,39 @@ static void Peripheral_LinkEstablished(gapRoleEvent_t *pEvent)
 		return;
 	}
 	int slotp;
-	slotp = ble_peri_slots_find_free();
+	slotp = ble_peri_slots_take(pEvent->linkCmpl.connectionHandle);
+	if (peripheralConsoleOpen(slotp) < 0) {
+		PERI_DBG_PRINT("no console buffers, drop new connection\n\r");
+		ble_peri_slots_put(slotp);
+		GAPRole_TerminateLink(pEvent->linkCmpl.connectionHandle);
+		return;
+	}
 	ble_peri_slots[slotp].state |= STATE_DEV_CONNECTED;
-	ble_peri_slots[slotp].connHandle = pEvent->linkCmpl.connectionHandle;
+	ble_peri_slots[slotp].conn_interval = pEvent->linkCmpl.connInterval;
+	ble_peri_slots[slotp].mtu = ATT_MTU_SIZE;
+	ble_peri_slots[slotp].data_len = LL_DATA_LEN_MIN;
+	ble_peri_slots[slotp].rx_accepted = 0;
+	ble_peri_slots[slotp].rx_dropped = 0;
+	ble_peri_slots[slotp].rx_granted = 0;
+	memset(&ble_peri_slots[slotp].cp, 0, sizeof(ble_peri_slots[slotp].cp));
+	ble_peri_slots[slotp].cp.profile =
+		conn_profile_of(pEvent->linkCmpl.connInterval,
+				pEvent->linkCmpl.connLatency);
+	ble_peri_slots[slotp].cp.target = ble_peri_slots[slotp].cp.profile;
+	ble_peri_slots[slotp].cp.latency = pEvent->linkCmpl.connLatency;
+	ble_peri_slots[slotp].cp.timeout = pEvent->linkCmpl.connTimeout;
+	ble_peri_slots[slotp].cp.active_at = TMOS_GetSystemClock();
+	ble_peri_slots[slotp].hid_protocol = HID_PROTOCOL_REPORT;
+	ble_peri_slots[slotp].hid_leds = 0;
+	memset(ble_peri_slots[slotp].hid_sent, 0,
+	       sizeof(ble_peri_slots[slotp].hid_sent));
+	ble_peri_slots[slotp].hid_busy_until = TMOS_GetSystemClock();
+	ble_peri_slots[slotp].hid_reports = 0;
+	ble_peri_slots[slotp].battery_sent = BATTERY_LEVEL_NONE;
 	PERI_DBG_PRINT("slots used: %d\n\r", ble_peri_slots_used());
 	PERI_DBG_PRINT("slots free: %d\n\r", ble_peri_slots_free());
 
-	// Set timer for param update event
+	// Settle on a profile once the central is done with discovery
 	tmos_start_task(ble_peri_slots[slotp].taskID, SBP_PARAM_UPDATE_EVT,
 			PARAM_UPDATE_DELAY);
 
@@ -119,9 +391,9 @@ static void Peripheral_LinkEstablished(gapRoleEvent_t *pEvent)
 	tmos_start_task(ble_peri_slots[slotp].taskID, SBP_PHY_UPDATE_EVT,
 			PHY_UPDATE_DELAY);
 
-	// Start read rssi
-	tmos_start_task(ble_peri_slots[slotp].taskID, SBP_READ_RSSI_EVT,
-			PERIOD_READ_RSSI);
+	// Start read rssi, its timing hardly matters
+	peripheralTimerStart(&ble_peri_slots[slotp].rssi_timer,
+			     PERIOD_READ_RSSI, PERIOD_READ_RSSI / 2);
 }
 
 static void Peripheral_LinkTerminated(gapRoleEvent_t *pEvent)
@@ -136,10 +408,18 @@ static void Peripheral_LinkTerminated(gapRoleEvent_t *pEvent)
 		return;
 	}
 	// Stop timer for periodic event
-	tmos_stop_task(ble_peri_slots[slotp].taskID, SBP_PERIODIC_EVT);
-
-	ble_peri_slots[slotp].state = 0;
-	ble_peri_slots[slotp].connHandle = GAP_CONNHANDLE_INIT;
+	peripheralTimerStop(&ble_peri_slots[slotp].periodic_timer);
+	peripheralTimerStop(&ble_peri_slots[slotp].rssi_timer);
+	tmos_stop_task(ble_peri_slots[slotp].taskID, SBP_PARAM_UPDATE_EVT);
+	tmos_stop_task(ble_peri_slots[slotp].taskID, SBP_CONSOLE_TX_EVT);
+	tmos_clear_event(ble_peri_slots[slotp].taskID, SBP_CONSOLE_TX_EVT);
+
+	// Scripts belong to the console session, drop them with the link
+	sf_task_reset(&ble_peri_slots[slotp].sft);
+	sf_outer_reset(&ble_peri_slots[slotp].sfm);
+	peripheralConsoleClose(slotp);
+
+	ble_peri_slots_put(slotp);
 	PERI_DBG_PRINT("slots used: %d\n\r", ble_peri_slots_used());
 	PERI_DBG_PRINT("slots free: %d\n\r", ble_peri_slots_free());
 	if (ble_peri_slots_free() > 0) {
@@ -195,7 +475,11 @@ static void peripheralStateNotificationCB(gapRole_States_t newState,
 
 static void peripheralRssiCB(uint16_t connHandle, int8_t rssi)
 {
-	//PERI_DBG_PRINT("RSSI -%d dB Conn  %x \r\n", -rssi, connHandle);
+	int slotp;
+	slotp = ble_peri_slots_find_by_connHandle(connHandle);
+	if (slotp >= 0) {
+		ble_peri_slots[slotp].rssi = rssi;
+	}
 }
 
 static void peripheralParamUpdateCB(uint16_t connHandle, uint16_t connInterval,
@@ -204,21 +488,23 @@ static void peripheralParamUpdateCB(uint16_t connHandle, uint16_t connInterval,
 {
 	int slotp;
 	slotp = ble_peri_slots_find_by_connHandle(connHandle);
+	if (slotp < 0) {
+		PERI_PANIC();
+		return;
+	}
 	PERI_DBG_PRINT("Slot %d Update Connection Interval = %d \n\r", slotp,
 		       connInterval);
-	if ((connInterval < CONNECTION_INTERVAL_MIN) ||
-	    (connInterval > CONNECTION_INTERVAL_MAX)) {
-		// if connect interval not between with the define scope,
-		// Set timer for param update event
-		tmos_start_task(ble_peri_slots[slotp].taskID,
-				SBP_PARAM_UPDATE_EVT, PARAM_UPDATE_DELAY);
-	}
+	ble_peri_slots[slotp].conn_interval = connInterval;
+	peripheralConnParamUpdated(slotp, connInterval, connSlaveLatency,
+				   connTimeout);
 
-	// Set timer for periodic event
+	// Set timer for periodic event, it stops by itself when nobody
+	// listens to it
 	ble_peri_slots[slotp].periodic_delay =
 		(connInterval + (connInterval >> 1));
-	tmos_start_task(ble_peri_slots[slotp].taskID, SBP_PERIODIC_EVT,
-			ble_peri_slots[slotp].periodic_delay);
+	peripheralTimerStart(&ble_peri_slots[slotp].periodic_timer,
+			     ble_peri_slots[slotp].periodic_delay,
+			     ble_peri_slots[slotp].periodic_delay / 4);
 }
 
 static gapRolesCBs_t Peripheral_PeripheralCBs = {
@@ -266,8 +552,6 @@ static void Peripheral_ProcessGAPMsg(gapRoleEvent_t *pEvent)
 	}
 }
 
-static uint8_t peripheralMTU = ATT_MTU_SIZE;
-
 static void Peripheral_ProcessTMOSMsg(tmos_event_hdr_t *pMsg)
 {
 	switch (pMsg->event) {
@@ -278,13 +562,22 @@ static void Peripheral_ProcessTMOSMsg(tmos_event_hdr_t *pMsg)
 
 	case GATT_MSG_EVENT: {
 		gattMsgEvent_t *pMsgEvent;
+		int slotp;
 
 		pMsgEvent = (gattMsgEvent_t *)pMsg;
-		if (pMsgEvent->method == ATT_MTU_UPDATED_EVENT) {
-			peripheralMTU =
-				pMsgEvent->msg.exchangeMTUReq.clientRxMTU;
+		slotp = ble_peri_slots_find_by_connHandle(pMsgEvent->connHandle);
+		if (pMsgEvent->method == ATT_MTU_UPDATED_EVENT && slotp >= 0) {
+			// our side offers BLE_BUFF_MAX_LEN - 4, and the
+			// controller grows the data length up to the same
+			// buffer size on its own
+			ble_peri_slots[slotp].mtu =
+				MIN(pMsgEvent->msg.exchangeMTUReq.clientRxMTU,
+				    BLE_BUFF_MAX_LEN - 4);
+			ble_peri_slots[slotp].data_len =
+				MIN(BLE_BUFF_MAX_LEN,
+				    ble_peri_slots[slotp].mtu + 4);
 			PERI_DBG_PRINT(
-				"mtu exchange: %d\n\r",
+				"Slot %d mtu exchange: %d\n\r", slotp,
 				pMsgEvent->msg.exchangeMTUReq.clientRxMTU);
 		}
 		break;
@@ -321,19 +614,241 @@ static uint8_t advertData[] = {
 	0x02, // length of this data
 	GAP_ADTYPE_FLAGS,
 	GAP_ADTYPE_FLAGS_GENERAL | GAP_ADTYPE_FLAGS_BREDR_NOT_SUPPORTED,
+	// a keyboard, for the host's pairing dialog
+	0x03, // length of this data
+	GAP_ADTYPE_APPEARANCE,
+	LO_UINT16(GAP_APPEARE_HID_KEYBOARD),
+	HI_UINT16(GAP_APPEARE_HID_KEYBOARD),
+	0x03, // length of this data
+	GAP_ADTYPE_16BIT_MORE,
+	LO_UINT16(HID_SVC_UUID),
+	HI_UINT16(HID_SVC_UUID),
 };
 
-extern void peripheralSysInfoSysClockNotify(uint16_t connHandle);
-extern void peripheralConsoleRNWNotify(uint16_t connHandle);
+extern int peripheralSysInfoSysClockNotify(uint16_t connHandle);
+extern int peripheralConsoleRNWNotify(uint16_t connHandle);
+extern int peripheralConsoleCtlNotify(uint16_t connHandle);
+extern int peripheralConsoleCreditDue(int slotp);
+extern int peripheralHidNotify(int slotp, const uint8_t *report);
+extern int peripheralBatteryNotify(int slotp, uint8_t level);
+extern uint8_t peripheralBatteryLevel(void);
+
+// The matrix sits parked until a key interrupts, which sets
+// SBP_MATRIX_EVT with the first press already queued. From there a soft
+// timer scans every MATRIX_SCAN_TICKS until the keys were all up for
+// MATRIX_PARK_SCANS, then the matrix parks again and the timer stops.
+static struct stimer peri_scan_timer;
+static uint8_t peri_matrix_on;
+
+// Keys go out as HID reports the moment they come off the matrix, to
+// every link the report is news to. A link that just had one queued
+// holds the next until its following connection event, whatever
+// changes meanwhile goes out as one report of the latest state, and
+// SBP_HID_EVT sends it when the first link is free again. A key that
+// goes down and up within that time is not lost, its release sends the
+// press first, and waits for SBP_HID_EVT if a link has no buffer for it.
+// The report is encoded once per pass for all links.
+static struct keymap_state peri_keys;
+static uint8_t peri_keys_pressed; // a press no report carried yet
+static int peri_keys_held = -1; // a release waiting for its press
+
+// Returns 1 if every link has the report, else 0 with SBP_HID_EVT set to
+// try again.
+static int peripheralHidFlush(int force)
+{
+	uint8_t report[KEYMAP_REPORT_LEN];
+	uint32_t now = TMOS_GetSystemClock(), wait, next = UINT32_MAX;
+	int slotp, ret;
+	keymap_report(&peri_keys, report);
+	for (slotp = 0; slotp < PERIPHERAL_MAX_CONNECTION; slotp++) {
+		struct ble_peri_slot *slot = &ble_peri_slots[slotp];
+		if (!(slot->state & STATE_DEV_CONNECTED) ||
+		    memcmp(slot->hid_sent, report, sizeof(report)) == 0) {
+			continue;
+		}
+		wait = slot->hid_busy_until - now;
+		if (!force && (int32_t)wait > 0) {
+			next = MIN(next, wait);
+			continue;
+		}
+		ret = peripheralHidNotify(slotp, report);
+		if (ret < 0) {
+			// out of buffers, the next connection event frees some
+			next = MIN(next, slot->conn_interval * 2);
+		} else if (ret > 0) {
+			memcpy(slot->hid_sent, report, sizeof(report));
+			slot->hid_busy_until = now + slot->conn_interval * 2;
+			slot->hid_reports++;
+			ble_peri_conn_activity(slotp);
+		}
+	}
+	if (next == UINT32_MAX) {
+		// every link has it
+		peri_keys_pressed = 0;
+		tmos_stop_task(Peripheral_TaskID, SBP_HID_EVT);
+		if (peri_keys_held >= 0) {
+			tmos_set_event(Peripheral_TaskID, SBP_MATRIX_EVT);
+		}
+		return 1;
+	}
+	tmos_start_task(Peripheral_TaskID, SBP_HID_EVT, next);
+	return 0;
+}
+
+void ble_peri_hid_pending(void)
+{
+	tmos_set_event(Peripheral_TaskID, SBP_HID_EVT);
+}
+
+static int peripheralMatrixEvent(void)
+{
+	int ev = peri_keys_held;
+	if (ev < 0) {
+		return matrix_event();
+	}
+	peri_keys_held = -1;
+	return ev;
+}
+
+static void peripheralMatrixKeys(void)
+{
+	int ev, changed = 0;
+	while ((ev = peripheralMatrixEvent()) >= 0) {
+		if (!(ev & MATRIX_DOWN) && peri_keys_pressed &&
+		    !peripheralHidFlush(1)) {
+			// the release would overwrite the press before it
+			// went out, the rest of the events wait with it
+			peri_keys_held = ev;
+			return;
+		}
+		if (keymap_apply(&peri_keys, ev)) {
+			peri_keys_pressed |= (ev & MATRIX_DOWN) != 0;
+			changed = 1;
+		}
+	}
+	if (changed) {
+		peripheralHidFlush(0);
+	}
+}
+
+// The battery level is sampled once a PERIOD_BATTERY while a link
+// listens, and goes to the listeners that do not have it yet.
+static struct stimer peri_battery_timer;
+
+static int peripheralBatteryTimer(int arg)
+{
+	uint8_t level = peripheralBatteryLevel();
+	int slotp, listening = 0;
+	for (slotp = 0; slotp < PERIPHERAL_MAX_CONNECTION; slotp++) {
+		if (ble_peri_slots[slotp].state & STATE_DEV_CONNECTED) {
+			listening |= peripheralBatteryNotify(slotp, level);
+		}
+	}
+	return listening;
+}
+
+void ble_peri_battery_start(void)
+{
+	peripheralTimerStart(&peri_battery_timer, PERIOD_BATTERY,
+			     PERIOD_BATTERY / 4);
+}
+
+static void peripheralMatrixWake(void)
+{
+	tmos_set_event(Peripheral_TaskID, SBP_MATRIX_EVT);
+}
+
+static int peripheralScanTimer(int arg)
+{
+	matrix_scan();
+	peripheralMatrixKeys();
+	if (Matrix.quiet < MATRIX_PARK_SCANS) {
+		return 1;
+	}
+	matrix_park(peripheralMatrixWake);
+	return 0;
+}
 
-static void performPeriodicTask(uint16_t connHandle)
+void peripheralMatrixEnable(int on)
+{
+	peri_matrix_on = on;
+	if (on) {
+		matrix_park(peripheralMatrixWake);
+	} else {
+		matrix_unpark();
+		peripheralTimerStop(&peri_scan_timer);
+	}
+}
+
+// returns 0 once there is nothing left to do periodically
+static int performPeriodicTask(int slotp)
+{
+	ble_peri_slots[slotp].periodic_cnt++;
+
+	return peripheralSysInfoSysClockNotify(
+		ble_peri_slots[slotp].connHandle);
+}
+
+// (re)start the periodic task after its notifications got enabled
+void peripheralPeriodicStart(uint16_t connHandle)
 {
 	int slotp;
 	slotp = ble_peri_slots_find_by_connHandle(connHandle);
-	ble_peri_slots[slotp].periodic_cnt++;
+	if (slotp < 0 || ble_peri_slots[slotp].periodic_delay == 0) {
+		return;
+	}
+	peripheralTimerStart(&ble_peri_slots[slotp].periodic_timer,
+			     ble_peri_slots[slotp].periodic_delay,
+			     ble_peri_slots[slotp].periodic_delay / 4);
+}
 
-	peripheralSysInfoSysClockNotify(connHandle);
-	peripheralConsoleRNWNotify(connHandle);
+// Console output and rx credits leave through SBP_CONSOLE_TX_EVT. It
+// is raised when contx_fifo stops being empty or the client is owed
+// credits, and retries every connection interval while the stack is out
+// of buffers, so an idle console costs no wakeups. While it waits,
+// filling three quarters of contx_fifo tries again at once.
+void ble_peri_console_tx_pending(int slotp)
+{
+	struct ble_peri_slot *slot = &ble_peri_slots[slotp];
+	int used = fifo8_used(&slot->contx_fifo);
+
+	if (!(slot->state & STATE_DEV_CONNECTED) ||
+	    (used == 0 && !peripheralConsoleCreditDue(slotp))) {
+		return;
+	}
+	if (slot->state & STATE_CONSOLE_TX) {
+		if (used * 4 < slot->contx_fifo.size * 3 ||
+		    (slot->state & STATE_CONSOLE_TX_HIGH)) {
+			return;
+		}
+		slot->state |= STATE_CONSOLE_TX_HIGH;
+	}
+	slot->state |= STATE_CONSOLE_TX;
+	tmos_set_event(slot->taskID, SBP_CONSOLE_TX_EVT);
+}
+
+static void peripheralConsoleTx(int slotp)
+{
+	struct ble_peri_slot *slot = &ble_peri_slots[slotp];
+	int used = fifo8_used(&slot->contx_fifo);
+	int ret;
+	if (!(slot->state & STATE_DEV_CONNECTED)) {
+		return;
+	}
+	// credits first, they are small and keep the client writing
+	ret = peripheralConsoleCtlNotify(slot->connHandle) < 0 ||
+	      peripheralConsoleRNWNotify(slot->connHandle) < 0;
+	// output nobody listens to keeps no link awake
+	if (fifo8_used(&slot->contx_fifo) != used) {
+		ble_peri_conn_activity(slotp);
+	}
+	if (ret) {
+		// out of buffers, the next connection event frees some
+		tmos_start_task(slot->taskID, SBP_CONSOLE_TX_EVT,
+				slot->conn_interval * 2);
+		return;
+	}
+	slot->state &= ~(STATE_CONSOLE_TX | STATE_CONSOLE_TX_HIGH);
 }
 
 static uint16_t peri_connect_ProcessEvent(uint8_t task_id, uint16_t events)
@@ -346,13 +861,7 @@ static uint16_t peri_connect_ProcessEvent(uint8_t task_id, uint16_t events)
 	}
 
 	if (events & SBP_PARAM_UPDATE_EVT) {
-		PERI_DBG_PRINT("Send connection param update request\n\r");
-		// Send connect param update request
-		GAPRole_PeripheralConnParamUpdateReq(
-			ble_peri_slots[slotp].connHandle,
-			CONNECTION_INTERVAL_MIN, CONNECTION_INTERVAL_MAX,
-			SLAVE_LATENCY, CONNECTION_TIMEOUT,
-			ble_peri_slots[slotp].taskID);
+		peripheralConnParamEvt(slotp);
 		return (events ^ SBP_PARAM_UPDATE_EVT);
 	}
 
@@ -366,43 +875,16 @@ static uint16_t peri_connect_ProcessEvent(uint8_t task_id, uint16_t events)
 		return (events ^ SBP_PHY_UPDATE_EVT);
 	}
 
-	if (events & SBP_READ_RSSI_EVT) {
-		GAPRole_ReadRssiCmd(ble_peri_slots[slotp].connHandle);
-		tmos_start_task(ble_peri_slots[slotp].taskID, SBP_READ_RSSI_EVT,
-				PERIOD_READ_RSSI);
-		return (events ^ SBP_READ_RSSI_EVT);
-	}
-
-	if (events & SBP_PERIODIC_EVT) {
-		// Restart timer
-		if (ble_peri_slots[slotp].periodic_delay) {
-			tmos_start_task(ble_peri_slots[slotp].taskID,
-					SBP_PERIODIC_EVT,
-					ble_peri_slots[slotp].periodic_delay);
-		}
-		// Perform periodic application task
-		performPeriodicTask(ble_peri_slots[slotp].connHandle);
-		return (events ^ SBP_PERIODIC_EVT);
-	}
-
-	if (events & SBP_FORTH_EVT) {
-		// Restart timer
-		if (FORTH_DELAY) {
-			tmos_start_task(ble_peri_slots[slotp].taskID,
-					SBP_FORTH_EVT, FORTH_DELAY);
-		}
-		int cnt = 100;
-		do {
-			stepforth(NULL);
-		} while (cnt--);
-		return (events ^ SBP_FORTH_EVT);
+	if (events & SBP_CONSOLE_TX_EVT) {
+		peripheralConsoleTx(slotp);
+		return (events ^ SBP_CONSOLE_TX_EVT);
 	}
 
 	PERI_DBG_PRINT("%s: unhandle events: 0x%02X\n\r", __func__, events);
 	return 0;
 }
 
-static uint16_t Peripheral_ProcessEvent(uint8_t task_id, uint16_t events)
+static uint16_t peri_ProcessEvent(uint8_t task_id, uint16_t events)
 {
 	if (events & SYS_EVENT_MSG) {
 		uint8_t *pMsg;
@@ -424,43 +906,177 @@ static uint16_t Peripheral_ProcessEvent(uint8_t task_id, uint16_t events)
 		return (events ^ SBP_START_DEVICE_EVT);
 	}
 
+	if (events & SBP_FORTH_EVT) {
+		// One bounded pass, then back to TMOS. If scripts still have
+		// work the event is set again, so whatever the stack queued
+		// meanwhile runs first. With nothing runnable the event stays
+		// clear until sf_sched_wake().
+		int slotp;
+		peripheralUartConsoleIn();
+		if (sf_sched_run(FORTH_PASS_CYCLES)) {
+			tmos_set_event(Peripheral_TaskID, SBP_FORTH_EVT);
+		}
+		for (slotp = 0; slotp < PERIPHERAL_MAX_CONNECTION; slotp++) {
+			ble_peri_console_tx_pending(slotp);
+		}
+		if (peripheralUartConsoleOut()) {
+			tmos_start_task(Peripheral_TaskID, SBP_FORTH_EVT,
+					PERI_UARTCON_RETRY);
+		}
+		return (events ^ SBP_FORTH_EVT);
+	}
+
+	if (events & SBP_MATRIX_EVT) {
+		peripheralMatrixKeys();
+		if (peri_matrix_on) {
+			peripheralTimerStart(&peri_scan_timer,
+					     MATRIX_SCAN_TICKS, 0);
+		}
+		return (events ^ SBP_MATRIX_EVT);
+	}
+
+	if (events & SBP_HID_EVT) {
+		peripheralHidFlush(0);
+		return (events ^ SBP_HID_EVT);
+	}
+
+	if (events & SBP_TIMER_EVT) {
+		stimer_run(&peri_timers, TMOS_GetSystemClock());
+		peripheralTimerArm();
+		return (events ^ SBP_TIMER_EVT);
+	}
+
+	// debug output goes out between the events that made it
+	if (events & SBP_TRACE_EVT) {
+		trace_drain(peripheralTraceWrite);
+		if (trace_pending()) {
+			tmos_start_task(Peripheral_TaskID, SBP_TRACE_EVT,
+					PERI_TRACE_RETRY);
+		}
+		return (events ^ SBP_TRACE_EVT);
+	}
+
 	return peri_connect_ProcessEvent(task_id, events);
 }
 
+// every pass handles one event, the bit it cleared picks the site
+static int peripheralProfSite(uint16_t done)
+{
+	switch (done) {
+	case SYS_EVENT_MSG:
+		return PROF_EVT_MSG;
+	case SBP_START_DEVICE_EVT:
+		return PROF_EVT_START;
+	case SBP_PARAM_UPDATE_EVT:
+		return PROF_EVT_PARAM_UPDATE;
+	case SBP_PHY_UPDATE_EVT:
+		return PROF_EVT_PHY;
+	case SBP_FORTH_EVT:
+		return PROF_EVT_FORTH;
+	case SBP_CONSOLE_TX_EVT:
+		return PROF_EVT_CONSOLE_TX;
+	case SBP_TIMER_EVT:
+		return PROF_EVT_TIMER;
+	case SBP_TRACE_EVT:
+		return PROF_EVT_TRACE;
+	case SBP_MATRIX_EVT:
+	case SBP_HID_EVT:
+		return PROF_EVT_KEYS;
+	}
+	return PROF_EVT_OTHER;
+}
+
+static uint16_t Peripheral_ProcessEvent(uint8_t task_id, uint16_t events)
+{
+	uint32_t start = mcycle();
+	uint16_t left = peri_ProcessEvent(task_id, events);
+	prof_end(&PeriProf[peripheralProfSite(events & ~left)], start);
+	return left;
+}
+
 extern bStatus_t GATT_AddSysInfo_Service(void);
 extern bStatus_t GATT_AddConsole_Service(void);
+extern bStatus_t GATT_AddHid_Service(void);
+extern bStatus_t GATT_AddDevInfo_Service(void);
+extern bStatus_t GATT_AddBattery_Service(void);
+
+// every link runs its own Forth machine, the UART console one more
+static struct sf_machine *peripheralForthMachines[PERIPHERAL_MAX_CONNECTION + 1];
+
+static void peripheralForthWake(void)
+{
+	tmos_set_event(Peripheral_TaskID, SBP_FORTH_EVT);
+}
+
+static void peripheralTraceWake(void)
+{
+	tmos_set_event(Peripheral_TaskID, SBP_TRACE_EVT);
+}
 
 void Peripheral_Init(void)
 {
+	Peripheral_TaskID = TMOS_ProcessEventRegister(Peripheral_ProcessEvent);
+	trace_init(peri_trace_buf, sizeof(peri_trace_buf), RTC_GetCycle32k,
+		   peripheralTraceWake);
+
 	PERI_DBG_PRINT("BLE Peripheral Init...\n\r");
 	snprintf(attDeviceName, GAP_DEVICE_NAME_LEN - 1, "CH5%02X-%04X",
 		 R8_CHIP_ID, chip_uid_sum);
 	memcpy(&scanRspData[2], attDeviceName, MIN(10, strlen(attDeviceName)));
-	PERI_DBG_PRINT("Device Name: %s\n\r", attDeviceName);
+	// a RAM string, printed in full while booting
+	DBG_PRINT("BLE PERI:Device Name: %s\n\r", attDeviceName);
 
-	Peripheral_TaskID = TMOS_ProcessEventRegister(Peripheral_ProcessEvent);
+	sf_sched_init(peripheralForthMachines,
+		      sizeof(peripheralForthMachines) /
+			      sizeof(peripheralForthMachines[0]),
+		      peripheralForthWake);
+	sf_dict_reset();
+	sf_native_reset();
 
 	int slotp;
 	memset(ble_peri_slots, 0x0, sizeof(ble_peri_slots));
+	memset(slot_by_handle, 0x0, sizeof(slot_by_handle));
+	slot_free_map = 0xffffffff >> (32 - PERIPHERAL_MAX_CONNECTION);
+	slot_used_num = 0;
+	stimer_init(&peri_timers);
+	prof_reset(PeriProf, PROF_SITES);
 	for (slotp = 0; slotp < PERIPHERAL_MAX_CONNECTION; slotp++) {
 		ble_peri_slots[slotp].taskID =
 			TMOS_ProcessEventRegister(Peripheral_ProcessEvent);
 		ble_peri_slots[slotp].connHandle = GAP_CONNHANDLE_INIT;
+		stimer_setup(&ble_peri_slots[slotp].periodic_timer,
+			     performPeriodicTask, slotp);
+		stimer_setup(&ble_peri_slots[slotp].rssi_timer,
+			     peripheralRssiTimer, slotp);
 
 		ble_peri_slots[slotp].sfm.task_addr =
 			&ble_peri_slots[slotp].sft;
 		ble_peri_slots[slotp].sfm.ble_peri_slot_addr =
 			&ble_peri_slots[slotp];
+		ble_peri_slots[slotp].sfm.rx = &ble_peri_slots[slotp].conrx_fifo;
+		ble_peri_slots[slotp].sfm.tx = &ble_peri_slots[slotp].contx_fifo;
+		ble_peri_slots[slotp].sfm.outer = &ble_peri_slots[slotp].sfo;
+		sf_task_reset(&ble_peri_slots[slotp].sft);
+		sf_outer_reset(&ble_peri_slots[slotp].sfm);
+		if (sf_sched_add(&ble_peri_slots[slotp].sfm) < 0) {
+			PERI_DBG_PRINT("slot %d: no room to schedule its "
+				       "console\n\r", slotp);
+		}
 
-		ble_peri_slots[slotp].conrx_fifo.buf =
-			ble_peri_slots[slotp].conrx_fifo_buf;
-		ble_peri_slots[slotp].conrx_fifo.size = CONFIFO_SIZE;
-		ble_peri_slots[slotp].contx_fifo.buf =
-			ble_peri_slots[slotp].contx_fifo_buf;
-		ble_peri_slots[slotp].contx_fifo.size = CONFIFO_SIZE;
-		fifo8_reset(&ble_peri_slots[slotp].conrx_fifo);
-		fifo8_reset(&ble_peri_slots[slotp].contx_fifo);
+		// no console buffers until a link comes up
+		fifo8_init(&ble_peri_slots[slotp].conrx_fifo, NULL, 0);
+		fifo8_init(&ble_peri_slots[slotp].contx_fifo, NULL, 0);
 	}
+	slot_task_base = ble_peri_slots[0].taskID;
+	// the wired console, its receive interrupt only sets SBP_FORTH_EVT
+	peripheralUartConsoleInit(peripheralForthWake);
+	matrix_init();
+	memset(&peri_keys, 0, sizeof(peri_keys));
+	peri_keys_pressed = 0;
+	peri_keys_held = -1;
+	stimer_setup(&peri_scan_timer, peripheralScanTimer, 0);
+	stimer_setup(&peri_battery_timer, peripheralBatteryTimer, 0);
+	peripheralMatrixEnable(1);
 
 	uint8_t initial_advertising_enable = TRUE;
 	uint16_t desired_min_interval = CONNECTION_INTERVAL_MIN;
@@ -486,16 +1102,36 @@ void Peripheral_Init(void)
 	// Register receive scan request callback
 	GAPRole_BroadcasterSetCB(&Broadcaster_BroadcasterCBs);
 
+	// Bond on the host's request, no display or keys to confirm with,
+	// HID wants the link encrypted and the keys kept across power off
+	uint8_t pair_mode = GAPBOND_PAIRING_MODE_WAIT_FOR_REQ;
+	uint8_t mitm = FALSE;
+	uint8_t io_cap = GAPBOND_IO_CAP_NO_INPUT_NO_OUTPUT;
+	uint8_t bonding = TRUE;
+	GAPBondMgr_SetParameter(GAPBOND_PERI_PAIRING_MODE, sizeof(uint8_t),
+				&pair_mode);
+	GAPBondMgr_SetParameter(GAPBOND_PERI_MITM_PROTECTION, sizeof(uint8_t),
+				&mitm);
+	GAPBondMgr_SetParameter(GAPBOND_PERI_IO_CAPABILITIES, sizeof(uint8_t),
+				&io_cap);
+	GAPBondMgr_SetParameter(GAPBOND_PERI_BONDING_ENABLED, sizeof(uint8_t),
+				&bonding);
+
 	GGS_AddService(GATT_ALL_SERVICES); // GAP
 	GATTServApp_AddService(GATT_ALL_SERVICES); // GATT attributes
 
 	// Register GATT attribute list and CBs with GATT Server App
 	GATT_AddSysInfo_Service();
 	GATT_AddConsole_Service();
+	GATT_AddHid_Service();
+	GATT_AddDevInfo_Service();
+	GATT_AddBattery_Service();
 
 	// Set the GAP Characteristics
 	GGS_SetParameter(GGS_DEVICE_NAME_ATT, sizeof(attDeviceName),
 			 attDeviceName);
+	uint16_t appearance = GAP_APPEARE_HID_KEYBOARD;
+	GGS_SetParameter(GGS_APPEARANCE_ATT, sizeof(appearance), &appearance);
 
 	// Update Connection Params
 	gapPeriConnectParams_t ConnectParams;
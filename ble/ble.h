@@ -3,40 +3,161 @@
 
 #include <stdint.h>
 #include "fifo8.h"
+#include "stimer.h"
+#include "prof.h"
+#include "trace.h"
 #include "stepforth.h"
+#include "sf_outer.h"
+#include "keymap.h"
 
 #define DBG_PRINT(...) PRINT(__VA_ARGS__)
 
-#define PERI_DBG_PRINT(...)             \
-	{                               \
-		DBG_PRINT("BLE PERI:"); \
-		DBG_PRINT(__VA_ARGS__); \
-	}
+// deferred, see lib/trace.h, fmt has to be a string literal
+#define PERI_DBG_PRINT(fmt, ...) TRACE("BLE PERI:" fmt, ##__VA_ARGS__)
 #define PERI_PANIC()                                                         \
 	{                                                                    \
 		PERI_DBG_PRINT("%s: PANIC LINE %d\n\r", __func__, __LINE__); \
 	}
 
 enum {
-	CONFIFO_SIZE = 96,
+	// console fifos are taken from a pool shared by all links
+	CONPOOL_BLOCK = 32, // bytes
+	CONFIFO_BLOCKS = 2, // each way, while the link is up
+	CONFIFO_BLOCKS_MAX = 5, // a busy fifo grows to, fifo8 < 256
+	// every link up, and one fifo moving to its larger run
+	CONPOOL_BLOCKS = PERIPHERAL_MAX_CONNECTION * 2 * CONFIFO_BLOCKS +
+			 CONFIFO_BLOCKS_MAX,
+	// conrx_fifo room worth telling the client about
+	CONRX_CREDIT_STEP = CONPOOL_BLOCK / 2,
+	// the wired console keeps fifos as large as a busy link's
+	UARTCON_FIFO = CONFIFO_BLOCKS_MAX * CONPOOL_BLOCK,
+};
+
+enum {
+	CONN_PROFILE_NONE = 0, // what the central picked, neither below
+	CONN_PROFILE_ACTIVE, // typing, console traffic
+	CONN_PROFILE_IDLE,
+	CONN_PROFILE_NUM,
+};
+
+// connection parameter manager, counters since the link came up
+struct ble_conn_param {
+	uint8_t profile; // CONN_PROFILE_* the link runs with
+	uint8_t target; // differs from profile while a request is out
+	uint8_t rejects; // in a row, the backoff doubles with each
+	uint16_t latency;
+	uint16_t timeout; // x 10ms
+	uint32_t active_at; // TMOS clock of the last input or output
+	uint16_t requests;
+	uint16_t rejected;
+	uint16_t to_active;
+	uint16_t to_idle;
+};
+
+enum {
+	POWER_RUN = 0, // awake, handlers or the stack spinning
+	POWER_IDLE, // clocks on, any interrupt wakes
+	POWER_HALT,
+	POWER_SLEEP, // RAM and RTC kept, the crystal restarts
+	POWER_STATES,
+	POWER_VALUE_LEN = 2 + POWER_STATES * 4 + 3 * 2 + 2 * 4,
+};
+
+// profiled sites, the TMOS event handlers of Peripheral_ProcessEvent()
+// and the GATT attribute callbacks
+enum {
+	PROF_EVT_MSG = 0, // GAP and TMOS messages
+	PROF_EVT_START,
+	PROF_EVT_PARAM_UPDATE,
+	PROF_EVT_PHY,
+	PROF_EVT_FORTH, // one sf_sched_run() pass over the machines
+	PROF_EVT_CONSOLE_TX,
+	PROF_EVT_TIMER, // the soft timers
+	PROF_EVT_TRACE, // trace ring to the UART
+	PROF_EVT_KEYS, // the first scan after a wake, held HID reports
+	PROF_EVT_OTHER, // events nobody handled
+	PROF_SYSINFO_READ,
+	PROF_SYSINFO_WRITE,
+	PROF_CONSOLE_READ,
+	PROF_CONSOLE_WRITE,
+	PROF_SITES,
+	// one attribute value, at most 512 bytes
+	PROF_VALUE_LEN = 4 + PROF_SITES * PROF_SITE_LEN,
+};
+
+enum {
+	HID_SVC_UUID = 0x1812, // advertised
+	HID_PROTOCOL_BOOT = 0,
+	HID_PROTOCOL_REPORT, // what a link starts with
+	BATTERY_LEVEL_NONE = 0xff, // battery_sent before any notification
+};
+
+// power manager, ble_power.c, times in RTC cycles since boot
+struct power_stats {
+	uint64_t rtc[POWER_STATES];
+	uint32_t entries[POWER_STATES];
+	uint32_t wake_worst; // from the RTC trigger to back in the stack
+	uint32_t wake_last;
+	uint32_t late; // wake-ups that overran the stack's deadline
+	uint32_t stamp; // RTC at the last state change
+	uint8_t enabled;
+	uint8_t last; // state of the last low power call
 };
 
 struct ble_peri_slot {
 	uint16_t state;
 	uint8_t taskID;
 	uint16_t connHandle;
+	uint16_t conn_interval; // x 1.25ms
+	uint16_t mtu; // ATT MTU agreed with this client
+	uint16_t data_len; // LL payload octets per packet
 	uint32_t periodic_cnt;
 	uint32_t periodic_delay;
+	struct stimer periodic_timer; // sysinfo clock notifications
+	struct stimer rssi_timer;
+	int8_t rssi; // dBm, last read
 
 	// virtual forth machine
 	struct sf_machine sfm;
 	struct sf_task sft;
+	struct sf_outer sfo;
 
 	// virtual com port
 	struct fifo8 conrx_fifo;
-	uint8_t conrx_fifo_buf[CONFIFO_SIZE];
+	uint8_t *conrx_buf;
+	struct fifo8 contx_fifo;
+	uint8_t *contx_buf; // ring contx_fifo falls back to
+	uint8_t *tx_noti; // GATT buffer contx_fifo sits on, or NULL
+	uint8_t conrx_blocks;
+	uint8_t contx_blocks;
+
+	// console rx flow control, bytes since the link came up
+	uint32_t rx_accepted;
+	uint32_t rx_dropped;
+	uint32_t rx_granted; // credit limit the client was last told
+
+	struct ble_conn_param cp;
+
+	// HID keyboard
+	uint8_t hid_protocol; // HID_PROTOCOL_*
+	uint8_t hid_leds; // output report, as the host last wrote it
+	uint8_t hid_sent[KEYMAP_REPORT_LEN]; // the last input report queued
+	uint32_t hid_busy_until; // TMOS clock, holds the next report till
+	uint32_t hid_reports;
+	uint8_t battery_sent; // level last notified, or BATTERY_LEVEL_NONE
+};
+
+// wired console on UART1, ble_uart_console.c
+struct uart_console {
+	struct sf_machine sfm;
+	struct sf_task sft;
+	struct sf_outer sfo;
+	struct fifo8 conrx_fifo;
 	struct fifo8 contx_fifo;
-	uint8_t contx_fifo_buf[CONFIFO_SIZE];
+	uint8_t conrx_buf[UARTCON_FIFO];
+	uint8_t contx_buf[UARTCON_FIFO];
+	uint32_t rx_bytes;
+	uint32_t tx_bytes;
 };
 
 int ble_peri_slots_find_free(void);
@@ -45,5 +166,13 @@ int ble_peri_slots_used(void);
 int ble_peri_slots_free(void);
 int ble_peri_slots_find_by_connHandle(int connHandle);
 int ble_peri_slots_find_by_taskID(int task_id);
+void ble_peri_console_tx_pending(int slotp);
+void ble_peri_conn_activity(int slotp);
+void ble_peri_hid_pending(void);
+void ble_peri_battery_start(void);
+void peripheralUartConsoleInit(void (*wake)(void));
+void peripheralUartConsoleIn(void);
+int peripheralUartConsoleOut(void);
+void peripheralMatrixEnable(int on);
 
 #endif
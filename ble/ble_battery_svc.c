@@ -0,0 +1,148 @@
+#include "CH58x_common.h"
+#include "CH58xBLE_LIB.h"
+#include "CONFIG.h"
+#include "ble.h"
+
+// Battery Service, the level in percent. Reads sample it, listeners get
+// it from ble_peri_battery_start()'s timer whenever it moved.
+enum {
+	BATTERY_SVC_UUID = 0x180F,
+	BATTERY_LEVEL_CHR_UUID = 0x2A19,
+	BATTERY_LEVEL_IDX = 2, // in BatteryAttrTbl, the value notified
+};
+
+extern struct ble_peri_slot ble_peri_slots[PERIPHERAL_MAX_CONNECTION];
+extern uint8_t peripheralBatteryLevel(void);
+
+static const uint8_t BatterySvcUUID[ATT_BT_UUID_SIZE] = {
+	LO_UINT16(BATTERY_SVC_UUID), HI_UINT16(BATTERY_SVC_UUID)
+};
+static const gattAttrType_t BatterySvc = { ATT_BT_UUID_SIZE, BatterySvcUUID };
+
+const uint8_t BatteryLevelUUID[ATT_BT_UUID_SIZE] = {
+	LO_UINT16(BATTERY_LEVEL_CHR_UUID), HI_UINT16(BATTERY_LEVEL_CHR_UUID)
+};
+
+const static uint8_t BatteryLevelProps = GATT_PROP_READ | GATT_PROP_NOTIFY;
+
+static gattCharCfg_t BatteryLevelConfig[PERIPHERAL_MAX_CONNECTION];
+
+// encrypted like the HID service it goes with
+static gattAttribute_t BatteryAttrTbl[] = {
+	// Battery Service
+	{
+		{ ATT_BT_UUID_SIZE, primaryServiceUUID }, /* type */
+		GATT_PERMIT_READ, /* permissions */
+		0, /* handle */
+		(uint8_t *)&BatterySvc /* pValue */
+	},
+
+	// Battery Level
+	{
+		{ ATT_BT_UUID_SIZE, characterUUID },
+		GATT_PERMIT_READ,
+		0,
+		(uint8_t *)&BatteryLevelProps
+	},
+	{
+		{ ATT_BT_UUID_SIZE, BatteryLevelUUID },
+		GATT_PERMIT_ENCRYPT_READ,
+		0,
+		NULL,
+	},
+	{
+		{ ATT_BT_UUID_SIZE, clientCharCfgUUID },
+		GATT_PERMIT_ENCRYPT_READ | GATT_PERMIT_ENCRYPT_WRITE,
+		0,
+		(uint8_t *)BatteryLevelConfig,
+	},
+};
+
+static bStatus_t Battery_ReadAttr(uint16_t connHandle, gattAttribute_t *pAttr,
+				  uint8_t *pValue, uint16_t *pLen,
+				  uint16_t offset, uint16_t maxLen,
+				  uint8_t method)
+{
+	uint16_t uuid = BUILD_UINT16(pAttr->type.uuid[0], pAttr->type.uuid[1]);
+	if (uuid != BATTERY_LEVEL_CHR_UUID) {
+		PERI_DBG_PRINT("%s: Unhandle UUID: 0x%04X\n\r", __func__, uuid);
+		*pLen = 0;
+		return ATT_ERR_ATTR_NOT_FOUND;
+	}
+	if (offset != 0) {
+		return ATT_ERR_ATTR_NOT_LONG;
+	}
+	*pLen = 1;
+	pValue[0] = peripheralBatteryLevel();
+	return SUCCESS;
+}
+
+static bStatus_t Battery_WriteAttr(uint16_t connHandle, gattAttribute_t *pAttr,
+				   uint8_t *pValue, uint16_t len,
+				   uint16_t offset, uint8_t method)
+{
+	bStatus_t status;
+	uint16_t uuid = BUILD_UINT16(pAttr->type.uuid[0], pAttr->type.uuid[1]);
+	int slotp;
+	if (uuid != GATT_CLIENT_CHAR_CFG_UUID) {
+		return ATT_ERR_WRITE_NOT_PERMITTED;
+	}
+	slotp = ble_peri_slots_find_by_connHandle(connHandle);
+	if (slotp < 0) {
+		PERI_PANIC();
+		return ATT_ERR_INVALID_PDU;
+	}
+	status = GATTServApp_ProcessCCCWriteReq(connHandle, pAttr, pValue, len,
+						offset, GATT_CLIENT_CFG_NOTIFY);
+	// a new listener has not been sent any level yet
+	if (status == SUCCESS) {
+		ble_peri_slots[slotp].battery_sent = BATTERY_LEVEL_NONE;
+		ble_peri_battery_start();
+	}
+	return status;
+}
+
+// Send level to the link if it listens and was not sent it already.
+// Returns 0 if it does not listen, else 1, the stack out of buffers
+// included, the next sample tries again.
+int peripheralBatteryNotify(int slotp, uint8_t level)
+{
+	struct ble_peri_slot *slot = &ble_peri_slots[slotp];
+	attHandleValueNoti_t noti;
+	if ((GATTServApp_ReadCharCfg(slot->connHandle, BatteryLevelConfig) &
+	     GATT_CLIENT_CFG_NOTIFY) == 0) {
+		return 0;
+	}
+	if (slot->battery_sent == level) {
+		return 1;
+	}
+	noti.len = 1;
+	noti.pValue = GATT_bm_alloc(slot->connHandle, ATT_HANDLE_VALUE_NOTI,
+				    noti.len, NULL, 0);
+	if (noti.pValue == NULL) {
+		return 1;
+	}
+	noti.pValue[0] = level;
+	noti.handle = BatteryAttrTbl[BATTERY_LEVEL_IDX].handle;
+	if (GATT_Notification(slot->connHandle, &noti, FALSE) != SUCCESS) {
+		GATT_bm_free((gattMsg_t *)&noti, ATT_HANDLE_VALUE_NOTI);
+		return 1;
+	}
+	slot->battery_sent = level;
+	return 1;
+}
+
+static gattServiceCBs_t BatteryCBs = {
+	Battery_ReadAttr, // Read callback function pointer
+	Battery_WriteAttr, // Write callback function pointer
+	NULL // Authorization callback function pointer
+};
+
+bStatus_t GATT_AddBattery_Service(void)
+{
+	GATTServApp_InitCharCfg(INVALID_CONNHANDLE, BatteryLevelConfig);
+	return GATTServApp_RegisterService(BatteryAttrTbl,
+					   GATT_NUM_ATTRS(BatteryAttrTbl),
+					   GATT_MAX_ENCRYPT_KEY_SIZE,
+					   &BatteryCBs);
+}
@@ -3,11 +3,15 @@
 #include "CONFIG.h"
 #include "ble.h"
 #include "fifo8.h"
+#include "pool.h"
+#include "sf_outer.h"
+#include "sf_sched.h"
 
 enum {
 	CONSOLE_SVC_UUID = 0xFFC0,
 	CONSOLE_RNW_CHR_UUID = 0xFFC1,
 	CONSOLE_CTL_CHR_UUID = 0xFFC2,
+	CONSOLE_CTL_LEN = 14,
 };
 
 extern uint8_t chip_uid[8];
@@ -32,17 +36,27 @@ const uint8_t ConsoleCtlUUID[ATT_BT_UUID_SIZE] = {
 	LO_UINT16(CONSOLE_CTL_CHR_UUID), HI_UINT16(CONSOLE_CTL_CHR_UUID)
 };
 
-const static uint8_t ConsoleCtlProps = GATT_PROP_READ;
+const static uint8_t ConsoleCtlProps = GATT_PROP_READ | GATT_PROP_NOTIFY;
 
+// The client may write to the console until its byte count since the
+// connection reaches the credit limit, the limit is notified here as
+// conrx_fifo drains. All words are little endian.
 const static uint8_t ConsoleCtlUserDesp[] = "Debug Console Info Interface, \
 byte0 is rx fifo free,\
-byte1 is tx fifo free \0";
+byte1 is tx fifo free,\
+u32 at 2 is rx credit limit,\
+u32 at 6 is rx bytes accepted,\
+u32 at 10 is rx bytes dropped \0";
 
+static gattCharCfg_t ConsoleCtlConfig[PERIPHERAL_MAX_CONNECTION];
+
+// The console runs Forth that can store anywhere and compile native
+// code, only a bonded, encrypted link gets to it.
 static gattAttribute_t ConsoleAttrTbl[] = {
 	// Console Service
 	{
 		{ ATT_BT_UUID_SIZE, primaryServiceUUID }, /* type */
-		GATT_PERMIT_READ | GATT_PERMIT_WRITE, /* permissions */
+		GATT_PERMIT_READ, /* permissions */
 		0, /* handle */
 		(uint8_t *)&ConsoleSvc /* pValue */
 	},
@@ -58,7 +72,7 @@ static gattAttribute_t ConsoleAttrTbl[] = {
 	// Console Value
 	{
 		{ ATT_BT_UUID_SIZE, ConsoleRNWUUID },
-		GATT_PERMIT_READ | GATT_PERMIT_WRITE,
+		GATT_PERMIT_ENCRYPT_READ | GATT_PERMIT_ENCRYPT_WRITE,
 		0,
 		NULL,
 	},
@@ -74,7 +88,7 @@ static gattAttribute_t ConsoleAttrTbl[] = {
 	// Console Notify configuration
 	{
 		{ ATT_BT_UUID_SIZE, clientCharCfgUUID },
-		GATT_PERMIT_READ | GATT_PERMIT_WRITE,
+		GATT_PERMIT_ENCRYPT_READ | GATT_PERMIT_ENCRYPT_WRITE,
 		0,
 		(uint8_t *)ConsoleRNWConfig,
 	},
@@ -90,7 +104,7 @@ static gattAttribute_t ConsoleAttrTbl[] = {
 	// Console Ctl Value
 	{
 		{ ATT_BT_UUID_SIZE, ConsoleCtlUUID },
-		GATT_PERMIT_READ,
+		GATT_PERMIT_ENCRYPT_READ,
 		0,
 		NULL,
 	},
@@ -102,14 +116,175 @@ static gattAttribute_t ConsoleAttrTbl[] = {
 		0,
 		(uint8_t *)ConsoleCtlUserDesp,
 	},
+
+	// Console Ctl Notify configuration
+	{
+		{ ATT_BT_UUID_SIZE, clientCharCfgUUID },
+		GATT_PERMIT_ENCRYPT_READ | GATT_PERMIT_ENCRYPT_WRITE,
+		0,
+		(uint8_t *)ConsoleCtlConfig,
+	},
 };
 
 extern struct ble_peri_slot ble_peri_slots[PERIPHERAL_MAX_CONNECTION];
+extern struct prof_site PeriProf[PROF_SITES];
 
-static bStatus_t Console_ReadAttrCB(uint16_t connHandle, gattAttribute_t *pAttr,
-				    uint8_t *pValue, uint16_t *pLen,
-				    uint16_t offset, uint16_t maxLen,
-				    uint8_t method)
+// data or room on the console may have given the slot's interpreter or
+// script something to do
+static void Console_Wake(int slotp)
+{
+	if (sf_outer_ready(&ble_peri_slots[slotp].sfm)) {
+		sf_sched_wake();
+	}
+}
+
+// one notification per LL packet, as large as the link carries
+static int Console_Payload(struct ble_peri_slot *slot)
+{
+	return MIN(slot->mtu, slot->data_len - 4) - 3;
+}
+
+// Console output is written straight into the next notification:
+// contx_fifo is placed over a GATT buffer, EMIT and the interpreter fill
+// it in place and the buffer goes to the stack as it is. Only while the
+// stack has no buffer to spare the fifo falls back to the ring in the
+// slot, which is copied out as before.
+static void Console_TxArm(int slotp)
+{
+	struct ble_peri_slot *slot = &ble_peri_slots[slotp];
+	int size;
+	if (slot->tx_noti || fifo8_used(&slot->contx_fifo) ||
+	    (GATTServApp_ReadCharCfg(slot->connHandle, ConsoleRNWConfig) &
+	     GATT_CLIENT_CFG_NOTIFY) == 0) {
+		return;
+	}
+	size = MIN(Console_Payload(slot), UINT8_MAX);
+	slot->tx_noti = GATT_bm_alloc(slot->connHandle, ATT_HANDLE_VALUE_NOTI,
+				      size, NULL, 0);
+	if (slot->tx_noti) {
+		fifo8_init(&slot->contx_fifo, slot->tx_noti, size);
+	}
+}
+
+// back on the ring, once the buffer went to the stack or with the link
+static void Console_TxRelease(int slotp)
+{
+	struct ble_peri_slot *slot = &ble_peri_slots[slotp];
+	attHandleValueNoti_t noti;
+	if (slot->tx_noti) {
+		noti.pValue = slot->tx_noti;
+		GATT_bm_free((gattMsg_t *)&noti, ATT_HANDLE_VALUE_NOTI);
+		slot->tx_noti = NULL;
+	}
+	fifo8_init(&slot->contx_fifo, slot->contx_buf,
+		   slot->contx_blocks * CONPOOL_BLOCK);
+}
+
+// The console fifos of all links share one pool. A link takes
+// CONFIFO_BLOCKS each way when it comes up and gives them back when it
+// goes, a fifo that runs full moves to a run of CONFIFO_BLOCKS_MAX in one
+// step, first fit would leave holes too short for anything growing block
+// by block. Growing leaves enough behind for the links that are not up
+// yet.
+static uint8_t ConsolePoolMem[CONPOOL_BLOCKS * CONPOOL_BLOCK];
+static uint32_t ConsolePoolMap[POOL_MAP_WORDS(CONPOOL_BLOCKS)];
+struct pool ConsolePool;
+
+static void Console_Grow(struct fifo8 *f, uint8_t **buf, uint8_t *blocks)
+{
+	uint8_t *p;
+	if (*blocks >= CONFIFO_BLOCKS_MAX ||
+	    pool_free_blocks(&ConsolePool) <
+		    ble_peri_slots_free() * 2 * CONFIFO_BLOCKS +
+			    CONFIFO_BLOCKS_MAX) {
+		return;
+	}
+	p = pool_alloc(&ConsolePool, CONFIFO_BLOCKS_MAX);
+	if (p == NULL) {
+		return;
+	}
+	fifo8_move(f, p, CONFIFO_BLOCKS_MAX * CONPOOL_BLOCK);
+	pool_free(&ConsolePool, *buf, *blocks);
+	*buf = p;
+	*blocks = CONFIFO_BLOCKS_MAX;
+}
+
+int peripheralConsoleOpen(int slotp)
+{
+	struct ble_peri_slot *slot = &ble_peri_slots[slotp];
+	slot->conrx_buf = pool_alloc(&ConsolePool, CONFIFO_BLOCKS);
+	slot->contx_buf = pool_alloc(&ConsolePool, CONFIFO_BLOCKS);
+	if (slot->conrx_buf == NULL || slot->contx_buf == NULL) {
+		pool_free(&ConsolePool, slot->conrx_buf, CONFIFO_BLOCKS);
+		pool_free(&ConsolePool, slot->contx_buf, CONFIFO_BLOCKS);
+		slot->conrx_buf = NULL;
+		slot->contx_buf = NULL;
+		return -1;
+	}
+	slot->conrx_blocks = CONFIFO_BLOCKS;
+	slot->contx_blocks = CONFIFO_BLOCKS;
+	slot->tx_noti = NULL;
+	fifo8_init(&slot->conrx_fifo, slot->conrx_buf,
+		   CONFIFO_BLOCKS * CONPOOL_BLOCK);
+	fifo8_init(&slot->contx_fifo, slot->contx_buf,
+		   CONFIFO_BLOCKS * CONPOOL_BLOCK);
+	return 0;
+}
+
+void peripheralConsoleClose(int slotp)
+{
+	struct ble_peri_slot *slot = &ble_peri_slots[slotp];
+	Console_TxRelease(slotp);
+	pool_free(&ConsolePool, slot->conrx_buf, slot->conrx_blocks);
+	pool_free(&ConsolePool, slot->contx_buf, slot->contx_blocks);
+	slot->conrx_buf = NULL;
+	slot->contx_buf = NULL;
+	slot->conrx_blocks = 0;
+	slot->contx_blocks = 0;
+	fifo8_init(&slot->conrx_fifo, NULL, 0);
+	fifo8_init(&slot->contx_fifo, NULL, 0);
+}
+
+static uint32_t Console_CreditLimit(int slotp)
+{
+	struct ble_peri_slot *slot = &ble_peri_slots[slotp];
+	return slot->rx_accepted + fifo8_free(&slot->conrx_fifo);
+}
+
+// worth a notification once a step of room opened up, or all of it did
+int peripheralConsoleCreditDue(int slotp)
+{
+	struct ble_peri_slot *slot = &ble_peri_slots[slotp];
+	uint32_t owed = Console_CreditLimit(slotp) - slot->rx_granted;
+	if (owed == 0 || (GATTServApp_ReadCharCfg(slot->connHandle,
+						  ConsoleCtlConfig) &
+			  GATT_CLIENT_CFG_NOTIFY) == 0) {
+		return 0;
+	}
+	return owed >= CONRX_CREDIT_STEP ||
+	       fifo8_used(&slot->conrx_fifo) == 0;
+}
+
+static void Console_CtlValue(int slotp, uint8_t *p)
+{
+	struct ble_peri_slot *slot = &ble_peri_slots[slotp];
+	uint32_t v[3];
+	int i;
+	p[0] = fifo8_free(&slot->conrx_fifo);
+	p[1] = fifo8_free(&slot->contx_fifo);
+	v[0] = Console_CreditLimit(slotp);
+	v[1] = slot->rx_accepted;
+	v[2] = slot->rx_dropped;
+	for (i = 0; i < 12; i++) {
+		p[2 + i] = v[i / 4] >> (i % 4 * 8);
+	}
+	slot->rx_granted = v[0];
+}
+
+static bStatus_t Console_ReadAttr(uint16_t connHandle, gattAttribute_t *pAttr,
+				  uint8_t *pValue, uint16_t *pLen,
+				  uint16_t offset, uint16_t maxLen,
+				  uint8_t method)
 {
 	bStatus_t status = SUCCESS;
 	uint16_t uuid = BUILD_UINT16(pAttr->type.uuid[0], pAttr->type.uuid[1]);
@@ -125,10 +300,9 @@ static bStatus_t Console_ReadAttrCB(uint16_t connHandle, gattAttribute_t *pAttr,
 			status = ATT_ERR_ATTR_NOT_LONG;
 			return status;
 		}
-		*pLen = MIN(maxLen, fifo8_used(&ble_peri_slots[slotp].contx_fifo));
-		for (int i = 0; i < *pLen; i++) {
-			pValue[i] = fifo8_pop(&ble_peri_slots[slotp].contx_fifo);
-		}
+		*pLen = fifo8_pop_buf(&ble_peri_slots[slotp].contx_fifo,
+				      pValue, maxLen);
+		Console_Wake(slotp);
 		return status;
 	}
 
@@ -137,9 +311,12 @@ static bStatus_t Console_ReadAttrCB(uint16_t connHandle, gattAttribute_t *pAttr,
 			status = ATT_ERR_ATTR_NOT_LONG;
 			return status;
 		}
-		*pLen = 2;
-		pValue[0] = fifo8_free(&ble_peri_slots[slotp].conrx_fifo);
-		pValue[1] = fifo8_free(&ble_peri_slots[slotp].contx_fifo);
+		if (maxLen < CONSOLE_CTL_LEN) {
+			status = ATT_ERR_INVALID_VALUE_SIZE;
+			return status;
+		}
+		*pLen = CONSOLE_CTL_LEN;
+		Console_CtlValue(slotp, pValue);
 		return status;
 	}
 
@@ -149,10 +326,10 @@ static bStatus_t Console_ReadAttrCB(uint16_t connHandle, gattAttribute_t *pAttr,
 	return status;
 }
 
-static bStatus_t Console_WriteAttrCB(uint16_t connHandle,
-				     gattAttribute_t *pAttr, uint8_t *pValue,
-				     uint16_t len, uint16_t offset,
-				     uint8_t method)
+static bStatus_t Console_WriteAttr(uint16_t connHandle,
+				   gattAttribute_t *pAttr, uint8_t *pValue,
+				   uint16_t len, uint16_t offset,
+				   uint8_t method)
 {
 	bStatus_t status = SUCCESS;
 	uint16_t uuid = BUILD_UINT16(pAttr->type.uuid[0], pAttr->type.uuid[1]);
@@ -164,11 +341,25 @@ static bStatus_t Console_WriteAttrCB(uint16_t connHandle,
 		return ATT_ERR_INVALID_PDU;
 	}
 	if (uuid == CONSOLE_RNW_CHR_UUID) {
-		int i = 0;
-		while (len && fifo8_free(&ble_peri_slots[slotp].conrx_fifo)) {
-			fifo8_push(&ble_peri_slots[slotp].conrx_fifo, pValue[i]);
-			len--; i++;
+		struct ble_peri_slot *slot = &ble_peri_slots[slotp];
+		int n;
+		// a client writing past its credits loses the excess, it
+		// shows in the dropped count
+		if (len > fifo8_free(&slot->conrx_fifo)) {
+			Console_Grow(&slot->conrx_fifo, &slot->conrx_buf,
+				     &slot->conrx_blocks);
+		}
+		n = fifo8_push_buf(&slot->conrx_fifo, pValue, len);
+		slot->rx_accepted += n;
+		slot->rx_dropped += len - n;
+		// input piles up faster than it is read, more room means
+		// more credits
+		if (fifo8_free(&slot->conrx_fifo) < CONPOOL_BLOCK) {
+			Console_Grow(&slot->conrx_fifo, &slot->conrx_buf,
+				     &slot->conrx_blocks);
 		}
+		ble_peri_conn_activity(slotp);
+		Console_Wake(slotp);
 		return status;
 	}
 
@@ -176,6 +367,12 @@ static bStatus_t Console_WriteAttrCB(uint16_t connHandle,
 		status = GATTServApp_ProcessCCCWriteReq(connHandle, pAttr,
 							pValue, len, offset,
 							GATT_CLIENT_CFG_NOTIFY);
+		// flush what piled up while nobody listened, or hand out
+		// the first credits
+		if (status == SUCCESS) {
+			Console_TxArm(slotp);
+			ble_peri_console_tx_pending(slotp);
+		}
 		return status;
 	}
 
@@ -203,39 +400,131 @@ bStatus_t ConsoleRNW_Notify(uint16_t connHandle,
 	return bleIncorrectMode;
 }
 
-void peripheralConsoleRNWNotify(uint16_t connHandle)
+// Tell the client its new credit limit. Returns -1 if the stack had no
+// room for it, else 0.
+int peripheralConsoleCtlNotify(uint16_t connHandle)
+{
+	attHandleValueNoti_t noti;
+	bStatus_t status;
+	uint32_t granted;
+	int slotp;
+	slotp = ble_peri_slots_find_by_connHandle(connHandle);
+	if (slotp < 0 || !peripheralConsoleCreditDue(slotp)) {
+		return 0;
+	}
+	noti.len = CONSOLE_CTL_LEN;
+	noti.pValue = GATT_bm_alloc(connHandle, ATT_HANDLE_VALUE_NOTI, noti.len,
+				    NULL, 0);
+	if (noti.pValue == NULL) {
+		return -1;
+	}
+	// the limit only counts as granted once the stack took it
+	granted = ble_peri_slots[slotp].rx_granted;
+	Console_CtlValue(slotp, noti.pValue);
+	noti.handle = ConsoleAttrTbl[6].handle;
+	status = GATT_Notification(connHandle, &noti, FALSE);
+	if (status != SUCCESS) {
+		GATT_bm_free((gattMsg_t *)&noti, ATT_HANDLE_VALUE_NOTI);
+		ble_peri_slots[slotp].rx_granted = granted;
+	}
+	// out of buffers either way, the credit goes out on the retry
+	return status == blePending || status == MSG_BUFFER_NOT_AVAIL ? -1 : 0;
+}
+
+// Send what is in contx_fifo, the buffer under it in one go or the ring
+// in as many notifications as the stack takes. Returns -1 if bytes are
+// left because it ran out of buffers, else 0.
+int peripheralConsoleRNWNotify(uint16_t connHandle)
 {
 	uint16_t value =
 		GATTServApp_ReadCharCfg(connHandle, ConsoleRNWConfig);
 
 	// If notifications disable
 	if ((value & GATT_CLIENT_CFG_NOTIFY) == 0) {
-		return;
+		return 0;
 	}
 
 	int slotp;
 	slotp = ble_peri_slots_find_by_connHandle(connHandle);
 	if (slotp < 0) {
 		PERI_PANIC();
-		return;
+		return 0;
 	}
 
+	struct ble_peri_slot *slot = &ble_peri_slots[slotp];
 	attHandleValueNoti_t noti;
-	int used;
-	used = fifo8_used(&ble_peri_slots[slotp].contx_fifo);
-	noti.len = MIN((ATT_MTU_SIZE - 4), used);
-	if (noti.len == 0) {
-		return;
+	bStatus_t status = SUCCESS;
+	int payload, sent = 0;
+	if (slot->tx_noti && fifo8_used(&slot->contx_fifo)) {
+		// a client read may have left the bytes off the start
+		fifo8_compact(&slot->contx_fifo);
+		noti.pValue = slot->tx_noti;
+		noti.len = fifo8_used(&slot->contx_fifo);
+		status = ConsoleRNW_Notify(connHandle, &noti);
+		if (status == SUCCESS) {
+			// the stack owns and frees the buffer now
+			slot->tx_noti = NULL;
+			Console_TxRelease(slotp);
+			sent++;
+		}
 	}
-	noti.pValue = GATT_bm_alloc(connHandle, ATT_HANDLE_VALUE_NOTI, noti.len,
-				    NULL, 0);
-	int i;
-	for (i = 0; i < noti.len; i++) {
-		noti.pValue[i] = fifo8_pop(&ble_peri_slots[slotp].contx_fifo);
+	// Bytes leave the ring once the stack accepted them, a refused
+	// notification goes out again on the next try.
+	payload = Console_Payload(slot);
+	while (!slot->tx_noti &&
+	       (noti.len = MIN(payload, fifo8_used(&slot->contx_fifo)))) {
+		noti.pValue = GATT_bm_alloc(connHandle, ATT_HANDLE_VALUE_NOTI,
+					    noti.len, NULL, 0);
+		if (noti.pValue == NULL) {
+			status = MSG_BUFFER_NOT_AVAIL;
+			break;
+		}
+		fifo8_peek_buf(&slot->contx_fifo, noti.pValue, noti.len);
+		status = ConsoleRNW_Notify(connHandle, &noti);
+		if (status != SUCCESS) {
+			GATT_bm_free((gattMsg_t *)&noti, ATT_HANDLE_VALUE_NOTI);
+			break;
+		}
+		fifo8_drop(&slot->contx_fifo, noti.len);
+		sent++;
 	}
-	if (ConsoleRNW_Notify(connHandle, &noti) != SUCCESS) {
-		GATT_bm_free((gattMsg_t *)&noti, ATT_HANDLE_VALUE_NOTI);
+	// the stack is slower than the writers, give them more ring
+	if (!slot->tx_noti && fifo8_free(&slot->contx_fifo) == 0) {
+		Console_Grow(&slot->contx_fifo, &slot->contx_buf,
+			     &slot->contx_blocks);
+	}
+	Console_TxArm(slotp);
+	if (sent) {
+		Console_Wake(slotp);
+	}
+	if (status == blePending || status == MSG_BUFFER_NOT_AVAIL) {
+		return -1;
 	}
+	return 0;
+}
+
+static bStatus_t Console_ReadAttrCB(uint16_t connHandle, gattAttribute_t *pAttr,
+				    uint8_t *pValue, uint16_t *pLen,
+				    uint16_t offset, uint16_t maxLen,
+				    uint8_t method)
+{
+	uint32_t start = mcycle();
+	bStatus_t status = Console_ReadAttr(connHandle, pAttr, pValue, pLen,
+					    offset, maxLen, method);
+	prof_end(&PeriProf[PROF_CONSOLE_READ], start);
+	return status;
+}
+
+static bStatus_t Console_WriteAttrCB(uint16_t connHandle,
+				     gattAttribute_t *pAttr, uint8_t *pValue,
+				     uint16_t len, uint16_t offset,
+				     uint8_t method)
+{
+	uint32_t start = mcycle();
+	bStatus_t status = Console_WriteAttr(connHandle, pAttr, pValue, len,
+					     offset, method);
+	prof_end(&PeriProf[PROF_CONSOLE_WRITE], start);
+	return status;
 }
 
 static gattServiceCBs_t ConsoleCBs = {
@@ -245,7 +534,10 @@ static gattServiceCBs_t ConsoleCBs = {
 };
 
 bStatus_t GATT_AddConsole_Service(void) {
+	pool_init(&ConsolePool, ConsolePoolMem, ConsolePoolMap, CONPOOL_BLOCK,
+		  CONPOOL_BLOCKS);
 	GATTServApp_InitCharCfg(INVALID_CONNHANDLE, ConsoleRNWConfig);
+	GATTServApp_InitCharCfg(INVALID_CONNHANDLE, ConsoleCtlConfig);
 	return GATTServApp_RegisterService(ConsoleAttrTbl,
 				    GATT_NUM_ATTRS(ConsoleAttrTbl),
 				    GATT_MAX_ENCRYPT_KEY_SIZE, &ConsoleCBs);
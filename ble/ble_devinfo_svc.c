@@ -0,0 +1,90 @@
+#include "CH58x_common.h"
+#include "CH58xBLE_LIB.h"
+#include "CONFIG.h"
+#include "ble.h"
+
+// Device Information, only the PnP ID HOGP asks for: the vendor ID
+// source, vendor, product and version, little endian.
+enum {
+	DEVINFO_SVC_UUID = 0x180A,
+	DEVINFO_PNP_ID_CHR_UUID = 0x2A50,
+	DEVINFO_VENDOR_ID_USB = 0x02, // assigned by the USB-IF
+	DEVINFO_VENDOR_ID = 0x1A86, // WCH
+	DEVINFO_PRODUCT_ID = 0x0582,
+	DEVINFO_PRODUCT_VERSION = 0x0100,
+};
+
+static const uint8_t DevInfoSvcUUID[ATT_BT_UUID_SIZE] = {
+	LO_UINT16(DEVINFO_SVC_UUID), HI_UINT16(DEVINFO_SVC_UUID)
+};
+static const gattAttrType_t DevInfoSvc = { ATT_BT_UUID_SIZE, DevInfoSvcUUID };
+
+const uint8_t DevInfoPnpIdUUID[ATT_BT_UUID_SIZE] = {
+	LO_UINT16(DEVINFO_PNP_ID_CHR_UUID), HI_UINT16(DEVINFO_PNP_ID_CHR_UUID)
+};
+
+const static uint8_t DevInfoPnpIdProps = GATT_PROP_READ;
+
+const static uint8_t DevInfoPnpId[7] = {
+	DEVINFO_VENDOR_ID_USB,
+	LO_UINT16(DEVINFO_VENDOR_ID), HI_UINT16(DEVINFO_VENDOR_ID),
+	LO_UINT16(DEVINFO_PRODUCT_ID), HI_UINT16(DEVINFO_PRODUCT_ID),
+	LO_UINT16(DEVINFO_PRODUCT_VERSION), HI_UINT16(DEVINFO_PRODUCT_VERSION),
+};
+
+static gattAttribute_t DevInfoAttrTbl[] = {
+	// Device Information Service
+	{
+		{ ATT_BT_UUID_SIZE, primaryServiceUUID }, /* type */
+		GATT_PERMIT_READ, /* permissions */
+		0, /* handle */
+		(uint8_t *)&DevInfoSvc /* pValue */
+	},
+
+	// PnP ID
+	{
+		{ ATT_BT_UUID_SIZE, characterUUID },
+		GATT_PERMIT_READ,
+		0,
+		(uint8_t *)&DevInfoPnpIdProps
+	},
+	{
+		{ ATT_BT_UUID_SIZE, DevInfoPnpIdUUID },
+		GATT_PERMIT_READ,
+		0,
+		(uint8_t *)DevInfoPnpId,
+	},
+};
+
+static bStatus_t DevInfo_ReadAttr(uint16_t connHandle, gattAttribute_t *pAttr,
+				  uint8_t *pValue, uint16_t *pLen,
+				  uint16_t offset, uint16_t maxLen,
+				  uint8_t method)
+{
+	uint16_t uuid = BUILD_UINT16(pAttr->type.uuid[0], pAttr->type.uuid[1]);
+	if (uuid != DEVINFO_PNP_ID_CHR_UUID) {
+		PERI_DBG_PRINT("%s: Unhandle UUID: 0x%04X\n\r", __func__, uuid);
+		*pLen = 0;
+		return ATT_ERR_ATTR_NOT_FOUND;
+	}
+	if (offset != 0) {
+		return ATT_ERR_ATTR_NOT_LONG;
+	}
+	*pLen = MIN(maxLen, sizeof(DevInfoPnpId));
+	tmos_memcpy(pValue, DevInfoPnpId, *pLen);
+	return SUCCESS;
+}
+
+static gattServiceCBs_t DevInfoCBs = {
+	DevInfo_ReadAttr, // Read callback function pointer
+	NULL, // Write callback function pointer
+	NULL // Authorization callback function pointer
+};
+
+bStatus_t GATT_AddDevInfo_Service(void)
+{
+	return GATTServApp_RegisterService(DevInfoAttrTbl,
+					   GATT_NUM_ATTRS(DevInfoAttrTbl),
+					   GATT_MAX_ENCRYPT_KEY_SIZE,
+					   &DevInfoCBs);
+}
@@ -0,0 +1,431 @@
+#include "CH58x_common.h"
+#include "CH58xBLE_LIB.h"
+#include "CONFIG.h"
+#include "ble.h"
+
+enum {
+	HID_INFO_CHR_UUID = 0x2A4A,
+	HID_REPORT_MAP_CHR_UUID = 0x2A4B,
+	HID_CTL_POINT_CHR_UUID = 0x2A4C,
+	HID_REPORT_CHR_UUID = 0x2A4D,
+	HID_PROTOCOL_CHR_UUID = 0x2A4E,
+	HID_BOOT_IN_CHR_UUID = 0x2A22,
+	HID_BOOT_OUT_CHR_UUID = 0x2A32,
+	HID_REPORT_REF_UUID = 0x2908,
+	HID_REPORT_TYPE_INPUT = 1,
+	HID_REPORT_TYPE_OUTPUT = 2,
+	// C does not name array entries, the values notified by hand
+	HID_REPORT_IN_IDX = 10,
+	HID_REPORT_OUT_IDX = 14,
+	HID_BOOT_IN_IDX = 17,
+};
+
+static const uint8_t HidSvcUUID[ATT_BT_UUID_SIZE] = {
+	LO_UINT16(HID_SVC_UUID), HI_UINT16(HID_SVC_UUID)
+};
+static const gattAttrType_t HidSvc = { ATT_BT_UUID_SIZE, HidSvcUUID };
+
+const uint8_t HidInfoUUID[ATT_BT_UUID_SIZE] = {
+	LO_UINT16(HID_INFO_CHR_UUID), HI_UINT16(HID_INFO_CHR_UUID)
+};
+const uint8_t HidReportMapUUID[ATT_BT_UUID_SIZE] = {
+	LO_UINT16(HID_REPORT_MAP_CHR_UUID), HI_UINT16(HID_REPORT_MAP_CHR_UUID)
+};
+const uint8_t HidCtlPointUUID[ATT_BT_UUID_SIZE] = {
+	LO_UINT16(HID_CTL_POINT_CHR_UUID), HI_UINT16(HID_CTL_POINT_CHR_UUID)
+};
+const uint8_t HidReportUUID[ATT_BT_UUID_SIZE] = {
+	LO_UINT16(HID_REPORT_CHR_UUID), HI_UINT16(HID_REPORT_CHR_UUID)
+};
+const uint8_t HidProtocolUUID[ATT_BT_UUID_SIZE] = {
+	LO_UINT16(HID_PROTOCOL_CHR_UUID), HI_UINT16(HID_PROTOCOL_CHR_UUID)
+};
+const uint8_t HidBootInUUID[ATT_BT_UUID_SIZE] = {
+	LO_UINT16(HID_BOOT_IN_CHR_UUID), HI_UINT16(HID_BOOT_IN_CHR_UUID)
+};
+const uint8_t HidBootOutUUID[ATT_BT_UUID_SIZE] = {
+	LO_UINT16(HID_BOOT_OUT_CHR_UUID), HI_UINT16(HID_BOOT_OUT_CHR_UUID)
+};
+const uint8_t HidReportRefUUID[ATT_BT_UUID_SIZE] = {
+	LO_UINT16(HID_REPORT_REF_UUID), HI_UINT16(HID_REPORT_REF_UUID)
+};
+
+// HID 1.11, no country, wakes the host and is normally connectable
+const static uint8_t HidInfo[4] = { 0x11, 0x01, 0x00, 0x03 };
+
+// The boot keyboard report, so the report protocol sends the same eight
+// bytes the boot one does and one encoding serves both. No report IDs.
+const static uint8_t HidReportMap[] = {
+	0x05, 0x01, // Usage Page (Generic Desktop)
+	0x09, 0x06, // Usage (Keyboard)
+	0xA1, 0x01, // Collection (Application)
+	0x05, 0x07, //   Usage Page (Keyboard)
+	0x19, 0xE0, //   Usage Minimum (LeftControl)
+	0x29, 0xE7, //   Usage Maximum (RightGUI)
+	0x15, 0x00, //   Logical Minimum (0)
+	0x25, 0x01, //   Logical Maximum (1)
+	0x75, 0x01, //   Report Size (1)
+	0x95, 0x08, //   Report Count (8)
+	0x81, 0x02, //   Input (Data, Variable, Absolute), modifiers
+	0x95, 0x01, //   Report Count (1)
+	0x75, 0x08, //   Report Size (8)
+	0x81, 0x01, //   Input (Constant), reserved
+	0x95, 0x05, //   Report Count (5)
+	0x75, 0x01, //   Report Size (1)
+	0x05, 0x08, //   Usage Page (LEDs)
+	0x19, 0x01, //   Usage Minimum (NumLock)
+	0x29, 0x05, //   Usage Maximum (Kana)
+	0x91, 0x02, //   Output (Data, Variable, Absolute), LEDs
+	0x95, 0x01, //   Report Count (1)
+	0x75, 0x03, //   Report Size (3)
+	0x91, 0x01, //   Output (Constant), padding
+	0x95, 0x06, //   Report Count (6)
+	0x75, 0x08, //   Report Size (8)
+	0x15, 0x00, //   Logical Minimum (0)
+	0x25, 0x65, //   Logical Maximum (101)
+	0x05, 0x07, //   Usage Page (Keyboard)
+	0x19, 0x00, //   Usage Minimum (0)
+	0x29, 0x65, //   Usage Maximum (Application)
+	0x81, 0x00, //   Input (Data, Array), keys
+	0xC0, // End Collection
+};
+
+const static uint8_t HidReportInRef[2] = { 0, HID_REPORT_TYPE_INPUT };
+const static uint8_t HidReportOutRef[2] = { 0, HID_REPORT_TYPE_OUTPUT };
+
+const static uint8_t HidReadProps = GATT_PROP_READ;
+const static uint8_t HidCtlPointProps = GATT_PROP_WRITE_NO_RSP;
+const static uint8_t HidRWProps =
+	GATT_PROP_READ | GATT_PROP_WRITE | GATT_PROP_WRITE_NO_RSP;
+const static uint8_t HidProtocolProps = GATT_PROP_READ | GATT_PROP_WRITE_NO_RSP;
+const static uint8_t HidInProps = GATT_PROP_READ | GATT_PROP_NOTIFY;
+
+static gattCharCfg_t HidReportInConfig[PERIPHERAL_MAX_CONNECTION];
+static gattCharCfg_t HidBootInConfig[PERIPHERAL_MAX_CONNECTION];
+
+// Reports, their CCCDs, the report map and the mode want an encrypted
+// link as HOGP asks, the bond manager pairs when the host requests it.
+static gattAttribute_t HidAttrTbl[] = {
+	// HID Service
+	{
+		{ ATT_BT_UUID_SIZE, primaryServiceUUID }, /* type */
+		GATT_PERMIT_READ, /* permissions */
+		0, /* handle */
+		(uint8_t *)&HidSvc /* pValue */
+	},
+
+	// HID Information
+	{
+		{ ATT_BT_UUID_SIZE, characterUUID },
+		GATT_PERMIT_READ,
+		0,
+		(uint8_t *)&HidReadProps
+	},
+	{
+		{ ATT_BT_UUID_SIZE, HidInfoUUID },
+		GATT_PERMIT_READ,
+		0,
+		(uint8_t *)HidInfo,
+	},
+
+	// HID Control Point
+	{
+		{ ATT_BT_UUID_SIZE, characterUUID },
+		GATT_PERMIT_READ,
+		0,
+		(uint8_t *)&HidCtlPointProps
+	},
+	{
+		{ ATT_BT_UUID_SIZE, HidCtlPointUUID },
+		GATT_PERMIT_ENCRYPT_WRITE,
+		0,
+		NULL,
+	},
+
+	// Protocol Mode
+	{
+		{ ATT_BT_UUID_SIZE, characterUUID },
+		GATT_PERMIT_READ,
+		0,
+		(uint8_t *)&HidProtocolProps
+	},
+	{
+		{ ATT_BT_UUID_SIZE, HidProtocolUUID },
+		GATT_PERMIT_ENCRYPT_READ | GATT_PERMIT_ENCRYPT_WRITE,
+		0,
+		NULL,
+	},
+
+	// Report Map
+	{
+		{ ATT_BT_UUID_SIZE, characterUUID },
+		GATT_PERMIT_READ,
+		0,
+		(uint8_t *)&HidReadProps
+	},
+	{
+		{ ATT_BT_UUID_SIZE, HidReportMapUUID },
+		GATT_PERMIT_ENCRYPT_READ,
+		0,
+		(uint8_t *)HidReportMap,
+	},
+
+	// Input Report, HID_REPORT_IN_IDX
+	{
+		{ ATT_BT_UUID_SIZE, characterUUID },
+		GATT_PERMIT_READ,
+		0,
+		(uint8_t *)&HidInProps
+	},
+	{
+		{ ATT_BT_UUID_SIZE, HidReportUUID },
+		GATT_PERMIT_ENCRYPT_READ,
+		0,
+		NULL,
+	},
+	{
+		{ ATT_BT_UUID_SIZE, clientCharCfgUUID },
+		GATT_PERMIT_ENCRYPT_READ | GATT_PERMIT_ENCRYPT_WRITE,
+		0,
+		(uint8_t *)HidReportInConfig,
+	},
+	{
+		{ ATT_BT_UUID_SIZE, HidReportRefUUID },
+		GATT_PERMIT_READ,
+		0,
+		(uint8_t *)HidReportInRef,
+	},
+
+	// Output Report, HID_REPORT_OUT_IDX, the LEDs
+	{
+		{ ATT_BT_UUID_SIZE, characterUUID },
+		GATT_PERMIT_READ,
+		0,
+		(uint8_t *)&HidRWProps
+	},
+	{
+		{ ATT_BT_UUID_SIZE, HidReportUUID },
+		GATT_PERMIT_ENCRYPT_READ | GATT_PERMIT_ENCRYPT_WRITE,
+		0,
+		NULL,
+	},
+	{
+		{ ATT_BT_UUID_SIZE, HidReportRefUUID },
+		GATT_PERMIT_READ,
+		0,
+		(uint8_t *)HidReportOutRef,
+	},
+
+	// Boot Keyboard Input Report, HID_BOOT_IN_IDX
+	{
+		{ ATT_BT_UUID_SIZE, characterUUID },
+		GATT_PERMIT_READ,
+		0,
+		(uint8_t *)&HidInProps
+	},
+	{
+		{ ATT_BT_UUID_SIZE, HidBootInUUID },
+		GATT_PERMIT_ENCRYPT_READ,
+		0,
+		NULL,
+	},
+	{
+		{ ATT_BT_UUID_SIZE, clientCharCfgUUID },
+		GATT_PERMIT_ENCRYPT_READ | GATT_PERMIT_ENCRYPT_WRITE,
+		0,
+		(uint8_t *)HidBootInConfig,
+	},
+
+	// Boot Keyboard Output Report
+	{
+		{ ATT_BT_UUID_SIZE, characterUUID },
+		GATT_PERMIT_READ,
+		0,
+		(uint8_t *)&HidRWProps
+	},
+	{
+		{ ATT_BT_UUID_SIZE, HidBootOutUUID },
+		GATT_PERMIT_ENCRYPT_READ | GATT_PERMIT_ENCRYPT_WRITE,
+		0,
+		NULL,
+	},
+};
+
+extern struct ble_peri_slot ble_peri_slots[PERIPHERAL_MAX_CONNECTION];
+
+static bStatus_t Hid_ReadAttr(uint16_t connHandle, gattAttribute_t *pAttr,
+			      uint8_t *pValue, uint16_t *pLen,
+			      uint16_t offset, uint16_t maxLen, uint8_t method)
+{
+	uint16_t uuid = BUILD_UINT16(pAttr->type.uuid[0], pAttr->type.uuid[1]);
+	const uint8_t *value;
+	uint16_t len;
+	int slotp;
+	slotp = ble_peri_slots_find_by_connHandle(connHandle);
+	if (slotp < 0) {
+		PERI_PANIC();
+		return ATT_ERR_INVALID_PDU;
+	}
+
+	struct ble_peri_slot *slot = &ble_peri_slots[slotp];
+	switch (uuid) {
+	case HID_REPORT_MAP_CHR_UUID:
+		// the only long one
+		if (offset > sizeof(HidReportMap)) {
+			return ATT_ERR_INVALID_OFFSET;
+		}
+		*pLen = MIN(maxLen, sizeof(HidReportMap) - offset);
+		tmos_memcpy(pValue, &HidReportMap[offset], *pLen);
+		return SUCCESS;
+	case HID_INFO_CHR_UUID:
+		value = HidInfo;
+		len = sizeof(HidInfo);
+		break;
+	case HID_REPORT_REF_UUID:
+		value = pAttr->pValue;
+		len = 2;
+		break;
+	case HID_PROTOCOL_CHR_UUID:
+		value = &slot->hid_protocol;
+		len = 1;
+		break;
+	case HID_REPORT_CHR_UUID:
+		if (pAttr == &HidAttrTbl[HID_REPORT_OUT_IDX]) {
+			value = &slot->hid_leds;
+			len = 1;
+			break;
+		}
+		// fall through
+	case HID_BOOT_IN_CHR_UUID:
+		value = slot->hid_sent;
+		len = KEYMAP_REPORT_LEN;
+		break;
+	case HID_BOOT_OUT_CHR_UUID:
+		value = &slot->hid_leds;
+		len = 1;
+		break;
+	default:
+		PERI_DBG_PRINT("%s: Unhandle UUID: 0x%04X\n\r", __func__, uuid);
+		*pLen = 0;
+		return ATT_ERR_ATTR_NOT_FOUND;
+	}
+	if (offset != 0) {
+		return ATT_ERR_ATTR_NOT_LONG;
+	}
+	*pLen = MIN(maxLen, len);
+	tmos_memcpy(pValue, value, *pLen);
+	return SUCCESS;
+}
+
+static bStatus_t Hid_WriteAttr(uint16_t connHandle, gattAttribute_t *pAttr,
+			       uint8_t *pValue, uint16_t len, uint16_t offset,
+			       uint8_t method)
+{
+	bStatus_t status = SUCCESS;
+	uint16_t uuid = BUILD_UINT16(pAttr->type.uuid[0], pAttr->type.uuid[1]);
+	int slotp;
+	slotp = ble_peri_slots_find_by_connHandle(connHandle);
+	if (slotp < 0) {
+		PERI_PANIC();
+		return ATT_ERR_INVALID_PDU;
+	}
+
+	struct ble_peri_slot *slot = &ble_peri_slots[slotp];
+	if (uuid == GATT_CLIENT_CHAR_CFG_UUID) {
+		status = GATTServApp_ProcessCCCWriteReq(connHandle, pAttr,
+							pValue, len, offset,
+							GATT_CLIENT_CFG_NOTIFY);
+		// the keys held go out to a new listener
+		if (status == SUCCESS) {
+			ble_peri_hid_pending();
+		}
+		return status;
+	}
+	if (offset != 0) {
+		return ATT_ERR_ATTR_NOT_LONG;
+	}
+	if (len != 1) {
+		return ATT_ERR_INVALID_VALUE_SIZE;
+	}
+
+	switch (uuid) {
+	case HID_PROTOCOL_CHR_UUID:
+		if (pValue[0] > HID_PROTOCOL_REPORT) {
+			return ATT_ERR_INVALID_VALUE;
+		}
+		// the other input starts from no keys
+		if (slot->hid_protocol != pValue[0]) {
+			slot->hid_protocol = pValue[0];
+			memset(slot->hid_sent, 0, sizeof(slot->hid_sent));
+			ble_peri_hid_pending();
+		}
+		return status;
+	case HID_CTL_POINT_CHR_UUID:
+		// suspend and exit suspend, nothing here sleeps differently
+		if (pValue[0] > 1) {
+			return ATT_ERR_INVALID_VALUE;
+		}
+		return status;
+	case HID_REPORT_CHR_UUID:
+		if (pAttr != &HidAttrTbl[HID_REPORT_OUT_IDX]) {
+			return ATT_ERR_WRITE_NOT_PERMITTED;
+		}
+		// fall through
+	case HID_BOOT_OUT_CHR_UUID:
+		slot->hid_leds = pValue[0];
+		return status;
+	}
+
+	PERI_DBG_PRINT("%s: Unhandle UUID: 0x%04X\n\r", __func__, uuid);
+	return ATT_ERR_ATTR_NOT_FOUND;
+}
+
+// Queue report on the input of the protocol the link runs. The stack
+// takes a buffer per notification, so the one encoding is copied into
+// each. Returns 1 if sent, 0 if nobody listens there and -1 if the
+// stack had no room.
+int peripheralHidNotify(int slotp, const uint8_t *report)
+{
+	struct ble_peri_slot *slot = &ble_peri_slots[slotp];
+	gattCharCfg_t *cfg = HidReportInConfig;
+	attHandleValueNoti_t noti;
+	bStatus_t status;
+	int idx = HID_REPORT_IN_IDX;
+	if (slot->hid_protocol == HID_PROTOCOL_BOOT) {
+		cfg = HidBootInConfig;
+		idx = HID_BOOT_IN_IDX;
+	}
+	if ((GATTServApp_ReadCharCfg(slot->connHandle, cfg) &
+	     GATT_CLIENT_CFG_NOTIFY) == 0) {
+		return 0;
+	}
+	noti.len = KEYMAP_REPORT_LEN;
+	noti.pValue = GATT_bm_alloc(slot->connHandle, ATT_HANDLE_VALUE_NOTI,
+				    noti.len, NULL, 0);
+	if (noti.pValue == NULL) {
+		return -1;
+	}
+	tmos_memcpy(noti.pValue, report, noti.len);
+	noti.handle = HidAttrTbl[idx].handle;
+	status = GATT_Notification(slot->connHandle, &noti, FALSE);
+	if (status != SUCCESS) {
+		GATT_bm_free((gattMsg_t *)&noti, ATT_HANDLE_VALUE_NOTI);
+		return status == blePending ? -1 : 0;
+	}
+	return 1;
+}
+
+static gattServiceCBs_t HidCBs = {
+	Hid_ReadAttr, // Read callback function pointer
+	Hid_WriteAttr, // Write callback function pointer
+	NULL // Authorization callback function pointer
+};
+
+bStatus_t GATT_AddHid_Service(void)
+{
+	GATTServApp_InitCharCfg(INVALID_CONNHANDLE, HidReportInConfig);
+	GATTServApp_InitCharCfg(INVALID_CONNHANDLE, HidBootInConfig);
+	return GATTServApp_RegisterService(HidAttrTbl,
+					   GATT_NUM_ATTRS(HidAttrTbl),
+					   GATT_MAX_ENCRYPT_KEY_SIZE, &HidCBs);
+}
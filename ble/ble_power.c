@@ -0,0 +1,248 @@
+#include "CH58xBLE_LIB.h"
+#include "CONFIG.h"
+#include "HAL.h"
+#include "uart1.h"
+#include "ble.h"
+
+// Power manager, in place of the SDK's HAL/SLEEP.c. The stack calls
+// CH58X_LowPower() from its idle loop with the RTC time to wake at, which
+// leaves WAKE_UP_RTC_MAX_TIME before its next deadline for the 32MHz
+// crystal to settle. The gap picks the state: too short and the stack
+// keeps spinning, then idle with the clocks on, halt, and sleep with only
+// the RAM and the RTC kept. Time in each state and how long a wake-up
+// takes to get back to the stack are counted in RTC cycles.
+
+#if CLK_OSC32K == 1
+#define POWER_RTC_HZ 32000
+#else
+#define POWER_RTC_HZ 32768
+#endif
+
+// not worth an RTC trigger below, in RTC cycles to the deadline
+#define POWER_IDLE_MIN 30
+// halt below, sleep from here on
+#define POWER_SLEEP_MIN (SLEEP_RTC_MIN_TIME * 4)
+// battery level runs linearly over VDD in mV, two alkaline or one
+// lithium cell
+#define POWER_BATTERY_EMPTY 2000
+#define POWER_BATTERY_FULL 3000
+// UART1 receives only with the clocks on, stay in idle this long after
+// the last byte came in, in RTC cycles
+#define POWER_UART_AWAKE (POWER_RTC_HZ * 5)
+
+extern struct stimer_list peri_timers;
+
+// sleep is off until a central writes 1 to the sysinfo power value
+struct power_stats PowerStats = {
+	.enabled = 0,
+};
+
+// RTC cycles from a to b, the counter wraps at RTC_TIMER_MAX_VALUE
+static uint32_t power_since(uint32_t a, uint32_t b)
+{
+	if (b >= a) {
+		return b - a;
+	}
+	return b + (RTC_TIMER_MAX_VALUE - a);
+}
+
+static uint32_t power_after(uint32_t a, uint32_t cycles)
+{
+	a += cycles;
+	if (a >= RTC_TIMER_MAX_VALUE) {
+		a -= RTC_TIMER_MAX_VALUE;
+	}
+	return a;
+}
+
+static void power_account(int state, uint32_t rtc)
+{
+	PowerStats.rtc[state] += power_since(PowerStats.stamp, rtc);
+	PowerStats.stamp = rtc;
+}
+
+// from the trigger to back in the stack, late when past the deadline
+static void power_wake(uint32_t trigger, uint32_t deadline, uint32_t rtc)
+{
+	struct power_stats *ps = &PowerStats;
+	uint32_t wake = power_since(trigger, rtc);
+	ps->wake_last = wake;
+	if (wake > ps->wake_worst) {
+		ps->wake_worst = wake;
+	}
+	if (wake > power_since(trigger, deadline)) {
+		ps->late++;
+	}
+}
+
+// 0 after a low power state, 2 when the gap was too short or too long,
+// 3 when the trigger fired before the CPU could stop
+__HIGH_CODE
+uint32_t CH58X_LowPower(uint32_t time)
+{
+	struct power_stats *ps = &PowerStats;
+	uint32_t irq_status, rtc, gap, trigger, deadline;
+	int state, woke;
+	SYS_DisableAllIrq(&irq_status);
+	rtc = RTC_GetCycle32k();
+	deadline = power_after(time, WAKE_UP_RTC_MAX_TIME);
+	gap = power_since(rtc, deadline);
+	if (!ps->enabled || gap < POWER_IDLE_MIN || gap > SLEEP_RTC_MAX_TIME) {
+		SYS_RecoverIrq(irq_status);
+		return 2;
+	}
+	gap -= MIN(gap, WAKE_UP_RTC_MAX_TIME);
+	if (gap < SLEEP_RTC_MIN_TIME || uart1_pending() ||
+	    power_since(Uart1Rx.last, rtc) < POWER_UART_AWAKE) {
+		// the crystal keeps running, wake right at the deadline, and
+		// UART1 keeps sending what is queued and receiving
+		state = POWER_IDLE;
+		trigger = deadline;
+	} else {
+		state = gap < POWER_SLEEP_MIN ? POWER_HALT : POWER_SLEEP;
+		trigger = time;
+	}
+	RTC_SetTignTime(trigger);
+	SYS_RecoverIrq(irq_status);
+#if defined(__riscv) && defined(DEBUG)
+	if (state != POWER_IDLE) {
+		while ((R8_UART1_LSR & RB_LSR_TX_ALL_EMP) == 0) {
+			__nop();
+		}
+	}
+#endif
+	if (RTCTigFlag) {
+		return 3;
+	}
+	power_account(POWER_RUN, rtc);
+	ps->entries[state]++;
+	ps->last = state;
+	if (state == POWER_IDLE) {
+		LowPower_Idle();
+		woke = RTCTigFlag;
+	} else {
+		if (state == POWER_HALT) {
+			LowPower_Halt();
+		} else {
+			LowPower_Sleep(RB_PWR_RAM2K | RB_PWR_RAM30K |
+				       RB_PWR_EXTEND);
+		}
+		// woken by the RTC, the crystal settles until the deadline
+		// unless its start-up already took longer than that
+		woke = RTCTigFlag;
+		if (woke) {
+			gap = power_since(RTC_GetCycle32k(), deadline);
+			if (gap && gap <= WAKE_UP_RTC_MAX_TIME) {
+				RTC_SetTignTime(deadline);
+				LowPower_Idle();
+			}
+		} else {
+			// a key woke it early and already had its scan, the
+			// stack only runs on the settled crystal
+			RTC_SetTignTime(power_after(RTC_GetCycle32k(),
+						    WAKE_UP_RTC_MAX_TIME));
+			LowPower_Idle();
+		}
+		HSECFG_Current(HSE_RCur_100);
+	}
+	rtc = RTC_GetCycle32k();
+	power_account(state, rtc);
+	if (woke) {
+		power_wake(trigger, deadline, rtc);
+	}
+	return 0;
+}
+
+void HAL_SleepInit(void)
+{
+#ifdef __riscv
+	R8_SAFE_ACCESS_SIG = SAFE_ACCESS_SIG1;
+	R8_SAFE_ACCESS_SIG = SAFE_ACCESS_SIG2;
+	R8_SLP_WAKE_CTRL |= RB_SLP_RTC_WAKE;
+	R8_SAFE_ACCESS_SIG = SAFE_ACCESS_SIG1;
+	R8_SAFE_ACCESS_SIG = SAFE_ACCESS_SIG2;
+	R8_RTC_MODE_CTRL |= RB_RTC_TRIG_EN;
+	R8_SAFE_ACCESS_SIG = 0;
+	PFIC_EnableIRQ(RTC_IRQn);
+#endif
+	PowerStats.stamp = RTC_GetCycle32k();
+}
+
+// VDD on the ADC's internal channel at -12dB, which reads
+// (adc / 512 - 3) * 1.05V, then as a percentage. The ADC is powered
+// only for the conversion.
+uint8_t peripheralBatteryLevel(void)
+{
+	int mv;
+	ADC_InterBATSampInit();
+	mv = ((int)ADC_ExcutSingleConver() - 3 * 512) * 1050 / 512;
+#ifdef __riscv
+	R8_ADC_CFG &= ~RB_ADC_POWER_ON;
+#endif
+	if (mv <= POWER_BATTERY_EMPTY) {
+		return 0;
+	}
+	if (mv >= POWER_BATTERY_FULL) {
+		return 100;
+	}
+	return (mv - POWER_BATTERY_EMPTY) * 100 /
+	       (POWER_BATTERY_FULL - POWER_BATTERY_EMPTY);
+}
+
+void peripheralPowerEnable(int on)
+{
+	PowerStats.enabled = !!on;
+}
+
+static uint32_t power_ms(uint64_t cycles)
+{
+	return cycles * 1000 / POWER_RTC_HZ;
+}
+
+static uint16_t power_us(uint32_t cycles)
+{
+	return MIN((uint64_t)cycles * 1000000 / POWER_RTC_HZ, 0xffff);
+}
+
+// u8 enabled and last state, u32 little endian ms in run, idle, halt
+// and sleep, then u16 worst and last wake-up in us and the late count,
+// then u32 soft timer wakeups and timer runs, the batching the timers
+// get on the air. Run time includes the stretch since the last state
+// change.
+int peripheralPowerValue(uint8_t *p)
+{
+	struct power_stats *ps = &PowerStats;
+	uint16_t v[] = {
+		power_us(ps->wake_worst), power_us(ps->wake_last),
+		MIN(ps->late, 0xffff),
+	};
+	uint32_t t[] = { peri_timers.wakeups, peri_timers.runs };
+	uint32_t ms;
+	int i;
+	p[0] = ps->enabled;
+	p[1] = ps->last;
+	for (i = 0; i < POWER_STATES; i++) {
+		if (i == POWER_RUN) {
+			ms = power_ms(ps->rtc[i] + power_since(ps->stamp,
+							     RTC_GetCycle32k()));
+		} else {
+			ms = power_ms(ps->rtc[i]);
+		}
+		p[2 + i * 4] = ms;
+		p[3 + i * 4] = ms >> 8;
+		p[4 + i * 4] = ms >> 16;
+		p[5 + i * 4] = ms >> 24;
+	}
+	for (i = 0; i < sizeof(v) / sizeof(v[0]); i++) {
+		p[2 + POWER_STATES * 4 + i * 2] = LO_UINT16(v[i]);
+		p[3 + POWER_STATES * 4 + i * 2] = HI_UINT16(v[i]);
+	}
+	p += 2 + POWER_STATES * 4 + sizeof(v);
+	for (i = 0; i < sizeof(t) / sizeof(t[0]); i++) {
+		p[i * 4] = t[i];
+		p[1 + i * 4] = t[i] >> 8;
+		p[2 + i * 4] = t[i] >> 16;
+		p[3 + i * 4] = t[i] >> 24;
+	}
+	return 2 + POWER_STATES * 4 + sizeof(v) + sizeof(t);
+}
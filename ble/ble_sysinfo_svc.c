@@ -8,9 +8,18 @@ enum {
 	CHIPNAME_R_CHR_UUID = 0xFFE1,
 	SYSCLOCK_RN_CHR_UUID = 0xFFE2,
 	CHIPUID_R_CHR_UUID = 0xFFE3,
+	CONNPARAM_R_CHR_UUID = 0xFFE4,
+	CONNPARAM_LEN = 16,
+	POWER_RW_CHR_UUID = 0xFFE5,
+	PERF_RW_CHR_UUID = 0xFFE6,
 };
 
 extern uint8_t chip_uid[8];
+extern void peripheralPeriodicStart(uint16_t connHandle);
+extern struct ble_peri_slot ble_peri_slots[PERIPHERAL_MAX_CONNECTION];
+extern struct prof_site PeriProf[PROF_SITES];
+extern int peripheralPowerValue(uint8_t *p);
+extern void peripheralPowerEnable(int on);
 
 static const uint8_t SysInfoSvcUUID[ATT_BT_UUID_SIZE] = {
 	LO_UINT16(SYSINFO_SVC_UUID), HI_UINT16(SYSINFO_SVC_UUID)
@@ -35,11 +44,44 @@ const static uint8_t SysInfoChipUidProps = GATT_PROP_READ;
 
 static uint8_t SysInfoChipUidUserDesp[] = "chip uid\0";
 
+const uint8_t SysInfoConnParamUUID[ATT_BT_UUID_SIZE] = {
+	LO_UINT16(CONNPARAM_R_CHR_UUID), HI_UINT16(CONNPARAM_R_CHR_UUID)
+};
+
+const static uint8_t SysInfoConnParamProps = GATT_PROP_READ;
+
+static uint8_t SysInfoConnParamUserDesp[] =
+	"profile backoff interval latency timeout requests rejected "
+	"to_active to_idle\0";
+
+const uint8_t SysInfoPowerUUID[ATT_BT_UUID_SIZE] = {
+	LO_UINT16(POWER_RW_CHR_UUID), HI_UINT16(POWER_RW_CHR_UUID)
+};
+
+const static uint8_t SysInfoPowerProps = GATT_PROP_READ | GATT_PROP_WRITE;
+
+static uint8_t SysInfoPowerUserDesp[] =
+	"enabled state run_ms idle_ms halt_ms sleep_ms wake_worst_us "
+	"wake_last_us late, write 0/1 to switch\0";
+
+const uint8_t SysInfoPerfUUID[ATT_BT_UUID_SIZE] = {
+	LO_UINT16(PERF_RW_CHR_UUID), HI_UINT16(PERF_RW_CHR_UUID)
+};
+
+const static uint8_t SysInfoPerfProps = GATT_PROP_READ | GATT_PROP_WRITE;
+
+static uint8_t SysInfoPerfUserDesp[] =
+	"handler cycle profile, long read, write 0 to clear\0";
+
+// snapshot taken when a long read starts at offset 0
+_Static_assert(PROF_VALUE_LEN <= 512, "perf table over an attribute");
+static uint8_t SysInfoPerfValue[PROF_VALUE_LEN];
+
 gattAttribute_t SysInfoAttrTbl[] = {
 	// System Information Service
 	{
 		{ ATT_BT_UUID_SIZE, primaryServiceUUID }, /* type */
-		GATT_PERMIT_READ | GATT_PERMIT_WRITE, /* permissions */
+		GATT_PERMIT_READ, /* permissions */
 		0, /* handle */
 		(uint8_t *)&SysInfoSvc /* pValue */
 	},
@@ -99,12 +141,115 @@ gattAttribute_t SysInfoAttrTbl[] = {
 		0,
 		SysInfoChipUidUserDesp,
 	},
+
+	// Connection Parameters Declaration
+	{
+		{ ATT_BT_UUID_SIZE, characterUUID },
+		GATT_PERMIT_READ,
+		0,
+		(uint8_t *)&SysInfoConnParamProps
+	},
+
+	// Connection Parameters Value
+	{
+		{ ATT_BT_UUID_SIZE, SysInfoConnParamUUID },
+		GATT_PERMIT_READ,
+		0,
+		NULL,
+	},
+
+	// Connection Parameters User Description
+	{
+		{ ATT_BT_UUID_SIZE, charUserDescUUID },
+		GATT_PERMIT_READ,
+		0,
+		SysInfoConnParamUserDesp,
+	},
+
+	// Power Manager Declaration
+	{
+		{ ATT_BT_UUID_SIZE, characterUUID },
+		GATT_PERMIT_READ,
+		0,
+		(uint8_t *)&SysInfoPowerProps
+	},
+
+	// Power Manager Value
+	{
+		{ ATT_BT_UUID_SIZE, SysInfoPowerUUID },
+		GATT_PERMIT_ENCRYPT_READ | GATT_PERMIT_ENCRYPT_WRITE,
+		0,
+		NULL,
+	},
+
+	// Power Manager User Description
+	{
+		{ ATT_BT_UUID_SIZE, charUserDescUUID },
+		GATT_PERMIT_READ,
+		0,
+		SysInfoPowerUserDesp,
+	},
+
+	// Handler Profile Declaration
+	{
+		{ ATT_BT_UUID_SIZE, characterUUID },
+		GATT_PERMIT_READ,
+		0,
+		(uint8_t *)&SysInfoPerfProps
+	},
+
+	// Handler Profile Value
+	{
+		{ ATT_BT_UUID_SIZE, SysInfoPerfUUID },
+		GATT_PERMIT_ENCRYPT_READ | GATT_PERMIT_ENCRYPT_WRITE,
+		0,
+		NULL,
+	},
+
+	// Handler Profile User Description
+	{
+		{ ATT_BT_UUID_SIZE, charUserDescUUID },
+		GATT_PERMIT_READ,
+		0,
+		SysInfoPerfUserDesp,
+	},
 };
 
-static bStatus_t SysInfo_ReadAttrCB(uint16_t connHandle, gattAttribute_t *pAttr,
-				    uint8_t *pValue, uint16_t *pLen,
-				    uint16_t offset, uint16_t maxLen,
-				    uint8_t method)
+// The reading link's own parameter manager state, u8 profile and
+// refusals in a row, then u16 little endian interval, latency, timeout
+// and the requests, rejected, to_active, to_idle counters.
+static void SysInfo_ConnParamValue(int slotp, uint8_t *p)
+{
+	struct ble_peri_slot *slot = &ble_peri_slots[slotp];
+	uint16_t v[] = {
+		slot->conn_interval, slot->cp.latency, slot->cp.timeout,
+		slot->cp.requests, slot->cp.rejected, slot->cp.to_active,
+		slot->cp.to_idle,
+	};
+	int i;
+	p[0] = slot->cp.profile;
+	p[1] = slot->cp.rejects;
+	for (i = 0; i < sizeof(v) / sizeof(v[0]); i++) {
+		p[2 + i * 2] = LO_UINT16(v[i]);
+		p[3 + i * 2] = HI_UINT16(v[i]);
+	}
+}
+
+// u8 sites, buckets, the log2 cycles bucket 0 ends at and cycles per
+// us, then the sites in enum order as prof_encode() lays them out
+static void SysInfo_PerfValue(uint8_t *p)
+{
+	p[0] = PROF_SITES;
+	p[1] = PROF_BUCKETS;
+	p[2] = PROF_SHIFT;
+	p[3] = MCYCLE_PER_US;
+	prof_encode(PeriProf, PROF_SITES, p + 4);
+}
+
+static bStatus_t SysInfo_ReadAttr(uint16_t connHandle, gattAttribute_t *pAttr,
+				  uint8_t *pValue, uint16_t *pLen,
+				  uint16_t offset, uint16_t maxLen,
+				  uint8_t method)
 {
 	bStatus_t status = SUCCESS;
 	uint16_t uuid = BUILD_UINT16(pAttr->type.uuid[0], pAttr->type.uuid[1]);
@@ -119,6 +264,45 @@ static bStatus_t SysInfo_ReadAttrCB(uint16_t connHandle, gattAttribute_t *pAttr,
 		return status;
 	}
 
+	if (uuid == CONNPARAM_R_CHR_UUID) {
+		uint8_t value[CONNPARAM_LEN];
+		int slotp = ble_peri_slots_find_by_connHandle(connHandle);
+		if (slotp < 0) {
+			PERI_PANIC();
+			return ATT_ERR_INVALID_PDU;
+		}
+		if (offset != 0) {
+			return ATT_ERR_ATTR_NOT_LONG;
+		}
+		SysInfo_ConnParamValue(slotp, value);
+		*pLen = MIN(maxLen, sizeof(value));
+		tmos_memcpy(pValue, value, *pLen);
+		return status;
+	}
+
+	if (uuid == POWER_RW_CHR_UUID) {
+		uint8_t value[POWER_VALUE_LEN];
+		if (offset != 0) {
+			return ATT_ERR_ATTR_NOT_LONG;
+		}
+		*pLen = MIN(maxLen, peripheralPowerValue(value));
+		tmos_memcpy(pValue, value, *pLen);
+		return status;
+	}
+
+	// the table is larger than an MTU, clients read it in chunks
+	if (uuid == PERF_RW_CHR_UUID) {
+		if (offset > sizeof(SysInfoPerfValue)) {
+			return ATT_ERR_INVALID_OFFSET;
+		}
+		if (offset == 0) {
+			SysInfo_PerfValue(SysInfoPerfValue);
+		}
+		*pLen = MIN(maxLen, sizeof(SysInfoPerfValue) - offset);
+		tmos_memcpy(pValue, &SysInfoPerfValue[offset], *pLen);
+		return status;
+	}
+
 	if (uuid == CHIPUID_R_CHR_UUID) {
 		// check offset
 		if (offset >= sizeof(chip_uid)) {
@@ -138,10 +322,10 @@ static bStatus_t SysInfo_ReadAttrCB(uint16_t connHandle, gattAttribute_t *pAttr,
 	return status;
 }
 
-static bStatus_t SysInfo_WriteAttrCB(uint16_t connHandle,
-				     gattAttribute_t *pAttr, uint8_t *pValue,
-				     uint16_t len, uint16_t offset,
-				     uint8_t method)
+static bStatus_t SysInfo_WriteAttr(uint16_t connHandle,
+				   gattAttribute_t *pAttr, uint8_t *pValue,
+				   uint16_t len, uint16_t offset,
+				   uint8_t method)
 {
 	bStatus_t status = SUCCESS;
 	uint16_t uuid = BUILD_UINT16(pAttr->type.uuid[0], pAttr->type.uuid[1]);
@@ -157,6 +341,30 @@ static bStatus_t SysInfo_WriteAttrCB(uint16_t connHandle,
 		status = GATTServApp_ProcessCCCWriteReq(connHandle, pAttr,
 							pValue, len, offset,
 							GATT_CLIENT_CFG_NOTIFY);
+		// the periodic task stops while the clock is not listened to
+		if (status == SUCCESS) {
+			peripheralPeriodicStart(connHandle);
+		}
+		return status;
+	}
+
+	// one byte, 0 keeps the CPU awake between events
+	if (uuid == POWER_RW_CHR_UUID) {
+		if (offset != 0 || len != 1) {
+			return ATT_ERR_INVALID_VALUE_SIZE;
+		}
+		peripheralPowerEnable(pValue[0]);
+		return status;
+	}
+
+	if (uuid == PERF_RW_CHR_UUID) {
+		if (offset != 0 || len != 1) {
+			return ATT_ERR_INVALID_VALUE_SIZE;
+		}
+		if (pValue[0] != 0) {
+			return ATT_ERR_INVALID_VALUE;
+		}
+		prof_reset(PeriProf, PROF_SITES);
 		return status;
 	}
 
@@ -184,14 +392,15 @@ bStatus_t SysInfoSysClock_Notify(uint16_t connHandle,
 	return bleIncorrectMode;
 }
 
-void peripheralSysInfoSysClockNotify(uint16_t connHandle)
+// returns 0 when the notifications are off
+int peripheralSysInfoSysClockNotify(uint16_t connHandle)
 {
 	uint16_t value =
 		GATTServApp_ReadCharCfg(connHandle, SysInfoSysClockConfig);
 
 	// If notifications disable
 	if ((value & GATT_CLIENT_CFG_NOTIFY) == 0) {
-		return;
+		return 0;
 	}
 
 	attHandleValueNoti_t noti;
@@ -204,6 +413,31 @@ void peripheralSysInfoSysClockNotify(uint16_t connHandle)
 	if (SysInfoSysClock_Notify(connHandle, &noti) != SUCCESS) {
 		GATT_bm_free((gattMsg_t *)&noti, ATT_HANDLE_VALUE_NOTI);
 	}
+	return 1;
+}
+
+static bStatus_t SysInfo_ReadAttrCB(uint16_t connHandle, gattAttribute_t *pAttr,
+				    uint8_t *pValue, uint16_t *pLen,
+				    uint16_t offset, uint16_t maxLen,
+				    uint8_t method)
+{
+	uint32_t start = mcycle();
+	bStatus_t status = SysInfo_ReadAttr(connHandle, pAttr, pValue, pLen,
+					    offset, maxLen, method);
+	prof_end(&PeriProf[PROF_SYSINFO_READ], start);
+	return status;
+}
+
+static bStatus_t SysInfo_WriteAttrCB(uint16_t connHandle,
+				     gattAttribute_t *pAttr, uint8_t *pValue,
+				     uint16_t len, uint16_t offset,
+				     uint8_t method)
+{
+	uint32_t start = mcycle();
+	bStatus_t status = SysInfo_WriteAttr(connHandle, pAttr, pValue, len,
+					     offset, method);
+	prof_end(&PeriProf[PROF_SYSINFO_WRITE], start);
+	return status;
 }
 
 static gattServiceCBs_t SysInfoCBs = {
@@ -0,0 +1,72 @@
+#include "CH58xBLE_LIB.h"
+#include "CONFIG.h"
+#include "uart1.h"
+#include "ble.h"
+#include "fifo8.h"
+#include "sf_outer.h"
+#include "sf_sched.h"
+
+// The wired console, the same outer interpreter a link's console runs
+// but on UART1. Its machine sits in the scheduler next to the slots' and
+// runs in the same SBP_FORTH_EVT passes. The fifos are its own rather
+// than from the console pool, the cable does not come and go. Input is
+// moved over from the UART1 receive ring before a pass, output into the
+// transmit ring after it, a fifo at a time rather than per byte.
+
+struct uart_console UartConsole;
+
+void peripheralUartConsoleInit(void (*wake)(void))
+{
+	struct uart_console *c = &UartConsole;
+	memset(c, 0, sizeof(*c));
+	fifo8_init(&c->conrx_fifo, c->conrx_buf, sizeof(c->conrx_buf));
+	fifo8_init(&c->contx_fifo, c->contx_buf, sizeof(c->contx_buf));
+	c->sfm.task_addr = &c->sft;
+	c->sfm.rx = &c->conrx_fifo;
+	c->sfm.tx = &c->contx_fifo;
+	c->sfm.outer = &c->sfo;
+	sf_task_reset(&c->sft);
+	sf_outer_reset(&c->sfm);
+	// left off rather than taking input nothing would read
+	if (sf_sched_add(&c->sfm) < 0) {
+		PERI_DBG_PRINT("uart console: no room to schedule it\n\r");
+		return;
+	}
+	uart1_rx_start(wake);
+}
+
+void peripheralUartConsoleIn(void)
+{
+	struct uart_console *c = &UartConsole;
+	uint8_t buf[CONPOOL_BLOCK * 2];
+	int n;
+	while ((n = MIN(fifo8_free(&c->conrx_fifo), sizeof(buf))) > 0 &&
+	       (n = uart1_read(buf, n)) > 0) {
+		fifo8_push_buf(&c->conrx_fifo, buf, n);
+		c->rx_bytes += n;
+	}
+}
+
+// Returns the bytes left over while the UART1 ring is full, they keep
+// the machine waiting on room rather than pushing out older output.
+// Input still in the receive ring asks for another pass as well, once
+// the sender is paused no interrupt would come for it.
+int peripheralUartConsoleOut(void)
+{
+	struct uart_console *c = &UartConsole;
+	uint8_t *p;
+	int n, len;
+	while ((len = fifo8_peek_contig(&c->contx_fifo, &p)) > 0) {
+		n = uart1_write(p, MIN(len, uart1_free()));
+		fifo8_drop(&c->contx_fifo, n);
+		c->tx_bytes += n;
+		if (n < len) {
+			break;
+		}
+	}
+	if (sf_outer_ready(&c->sfm) ||
+	    (uart1_readable() && fifo8_free(&c->conrx_fifo))) {
+		sf_sched_wake();
+	}
+	return fifo8_used(&c->contx_fifo);
+}
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <string.h>
+#include "sf_bench.h"
+#include "sf_outer.h"
+#include "mcycle.h"
+
+// Forth VM benchmark suite. Each program is compiled from source by the
+// outer interpreter as a console user would and then timed on a private
+// machine straight through stepforth(). The stacks are painted before a
+// run and scanned after it for the high-water marks. Runs on the host
+// build and on the target, which prints it on the debug UART when built
+// with SF_BENCH=1. It resets the dictionary, so it runs before the
+// consoles are up.
+
+#define SF_BENCH_PAINT ((sf_cell)0x5aa5c33c)
+
+enum {
+	SF_BENCH_FLAGS = 1000,
+	SF_BENCH_STR = 256,
+	SF_BENCH_KEYS = 128,
+	SF_BENCH_ECHO = 512,
+	SF_BENCH_FIFO = 128,
+};
+
+// every program defines "bench" and leaves one cell
+static const struct {
+	const char *name;
+	const char *src;
+} sf_bench_progs[SF_BENCH_NUM] = {
+	{ "fib",
+	  ": fib dup 2 < if exit then dup 1- recurse swap 2 - recurse + ;\n"
+	  ": bench 0 50 0 do 12 fib + loop ;\n" },
+	{ "sieve",
+	  ": sieve 1000 2 do 1 flags i + c! loop 0 1000 2 do flags i + c@ if\n"
+	  "1+ i dup + begin dup 1000 < while 0 over flags + c! i + repeat drop\n"
+	  "then loop ;\n"
+	  ": bench sieve ;\n" },
+	{ "strcmp",
+	  ": scmp 0 do over i + c@ over i + c@ - dup if nip nip unloop exit\n"
+	  "then drop loop drop drop 0 ;\n"
+	  ": bench 0 100 0 do sa sb 256 scmp + loop ;\n" },
+	{ "echo",
+	  ": bench 0 begin key dup emit while 1+ repeat ;\n" },
+	{ "keymap",
+	  ": bench 0 4096 0 do i 3 rshift 7 and 4 lshift i 15 and + keymap +\n"
+	  "c@ + loop ;\n" },
+};
+
+static uint8_t sf_bench_flags[SF_BENCH_FLAGS];
+static uint8_t sf_bench_sa[SF_BENCH_STR], sf_bench_sb[SF_BENCH_STR];
+static uint8_t sf_bench_keymap[SF_BENCH_KEYS];
+static sf_cell sf_bench_expect[SF_BENCH_NUM];
+
+static struct sf_task sf_bench_task;
+static struct sf_outer sf_bench_outer;
+static uint8_t sf_bench_rx_buf[SF_BENCH_FIFO], sf_bench_tx_buf[SF_BENCH_FIFO];
+static struct fifo8 sf_bench_rx, sf_bench_tx;
+static struct sf_machine sf_bench_m = {
+	.task_addr = &sf_bench_task,
+	.rx = &sf_bench_rx,
+	.tx = &sf_bench_tx,
+	.outer = &sf_bench_outer,
+};
+
+static void sf_bench_const(const char *name, void *p) {
+	sf_dict_define(name, strlen(name), SF_W_CONST, (sf_cell)p);
+}
+
+static void sf_bench_setup(void) {
+	sf_cell sum = 0;
+	int i;
+
+	memset(sf_bench_sa, 'a', sizeof(sf_bench_sa));
+	memset(sf_bench_sb, 'a', sizeof(sf_bench_sb));
+	sf_bench_sa[SF_BENCH_STR - 1] = 'b';
+	for (i = 0; i < SF_BENCH_KEYS; i++) {
+		sf_bench_keymap[i] = i * 7 + 3;
+	}
+	for (i = 0; i < 4096; i++) {
+		sum += sf_bench_keymap[(i >> 3 & 7) << 4 | (i & 15)];
+	}
+	sf_bench_expect[0] = 50 * 144;
+	sf_bench_expect[1] = 168;
+	sf_bench_expect[2] = 100;
+	sf_bench_expect[3] = SF_BENCH_ECHO;
+	sf_bench_expect[4] = sum;
+
+	sf_dict_reset();
+	sf_bench_const("flags", sf_bench_flags);
+	sf_bench_const("sa", sf_bench_sa);
+	sf_bench_const("sb", sf_bench_sb);
+	sf_bench_const("keymap", sf_bench_keymap);
+	fifo8_init(&sf_bench_rx, sf_bench_rx_buf, SF_BENCH_FIFO);
+	fifo8_init(&sf_bench_tx, sf_bench_tx_buf, SF_BENCH_FIFO);
+	sf_task_reset(&sf_bench_task);
+	sf_outer_reset(&sf_bench_m);
+}
+
+// feed the source through the outer interpreter, which must answer
+// nothing but " ok"
+static int sf_bench_compile(struct sf_machine *m, const char *src) {
+	static const char ok[] = " ok\n";
+	int len = strlen(src), pos = 0, k = 0, bad = 0;
+
+	while (pos < len || sf_outer_ready(m)) {
+		pos += fifo8_push_buf(m->rx, (const uint8_t *)src + pos,
+				      len - pos);
+		sf_outer_step(m, 64);
+		while (fifo8_used(m->tx)) {
+			bad |= fifo8_pop(m->tx) != ok[k];
+			k = (k + 1) % 4;
+		}
+	}
+	return !bad && k == 0;
+}
+
+static void sf_bench_paint(sf_cell *p, int n) {
+	while (n--) {
+		*p++ = SF_BENCH_PAINT;
+	}
+}
+
+// cells from the base down to the deepest one written
+static int sf_bench_depth(const sf_cell *p, int n, int base) {
+	int i;
+
+	for (i = 0; i < n && p[i] == SF_BENCH_PAINT; i++)
+		;
+	return i < base ? base - i : 0;
+}
+
+// one timed run of xt, echo programs get their input fed and their
+// output checked on the way
+static int sf_bench_time(struct sf_machine *m, sf_cell xt, int echo,
+			 struct sf_bench_result *r, sf_cell *x) {
+	struct sf_task *t = m->task_addr;
+	sf_cell exec[2] = { xt, SF_OP_EXIT };
+	int in = 0, out = 0, bad = 0, n, c;
+	uint32_t start;
+
+	sf_task_reset(t);
+	sf_bench_paint(t->ps, sizeof(t->ps) / sizeof(t->ps[0]));
+	sf_bench_paint(t->rs, sizeof(t->rs) / sizeof(t->rs[0]));
+	fifo8_reset(m->rx);
+	fifo8_reset(m->tx);
+	sf_task_start(t, exec);
+	r->steps = 0;
+	r->cycles = 0;
+	while (t->state != SF_HALT) {
+		while (echo && in <= SF_BENCH_ECHO && fifo8_free(m->rx)) {
+			fifo8_push(m->rx, in < SF_BENCH_ECHO ? in % 255 + 1 : 0);
+			in++;
+		}
+		start = mcycle();
+		n = stepforth(m, SF_BENCH_CHUNK);
+		r->cycles += mcycle() - start;
+		r->steps += n;
+		while (fifo8_used(m->tx)) {
+			c = fifo8_pop(m->tx);
+			bad |= c != (out < SF_BENCH_ECHO ? out % 255 + 1 : 0);
+			out++;
+		}
+		if (n == 0) {
+			break;
+		}
+	}
+	r->ps_max = sf_bench_depth(t->ps, SF_STACK_GUARD + SF_PS_SIZE,
+				   SF_STACK_GUARD + SF_PS_SIZE);
+	r->rs_max = sf_bench_depth(t->rs, SF_STACK_GUARD + SF_RS_SIZE,
+				   SF_STACK_GUARD + SF_RS_SIZE);
+	if (t->state != SF_HALT || t->err || bad ||
+	    (echo && out != SF_BENCH_ECHO + 1) || sf_task_depth(t) != 1) {
+		return 0;
+	}
+	*x = sf_task_pop(t);
+	return 1;
+}
+
+// Run every program runs times, fill r[SF_BENCH_NUM] and return how many
+// failed.
+int sf_bench_run(struct sf_bench_result *r, int runs) {
+	struct sf_machine *m = &sf_bench_m;
+	struct sf_bench_result one;
+	struct sf_word w;
+	int i, k, failed = 0;
+	sf_cell x;
+
+	sf_bench_setup();
+	for (i = 0; i < SF_BENCH_NUM; i++) {
+		memset(&r[i], 0, sizeof(r[i]));
+		r[i].name = sf_bench_progs[i].name;
+		sf_task_reset(m->task_addr);
+		if (!sf_bench_compile(m, sf_bench_progs[i].src) ||
+		    !sf_dict_find("bench", 5, &w) || w.kind != SF_W_COLON) {
+			failed++;
+			continue;
+		}
+		r[i].ok = 1;
+		for (k = 0; k < runs; k++) {
+			if (!sf_bench_time(m, w.value, i == 3, &one, &x) ||
+			    x != sf_bench_expect[i]) {
+				r[i].ok = 0;
+				break;
+			}
+			if (k == 0 || one.cycles < r[i].cycles) {
+				r[i].cycles = one.cycles;
+			}
+			r[i].steps = one.steps;
+			r[i].ps_max = one.ps_max;
+			r[i].rs_max = one.rs_max;
+		}
+		failed += !r[i].ok;
+	}
+	sf_dict_reset();
+	return failed;
+}
+
+int sf_bench_format(const struct sf_bench_result *r, char *buf, int size) {
+	uint32_t per = 0, kps = 0;
+
+	if (r->steps && r->cycles) {
+		per = (uint64_t)r->cycles * 100 / r->steps;
+		kps = (uint64_t)r->steps * MCYCLE_PER_US * 1000 / r->cycles;
+	}
+	return snprintf(buf, size,
+			"%-7s %8lu prims %6lu kprim/s %3lu.%02lu cyc/disp "
+			"ps %2u rs %2u%s\n",
+			r->name, (unsigned long)r->steps, (unsigned long)kps,
+			(unsigned long)per / 100, (unsigned long)per % 100,
+			r->ps_max, r->rs_max, r->ok ? "" : " FAIL");
+}
@@ -0,0 +1,25 @@
+#ifndef _SF_BENCH_H_
+#define _SF_BENCH_H_
+
+#include <stdint.h>
+#include "stepforth.h"
+
+enum {
+	SF_BENCH_NUM = 5,
+	SF_BENCH_CHUNK = 1024, // primitives per stepforth() call
+	SF_BENCH_LINE = 80, // sf_bench_format() output, with the newline
+};
+
+struct sf_bench_result {
+	const char *name;
+	uint32_t steps; // primitives dispatched, the same on every run
+	uint32_t cycles; // mcycle inside stepforth(), best of the runs
+	uint8_t ps_max; // stack high-water marks in cells
+	uint8_t rs_max;
+	uint8_t ok; // compiled and gave the expected answer
+};
+
+int sf_bench_run(struct sf_bench_result *r, int runs);
+int sf_bench_format(const struct sf_bench_result *r, char *buf, int size);
+
+#endif
@@ -0,0 +1,175 @@
+#include <string.h>
+#include "sf_dict.h"
+#include "sf_dict_rom.h"
+
+// Word lookup. Built-in words live in the generated perfect hash table in
+// flash, user words in a chained hash in RAM that is searched first so a
+// definition can shadow a built-in. Chains are pushed at the head, the
+// latest definition of a name wins.
+
+struct sf_uword {
+	uint16_t next; // 1 based index of the next word in the chain
+	uint16_t name;
+	uint16_t code; // thread start or constant cell in sf_dict_code
+	uint8_t len;
+	uint8_t kind;
+};
+
+_Static_assert((SF_DICT_HASH & (SF_DICT_HASH - 1)) == 0,
+	       "SF_DICT_HASH is not a power of two");
+
+static struct sf_uword uwords[SF_DICT_WORDS];
+static uint16_t uwords_num;
+static uint16_t uhash[SF_DICT_HASH];
+static char names[SF_DICT_NAMES];
+static uint16_t names_used;
+static sf_cell code[SF_DICT_CODE];
+static uint16_t here;
+
+// flash threads for the COLON words of SF_WORDS
+static const sf_cell sf_colon_dot[] = {
+	SF_OP_DUP, SF_OP_ZLT, SF_OP_ZBRANCH, 5, SF_OP_LIT, '-', SF_OP_EMIT,
+	SF_OP_NEGATE,
+	// push digits least significant first above a -1 sentinel
+	SF_OP_LIT, -1, SF_OP_SWAP, SF_OP_DUP, SF_OP_LIT, 10, SF_OP_MOD,
+	SF_OP_SWAP, SF_OP_LIT, 10, SF_OP_DIV, SF_OP_DUP, SF_OP_ZEQ,
+	SF_OP_ZBRANCH, -11, SF_OP_DROP,
+	// and emit them back until the sentinel shows up
+	SF_OP_DUP, SF_OP_ZLT, SF_OP_ZEQ, SF_OP_ZBRANCH, 7, SF_OP_LIT, '0',
+	SF_OP_ADD, SF_OP_EMIT, SF_OP_BRANCH, -10, SF_OP_DROP, SF_OP_LIT, ' ',
+	SF_OP_EMIT, SF_OP_EXIT,
+};
+
+static const sf_cell sf_colon_cr[] = {
+	SF_OP_LIT, '\n', SF_OP_EMIT, SF_OP_EXIT,
+};
+
+static const sf_cell sf_colon_space[] = {
+	SF_OP_LIT, ' ', SF_OP_EMIT, SF_OP_EXIT,
+};
+
+static const sf_cell *const sf_colon_rom[] = {
+	[SF_COLON_DOT] = sf_colon_dot,
+	[SF_COLON_CR] = sf_colon_cr,
+	[SF_COLON_SPACE] = sf_colon_space,
+};
+
+void sf_dict_reset(void) {
+	uwords_num = 0;
+	names_used = 0;
+	here = 0;
+	memset(uhash, 0, sizeof(uhash));
+}
+
+static int sf_dict_find_rom(const char *name, int len, struct sf_word *w) {
+	const struct sf_rom_word *r;
+	uint32_t b;
+
+	b = sf_hash(name, len, 0) & (SF_DICT_ROM_BUCKETS - 1);
+	r = &sf_dict_rom[sf_hash(name, len, sf_dict_rom_disp[b]) &
+			 (SF_DICT_ROM_SIZE - 1)];
+	if (r->len != len || memcmp(r->name, name, len) != 0) {
+		return 0;
+	}
+	w->kind = r->kind;
+	w->value = r->value;
+	if (r->kind == SF_W_COLON) {
+		w->value = (sf_cell)sf_colon_rom[r->value];
+	}
+	return 1;
+}
+
+int sf_dict_find(const char *name, int len, struct sf_word *w) {
+	struct sf_uword *u;
+	uint16_t i;
+
+	i = uhash[sf_hash(name, len, 0) & (SF_DICT_HASH - 1)];
+	for (; i; i = u->next) {
+		u = &uwords[i - 1];
+		if (u->len == len && memcmp(&names[u->name], name, len) == 0) {
+			w->kind = u->kind;
+			if (u->kind == SF_W_CONST) {
+				w->value = code[u->code];
+			} else {
+				w->value = (sf_cell)&code[u->code];
+			}
+			return 1;
+		}
+	}
+	return sf_dict_find_rom(name, len, w);
+}
+
+// COLON values must point into the code space, CONST values take a cell
+// of it. Returns -1 when the dictionary is full.
+int sf_dict_define(const char *name, int len, int kind, sf_cell value) {
+	struct sf_uword *u;
+	uint32_t b;
+
+	if (len > SF_NAME_MAX || uwords_num >= SF_DICT_WORDS ||
+	    names_used + len > SF_DICT_NAMES) {
+		return -1;
+	}
+	u = &uwords[uwords_num];
+	if (kind == SF_W_CONST) {
+		u->code = here;
+		if (sf_dict_comma(value) < 0) {
+			return -1;
+		}
+	} else {
+		u->code = (sf_cell *)value - code;
+	}
+	u->kind = kind;
+	u->len = len;
+	u->name = names_used;
+	memcpy(&names[names_used], name, len);
+	names_used += len;
+	b = sf_hash(name, len, 0) & (SF_DICT_HASH - 1);
+	u->next = uhash[b];
+	uhash[b] = ++uwords_num;
+	return 0;
+}
+
+sf_cell *sf_dict_here(void) {
+	return &code[here];
+}
+
+int sf_dict_comma(sf_cell x) {
+	if (here >= SF_DICT_CODE) {
+		return -1;
+	}
+	code[here++] = x;
+	return 0;
+}
+
+int sf_dict_room(void) {
+	return SF_DICT_CODE - here;
+}
+
+// drop whatever was compiled since here was p, for an aborted definition
+void sf_dict_rollback(sf_cell *p) {
+	here = p - code;
+}
+
+// thread of the latest word and its length in cells, if it is a colon
+// definition and nothing was compiled after it
+int sf_dict_last(sf_cell **thread) {
+	struct sf_uword *u;
+
+	if (uwords_num == 0) {
+		return 0;
+	}
+	u = &uwords[uwords_num - 1];
+	if (u->kind != SF_W_COLON) {
+		return 0;
+	}
+	*thread = &code[u->code];
+	return here - u->code;
+}
+
+void sf_dict_retarget_last(sf_cell *thread) {
+	uwords[uwords_num - 1].code = thread - code;
+}
+
+int sf_dict_words(void) {
+	return uwords_num;
+}
@@ -0,0 +1,106 @@
+#ifndef _SF_DICT_H_
+#define _SF_DICT_H_
+
+#include <stdint.h>
+#include "stepforth.h"
+
+// Built-in words besides the primitives, X(kind, id, name). IMM words are
+// handled by the outer interpreter, COLON words are threads in flash.
+#define SF_WORDS(X)                   \
+	X(IMM, COLON, ":")            \
+	X(IMM, SEMICOLON, ";")        \
+	X(IMM, RECURSE, "recurse")    \
+	X(IMM, IF, "if")              \
+	X(IMM, ELSE, "else")          \
+	X(IMM, THEN, "then")          \
+	X(IMM, BEGIN, "begin")        \
+	X(IMM, UNTIL, "until")        \
+	X(IMM, AGAIN, "again")        \
+	X(IMM, WHILE, "while")        \
+	X(IMM, REPEAT, "repeat")      \
+	X(IMM, DO, "do")              \
+	X(IMM, LOOP, "loop")          \
+	X(IMM, PLOOP, "+loop")        \
+	X(IMM, VARIABLE, "variable")  \
+	X(IMM, CONSTANT, "constant")  \
+	X(IMM, TICK, "'")             \
+	X(IMM, PAREN, "(")            \
+	X(IMM, BACKSLASH, "\\")       \
+	X(IMM, NATIVE, "native")      \
+	X(COLON, DOT, ".")            \
+	X(COLON, CR, "cr")            \
+	X(COLON, SPACE, "space")
+
+enum sf_word_kind {
+	SF_W_PRIM = 0, // value is the opcode
+	SF_W_COLON, // value is the thread address
+	SF_W_CONST, // value is pushed, variables are constants of their cell
+	SF_W_IMM, // value is an sf_builtin
+};
+
+enum sf_builtin {
+#define SF_BUILTIN_ENUM(kind, id, name) SF_##kind##_##id,
+	SF_WORDS(SF_BUILTIN_ENUM)
+#undef SF_BUILTIN_ENUM
+};
+
+enum {
+	SF_NAME_MAX = 31,
+};
+
+// RAM overlay for user words, shared by all machines. Sized for a
+// keyboard's consoles, the host build defines a few hundred words and
+// passes larger ones.
+#ifndef SF_DICT_WORDS
+#define SF_DICT_WORDS 64
+#endif
+#ifndef SF_DICT_HASH
+#define SF_DICT_HASH 32 // buckets, a power of two
+#endif
+#ifndef SF_DICT_NAMES
+#define SF_DICT_NAMES 512 // bytes
+#endif
+#ifndef SF_DICT_CODE
+#define SF_DICT_CODE 256 // cells
+#endif
+
+struct sf_word {
+	uint8_t kind;
+	sf_cell value;
+};
+
+// flash table entry, written by forth/sf_dictgen.c
+struct sf_rom_word {
+	const char *name;
+	uint8_t len;
+	uint8_t kind;
+	int16_t value;
+};
+
+// FNV-1a with a final mix so the low bits are usable as table index, the
+// generator and the lookup must agree on it
+static inline uint32_t sf_hash(const char *s, int len, uint32_t seed) {
+	uint32_t h = 2166136261u ^ seed;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		h = (h ^ (uint8_t)s[i]) * 16777619u;
+	}
+	h ^= h >> 15;
+	h *= 0x2c1b3c6du;
+	h ^= h >> 12;
+	return h;
+}
+
+void sf_dict_reset(void);
+int sf_dict_find(const char *name, int len, struct sf_word *w);
+int sf_dict_define(const char *name, int len, int kind, sf_cell value);
+sf_cell *sf_dict_here(void);
+int sf_dict_comma(sf_cell x);
+int sf_dict_room(void);
+void sf_dict_rollback(sf_cell *here);
+int sf_dict_last(sf_cell **thread);
+void sf_dict_retarget_last(sf_cell *thread);
+int sf_dict_words(void);
+
+#endif
@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sf_dict.h"
+
+// Build time generator for the flash dictionary. Runs on the build host
+// and prints forth/sf_dict_rom.h: a minimal-ish perfect hash over all
+// built-in names using hash and displace. A name is first hashed into a
+// bucket, each bucket stores the seed that places all of its names into
+// free slots, so a lookup is two hashes and one compare.
+
+enum {
+	GEN_MAX = 256,
+	GEN_SEED_MAX = 65535,
+};
+
+struct gen_word {
+	const char *name;
+	const char *kind;
+	const char *value;
+	int bucket;
+};
+
+static struct gen_word words[GEN_MAX];
+static int words_num;
+static int slot_of[GEN_MAX * 2];
+static uint16_t disp[GEN_MAX];
+static int order[GEN_MAX];
+static int bucket_size[GEN_MAX];
+static int size, buckets;
+
+static void add(const char *name, const char *kind, const char *value) {
+	int i;
+
+	for (i = 0; i < words_num; i++) {
+		if (strcmp(words[i].name, name) == 0) {
+			fprintf(stderr, "sf_dictgen: duplicate word %s\n", name);
+			exit(1);
+		}
+	}
+	words[words_num].name = name;
+	words[words_num].kind = kind;
+	words[words_num].value = value;
+	words_num++;
+}
+
+static int cmp_bucket(const void *a, const void *b) {
+	return bucket_size[*(const int *)b] - bucket_size[*(const int *)a];
+}
+
+static int place(int b, uint32_t seed) {
+	int i, j, n = 0, slots[GEN_MAX];
+
+	for (i = 0; i < words_num; i++) {
+		if (words[i].bucket != b) {
+			continue;
+		}
+		slots[n] = sf_hash(words[i].name, strlen(words[i].name),
+				   seed) & (size - 1);
+		if (slot_of[slots[n]] >= 0) {
+			return 0;
+		}
+		for (j = 0; j < n; j++) {
+			if (slots[j] == slots[n]) {
+				return 0;
+			}
+		}
+		n++;
+	}
+	n = 0;
+	for (i = 0; i < words_num; i++) {
+		if (words[i].bucket == b) {
+			slot_of[slots[n++]] = i;
+		}
+	}
+	return 1;
+}
+
+static void print_name(const char *s) {
+	putchar('"');
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') {
+			putchar('\\');
+		}
+		putchar(*s);
+	}
+	putchar('"');
+}
+
+int main(void) {
+	int i, b;
+	uint32_t seed;
+
+#define GEN_PRIM(op, name) add(name, "SF_W_PRIM", "SF_OP_" #op);
+	SF_PRIMITIVES(GEN_PRIM)
+#undef GEN_PRIM
+#define GEN_WORD(kind, id, name) add(name, "SF_W_" #kind, "SF_" #kind "_" #id);
+	SF_WORDS(GEN_WORD)
+#undef GEN_WORD
+
+	// keeping the table at most two thirds full keeps the seed search short
+	for (size = 1; size < words_num * 3 / 2; size <<= 1)
+		;
+	buckets = size / 4;
+	for (i = 0; i < words_num; i++) {
+		words[i].bucket = sf_hash(words[i].name, strlen(words[i].name),
+					  0) & (buckets - 1);
+		bucket_size[words[i].bucket]++;
+	}
+	for (i = 0; i < size; i++) {
+		slot_of[i] = -1;
+	}
+	for (b = 0; b < buckets; b++) {
+		order[b] = b;
+	}
+	qsort(order, buckets, sizeof(order[0]), cmp_bucket);
+	for (i = 0; i < buckets && bucket_size[order[i]]; i++) {
+		for (seed = 0; seed <= GEN_SEED_MAX; seed++) {
+			if (place(order[i], seed)) {
+				break;
+			}
+		}
+		if (seed > GEN_SEED_MAX) {
+			fprintf(stderr, "sf_dictgen: no seed for bucket %d\n",
+				order[i]);
+			return 1;
+		}
+		disp[order[i]] = seed;
+	}
+
+	printf("// generated by forth/sf_dictgen.c, do not edit\n\n");
+	printf("enum {\n\tSF_DICT_ROM_SIZE = %d,\n", size);
+	printf("\tSF_DICT_ROM_BUCKETS = %d,\n};\n\n", buckets);
+	printf("static const uint16_t sf_dict_rom_disp[SF_DICT_ROM_BUCKETS] = {");
+	for (b = 0; b < buckets; b++) {
+		printf("%s%u,", (b % 8) ? " " : "\n\t", disp[b]);
+	}
+	printf("\n};\n\n");
+	printf("static const struct sf_rom_word sf_dict_rom[SF_DICT_ROM_SIZE] = {\n");
+	for (i = 0; i < size; i++) {
+		struct gen_word *w;
+
+		if (slot_of[i] < 0) {
+			continue;
+		}
+		w = &words[slot_of[i]];
+		printf("\t[%d] = { ", i);
+		print_name(w->name);
+		printf(", %d, %s, %s },\n", (int)strlen(w->name), w->kind,
+		       w->value);
+	}
+	printf("};\n");
+	return 0;
+}
@@ -0,0 +1,631 @@
+#include <string.h>
+#include "sf_native.h"
+
+// Subroutine threaded compiler from a word's threaded code to rv32 base
+// ISA code. Primitives are inlined, calls to other native words become
+// jal. Inside native code the top of stack lives in t0 and a0 points at
+// the next cell, a1/a2 hold the bounds of a0 and a3 the branch fuel.
+// Stack bounds are checked where control flow joins, around calls, on
+// return and whenever a straight run could leave the guard cells; loop
+// back edges burn fuel so a runaway loop faults instead of hanging the
+// link. A fault returns a0 = 0 all the way out.
+//
+// Word frames on the machine stack hold ra and the do-loop parameters.
+
+// RAM is executable on the CH58x, the vendor link script runs the
+// __HIGH_CODE functions from it too. The buffer has its own NOLOAD
+// section, app/native.ld places it in RAM, so it costs no flash and the
+// startup code does not clear it.
+static uint32_t code[SF_NATIVE_SIZE]
+	__attribute__((section(".sf_native"), aligned(4)));
+static int used;
+
+enum {
+	ZERO = 0,
+	RA = 1,
+	SP = 2,
+	T0 = 5,
+	T1 = 6,
+	T2 = 7,
+	A0 = 10,
+	A1 = 11,
+	A2 = 12,
+	A3 = 13,
+	A4 = 14,
+	T3 = 28,
+	T4 = 29,
+};
+
+enum {
+	OP_LOAD = 0x03,
+	OP_IMM = 0x13,
+	OP_STORE = 0x23,
+	OP_REG = 0x33,
+	OP_LUI = 0x37,
+	OP_BRANCH = 0x63,
+	OP_JALR = 0x67,
+	OP_JAL = 0x6f,
+};
+
+enum {
+	F_BEQ = 0,
+	F_BNE = 1,
+	F_BLT = 4,
+	F_BGE = 5,
+	F_BLTU = 6,
+};
+
+struct sf_nat {
+	uint32_t *out; // NULL while sizing
+	uint32_t *start;
+	int pos;
+	int levels;
+	int exit;
+	int fault;
+	int d; // depth change since the last bounds check
+	int16_t at[SF_NATIVE_THREAD_MAX + 1];
+	uint8_t target[SF_NATIVE_THREAD_MAX + 1];
+};
+
+static struct sf_nat nat;
+
+static void emit(struct sf_nat *c, uint32_t insn) {
+	if (c->out) {
+		c->out[c->pos] = insn;
+	}
+	c->pos++;
+}
+
+static void rv_i(struct sf_nat *c, int op, int f3, int rd, int rs1, int imm) {
+	emit(c, ((uint32_t)imm & 0xfff) << 20 | rs1 << 15 | f3 << 12 |
+			rd << 7 | op);
+}
+
+static void rv_r(struct sf_nat *c, int f7, int f3, int rd, int rs1, int rs2) {
+	emit(c, f7 << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 | rd << 7 |
+			OP_REG);
+}
+
+static void rv_s(struct sf_nat *c, int f3, int rs2, int rs1, int imm) {
+	emit(c, ((uint32_t)imm >> 5 & 0x7f) << 25 | rs2 << 20 | rs1 << 15 |
+			f3 << 12 | (imm & 0x1f) << 7 | OP_STORE);
+}
+
+// branch from the current position to instruction index to
+static void rv_b(struct sf_nat *c, int f3, int rs1, int rs2, int to) {
+	uint32_t off = (to - c->pos) * 4;
+
+	emit(c, (off >> 12 & 1) << 31 | (off >> 5 & 0x3f) << 25 | rs2 << 20 |
+			rs1 << 15 | f3 << 12 | (off >> 1 & 0xf) << 8 |
+			(off >> 11 & 1) << 7 | OP_BRANCH);
+}
+
+static void rv_jal(struct sf_nat *c, int rd, int32_t bytes) {
+	uint32_t off = bytes;
+
+	emit(c, (off >> 20 & 1) << 31 | (off >> 1 & 0x3ff) << 21 |
+			(off >> 11 & 1) << 20 | (off >> 12 & 0xff) << 12 |
+			rd << 7 | OP_JAL);
+}
+
+#define ADDI(rd, rs, imm) rv_i(c, OP_IMM, 0, rd, rs, imm)
+#define LW(rd, rs, off) rv_i(c, OP_LOAD, 2, rd, rs, off)
+#define LBU(rd, rs, off) rv_i(c, OP_LOAD, 4, rd, rs, off)
+#define SW(rs2, rs1, off) rv_s(c, 2, rs2, rs1, off)
+#define SB(rs2, rs1, off) rv_s(c, 0, rs2, rs1, off)
+#define ADD(rd, a, b) rv_r(c, 0, 0, rd, a, b)
+#define SUB(rd, a, b) rv_r(c, 0x20, 0, rd, a, b)
+#define MV(rd, rs) ADDI(rd, rs, 0)
+#define NEG(rd, rs) SUB(rd, ZERO, rs)
+
+// the two stack moves everything else is built from
+static void push_t0(struct sf_nat *c) {
+	ADDI(A0, A0, -4);
+	SW(T0, A0, 0);
+}
+
+static void pop_t0(struct sf_nat *c) {
+	LW(T0, A0, 0);
+	ADDI(A0, A0, 4);
+}
+
+static void li(struct sf_nat *c, int rd, int32_t x) {
+	if (x >= -2048 && x < 2048) {
+		ADDI(rd, ZERO, x);
+		return;
+	}
+	emit(c, (((uint32_t)x + 0x800) & 0xfffff000) | rd << 7 | OP_LUI);
+	ADDI(rd, rd, x & 0xfff);
+}
+
+static void check(struct sf_nat *c) {
+	rv_b(c, F_BLTU, A0, A1, c->fault);
+	rv_b(c, F_BLTU, A2, A0, c->fault);
+	c->d = 0;
+}
+
+static void burn(struct sf_nat *c) {
+	ADDI(A3, A3, -1);
+	rv_b(c, F_BEQ, A3, ZERO, c->fault);
+}
+
+// cells popped and net depth change of each supported primitive
+static int8_t sf_native_need(sf_cell w) {
+	switch (w) {
+	case SF_OP_ROT:
+		return 3;
+	case SF_OP_SWAP: case SF_OP_OVER: case SF_OP_NIP: case SF_OP_ADD:
+	case SF_OP_SUB: case SF_OP_MUL: case SF_OP_DIV: case SF_OP_MOD:
+	case SF_OP_AND: case SF_OP_OR: case SF_OP_XOR: case SF_OP_LSHIFT:
+	case SF_OP_RSHIFT: case SF_OP_EQ: case SF_OP_LT: case SF_OP_GT:
+	case SF_OP_ULT: case SF_OP_STORE: case SF_OP_CSTORE:
+	case SF_OP_PSTORE: case SF_OP_DO: case SF_OP_FETCHADD:
+	case SF_OP_TWODUP:
+		return 2;
+	case SF_OP_DUP: case SF_OP_DROP: case SF_OP_INVERT:
+	case SF_OP_NEGATE: case SF_OP_INC: case SF_OP_DEC: case SF_OP_ZEQ:
+	case SF_OP_ZLT: case SF_OP_FETCH: case SF_OP_CFETCH:
+	case SF_OP_ZBRANCH: case SF_OP_PLOOP: case SF_OP_LITADD:
+	case SF_OP_LITADDFETCH: case SF_OP_DUPZBRANCH:
+	case SF_OP_ZEQZBRANCH:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static int8_t sf_native_net(sf_cell w) {
+	switch (w) {
+	case SF_OP_TWODUP:
+		return 2;
+	case SF_OP_LIT: case SF_OP_DUP: case SF_OP_OVER: case SF_OP_I:
+	case SF_OP_J: case SF_OP_DEPTH:
+		return 1;
+	case SF_OP_STORE: case SF_OP_CSTORE: case SF_OP_PSTORE:
+	case SF_OP_DO:
+		return -2;
+	case SF_OP_SWAP: case SF_OP_ROT: case SF_OP_INVERT:
+	case SF_OP_NEGATE: case SF_OP_INC: case SF_OP_DEC: case SF_OP_ZEQ:
+	case SF_OP_ZLT: case SF_OP_FETCH: case SF_OP_CFETCH:
+	case SF_OP_BRANCH: case SF_OP_EXIT: case SF_OP_LOOP:
+	case SF_OP_UNLOOP: case SF_OP_LITADD: case SF_OP_LITADDFETCH:
+	case SF_OP_DUPZBRANCH:
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+static int sf_native_has_literal(sf_cell w) {
+	return w == SF_OP_LIT || w == SF_OP_LITADD || w == SF_OP_LITADDFETCH;
+}
+
+static int sf_native_has_operand(sf_cell w) {
+	return sf_native_has_literal(w) || w == SF_OP_BRANCH ||
+	       w == SF_OP_ZBRANCH || w == SF_OP_DUPZBRANCH ||
+	       w == SF_OP_ZEQZBRANCH ||
+	       w == SF_OP_LOOP || w == SF_OP_PLOOP;
+}
+
+// find branch targets and loop nesting, reject what cannot be compiled
+static int sf_native_scan(struct sf_nat *c, const sf_cell *th, int n) {
+	int i, to, level = 0;
+	sf_cell w;
+
+	memset(c->target, 0, n + 1);
+	c->levels = 0;
+	for (i = 0; i < n; i++) {
+		w = th[i];
+		if ((uintptr_t)w >= SF_OP_NUM) {
+			// only words that are native already, no recursion
+			if (((const sf_cell *)w)[0] != SF_OP_NATIVE) {
+				return -1;
+			}
+			continue;
+		}
+		switch (w) {
+		case SF_OP_EXECUTE: case SF_OP_HALT: case SF_OP_PAUSE:
+		case SF_OP_TOR: case SF_OP_FROMR: case SF_OP_RFETCH:
+		case SF_OP_KEY: case SF_OP_KEYQ: case SF_OP_EMIT:
+		case SF_OP_NATIVE:
+			return -1;
+		case SF_OP_DO:
+			if (++level > c->levels) {
+				c->levels = level;
+			}
+			break;
+		case SF_OP_LOOP: case SF_OP_PLOOP:
+			if (--level < 0) {
+				return -1;
+			}
+			break;
+		case SF_OP_I:
+			if (level < 1) {
+				return -1;
+			}
+			break;
+		case SF_OP_J:
+			if (level < 2) {
+				return -1;
+			}
+			break;
+		}
+		if (!sf_native_has_operand(w)) {
+			continue;
+		}
+		if (++i >= n) {
+			return -1;
+		}
+		if (sf_native_has_literal(w)) {
+			if (th[i] != (int32_t)th[i]) {
+				return -1;
+			}
+			continue;
+		}
+		to = i + th[i];
+		if (to < 0 || to > n) {
+			return -1;
+		}
+		c->target[to] = 1;
+	}
+	return 0;
+}
+
+static void sf_native_compare(struct sf_nat *c, int f3, int swap) {
+	LW(T1, A0, 0);
+	ADDI(A0, A0, 4);
+	if (swap) {
+		rv_r(c, 0, f3, T0, T0, T1);
+	} else {
+		rv_r(c, 0, f3, T0, T1, T0);
+	}
+	NEG(T0, T0);
+}
+
+static int sf_native_gen(struct sf_nat *c, const sf_cell *th, int n) {
+	int i, frame, level = 0, slot, f3;
+	sf_cell w, x;
+
+	c->pos = 0;
+	c->d = 0;
+	frame = (4 + 8 * c->levels + 15) & ~15;
+	ADDI(SP, SP, -frame);
+	SW(RA, SP, frame - 4);
+	for (i = 0; i < n; i++) {
+		c->at[i] = c->pos;
+		if (c->target[i]) {
+			check(c);
+		}
+		w = th[i];
+		if ((uintptr_t)w >= SF_OP_NUM) {
+			uint32_t *fn = (uint32_t *)((const sf_cell *)w)[1];
+
+			check(c);
+			rv_jal(c, RA, (fn - (c->start + c->pos)) * 4);
+			rv_b(c, F_BEQ, A0, ZERO, c->fault);
+			continue;
+		}
+		// keep each straight run inside the guard cells, a pop also
+		// reloads t0 from the cell below what it consumed
+		if (c->d - sf_native_need(w) < 1 - SF_STACK_GUARD ||
+		    c->d + sf_native_net(w) > SF_STACK_GUARD) {
+			check(c);
+		}
+		c->d += sf_native_net(w);
+		x = sf_native_has_operand(w) ? th[i + 1] : 0;
+		switch (w) {
+		case SF_OP_EXIT:
+			if (i + 1 < n) {
+				rv_jal(c, ZERO, (c->at[n] - c->pos) * 4);
+			}
+			break;
+		case SF_OP_LIT:
+			i++;
+			if (i + 1 < n && !c->target[i + 1] &&
+			    (th[i + 1] == SF_OP_ADD || th[i + 1] == SF_OP_SUB) &&
+			    x > -2048 && x < 2048) {
+				// fold a small literal into addi
+				ADDI(T0, T0, th[i + 1] == SF_OP_ADD ? x : -x);
+				c->d--;
+				i++;
+				break;
+			}
+			push_t0(c);
+			li(c, T0, x);
+			break;
+		case SF_OP_BRANCH:
+			i++;
+			if (x <= 0) {
+				burn(c);
+			}
+			rv_jal(c, ZERO, (c->at[i + x] - c->pos) * 4);
+			break;
+		case SF_OP_ZBRANCH:
+		case SF_OP_DUPZBRANCH:
+		case SF_OP_ZEQZBRANCH:
+			i++;
+			MV(T1, T0);
+			if (w != SF_OP_DUPZBRANCH) {
+				pop_t0(c);
+			}
+			// taken on zero, or on non zero after 0=
+			f3 = w == SF_OP_ZEQZBRANCH ? F_BNE : F_BEQ;
+			if (x <= 0) {
+				rv_b(c, f3 ^ 1, T1, ZERO, c->pos + 4);
+				burn(c);
+				rv_jal(c, ZERO, (c->at[i + x] - c->pos) * 4);
+			} else {
+				rv_b(c, f3, T1, ZERO, c->at[i + x]);
+			}
+			break;
+		case SF_OP_LITADD:
+		case SF_OP_LITADDFETCH:
+			i++;
+			if (x >= -2048 && x < 2048) {
+				ADDI(T0, T0, x);
+			} else {
+				li(c, T1, x);
+				ADD(T0, T0, T1);
+			}
+			if (w == SF_OP_LITADDFETCH) {
+				LW(T0, T0, 0);
+			}
+			break;
+		case SF_OP_FETCHADD:
+			LW(T0, T0, 0);
+			LW(T1, A0, 0);
+			ADDI(A0, A0, 4);
+			ADD(T0, T1, T0);
+			break;
+		case SF_OP_TWODUP:
+			LW(T1, A0, 0);
+			ADDI(A0, A0, -8);
+			SW(T0, A0, 4);
+			SW(T1, A0, 0);
+			break;
+		case SF_OP_DUP:
+			push_t0(c);
+			break;
+		case SF_OP_DROP:
+			pop_t0(c);
+			break;
+		case SF_OP_SWAP:
+			LW(T1, A0, 0);
+			SW(T0, A0, 0);
+			MV(T0, T1);
+			break;
+		case SF_OP_OVER:
+			LW(T1, A0, 0);
+			push_t0(c);
+			MV(T0, T1);
+			break;
+		case SF_OP_ROT:
+			LW(T1, A0, 0);
+			LW(T2, A0, 4);
+			SW(T1, A0, 4);
+			SW(T0, A0, 0);
+			MV(T0, T2);
+			break;
+		case SF_OP_NIP:
+			ADDI(A0, A0, 4);
+			break;
+		case SF_OP_ADD:
+		case SF_OP_SUB:
+		case SF_OP_MUL:
+		case SF_OP_DIV:
+		case SF_OP_MOD:
+		case SF_OP_AND:
+		case SF_OP_OR:
+		case SF_OP_XOR:
+		case SF_OP_LSHIFT:
+		case SF_OP_RSHIFT:
+			if (w == SF_OP_DIV || w == SF_OP_MOD) {
+				rv_b(c, F_BEQ, T0, ZERO, c->fault);
+			}
+			LW(T1, A0, 0);
+			ADDI(A0, A0, 4);
+			switch (w) {
+			case SF_OP_ADD: ADD(T0, T1, T0); break;
+			case SF_OP_SUB: SUB(T0, T1, T0); break;
+			case SF_OP_MUL: rv_r(c, 1, 0, T0, T1, T0); break;
+			case SF_OP_DIV: rv_r(c, 1, 4, T0, T1, T0); break;
+			case SF_OP_MOD: rv_r(c, 1, 6, T0, T1, T0); break;
+			case SF_OP_AND: rv_r(c, 0, 7, T0, T1, T0); break;
+			case SF_OP_OR: rv_r(c, 0, 6, T0, T1, T0); break;
+			case SF_OP_XOR: rv_r(c, 0, 4, T0, T1, T0); break;
+			case SF_OP_LSHIFT: rv_r(c, 0, 1, T0, T1, T0); break;
+			case SF_OP_RSHIFT: rv_r(c, 0, 5, T0, T1, T0); break;
+			}
+			break;
+		case SF_OP_INVERT:
+			rv_i(c, OP_IMM, 4, T0, T0, -1);
+			break;
+		case SF_OP_NEGATE:
+			NEG(T0, T0);
+			break;
+		case SF_OP_INC:
+			ADDI(T0, T0, 1);
+			break;
+		case SF_OP_DEC:
+			ADDI(T0, T0, -1);
+			break;
+		case SF_OP_EQ:
+			LW(T1, A0, 0);
+			ADDI(A0, A0, 4);
+			SUB(T0, T1, T0);
+			rv_i(c, OP_IMM, 3, T0, T0, 1); // seqz
+			NEG(T0, T0);
+			break;
+		case SF_OP_LT:
+			sf_native_compare(c, 2, 0);
+			break;
+		case SF_OP_GT:
+			sf_native_compare(c, 2, 1);
+			break;
+		case SF_OP_ULT:
+			sf_native_compare(c, 3, 0);
+			break;
+		case SF_OP_ZEQ:
+			rv_i(c, OP_IMM, 3, T0, T0, 1);
+			NEG(T0, T0);
+			break;
+		case SF_OP_ZLT:
+			rv_i(c, OP_IMM, 5, T0, T0, 0x400 | 31); // srai
+			break;
+		case SF_OP_FETCH:
+			LW(T0, T0, 0);
+			break;
+		case SF_OP_CFETCH:
+			LBU(T0, T0, 0);
+			break;
+		case SF_OP_STORE:
+		case SF_OP_CSTORE:
+		case SF_OP_PSTORE:
+			LW(T1, A0, 0);
+			if (w == SF_OP_STORE) {
+				SW(T1, T0, 0);
+			} else if (w == SF_OP_CSTORE) {
+				SB(T1, T0, 0);
+			} else {
+				LW(T2, T0, 0);
+				ADD(T2, T2, T1);
+				SW(T2, T0, 0);
+			}
+			LW(T0, A0, 4);
+			ADDI(A0, A0, 8);
+			break;
+		case SF_OP_DO:
+			slot = 8 * level++;
+			SW(T0, SP, slot);
+			LW(T1, A0, 0);
+			SW(T1, SP, slot + 4);
+			LW(T0, A0, 4);
+			ADDI(A0, A0, 8);
+			break;
+		case SF_OP_LOOP:
+			i++;
+			slot = 8 * --level;
+			LW(T1, SP, slot);
+			LW(T2, SP, slot + 4);
+			ADDI(T1, T1, 1);
+			SW(T1, SP, slot);
+			rv_b(c, F_BEQ, T1, T2, c->pos + 4);
+			burn(c);
+			rv_jal(c, ZERO, (c->at[i + x] - c->pos) * 4);
+			break;
+		case SF_OP_PLOOP:
+			i++;
+			slot = 8 * --level;
+			LW(T1, SP, slot);
+			LW(T2, SP, slot + 4);
+			SUB(T3, T1, T2);
+			ADD(T4, T3, T0);
+			ADD(T1, T1, T0);
+			SW(T1, SP, slot);
+			rv_r(c, 0, 4, T4, T3, T4); // xor
+			rv_r(c, 0, 4, T3, T3, T0);
+			rv_r(c, 0, 7, T3, T3, T4); // and
+			pop_t0(c);
+			rv_b(c, F_BLT, T3, ZERO, c->pos + 4);
+			burn(c);
+			rv_jal(c, ZERO, (c->at[i + x] - c->pos) * 4);
+			break;
+		case SF_OP_I:
+		case SF_OP_J:
+			slot = 8 * (level - (w == SF_OP_I ? 1 : 2));
+			push_t0(c);
+			LW(T0, SP, slot);
+			break;
+		case SF_OP_UNLOOP:
+			break;
+		case SF_OP_DEPTH:
+			SUB(T1, A2, A0);
+			rv_i(c, OP_IMM, 5, T1, T1, 0x400 | 2); // srai
+			push_t0(c);
+			MV(T0, T1);
+			break;
+		}
+	}
+	c->at[n] = c->pos;
+	check(c);
+	c->exit = c->pos;
+	LW(RA, SP, frame - 4);
+	ADDI(SP, SP, frame);
+	rv_i(c, OP_JALR, 0, ZERO, RA, 0);
+	c->fault = c->pos;
+	ADDI(A0, ZERO, 0);
+	rv_jal(c, ZERO, (c->exit - c->pos) * 4);
+	return c->pos;
+}
+
+static void sf_native_sync(void) {
+#ifdef __riscv
+	__asm__ volatile(".word 0x0000100f" ::: "memory"); // fence.i
+#endif
+}
+
+// Entry from C: sf_cell *enter(sp, lo, hi, fuel, fn). Loads the cached
+// top of stack and biases the bounds to match, stores it back unless the
+// word faulted.
+void sf_native_reset(void) {
+	struct sf_nat *c = &nat;
+
+	c->out = code;
+	c->pos = 0;
+	ADDI(SP, SP, -16);
+	SW(RA, SP, 12);
+	LW(T0, A0, 0);
+	ADDI(A0, A0, 4);
+	ADDI(A1, A1, 4);
+	ADDI(A2, A2, 4);
+	rv_i(c, OP_JALR, 0, RA, A4, 0);
+	rv_b(c, F_BEQ, A0, ZERO, c->pos + 3);
+	push_t0(c);
+	LW(RA, SP, 12);
+	ADDI(SP, SP, 16);
+	rv_i(c, OP_JALR, 0, ZERO, RA, 0);
+	used = c->pos;
+	sf_native_sync();
+}
+
+// Returns the entry point or NULL if the word uses something native code
+// cannot do (console I/O, the return stack, calls to threaded words) or
+// the code space is full.
+void *sf_native_compile(const sf_cell *th, int n) {
+	struct sf_nat *c = &nat;
+	int size;
+
+	if (n > SF_NATIVE_THREAD_MAX || sf_native_scan(c, th, n) < 0) {
+		return NULL;
+	}
+	c->start = &code[used];
+	c->out = NULL;
+	c->fault = 0;
+	c->exit = 0;
+	size = sf_native_gen(c, th, n);
+	// all branches must stay within the +-4KB of a conditional branch
+	if (used + size > SF_NATIVE_SIZE || size > 1000) {
+		return NULL;
+	}
+	c->out = c->start;
+	sf_native_gen(c, th, n);
+	used += size;
+	sf_native_sync();
+	return c->start;
+}
+
+sf_cell *sf_native_call(void *fn, sf_cell *sp, sf_cell *lo, sf_cell *hi) {
+#ifdef __riscv
+	sf_cell *(*enter)(sf_cell *, sf_cell *, sf_cell *, int32_t, void *) =
+		(void *)code;
+
+	return enter(sp, lo, hi, SF_NATIVE_FUEL, fn);
+#else
+	return sf_native_sim(code, used, fn, sp, lo, hi, SF_NATIVE_FUEL);
+#endif
+}
+
+const uint32_t *sf_native_code(int *size) {
+	*size = used;
+	return code;
+}
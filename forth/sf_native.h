@@ -0,0 +1,29 @@
+#ifndef _SF_NATIVE_H_
+#define _SF_NATIVE_H_
+
+#include <stdint.h>
+#include "stepforth.h"
+
+// instructions of executable RAM, a few dozen console words, the host
+// build's native bench compiles about 530
+#ifndef SF_NATIVE_SIZE
+#define SF_NATIVE_SIZE 512
+#endif
+
+enum {
+	SF_NATIVE_THREAD_MAX = 256, // cells of a word that can be compiled
+	SF_NATIVE_FUEL = 1 << 16, // backward branches per call
+};
+
+void sf_native_reset(void);
+void *sf_native_compile(const sf_cell *thread, int cells);
+sf_cell *sf_native_call(void *fn, sf_cell *sp, sf_cell *lo, sf_cell *hi);
+const uint32_t *sf_native_code(int *size);
+
+#ifndef __riscv
+// rv32 interpreter of the host build, see host/rv32sim.c
+sf_cell *sf_native_sim(const uint32_t *code, int size, void *fn, sf_cell *sp,
+		       sf_cell *lo, sf_cell *hi, int32_t fuel);
+#endif
+
+#endif
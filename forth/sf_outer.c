@@ -0,0 +1,541 @@
+#include <string.h>
+#include "sf_outer.h"
+#include "sf_native.h"
+
+// The code space is shared, only one machine may compile at a time.
+static struct sf_machine *sf_compiler;
+static uint8_t sf_fuse = 1;
+
+// Peephole rules, the op compiled last and the next one are replaced by
+// a superinstruction. Chains make triples: lit + @ becomes (lit+@). The
+// set comes from the n-gram counts of an SF_PROFILE build running the
+// benches.
+static const struct {
+	uint8_t a, b, ab;
+} sf_fuse_rules[] = {
+	{ SF_OP_LIT, SF_OP_ADD, SF_OP_LITADD },
+	{ SF_OP_LITADD, SF_OP_FETCH, SF_OP_LITADDFETCH },
+	{ SF_OP_DUP, SF_OP_ZBRANCH, SF_OP_DUPZBRANCH },
+	{ SF_OP_ZEQ, SF_OP_ZBRANCH, SF_OP_ZEQZBRANCH },
+	{ SF_OP_FETCH, SF_OP_ADD, SF_OP_FETCHADD },
+	{ SF_OP_OVER, SF_OP_OVER, SF_OP_TWODUP },
+};
+
+static const char *const sf_err_text[] = {
+	[SF_ERR_PSTACK] = "stack",
+	[SF_ERR_RSTACK] = "rstack",
+	[SF_ERR_DIV0] = "div0",
+	[SF_ERR_OP] = "bad op",
+	[SF_ERR_NATIVE] = "native",
+};
+
+static void sf_outer_say(struct sf_outer *o, const char *s, int len) {
+	if (len > SF_OUT_SIZE - o->out_len) {
+		len = SF_OUT_SIZE - o->out_len;
+	}
+	memcpy(&o->out[o->out_len], s, len);
+	o->out_len += len;
+}
+
+static int sf_outer_flush(struct sf_machine *m) {
+	struct sf_outer *o = m->outer;
+
+	if (m->tx) {
+		o->out_pos += fifo8_push_buf(m->tx,
+					     (uint8_t *)&o->out[o->out_pos],
+					     o->out_len - o->out_pos);
+		if (o->out_pos < o->out_len) {
+			return 0;
+		}
+	}
+	o->out_pos = 0;
+	o->out_len = 0;
+	return 1;
+}
+
+static void sf_outer_end_def(struct sf_machine *m) {
+	struct sf_outer *o = m->outer;
+
+	if (o->compiling) {
+		sf_dict_rollback(o->def);
+		o->compiling = 0;
+	}
+	if (sf_compiler == m) {
+		sf_compiler = NULL;
+	}
+}
+
+// report "<tok> <what>", drop the rest of the line, any half compiled
+// definition and the stacks
+static void sf_outer_abort(struct sf_machine *m, const char *tok, int len,
+			   const char *what) {
+	struct sf_outer *o = m->outer;
+
+	if (len) {
+		sf_outer_say(o, tok, len);
+		sf_outer_say(o, " ", 1);
+	}
+	sf_outer_say(o, what, strlen(what));
+	sf_outer_say(o, "\n", 1);
+	o->line = 0;
+	o->len = 0;
+	sf_outer_end_def(m);
+	sf_task_reset(m->task_addr);
+}
+
+void sf_outer_reset(struct sf_machine *m) {
+	struct sf_outer *o = m->outer;
+
+	if (o == NULL) {
+		return;
+	}
+	sf_outer_end_def(m);
+	o->len = 0;
+	o->line = 0;
+	o->out_len = 0;
+	o->out_pos = 0;
+}
+
+static int sf_outer_read(struct sf_machine *m) {
+	struct sf_outer *o = m->outer;
+	int c;
+
+	while (m->rx && fifo8_used(m->rx)) {
+		c = fifo8_pop(m->rx);
+		if (c == '\r' || c == '\n') {
+			if (o->len == 0) {
+				continue;
+			}
+		} else {
+			o->tib[o->len++] = c;
+			if (o->len < SF_TIB_SIZE) {
+				continue;
+			}
+		}
+		o->line = 1;
+		o->pos = 0;
+		return 1;
+	}
+	return 0;
+}
+
+// next blank delimited word of the line, folded to lower case
+static int sf_outer_word(struct sf_outer *o, char **tok) {
+	int start;
+
+	while (o->pos < o->len && (uint8_t)o->tib[o->pos] <= ' ') {
+		o->pos++;
+	}
+	start = o->pos;
+	while (o->pos < o->len && (uint8_t)o->tib[o->pos] > ' ') {
+		if (o->tib[o->pos] >= 'A' && o->tib[o->pos] <= 'Z') {
+			o->tib[o->pos] += 'a' - 'A';
+		}
+		o->pos++;
+	}
+	*tok = &o->tib[start];
+	return o->pos - start;
+}
+
+// decimal, or hex with a leading $, optionally negative
+static int sf_outer_number(const char *s, int len, sf_cell *x) {
+	sf_cell n = 0;
+	int i = 0, neg = 0, base = 10, d;
+
+	if (i < len && s[i] == '-') {
+		neg = 1;
+		i++;
+	}
+	if (i < len && s[i] == '$') {
+		base = 16;
+		i++;
+	}
+	if (i == len) {
+		return 0;
+	}
+	for (; i < len; i++) {
+		if (s[i] >= '0' && s[i] <= '9') {
+			d = s[i] - '0';
+		} else if (s[i] >= 'a' && s[i] <= 'f') {
+			d = s[i] - 'a' + 10;
+		} else {
+			return 0;
+		}
+		if (d >= base) {
+			return 0;
+		}
+		n = n * base + d;
+	}
+	*x = neg ? -n : n;
+	return 1;
+}
+
+// for measuring, fusion only changes the code compiled afterwards
+void sf_outer_fuse(int on) {
+	sf_fuse = on;
+}
+
+// compile a primitive, its operand if any follows with sf_dict_comma()
+static void sf_outer_op(struct sf_outer *o, sf_cell op) {
+	int i;
+
+	for (i = 0; o->last && sf_fuse && i < sizeof(sf_fuse_rules) /
+					sizeof(sf_fuse_rules[0]); i++) {
+		if (*o->last == sf_fuse_rules[i].a &&
+		    op == sf_fuse_rules[i].b) {
+			*o->last = sf_fuse_rules[i].ab;
+			return;
+		}
+	}
+	o->last = sf_dict_here();
+	sf_dict_comma(op);
+}
+
+// a branch may land here, nothing compiled before fuses with what follows
+static void sf_outer_label(struct sf_outer *o) {
+	o->last = NULL;
+}
+
+static void sf_outer_cs_push(struct sf_outer *o, sf_cell *p) {
+	o->cs[o->cs_num++] = p;
+	sf_outer_label(o);
+}
+
+// compile a forward branch and leave its operand to be resolved
+static void sf_outer_orig(struct sf_outer *o, sf_cell op) {
+	sf_outer_op(o, op);
+	o->cs[o->cs_num++] = sf_dict_here();
+	sf_dict_comma(0);
+}
+
+static void sf_outer_resolve(struct sf_outer *o, sf_cell *orig) {
+	*orig = sf_dict_here() - orig;
+	sf_outer_label(o);
+}
+
+static void sf_outer_back(struct sf_outer *o, sf_cell op, sf_cell *dest) {
+	sf_outer_op(o, op);
+	sf_dict_comma(dest - sf_dict_here());
+}
+
+// words that need a name from the input: : variable constant '
+static void sf_outer_defining(struct sf_machine *m, int id, char *tok,
+			      int len) {
+	struct sf_outer *o = m->outer;
+	struct sf_task *t = m->task_addr;
+	struct sf_word w;
+	sf_cell *p;
+	char *name;
+	int n;
+
+	n = sf_outer_word(o, &name);
+	if (n == 0 || n > SF_NAME_MAX) {
+		sf_outer_abort(m, tok, len, "name?");
+		return;
+	}
+	switch (id) {
+	case SF_IMM_COLON:
+		if (o->compiling) {
+			sf_outer_abort(m, tok, len, "nested");
+			return;
+		}
+		memcpy(o->def_name, name, n);
+		o->def_len = n;
+		o->def = sf_dict_here();
+		o->cs_num = 0;
+		o->last = NULL;
+		o->compiling = 1;
+		sf_compiler = m;
+		return;
+	case SF_IMM_VARIABLE:
+		p = sf_dict_here();
+		sf_dict_comma(0);
+		if (sf_dict_define(name, n, SF_W_CONST, (sf_cell)p) < 0) {
+			sf_dict_rollback(p);
+			sf_outer_abort(m, name, n, "dictionary full");
+		}
+		return;
+	case SF_IMM_CONSTANT:
+		if (sf_task_depth(t) < 1) {
+			sf_outer_abort(m, tok, len, "stack?");
+			return;
+		}
+		if (sf_dict_define(name, n, SF_W_CONST, sf_task_pop(t)) < 0) {
+			sf_outer_abort(m, name, n, "dictionary full");
+		}
+		return;
+	case SF_IMM_TICK:
+		if (!sf_dict_find(name, n, &w) ||
+		    (w.kind != SF_W_PRIM && w.kind != SF_W_COLON)) {
+			sf_outer_abort(m, name, n, "?");
+			return;
+		}
+		if (o->compiling) {
+			sf_outer_op(o, SF_OP_LIT);
+			sf_dict_comma(w.value);
+		} else {
+			sf_task_push(t, w.value);
+		}
+		return;
+	}
+}
+
+// recompile the latest definition to machine code, its dictionary entry
+// then points at a NATIVE stub, callers compiled before keep the thread
+static void sf_outer_native(struct sf_machine *m, char *tok, int len) {
+	sf_cell *thread, *stub;
+	void *fn;
+	int n;
+
+	n = sf_dict_last(&thread);
+	if (n == 0 || sf_dict_room() < 3) {
+		sf_outer_abort(m, tok, len, "?");
+		return;
+	}
+	fn = sf_native_compile(thread, n);
+	if (fn == NULL) {
+		sf_outer_abort(m, tok, len, "not possible");
+		return;
+	}
+	stub = sf_dict_here();
+	sf_dict_comma(SF_OP_NATIVE);
+	sf_dict_comma((sf_cell)fn);
+	sf_dict_comma(SF_OP_EXIT);
+	sf_dict_retarget_last(stub);
+}
+
+static void sf_outer_builtin(struct sf_machine *m, int id, char *tok,
+			     int len) {
+	struct sf_outer *o = m->outer;
+	sf_cell *orig, *dest;
+
+	switch (id) {
+	case SF_IMM_PAREN:
+		while (o->pos < o->len && o->tib[o->pos++] != ')')
+			;
+		return;
+	case SF_IMM_BACKSLASH:
+		o->pos = o->len;
+		return;
+	case SF_IMM_NATIVE:
+		if (o->compiling || (sf_compiler && sf_compiler != m)) {
+			sf_outer_abort(m, tok, len, "busy");
+			return;
+		}
+		sf_outer_native(m, tok, len);
+		return;
+	case SF_IMM_COLON:
+	case SF_IMM_VARIABLE:
+	case SF_IMM_CONSTANT:
+	case SF_IMM_TICK:
+		if (id != SF_IMM_TICK && sf_compiler && sf_compiler != m) {
+			sf_outer_abort(m, tok, len, "busy");
+			return;
+		}
+		sf_outer_defining(m, id, tok, len);
+		return;
+	}
+	if (!o->compiling) {
+		sf_outer_abort(m, tok, len, "compile only");
+		return;
+	}
+	// pops below are checked once up front, pushes here
+	switch (id) {
+	case SF_IMM_ELSE:
+	case SF_IMM_THEN:
+	case SF_IMM_UNTIL:
+	case SF_IMM_AGAIN:
+	case SF_IMM_WHILE:
+	case SF_IMM_LOOP:
+	case SF_IMM_PLOOP:
+		if (o->cs_num < 1) {
+			goto unbalanced;
+		}
+		break;
+	case SF_IMM_REPEAT:
+		if (o->cs_num < 2) {
+			goto unbalanced;
+		}
+		break;
+	}
+	if (o->cs_num >= SF_CS_SIZE - 1 &&
+	    (id == SF_IMM_IF || id == SF_IMM_BEGIN || id == SF_IMM_DO ||
+	     id == SF_IMM_WHILE)) {
+		sf_outer_abort(m, tok, len, "too deep");
+		return;
+	}
+	switch (id) {
+	case SF_IMM_SEMICOLON:
+		if (o->cs_num) {
+			goto unbalanced;
+		}
+		sf_dict_comma(SF_OP_EXIT);
+		if (sf_dict_define(o->def_name, o->def_len, SF_W_COLON,
+				   (sf_cell)o->def) < 0) {
+			sf_outer_abort(m, tok, len, "dictionary full");
+			return;
+		}
+		o->compiling = 0;
+		sf_compiler = NULL;
+		return;
+	case SF_IMM_RECURSE:
+		sf_dict_comma((sf_cell)o->def);
+		sf_outer_label(o);
+		return;
+	case SF_IMM_IF:
+		sf_outer_orig(o, SF_OP_ZBRANCH);
+		return;
+	case SF_IMM_ELSE:
+		orig = o->cs[--o->cs_num];
+		sf_outer_orig(o, SF_OP_BRANCH);
+		sf_outer_resolve(o, orig);
+		return;
+	case SF_IMM_THEN:
+		sf_outer_resolve(o, o->cs[--o->cs_num]);
+		return;
+	case SF_IMM_BEGIN:
+	case SF_IMM_DO:
+		if (id == SF_IMM_DO) {
+			sf_outer_op(o, SF_OP_DO);
+		}
+		sf_outer_cs_push(o, sf_dict_here());
+		return;
+	case SF_IMM_UNTIL:
+		sf_outer_back(o, SF_OP_ZBRANCH, o->cs[--o->cs_num]);
+		return;
+	case SF_IMM_AGAIN:
+		sf_outer_back(o, SF_OP_BRANCH, o->cs[--o->cs_num]);
+		return;
+	case SF_IMM_WHILE:
+		sf_outer_orig(o, SF_OP_ZBRANCH);
+		return;
+	case SF_IMM_REPEAT:
+		orig = o->cs[--o->cs_num];
+		dest = o->cs[--o->cs_num];
+		sf_outer_back(o, SF_OP_BRANCH, dest);
+		sf_outer_resolve(o, orig);
+		return;
+	case SF_IMM_LOOP:
+		sf_outer_back(o, SF_OP_LOOP, o->cs[--o->cs_num]);
+		return;
+	case SF_IMM_PLOOP:
+		sf_outer_back(o, SF_OP_PLOOP, o->cs[--o->cs_num]);
+		return;
+	}
+	return;
+
+unbalanced:
+	sf_outer_abort(m, tok, len, "unbalanced");
+}
+
+// interpret or compile the next word of the line
+static void sf_outer_token(struct sf_machine *m) {
+	struct sf_outer *o = m->outer;
+	struct sf_task *t = m->task_addr;
+	struct sf_word w;
+	char *tok;
+	int len;
+
+	len = sf_outer_word(o, &tok);
+	if (len == 0) {
+		o->line = 0;
+		o->len = 0;
+		if (!o->compiling) {
+			sf_outer_say(o, " ok\n", 4);
+		}
+		return;
+	}
+	if (!sf_dict_find(tok, len, &w)) {
+		if (!sf_outer_number(tok, len, &w.value)) {
+			sf_outer_abort(m, tok, len, "?");
+			return;
+		}
+		w.kind = SF_W_CONST;
+	}
+	// no word compiles more than two cells, the defining ones included
+	if ((o->compiling || w.kind == SF_W_IMM) && sf_dict_room() < 2) {
+		sf_outer_abort(m, tok, len, "dictionary full");
+		return;
+	}
+	if (w.kind == SF_W_IMM) {
+		sf_outer_builtin(m, w.value, tok, len);
+		return;
+	}
+	if (o->compiling) {
+		if (w.kind == SF_W_CONST) {
+			sf_outer_op(o, SF_OP_LIT);
+			sf_dict_comma(w.value);
+		} else if (w.kind == SF_W_PRIM) {
+			sf_outer_op(o, w.value);
+		} else {
+			sf_dict_comma(w.value);
+			sf_outer_label(o);
+		}
+		return;
+	}
+	if (w.kind == SF_W_CONST) {
+		if (sf_task_depth(t) >= SF_PS_SIZE) {
+			sf_outer_abort(m, tok, len, "stack");
+			return;
+		}
+		sf_task_push(t, w.value);
+		return;
+	}
+	o->exec[0] = w.value;
+	o->exec[1] = SF_OP_EXIT;
+	sf_task_start(t, o->exec);
+}
+
+int sf_outer_ready(struct sf_machine *m) {
+	struct sf_outer *o = m->outer;
+	struct sf_task *t = m->task_addr;
+
+	if (t->state != SF_HALT || o == NULL) {
+		return sf_runnable(m);
+	}
+	if (t->err) {
+		return 1;
+	}
+	if (o->out_len) {
+		return m->tx == NULL || fifo8_free(m->tx) > 0;
+	}
+	return o->line || (m->rx && fifo8_used(m->rx));
+}
+
+// Run the machine for at most budget steps, a step being a primitive on
+// the task or a word handled by the outer interpreter. A machine without
+// an outer interpreter just runs its task.
+int sf_outer_step(struct sf_machine *m, int budget) {
+	struct sf_outer *o = m->outer;
+	struct sf_task *t = m->task_addr;
+	int n = 0;
+
+	while (n < budget) {
+		if (t->state != SF_HALT) {
+			n += stepforth(m, budget - n);
+			if (t->state != SF_HALT) {
+				break;
+			}
+			continue;
+		}
+		if (o == NULL) {
+			break;
+		}
+		if (t->err) {
+			sf_outer_abort(m, NULL, 0, sf_err_text[t->err]);
+			continue;
+		}
+		if (o->out_len) {
+			if (!sf_outer_flush(m)) {
+				break;
+			}
+			continue;
+		}
+		if (!o->line && !sf_outer_read(m)) {
+			break;
+		}
+		sf_outer_token(m);
+		n++;
+	}
+	return n;
+}
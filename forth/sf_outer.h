@@ -0,0 +1,40 @@
+#ifndef _SF_OUTER_H_
+#define _SF_OUTER_H_
+
+#include <stdint.h>
+#include "stepforth.h"
+#include "sf_dict.h"
+
+enum {
+	SF_TIB_SIZE = 80,
+	SF_OUT_SIZE = 48,
+	SF_CS_SIZE = 8, // nesting of control structures in a definition
+};
+
+// Outer interpreter state of a machine. Lines come from the machine's rx
+// fifo, words found in interpret state run on the machine's task and the
+// interpreter resumes with the next word once the task halts again.
+struct sf_outer {
+	char tib[SF_TIB_SIZE];
+	uint8_t len;
+	uint8_t pos;
+	uint8_t line; // tib holds a complete line
+	uint8_t compiling;
+	uint8_t cs_num;
+	uint8_t def_len;
+	uint8_t out_len;
+	uint8_t out_pos;
+	char out[SF_OUT_SIZE];
+	char def_name[SF_NAME_MAX];
+	sf_cell *def;
+	sf_cell *last; // op the next one may fuse with, NULL after a label
+	sf_cell *cs[SF_CS_SIZE];
+	sf_cell exec[2];
+};
+
+void sf_outer_reset(struct sf_machine *m);
+int sf_outer_ready(struct sf_machine *m);
+int sf_outer_step(struct sf_machine *m, int budget);
+void sf_outer_fuse(int on);
+
+#endif
@@ -0,0 +1,107 @@
+#include <string.h>
+#include "mcycle.h"
+#include "sf_outer.h"
+#include "sf_sched.h"
+
+// Round robin over the registered machines with a cycle budget per turn.
+// A machine that overruns its turn carries the debt into the next one,
+// so a task stuck in slow primitives cannot take more than its share.
+// The caller owns the table and sizes it for the machines it has.
+
+static struct sf_machine **machines;
+static int machines_size;
+static int machines_num;
+static int cursor;
+static void (*wake_cb)(void);
+
+struct sf_sched_stats sf_sched_stats;
+
+void sf_sched_init(struct sf_machine **table, int size, void (*wake)(void)) {
+	machines = table;
+	machines_size = size;
+	machines_num = 0;
+	cursor = 0;
+	wake_cb = wake;
+	memset(&sf_sched_stats, 0, sizeof(sf_sched_stats));
+}
+
+int sf_sched_add(struct sf_machine *m) {
+	if (machines_num >= machines_size) {
+		return -1;
+	}
+	m->credit = 0;
+	m->steps = 0;
+	m->cycles = 0;
+	machines[machines_num] = m;
+	return machines_num++;
+}
+
+// something may have made a machine runnable (task started, console
+// data or room arrived), have the owner schedule a pass
+void sf_sched_wake(void) {
+	if (wake_cb) {
+		wake_cb();
+	}
+}
+
+int sf_sched_runnable(void) {
+	int i;
+
+	for (i = 0; i < machines_num; i++) {
+		if (sf_outer_ready(machines[i])) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Run one pass of at most budget cycles (plus one chunk) and return
+// nonzero if any machine still has work. Callers should give the rest
+// of the system a turn before the next pass.
+int sf_sched_run(uint32_t budget) {
+	uint32_t start, t0, used;
+	int visited, n;
+
+	start = mcycle();
+	for (visited = 0; visited < machines_num; visited++) {
+		struct sf_machine *m = machines[cursor];
+
+		if (visited && mcycle() - start >= budget) {
+			break;
+		}
+		if (!sf_outer_ready(m)) {
+			m->credit = 0;
+		} else {
+			// credit left over means the last pass ended inside
+			// this turn, carry on with it
+			if (m->credit <= 0) {
+				m->credit += SF_SCHED_QUANTUM;
+			}
+			while (m->credit > 0) {
+				t0 = mcycle();
+				n = sf_outer_step(m, SF_SCHED_CHUNK);
+				used = mcycle() - t0;
+				m->credit -= used;
+				m->steps += n;
+				m->cycles += used;
+				if (!sf_outer_ready(m)) {
+					m->credit = 0;
+					break;
+				}
+				if (m->credit > 0 && t0 + used - start >= budget) {
+					goto out;
+				}
+			}
+		}
+		if (++cursor == machines_num) {
+			cursor = 0;
+		}
+	}
+out:
+	used = mcycle() - start;
+	sf_sched_stats.passes++;
+	if (used > sf_sched_stats.pass_cycles_max) {
+		sf_sched_stats.pass_cycles_max = used;
+	}
+	return sf_sched_runnable();
+}
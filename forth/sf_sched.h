@@ -0,0 +1,25 @@
+#ifndef _SF_SCHED_H_
+#define _SF_SCHED_H_
+
+#include <stdint.h>
+#include "stepforth.h"
+
+enum {
+	SF_SCHED_QUANTUM = 100 * 60, // cycles per machine turn, 100us
+	SF_SCHED_CHUNK = 16, // primitives between cycle counter reads
+};
+
+struct sf_sched_stats {
+	uint32_t passes;
+	uint32_t pass_cycles_max;
+};
+
+extern struct sf_sched_stats sf_sched_stats;
+
+void sf_sched_init(struct sf_machine **table, int size, void (*wake)(void));
+int sf_sched_add(struct sf_machine *m);
+void sf_sched_wake(void);
+int sf_sched_runnable(void);
+int sf_sched_run(uint32_t budget);
+
+#endif
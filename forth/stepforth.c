@@ -1,6 +1,444 @@
+#include <stddef.h>
+#include <string.h>
 #include "stepforth.h"
+#include "sf_native.h"
 
-void stepforth(void *mctx) {
-	// TODO
-	return;
+// Stacks grow down from their base, sp[0] is the top of stack.
+
+#define SF_TRUE ((sf_cell)-1)
+#define SF_FLAG(x) ((x) ? SF_TRUE : 0)
+
+void sf_task_reset(struct sf_task *t) {
+	t->ip = 0;
+	t->wp = 0;
+	t->psb = (intptr_t)&t->ps[SF_STACK_GUARD + SF_PS_SIZE];
+	t->psp = t->psb;
+	t->rsb = (intptr_t)&t->rs[SF_STACK_GUARD + SF_RS_SIZE];
+	t->rsp = t->rsb;
+	t->state = SF_HALT;
+	t->err = SF_OK;
+}
+
+// run code until it returns from its outermost level, the parameter
+// stack is left as is so arguments can be pushed beforehand
+void sf_task_start(struct sf_task *t, const sf_cell *code) {
+	t->ip = (intptr_t)code;
+	t->wp = 0;
+	t->rsp = t->rsb;
+	t->state = SF_RUN;
+	t->err = SF_OK;
+}
+
+int sf_task_depth(struct sf_task *t) {
+	return (sf_cell *)t->psb - (sf_cell *)t->psp;
+}
+
+void sf_task_push(struct sf_task *t, sf_cell x) {
+	sf_cell *sp = (sf_cell *)t->psp;
+
+	if (sf_task_depth(t) >= SF_PS_SIZE) {
+		return;
+	}
+	*--sp = x;
+	t->psp = (intptr_t)sp;
+}
+
+sf_cell sf_task_pop(struct sf_task *t) {
+	sf_cell *sp = (sf_cell *)t->psp;
+
+	if (sf_task_depth(t) <= 0) {
+		return 0;
+	}
+	t->psp = (intptr_t)(sp + 1);
+	return *sp;
+}
+
+// A task blocked on console I/O becomes runnable again once its fifo
+// has data or room.
+int sf_runnable(struct sf_machine *m) {
+	struct sf_task *t = m->task_addr;
+
+	switch (t->state) {
+	case SF_RUN:
+		return 1;
+	case SF_WAIT_RX:
+		if (m->rx && fifo8_used(m->rx)) {
+			t->state = SF_RUN;
+			return 1;
+		}
+		return 0;
+	case SF_WAIT_TX:
+		if (m->tx && fifo8_free(m->tx)) {
+			t->state = SF_RUN;
+			return 1;
+		}
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+#ifdef SF_PROFILE
+void sf_prof_reset(struct sf_machine *m) {
+	memset(&m->prof, 0, sizeof(m->prof));
+	m->prof.hist[0] = SF_OP_NUM;
+	m->prof.hist[1] = SF_OP_NUM;
+}
+
+static void sf_prof_gram(struct sf_prof *p, uint32_t key) {
+	uint32_t h = key * 2654435761u;
+	int i;
+
+	for (i = 0; i < SF_PROF_PROBES; i++) {
+		struct sf_gram *g = &p->gram[((h >> 24) + i) & (SF_PROF_GRAMS - 1)];
+
+		if (g->key == key || g->count == 0) {
+			g->key = key;
+			g->count++;
+			return;
+		}
+	}
+	p->lost++;
+}
+
+// count the pair and the triple w ends
+static void sf_prof_note(struct sf_machine *m, sf_cell w) {
+	struct sf_prof *p = &m->prof;
+	uint32_t op = (uintptr_t)w < SF_OP_NUM ? w : SF_OP_NUM;
+
+	sf_prof_gram(p, 2 << 24 | p->hist[1] << 8 | op);
+	sf_prof_gram(p, 3 << 24 | p->hist[0] << 16 | p->hist[1] << 8 | op);
+	p->hist[0] = p->hist[1];
+	p->hist[1] = op;
+}
+#endif
+
+// Execute at most budget primitives of the machine's task and return how
+// many ran. Returns early when the task halts, blocks on console I/O,
+// executes PAUSE or faults; registers live in locals while running and
+// are written back to the task on the way out.
+int stepforth(struct sf_machine *m, int budget) {
+	struct sf_task *t = m->task_addr;
+	sf_cell *ip = (sf_cell *)t->ip;
+	sf_cell *sp = (sf_cell *)t->psp;
+	sf_cell *rp = (sf_cell *)t->rsp;
+	sf_cell *psb = (sf_cell *)t->psb;
+	sf_cell *rsb = (sf_cell *)t->rsb;
+	sf_cell w = 0, x;
+	int n;
+
+	if (!sf_runnable(m)) {
+		return 0;
+	}
+	n = 0;
+	if (t->wp) {
+		// retry the primitive that blocked last time
+		w = t->wp;
+		t->wp = 0;
+		goto dispatch;
+	}
+	for (; n < budget; n++) {
+		w = *ip++;
+	dispatch:
+#ifdef SF_PROFILE
+		sf_prof_note(m, w);
+#endif
+		if ((uintptr_t)w >= SF_OP_NUM) {
+			// call colon definition
+			*--rp = (sf_cell)ip;
+			ip = (sf_cell *)w;
+			goto check;
+		}
+		switch (w) {
+		case SF_OP_EXIT:
+			if (rp == rsb) {
+				ip = NULL;
+				t->state = SF_HALT;
+				n++;
+				goto out;
+			}
+			ip = (sf_cell *)*rp++;
+			break;
+		case SF_OP_LIT:
+			*--sp = *ip++;
+			break;
+		case SF_OP_BRANCH:
+			ip += *ip;
+			break;
+		case SF_OP_ZBRANCH:
+			if (*sp++ == 0) {
+				ip += *ip;
+			} else {
+				ip++;
+			}
+			break;
+		case SF_OP_EXECUTE:
+			w = *sp++;
+			goto dispatch;
+		case SF_OP_HALT:
+			ip = NULL;
+			t->state = SF_HALT;
+			n++;
+			goto out;
+		case SF_OP_PAUSE:
+			n++;
+			goto out;
+		case SF_OP_DUP:
+			x = sp[0];
+			*--sp = x;
+			break;
+		case SF_OP_DROP:
+			sp++;
+			break;
+		case SF_OP_SWAP:
+			x = sp[0];
+			sp[0] = sp[1];
+			sp[1] = x;
+			break;
+		case SF_OP_OVER:
+			x = sp[1];
+			*--sp = x;
+			break;
+		case SF_OP_ROT:
+			x = sp[2];
+			sp[2] = sp[1];
+			sp[1] = sp[0];
+			sp[0] = x;
+			break;
+		case SF_OP_NIP:
+			sp[1] = sp[0];
+			sp++;
+			break;
+		case SF_OP_TOR:
+			*--rp = *sp++;
+			break;
+		case SF_OP_FROMR:
+			*--sp = *rp++;
+			break;
+		case SF_OP_RFETCH:
+			*--sp = rp[0];
+			break;
+		case SF_OP_ADD:
+			sp[1] += sp[0];
+			sp++;
+			break;
+		case SF_OP_SUB:
+			sp[1] -= sp[0];
+			sp++;
+			break;
+		case SF_OP_MUL:
+			sp[1] *= sp[0];
+			sp++;
+			break;
+		case SF_OP_DIV:
+		case SF_OP_MOD:
+			if (sp[0] == 0) {
+				t->err = SF_ERR_DIV0;
+				goto fault;
+			}
+			sp[1] = (w == SF_OP_DIV) ? sp[1] / sp[0] :
+						   sp[1] % sp[0];
+			sp++;
+			break;
+		case SF_OP_AND:
+			sp[1] &= sp[0];
+			sp++;
+			break;
+		case SF_OP_OR:
+			sp[1] |= sp[0];
+			sp++;
+			break;
+		case SF_OP_XOR:
+			sp[1] ^= sp[0];
+			sp++;
+			break;
+		case SF_OP_INVERT:
+			sp[0] = ~sp[0];
+			break;
+		case SF_OP_NEGATE:
+			sp[0] = -sp[0];
+			break;
+		case SF_OP_LSHIFT:
+			sp[1] = (uintptr_t)sp[1] << sp[0];
+			sp++;
+			break;
+		case SF_OP_RSHIFT:
+			sp[1] = (uintptr_t)sp[1] >> sp[0];
+			sp++;
+			break;
+		case SF_OP_INC:
+			sp[0]++;
+			break;
+		case SF_OP_DEC:
+			sp[0]--;
+			break;
+		case SF_OP_EQ:
+			sp[1] = SF_FLAG(sp[1] == sp[0]);
+			sp++;
+			break;
+		case SF_OP_LT:
+			sp[1] = SF_FLAG(sp[1] < sp[0]);
+			sp++;
+			break;
+		case SF_OP_GT:
+			sp[1] = SF_FLAG(sp[1] > sp[0]);
+			sp++;
+			break;
+		case SF_OP_ULT:
+			sp[1] = SF_FLAG((uintptr_t)sp[1] < (uintptr_t)sp[0]);
+			sp++;
+			break;
+		case SF_OP_ZEQ:
+			sp[0] = SF_FLAG(sp[0] == 0);
+			break;
+		case SF_OP_ZLT:
+			sp[0] = SF_FLAG(sp[0] < 0);
+			break;
+		case SF_OP_FETCH:
+			sp[0] = *(sf_cell *)sp[0];
+			break;
+		case SF_OP_STORE:
+			*(sf_cell *)sp[0] = sp[1];
+			sp += 2;
+			break;
+		case SF_OP_CFETCH:
+			sp[0] = *(uint8_t *)sp[0];
+			break;
+		case SF_OP_CSTORE:
+			*(uint8_t *)sp[0] = sp[1];
+			sp += 2;
+			break;
+		case SF_OP_PSTORE:
+			*(sf_cell *)sp[0] += sp[1];
+			sp += 2;
+			break;
+		case SF_OP_DO:
+			// R: limit index
+			rp -= 2;
+			rp[1] = sp[1];
+			rp[0] = sp[0];
+			sp += 2;
+			break;
+		case SF_OP_LOOP:
+			if (++rp[0] == rp[1]) {
+				rp += 2;
+				ip++;
+			} else {
+				ip += *ip;
+			}
+			break;
+		case SF_OP_PLOOP:
+			// ends when index - limit crosses from -1 to 0 either
+			// way, not where it wraps, in unsigned arithmetic
+			x = (uintptr_t)rp[0] - (uintptr_t)rp[1];
+			rp[0] = (uintptr_t)rp[0] + (uintptr_t)sp[0];
+			if (((x ^ (sf_cell)((uintptr_t)x + (uintptr_t)sp[0])) &
+			     (x ^ sp[0])) < 0) {
+				rp += 2;
+				ip++;
+			} else {
+				ip += *ip;
+			}
+			sp++;
+			break;
+		case SF_OP_I:
+			*--sp = rp[0];
+			break;
+		case SF_OP_J:
+			*--sp = rp[2];
+			break;
+		case SF_OP_UNLOOP:
+			rp += 2;
+			break;
+		case SF_OP_KEY:
+			if (m->rx == NULL || fifo8_used(m->rx) == 0) {
+				t->wp = w;
+				t->state = SF_WAIT_RX;
+				goto out;
+			}
+			*--sp = fifo8_pop(m->rx);
+			break;
+		case SF_OP_KEYQ:
+			*--sp = SF_FLAG(m->rx && fifo8_used(m->rx));
+			break;
+		case SF_OP_EMIT:
+			if (m->tx == NULL) {
+				sp++;
+				break;
+			}
+			if (fifo8_free(m->tx) == 0) {
+				t->wp = w;
+				t->state = SF_WAIT_TX;
+				goto out;
+			}
+			fifo8_push(m->tx, *sp++);
+			break;
+		case SF_OP_DEPTH:
+			x = psb - sp;
+			*--sp = x;
+			break;
+		case SF_OP_NATIVE:
+			sp = sf_native_call((void *)*ip++, sp, psb - SF_PS_SIZE,
+					    psb);
+			if (sp == NULL) {
+				t->err = SF_ERR_NATIVE;
+				goto fault;
+			}
+			break;
+		case SF_OP_LITADD:
+			sp[0] += *ip++;
+			break;
+		case SF_OP_LITADDFETCH:
+			sp[0] = *(sf_cell *)(sp[0] + *ip++);
+			break;
+		case SF_OP_DUPZBRANCH:
+			if (sp[0] == 0) {
+				ip += *ip;
+			} else {
+				ip++;
+			}
+			break;
+		case SF_OP_ZEQZBRANCH:
+			if (*sp++ != 0) {
+				ip += *ip;
+			} else {
+				ip++;
+			}
+			break;
+		case SF_OP_FETCHADD:
+			sp[1] += *(sf_cell *)sp[0];
+			sp++;
+			break;
+		case SF_OP_TWODUP:
+			sp -= 2;
+			sp[0] = sp[2];
+			sp[1] = sp[3];
+			break;
+		default:
+			t->err = SF_ERR_OP;
+			goto fault;
+		}
+	check:
+		if ((uintptr_t)(psb - sp) > SF_PS_SIZE) {
+			t->err = SF_ERR_PSTACK;
+			goto fault;
+		}
+		if ((uintptr_t)(rsb - rp) > SF_RS_SIZE) {
+			t->err = SF_ERR_RSTACK;
+			goto fault;
+		}
+	}
+	goto out;
+
+fault:
+	t->state = SF_HALT;
+	ip = NULL;
+	sp = psb;
+	rp = rsb;
+	n++;
+out:
+	t->ip = (intptr_t)ip;
+	t->psp = (intptr_t)sp;
+	t->rsp = (intptr_t)rp;
+	return n;
 }
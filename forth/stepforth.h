@@ -2,20 +2,168 @@
 #define _STEPFORTH_
 
 #include <stdint.h>
+#include "fifo8.h"
 
-void stepforth(void *mctx);
+typedef intptr_t sf_cell;
+
+// Threaded code is an array of cells. A cell below SF_OP_NUM is a
+// primitive token, anything else is the address of a colon definition
+// body to call. LIT, BRANCH, 0BRANCH, (LOOP) and (+LOOP) take the next
+// cell as operand, branch offsets are in cells relative to that operand.
+// NATIVE takes the entry of rv32 code made by sf_native_compile().
+// The last group are superinstructions the compiler fuses from common
+// sequences, see sf_outer_op(); all but (@+) and 2dup take the operand
+// of the op in their sequence that has one.
+#define SF_PRIMITIVES(X)         \
+	X(EXIT, "exit")          \
+	X(LIT, "lit")            \
+	X(BRANCH, "branch")      \
+	X(ZBRANCH, "0branch")    \
+	X(EXECUTE, "execute")    \
+	X(HALT, "halt")          \
+	X(PAUSE, "pause")        \
+	X(DUP, "dup")            \
+	X(DROP, "drop")          \
+	X(SWAP, "swap")          \
+	X(OVER, "over")          \
+	X(ROT, "rot")            \
+	X(NIP, "nip")            \
+	X(TOR, ">r")             \
+	X(FROMR, "r>")           \
+	X(RFETCH, "r@")          \
+	X(ADD, "+")              \
+	X(SUB, "-")              \
+	X(MUL, "*")              \
+	X(DIV, "/")              \
+	X(MOD, "mod")            \
+	X(AND, "and")            \
+	X(OR, "or")              \
+	X(XOR, "xor")            \
+	X(INVERT, "invert")      \
+	X(NEGATE, "negate")      \
+	X(LSHIFT, "lshift")      \
+	X(RSHIFT, "rshift")      \
+	X(INC, "1+")             \
+	X(DEC, "1-")             \
+	X(EQ, "=")               \
+	X(LT, "<")               \
+	X(GT, ">")               \
+	X(ULT, "u<")             \
+	X(ZEQ, "0=")             \
+	X(ZLT, "0<")             \
+	X(FETCH, "@")            \
+	X(STORE, "!")            \
+	X(CFETCH, "c@")          \
+	X(CSTORE, "c!")          \
+	X(PSTORE, "+!")          \
+	X(DO, "(do)")            \
+	X(LOOP, "(loop)")        \
+	X(PLOOP, "(+loop)")      \
+	X(I, "i")                \
+	X(J, "j")                \
+	X(UNLOOP, "unloop")      \
+	X(KEY, "key")            \
+	X(KEYQ, "key?")          \
+	X(EMIT, "emit")          \
+	X(DEPTH, "depth")        \
+	X(NATIVE, "(native)")    \
+	X(LITADD, "(lit+)")      \
+	X(LITADDFETCH, "(lit+@)") \
+	X(DUPZBRANCH, "(dup0branch)") \
+	X(ZEQZBRANCH, "(0=0branch)") \
+	X(FETCHADD, "(@+)")      \
+	X(TWODUP, "2dup")
+
+enum sf_op {
+#define SF_OP_ENUM(op, name) SF_OP_##op,
+	SF_PRIMITIVES(SF_OP_ENUM)
+#undef SF_OP_ENUM
+	SF_OP_NUM,
+};
+
+enum {
+	SF_PS_SIZE = 24,
+	SF_RS_SIZE = 16,
+	// slack around each stack so a primitive running on a bad depth
+	// stays inside the task before the step check catches it
+	SF_STACK_GUARD = 4,
+};
+
+enum sf_state {
+	SF_HALT = 0,
+	SF_RUN,
+	SF_WAIT_RX, // blocked in KEY
+	SF_WAIT_TX, // blocked in EMIT
+};
+
+enum sf_err {
+	SF_OK = 0,
+	SF_ERR_PSTACK,
+	SF_ERR_RSTACK,
+	SF_ERR_DIV0,
+	SF_ERR_OP,
+	SF_ERR_NATIVE,
+};
+
+#ifdef SF_PROFILE
+// Dynamic n-gram counts of a machine, built with SF_PROFILE=1 to pick
+// the superinstructions from real traces. A gram's key is n << 24 and its
+// ops from the oldest in the high byte, SF_OP_NUM stands for a call.
+enum {
+	SF_PROF_GRAMS = 1024,
+	SF_PROF_PROBES = 8,
+};
+
+struct sf_gram {
+	uint32_t key;
+	uint32_t count;
+};
+
+struct sf_prof {
+	uint8_t hist[2];
+	uint32_t lost; // grams that found no free entry
+	struct sf_gram gram[SF_PROF_GRAMS];
+};
+#endif
 
 struct sf_task {
 	intptr_t ip;
-	intptr_t wp;
+	intptr_t wp; // primitive to retry after blocking, 0 if none
 	intptr_t psp;
 	intptr_t psb;
 	intptr_t rsp;
+	intptr_t rsb;
+	uint8_t state;
+	uint8_t err;
+	sf_cell ps[SF_STACK_GUARD + SF_PS_SIZE + SF_STACK_GUARD];
+	sf_cell rs[SF_STACK_GUARD + SF_RS_SIZE + SF_STACK_GUARD];
 };
 
 struct sf_machine {
 	struct sf_task *task_addr;
 	struct ble_peri_slot *ble_peri_slot_addr;
+	struct fifo8 *rx;
+	struct fifo8 *tx;
+	struct sf_outer *outer; // NULL for a bare task
+
+	// scheduler accounting, see sf_sched.c
+	int32_t credit;
+	uint32_t steps;
+	uint32_t cycles;
+#ifdef SF_PROFILE
+	struct sf_prof prof;
+#endif
 };
 
+void sf_task_reset(struct sf_task *t);
+void sf_task_start(struct sf_task *t, const sf_cell *code);
+int sf_task_depth(struct sf_task *t);
+void sf_task_push(struct sf_task *t, sf_cell x);
+sf_cell sf_task_pop(struct sf_task *t);
+int sf_runnable(struct sf_machine *m);
+int stepforth(struct sf_machine *m, int budget);
+#ifdef SF_PROFILE
+void sf_prof_reset(struct sf_machine *m);
+#endif
+
 #endif
@@ -0,0 +1,377 @@
+#ifndef _HOST_CH58XBLE_LIB_H_
+#define _HOST_CH58XBLE_LIB_H_
+
+// Host stand-in for the vendor BLE library header. Types and constants
+// follow the names used by the WCH SDK so the firmware builds unchanged,
+// the implementation lives in host/port.c.
+
+#include <stdint.h>
+#include "CH58x_common.h"
+
+#define VER_LIB "CH58x_BLE_LIB_HOST"
+
+typedef uint8_t bStatus_t;
+typedef uint8_t tmosTaskID;
+typedef uint16_t tmosEvents;
+typedef uint32_t tmosTimer;
+typedef tmosEvents (*pTaskEventHandlerFn)(tmosTaskID taskID,
+					  tmosEvents event);
+
+// status
+#define SUCCESS 0x00
+#define FAILURE 0x01
+#define INVALIDPARAMETER 0x02
+#define INVALID_TASK 0x03
+#define MSG_BUFFER_NOT_AVAIL 0x04
+#define INVALID_MSG_POINTER 0x05
+#define INVALID_EVENT_ID 0x06
+#define bleNotReady 0x10
+#define bleAlreadyInRequestedMode 0x11
+#define bleIncorrectMode 0x12
+#define bleMemAllocError 0x13
+#define bleNotConnected 0x14
+#define bleNoResources 0x15
+#define blePending 0x16
+#define bleTimeout 0x17
+#define bleInvalidPDU 0x40
+
+#define BUILD_UINT16(loByte, hiByte) \
+	((uint16_t)(((loByte)&0x00FF) + (((hiByte)&0x00FF) << 8)))
+#define HI_UINT16(a) (((a) >> 8) & 0xFF)
+#define LO_UINT16(a) ((a)&0xFF)
+
+// TMOS
+#define INVALID_TASK_ID 0xFF
+#define SYS_EVENT_MSG 0x8000
+
+typedef struct {
+	uint8_t event;
+	uint8_t status;
+} tmos_event_hdr_t;
+
+tmosTaskID TMOS_ProcessEventRegister(pTaskEventHandlerFn eventCb);
+bStatus_t tmos_set_event(tmosTaskID taskID, tmosEvents event);
+bStatus_t tmos_clear_event(tmosTaskID taskID, tmosEvents event);
+bStatus_t tmos_start_task(tmosTaskID taskID, tmosEvents event,
+			  tmosTimer time);
+bStatus_t tmos_stop_task(tmosTaskID taskID, tmosEvents event);
+tmosTimer tmos_get_task_timer(tmosTaskID taskID, tmosEvents event);
+uint8_t *tmos_msg_allocate(uint16_t len);
+bStatus_t tmos_msg_deallocate(uint8_t *msg_ptr);
+bStatus_t tmos_msg_send(tmosTaskID taskID, uint8_t *msg_ptr);
+uint8_t *tmos_msg_receive(tmosTaskID taskID);
+void *tmos_memcpy(void *dst, const void *src, uint32_t len);
+void tmos_memset(void *pDst, uint8_t Value, uint32_t len);
+uint32_t TMOS_GetSystemClock(void);
+void TMOS_SystemProcess(void);
+
+// GAP
+#define GAP_MSG_EVENT 0xD0
+#define GATT_MSG_EVENT 0xB0
+
+#define GAP_DEVICE_INIT_DONE_EVENT 0x00
+#define GAP_MAKE_DISCOVERABLE_DONE_EVENT 0x02
+#define GAP_END_DISCOVERABLE_DONE_EVENT 0x03
+#define GAP_LINK_ESTABLISHED_EVENT 0x05
+#define GAP_LINK_TERMINATED_EVENT 0x06
+#define GAP_LINK_PARAM_UPDATE_EVENT 0x07
+#define GAP_PHY_UPDATE_EVENT 0x1A
+#define GAP_SCAN_REQUEST_EVENT 0x1B
+
+#define B_ADDR_LEN 6
+#define GAP_DEVICE_NAME_LEN (20 + 1)
+#define INVALID_CONNHANDLE 0xFFFF
+#define GAP_CONNHANDLE_INIT 0xFFFE
+
+#define GAP_ADTYPE_FLAGS 0x01
+#define GAP_ADTYPE_16BIT_MORE 0x02
+#define GAP_ADTYPE_16BIT_COMPLETE 0x03
+#define GAP_ADTYPE_LOCAL_NAME_COMPLETE 0x09
+#define GAP_ADTYPE_POWER_LEVEL 0x0A
+#define GAP_ADTYPE_SLAVE_CONN_INTERVAL_RANGE 0x12
+#define GAP_ADTYPE_APPEARANCE 0x19
+#define GAP_ADTYPE_FLAGS_LIMITED 0x01
+#define GAP_ADTYPE_FLAGS_GENERAL 0x02
+#define GAP_ADTYPE_FLAGS_BREDR_NOT_SUPPORTED 0x04
+#define GAP_APPEARE_HID_KEYBOARD 0x03C1
+
+#define GAP_PHY_BIT_LE_1M (1 << 0)
+#define GAP_PHY_BIT_LE_2M (1 << 1)
+#define GAP_PHY_BIT_LE_CODED (1 << 2)
+#define GAP_PHY_OPTIONS_NOPRE 0x00
+
+#define TGAP_DISC_ADV_INT_MIN 6
+#define TGAP_DISC_ADV_INT_MAX 7
+#define TGAP_ADV_SCAN_REQ_NOTIFY 34
+
+#define GAPROLE_ADVERT_ENABLED 0x305
+#define GAPROLE_ADVERT_DATA 0x307
+#define GAPROLE_SCAN_RSP_DATA 0x308
+#define GAPROLE_MIN_CONN_INTERVAL 0x311
+#define GAPROLE_MAX_CONN_INTERVAL 0x312
+
+typedef struct {
+	tmos_event_hdr_t hdr;
+	uint8_t opcode;
+} gapEventHdr_t;
+
+typedef struct {
+	tmos_event_hdr_t hdr;
+	uint8_t opcode;
+	uint8_t devAddrType;
+	uint8_t devAddr[B_ADDR_LEN];
+	uint16_t connectionHandle;
+	uint8_t connRole;
+	uint16_t connInterval;
+	uint16_t connLatency;
+	uint16_t connTimeout;
+	uint8_t clockAccuracy;
+} gapEstLinkReqEvent_t;
+
+typedef struct {
+	tmos_event_hdr_t hdr;
+	uint8_t opcode;
+	uint16_t connectionHandle;
+	uint8_t reason;
+} gapTerminateLinkEvent_t;
+
+typedef struct {
+	tmos_event_hdr_t hdr;
+	uint8_t opcode;
+	uint8_t status;
+	uint16_t connectionHandle;
+	uint16_t connInterval;
+	uint16_t connLatency;
+	uint16_t connTimeout;
+} gapLinkUpdateEvent_t;
+
+typedef struct {
+	tmos_event_hdr_t hdr;
+	uint8_t opcode;
+	uint16_t connectionHandle;
+	uint8_t connTxPHYS;
+	uint8_t connRxPHYS;
+} gapPhyUpdateEvent_t;
+
+typedef struct {
+	tmos_event_hdr_t hdr;
+	uint8_t opcode;
+	uint8_t advHandle;
+	uint8_t scannerAddrType;
+	uint8_t scannerAddr[B_ADDR_LEN];
+} gapScanReqReseiveEvent_t;
+
+typedef union {
+	gapEventHdr_t gap;
+	gapEstLinkReqEvent_t linkCmpl;
+	gapTerminateLinkEvent_t linkTerminate;
+	gapLinkUpdateEvent_t linkUpdate;
+	gapPhyUpdateEvent_t linkPhyUpdate;
+	gapScanReqReseiveEvent_t scanReqEvt;
+} gapRoleEvent_t;
+
+typedef uint8_t gapRole_States_t;
+
+#define GAPROLE_STATE_ADV_MASK (0xF)
+#define GAPROLE_INIT 0
+#define GAPROLE_STARTED 1
+#define GAPROLE_ADVERTISING 2
+#define GAPROLE_WAITING 3
+#define GAPROLE_CONNECTED 5
+#define GAPROLE_CONNECTED_ADV 6
+#define GAPROLE_ERROR 7
+
+typedef void (*gapRolesStateNotify_t)(gapRole_States_t newState,
+				      gapRoleEvent_t *pEvent);
+typedef void (*gapRolesRssiRead_t)(uint16_t connHandle, int8_t newRSSI);
+typedef void (*gapRolesParamUpdateCB_t)(uint16_t connHandle,
+					uint16_t connInterval,
+					uint16_t connSlaveLatency,
+					uint16_t connTimeout);
+
+typedef struct {
+	gapRolesStateNotify_t pfnStateChange;
+	gapRolesRssiRead_t pfnRssiRead;
+	gapRolesParamUpdateCB_t pfnParamUpdate;
+} gapRolesCBs_t;
+
+typedef struct {
+	void (*pfnScanRecv)(void *pEvent);
+	void (*pfnScanReqRecv)(void *pEvent);
+} gapRolesBroadcasterCBs_t;
+
+typedef struct {
+	void (*passcodeCB)(void);
+	void (*pairStateCB)(void);
+	void (*oobCB)(void);
+} gapBondCBs_t;
+
+typedef struct {
+	uint16_t intervalMin;
+	uint16_t intervalMax;
+	uint16_t latency;
+	uint16_t timeout;
+} gapPeriConnectParams_t;
+
+bStatus_t GAPRole_PeripheralInit(void);
+bStatus_t GAPRole_CentralInit(void);
+bStatus_t GAPRole_PeripheralStartDevice(uint8_t taskid, gapBondCBs_t *pCB,
+					gapRolesCBs_t *pAppCallbacks);
+bStatus_t GAPRole_SetParameter(uint16_t param, uint16_t len, void *pValue);
+bStatus_t GAPRole_TerminateLink(uint16_t connHandle);
+bStatus_t GAPRole_PeripheralConnParamUpdateReq(uint16_t connHandle,
+					       uint16_t minConnInterval,
+					       uint16_t maxConnInterval,
+					       uint16_t latency,
+					       uint16_t connTimeout,
+					       uint8_t taskId);
+bStatus_t GAPRole_UpdatePHY(uint16_t connHandle, uint8_t all_phys,
+			    uint8_t tx_phys, uint8_t rx_phys,
+			    uint16_t phy_options);
+bStatus_t GAPRole_ReadRssiCmd(uint16_t connHandle);
+bStatus_t GAPRole_BroadcasterSetCB(gapRolesBroadcasterCBs_t *pAppCallbacks);
+bStatus_t GAP_SetParamValue(uint16_t paramID, uint16_t paramValue);
+
+// GAPBondMgr
+#define GAPBOND_PERI_PAIRING_MODE 0x400
+#define GAPBOND_PERI_MITM_PROTECTION 0x401
+#define GAPBOND_PERI_IO_CAPABILITIES 0x402
+#define GAPBOND_PERI_BONDING_ENABLED 0x405
+#define GAPBOND_PAIRING_MODE_WAIT_FOR_REQ 0x01
+#define GAPBOND_IO_CAP_NO_INPUT_NO_OUTPUT 0x03
+
+bStatus_t GAPBondMgr_SetParameter(uint16_t param, uint8_t len, void *pValue);
+
+// GGS
+#define GGS_DEVICE_NAME_ATT 0
+#define GGS_APPEARANCE_ATT 1
+#define GGS_PERI_CONN_PARAM_ATT 4
+#define GATT_ALL_SERVICES 0xFFFFFFFF
+
+bStatus_t GGS_AddService(uint32_t services);
+bStatus_t GGS_SetParameter(uint8_t param, uint8_t len, void *value);
+
+// ATT
+#define ATT_MTU_SIZE 23
+#define ATT_BT_UUID_SIZE 2
+
+#define ATT_READ_REQ 0x0A
+#define ATT_READ_BLOB_REQ 0x0C
+#define ATT_WRITE_REQ 0x12
+#define ATT_HANDLE_VALUE_NOTI 0x1B
+#define ATT_WRITE_CMD 0x52
+#define ATT_MTU_UPDATED_EVENT 0x81
+
+#define ATT_ERR_INVALID_HANDLE 0x01
+#define ATT_ERR_READ_NOT_PERMITTED 0x02
+#define ATT_ERR_WRITE_NOT_PERMITTED 0x03
+#define ATT_ERR_INVALID_PDU 0x04
+#define ATT_ERR_INVALID_OFFSET 0x07
+#define ATT_ERR_ATTR_NOT_FOUND 0x0A
+#define ATT_ERR_ATTR_NOT_LONG 0x0B
+#define ATT_ERR_INVALID_VALUE_SIZE 0x0D
+#define ATT_ERR_INSUFFICIENT_RESOURCES 0x11
+#define ATT_ERR_INVALID_VALUE 0x80
+
+typedef struct {
+	uint16_t handle;
+	uint16_t len;
+	uint8_t *pValue;
+} attHandleValueNoti_t;
+
+typedef struct {
+	uint16_t clientRxMTU;
+} attExchangeMTUReq_t;
+
+// GATT
+#define GATT_PROP_BCAST 0x01
+#define GATT_PROP_READ 0x02
+#define GATT_PROP_WRITE_NO_RSP 0x04
+#define GATT_PROP_WRITE 0x08
+#define GATT_PROP_NOTIFY 0x10
+#define GATT_PROP_INDICATE 0x20
+
+#define GATT_PERMIT_READ 0x01
+#define GATT_PERMIT_WRITE 0x02
+#define GATT_PERMIT_ENCRYPT_READ 0x08
+#define GATT_PERMIT_ENCRYPT_WRITE 0x10
+
+#define GATT_CLIENT_CFG_NOTIFY 0x0001
+#define GATT_CLIENT_CFG_INDICATE 0x0002
+
+#define GATT_CLIENT_CHAR_CFG_UUID 0x2902
+#define GATT_MAX_ENCRYPT_KEY_SIZE 16
+
+#define GATT_NUM_ATTRS(attrs) (sizeof(attrs) / sizeof(gattAttribute_t))
+
+typedef struct {
+	uint8_t len;
+	const uint8_t *uuid;
+} gattAttrType_t;
+
+typedef struct attAttribute_t {
+	gattAttrType_t type;
+	uint8_t permissions;
+	uint16_t handle;
+	uint8_t *pValue;
+} gattAttribute_t;
+
+typedef struct {
+	uint16_t connHandle;
+	uint8_t value;
+} gattCharCfg_t;
+
+typedef union {
+	attExchangeMTUReq_t exchangeMTUReq;
+	attHandleValueNoti_t handleValueNoti;
+} gattMsg_t;
+
+typedef struct {
+	tmos_event_hdr_t hdr;
+	uint16_t connHandle;
+	uint8_t method;
+	gattMsg_t msg;
+} gattMsgEvent_t;
+
+typedef bStatus_t (*pfnGATTReadAttrCB_t)(uint16_t connHandle,
+					 gattAttribute_t *pAttr,
+					 uint8_t *pValue, uint16_t *pLen,
+					 uint16_t offset, uint16_t maxLen,
+					 uint8_t method);
+typedef bStatus_t (*pfnGATTWriteAttrCB_t)(uint16_t connHandle,
+					  gattAttribute_t *pAttr,
+					  uint8_t *pValue, uint16_t len,
+					  uint16_t offset, uint8_t method);
+typedef bStatus_t (*pfnGATTAuthorizeAttrCB_t)(uint16_t connHandle,
+					      gattAttribute_t *pAttr,
+					      uint8_t opcode);
+
+typedef struct {
+	pfnGATTReadAttrCB_t pfnReadAttrCB;
+	pfnGATTWriteAttrCB_t pfnWriteAttrCB;
+	pfnGATTAuthorizeAttrCB_t pfnAuthorizeAttrCB;
+} gattServiceCBs_t;
+
+extern const uint8_t primaryServiceUUID[ATT_BT_UUID_SIZE];
+extern const uint8_t characterUUID[ATT_BT_UUID_SIZE];
+extern const uint8_t charUserDescUUID[ATT_BT_UUID_SIZE];
+extern const uint8_t clientCharCfgUUID[ATT_BT_UUID_SIZE];
+
+bStatus_t GATTServApp_AddService(uint32_t services);
+bStatus_t GATTServApp_RegisterService(gattAttribute_t *pAttrs,
+				      uint16_t numAttrs, uint8_t encKeySize,
+				      gattServiceCBs_t *pServiceCBs);
+void GATTServApp_InitCharCfg(uint16_t connHandle, gattCharCfg_t *charCfgTbl);
+uint16_t GATTServApp_ReadCharCfg(uint16_t connHandle,
+				 gattCharCfg_t *charCfgTbl);
+bStatus_t GATTServApp_ProcessCCCWriteReq(uint16_t connHandle,
+					 gattAttribute_t *pAttr,
+					 uint8_t *pValue, uint16_t len,
+					 uint16_t offset, uint16_t validCfg);
+void *GATT_bm_alloc(uint16_t connHandle, uint8_t opcode, uint16_t size,
+		    uint16_t *pSizeAlloc, uint8_t flag);
+void GATT_bm_free(gattMsg_t *pMsg, uint8_t opcode);
+bStatus_t GATT_Notification(uint16_t connHandle, attHandleValueNoti_t *pNoti,
+			    uint8_t authenticated);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef _HOST_CH58X_COMMON_H_
+#define _HOST_CH58X_COMMON_H_
+
+// Host stand-in for the vendor CH58x_common.h, only what the firmware
+// sources under ble/, lib/ and forth/ actually use.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+#ifndef ENABLE
+#define ENABLE 1
+#endif
+#ifndef DISABLE
+#define DISABLE 0
+#endif
+
+#ifndef MIN
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+#define __HIGH_CODE
+#define __INTERRUPT
+
+#define R8_CHIP_ID 0x82
+
+// the ADC reads host_set_vdd()'s voltage
+void ADC_InterBATSampInit(void);
+uint16_t ADC_ExcutSingleConver(void);
+
+int host_printf(const char *fmt, ...);
+
+#ifdef DEBUG
+#define PRINT(X...) host_printf(X)
+#else
+#define PRINT(X...)
+#endif
+
+#endif
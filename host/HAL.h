@@ -0,0 +1,35 @@
+#ifndef _HOST_HAL_H_
+#define _HOST_HAL_H_
+
+// Host stand-in for the vendor HAL.h, the RTC and low power calls the
+// power manager uses. The RTC runs off the virtual clock in port.c and
+// the low power calls skip ahead to its trigger.
+
+#include "CH58x_common.h"
+
+#define FREQ_RTC 32000
+#define RTC_TIMER_MAX_VALUE 0xA8C00000
+#define US_TO_RTC(us) ((uint32_t)((us) * (FREQ_RTC / 1000) / 1000))
+#define MS_TO_RTC(ms) ((uint32_t)((ms) * (FREQ_RTC / 1000)))
+#define RTC_TO_US(clk) ((uint32_t)((uint64_t)(clk) * 1000000 / FREQ_RTC))
+#define RTC_TO_MS(clk) ((uint32_t)((uint64_t)(clk) * 1000 / FREQ_RTC))
+
+#define RB_PWR_RAM2K 0x01
+#define RB_PWR_RAM30K 0x02
+#define RB_PWR_EXTEND 0x04
+#define HSE_RCur_100 0
+
+extern volatile uint32_t RTCTigFlag;
+
+uint32_t RTC_GetCycle32k(void);
+void RTC_SetTignTime(uint32_t time);
+void LowPower_Idle(void);
+void LowPower_Halt(void);
+void LowPower_Sleep(uint8_t rm);
+void HSECFG_Current(int c);
+void SYS_DisableAllIrq(uint32_t *pirqv);
+void SYS_RecoverIrq(uint32_t irq_status);
+void HAL_SleepInit(void);
+uint32_t CH58X_LowPower(uint32_t time);
+
+#endif
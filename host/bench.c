@@ -0,0 +1,2543 @@
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include "CH58xBLE_LIB.h"
+#include "CONFIG.h"
+#include "HAL.h"
+#include "fifo8.h"
+#include "spsc.h"
+#include "pool.h"
+#include "stimer.h"
+#include "stepforth.h"
+#include "sf_sched.h"
+#include "sf_dict.h"
+#include "sf_native.h"
+#include "sf_outer.h"
+#include "sf_bench.h"
+#include "mcycle.h"
+#include "uart1.h"
+#include "matrix.h"
+#include "keymap.h"
+#include "ble.h"
+#include "host.h"
+
+// Benchmark harness for the host build. Each bench drives the real
+// firmware code through the port layer and returns how many units of
+// work it did, the runner turns that into wall clock ns/unit. Benches
+// also sanity check what they move so a broken fast path fails the run.
+
+enum {
+	CONSOLE_RNW_CHR_UUID = 0xFFC1,
+	CONSOLE_CTL_CHR_UUID = 0xFFC2,
+	CONSOLE_CTL_LEN = 14,
+	CONNPARAM_R_CHR_UUID = 0xFFE4,
+	CONNPARAM_LEN = 16,
+	SYSCLOCK_RN_CHR_UUID = 0xFFE2,
+	POWER_RW_CHR_UUID = 0xFFE5,
+	PERF_RW_CHR_UUID = 0xFFE6,
+	HID_REPORT_MAP_CHR_UUID = 0x2A4B,
+	HID_REPORT_CHR_UUID = 0x2A4D, // the input report comes first
+	HID_PROTOCOL_CHR_UUID = 0x2A4E,
+	HID_BOOT_IN_CHR_UUID = 0x2A22,
+	HID_BOOT_OUT_CHR_UUID = 0x2A32,
+	DEVINFO_PNP_ID_CHR_UUID = 0x2A50,
+	BATTERY_LEVEL_CHR_UUID = 0x2A19,
+	HID_REPORT_MAP_LEN = 63,
+	BENCH_LINKS = PERIPHERAL_MAX_CONNECTION,
+	BENCH_INTERVAL = 6, // x 1.25ms = 7.5ms
+	BENCH_FIFO8_SIZE = 96,
+	BENCH_FIFO8_BYTES = (1 << 24),
+	BENCH_SPSC_SIZE = 512,
+	BENCH_SPSC_BYTES = (1 << 24),
+	BENCH_FORTH_LOOPS = 65536,
+	BENCH_FORTH_RUNS = 64,
+	BENCH_FORTH_STEPS = 100,
+	BENCH_FORTH_SUITE_RUNS = 25,
+	// percent of cycles over the reference, host timings of the same
+	// binary spread by about 15% from process to process so only gross
+	// slowdowns show, dispatch counts are exact
+	BENCH_FORTH_SLOWER = 25,
+	BENCH_CALIBRATE_LOOPS = 1 << 18,
+	BENCH_CONSOLE_ROUNDS = 20000,
+	BENCH_STREAM_SECONDS = 20,
+	BENCH_STREAM_RATE = 20000, // B/s per link at the largest mtu
+	BENCH_SCHED_ROUNDS = 200,
+	BENCH_SCHED_GAP = 16,
+	BENCH_DICT_COLONS = 150,
+	BENCH_DICT_CONSTS = 200,
+	BENCH_DICT_LOOKUPS = 1 << 22,
+	BENCH_ECHO_ROUNDS = 200,
+	BENCH_PASTE_BYTES = 64 * 1024,
+	BENCH_PASTE_WRITES = 4, // write commands per connection event
+	BENCH_IDLE_SECONDS = 600,
+	BENCH_IDLE_WAKEUPS = 2, // per link and second, rssi polling
+	BENCH_TIMER_SECONDS = 10,
+	BENCH_CP_PICKY_SECONDS = 300,
+	BENCH_CP_PICKY_REQUESTS = 10, // backed off, not one per PARAM_UPDATE_DELAY
+	BENCH_SLOTS_MIN = 8, // links the slot table is checked with
+	BENCH_SLOTS_CHURN = 2000,
+	BENCH_SLOTS_LOOKUPS = 1 << 22,
+	BENCH_POWER_SECONDS = 60,
+	BENCH_POWER_SLEEP = 90, // percent of the time idle links sleep
+	BENCH_PROF_SECONDS = 5,
+	BENCH_TRACE_CALLS = 1 << 18,
+	BENCH_TRACE_FRAMES = 20, // fit the ring
+	BENCH_TRACE_FLOOD = 100, // do not
+	BENCH_UART_CAPTURE = 4096,
+	BENCH_UART_LINE = 64,
+	BENCH_UART_LINES = 8,
+	BENCH_UART_BURST = 3000,
+	BENCH_UARTCON_LINES = 2000,
+	BENCH_UARTCON_AHEAD = 64, // bytes the terminal has on the way
+	BENCH_UARTCON_HOLD = 200, // ticks the interpreter is held up
+	BENCH_MATRIX_SCANS = 200000,
+	BENCH_MATRIX_HOT = 48, // keys the random presses land on
+	BENCH_MATRIX_BUDGET = 5 * MCYCLE_PER_US, // a scan, without settling
+	BENCH_HID_KEYS = 400,
+	BENCH_HID_LOG = 16, // reports a link takes per round
+	BENCH_HID_HOLD = 30000, // us
+	BENCH_HID_PARKED = 4, // every fourth key lands on the parked matrix
+	// us, a connection interval to wait for, the debounce and the scan
+	// the key closed just after
+	BENCH_HID_LATENCY =
+		BENCH_INTERVAL * 1250 + (MATRIX_DEBOUNCE + 1) * 625,
+	BENCH_BATTERY_PERIOD = 96000, // ticks, ble.c samples it this often
+	BENCH_HID_KEY_A = 3 * 16 + 1, // usages 0x04, 0x16, 0x07 and 0x09
+	BENCH_HID_KEY_S = 3 * 16 + 2,
+	BENCH_HID_KEY_D = 3 * 16 + 3,
+	BENCH_HID_KEY_F = 3 * 16 + 4,
+	BENCH_HID_KEY_LSHIFT = 4 * 16,
+	BENCH_HID_KEY_ESC = 0,
+	TICKS_PER_SECOND = 1600,
+};
+
+extern struct ble_peri_slot ble_peri_slots[PERIPHERAL_MAX_CONNECTION];
+extern struct pool ConsolePool;
+extern struct stimer_list peri_timers;
+extern struct power_stats PowerStats;
+extern struct prof_site PeriProf[PROF_SITES];
+extern struct uart_console UartConsole;
+extern void peripheralPowerEnable(int on);
+
+struct bench {
+	const char *name;
+	const char *unit;
+	uint64_t (*fn)(void);
+};
+
+static int bench_failed;
+static int bench_verbose;
+static const char *bench_ref_in;
+static const char *bench_ref_out;
+static const char *bench_dump_out;
+static uint16_t bench_conn[BENCH_LINKS];
+static uint8_t bench_rx_seq[HOST_MAX_LINKS];
+static uint64_t bench_rx_lost;
+
+static uint64_t bench_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void bench_note(const char *fmt, ...)
+{
+	va_list ap;
+	printf("    ");
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+}
+
+static void bench_fail(const char *what)
+{
+	printf("    FAIL: %s\n", what);
+	bench_failed = 1;
+}
+
+static struct ble_peri_slot *bench_slot(uint16_t connHandle)
+{
+	int slotp = ble_peri_slots_find_by_connHandle(connHandle);
+	if (slotp < 0) {
+		return NULL;
+	}
+	return &ble_peri_slots[slotp];
+}
+
+static void bench_noti_sink(uint16_t connHandle, uint16_t handle,
+			    uint8_t *data, uint16_t len)
+{
+	int i;
+	// the stream is a byte counter, a jump means bytes were dropped
+	for (i = 0; i < len; i++) {
+		bench_rx_lost += (uint8_t)(data[i] - bench_rx_seq[connHandle]);
+		bench_rx_seq[connHandle] = data[i] + 1;
+	}
+}
+
+static void bench_links_up(int n)
+{
+	int i;
+	for (i = 0; i < n; i++) {
+		struct ble_peri_slot *slot;
+		bench_conn[i] = host_connect(BENCH_INTERVAL);
+		host_conn_param_update(bench_conn[i], BENCH_INTERVAL, 0, 100);
+		slot = bench_slot(bench_conn[i]);
+		fifo8_reset(&slot->conrx_fifo);
+		fifo8_reset(&slot->contx_fifo);
+		bench_rx_seq[bench_conn[i]] = 0;
+	}
+}
+
+static void bench_links_down(int n)
+{
+	int i;
+	for (i = 0; i < n; i++) {
+		host_disconnect(bench_conn[i], 0x13);
+	}
+	host_run(0);
+	if (host_gatt_buffers_in_use()) {
+		bench_fail("GATT buffers leaked");
+	}
+	if (ConsolePool.used) {
+		bench_fail("console pool blocks leaked");
+	}
+}
+
+static uint64_t bench_fifo8(void)
+{
+	struct fifo8 f;
+	uint8_t buf[BENCH_FIFO8_SIZE];
+	volatile uint32_t sum = 0;
+	uint64_t n;
+	int i;
+	f.buf = buf;
+	f.size = BENCH_FIFO8_SIZE;
+	fifo8_reset(&f);
+	for (n = 0; n < BENCH_FIFO8_BYTES; n += 64) {
+		for (i = 0; i < 64; i++) {
+			fifo8_push(&f, i);
+		}
+		for (i = 0; i < 64; i++) {
+			sum += fifo8_pop(&f);
+		}
+	}
+	return n;
+}
+
+static uint64_t bench_fifo8_buf(void)
+{
+	struct fifo8 f;
+	uint8_t buf[BENCH_FIFO8_SIZE];
+	uint8_t in[64], out[64];
+	uint64_t n;
+	int i;
+	for (i = 0; i < sizeof(in); i++) {
+		in[i] = i;
+	}
+	fifo8_init(&f, buf, BENCH_FIFO8_SIZE);
+	for (n = 0; n < BENCH_FIFO8_BYTES; n += sizeof(in)) {
+		fifo8_push_buf(&f, in, sizeof(in));
+		fifo8_pop_buf(&f, out, sizeof(out));
+		if (out[n & (sizeof(out) - 1)] != in[n & (sizeof(in) - 1)]) {
+			bench_fail("fifo8 span copy corrupted");
+			break;
+		}
+	}
+	return n;
+}
+
+// producer and consumer on separate threads stand in for an ISR and
+// the TMOS loop, the stream is a byte counter so any reordering, loss
+// or duplication shows up on the consumer side
+static struct spsc bench_spsc;
+
+static void *bench_spsc_producer(void *arg)
+{
+	uint8_t data[61];
+	uint8_t seq = 0;
+	uint64_t n = 0;
+	int i, len;
+	while (n < BENCH_SPSC_BYTES) {
+		if (n & 1) {
+			if (spsc_push(&bench_spsc, seq)) {
+				seq++;
+				n++;
+			} else {
+				sched_yield();
+			}
+			continue;
+		}
+		len = 1 + (n % sizeof(data));
+		for (i = 0; i < len; i++) {
+			data[i] = seq + i;
+		}
+		len = spsc_push_buf(&bench_spsc, data, len);
+		if (len == 0) {
+			sched_yield();
+		}
+		seq += len;
+		n += len;
+	}
+	return NULL;
+}
+
+static uint64_t bench_spsc_threads(void)
+{
+	static uint8_t buf[BENCH_SPSC_SIZE];
+	uint8_t out[97];
+	uint8_t seq = 0;
+	uint64_t n = 0;
+	uint64_t bad = 0;
+	pthread_t producer;
+	int i, len;
+	spsc_init(&bench_spsc, buf, sizeof(buf));
+	pthread_create(&producer, NULL, bench_spsc_producer, NULL);
+	while (n < BENCH_SPSC_BYTES) {
+		if (n & 2) {
+			int c = spsc_pop(&bench_spsc);
+			if (c < 0) {
+				sched_yield();
+				continue;
+			}
+			out[0] = c;
+			len = 1;
+		} else {
+			len = spsc_pop_buf(&bench_spsc, out, sizeof(out));
+			if (len == 0) {
+				sched_yield();
+			}
+		}
+		for (i = 0; i < len; i++) {
+			if (out[i] != seq) {
+				bad++;
+			}
+			seq = out[i] + 1;
+		}
+		n += len;
+	}
+	pthread_join(producer, NULL);
+	if (bad) {
+		bench_fail("spsc stream out of order");
+	}
+	return n;
+}
+
+// sum of 0..n-1 with a colon call per iteration, mixes literal, loop,
+// call and return dispatch
+static const sf_cell bench_forth_inner[] = {
+	SF_OP_DUP, SF_OP_INC, SF_OP_DROP, SF_OP_EXIT,
+};
+
+static const sf_cell bench_forth_sum[] = {
+	SF_OP_LIT, 0, SF_OP_LIT, BENCH_FORTH_LOOPS, SF_OP_LIT, 0, SF_OP_DO,
+	SF_OP_I, SF_OP_ADD, (sf_cell)bench_forth_inner, SF_OP_LOOP, -4,
+	SF_OP_HALT,
+};
+
+static uint64_t bench_stepforth(void)
+{
+	static struct sf_task t;
+	struct sf_machine m = { &t, NULL, NULL, NULL };
+	uint64_t steps = 0;
+	int run;
+	for (run = 0; run < BENCH_FORTH_RUNS; run++) {
+		sf_task_reset(&t);
+		sf_task_start(&t, bench_forth_sum);
+		while (t.state == SF_RUN) {
+			steps += stepforth(&m, BENCH_FORTH_STEPS);
+		}
+		if (t.err != SF_OK || sf_task_depth(&t) != 1 ||
+		    sf_task_pop(&t) != (sf_cell)BENCH_FORTH_LOOPS *
+						(BENCH_FORTH_LOOPS - 1) / 2) {
+			bench_fail("stepforth computed a wrong sum");
+			break;
+		}
+	}
+	return steps;
+}
+
+// Fixed integer work timed with mcycle next to the suite, host clocks
+// vary between runs and the comparison goes by the ratio to this.
+static uint32_t bench_calibrate(void)
+{
+	uint32_t best = 0, t, x;
+	volatile uint32_t sink;
+	int run, i;
+	for (run = 0; run < BENCH_FORTH_SUITE_RUNS; run++) {
+		t = mcycle();
+		for (i = 0, x = 1; i < BENCH_CALIBRATE_LOOPS; i++) {
+			x = x * 1664525 + 1013904223;
+		}
+		sink = x;
+		t = mcycle() - t;
+		if (run == 0 || t < best) {
+			best = t;
+		}
+	}
+	(void)sink;
+	return best;
+}
+
+// The Forth VM suite of forth/sf_bench.c. With -w the results are saved
+// as the reference, with -b they are checked against it: dispatching
+// more primitives or taking BENCH_FORTH_SLOWER percent more cycles than
+// the reference, both scaled by bench_calibrate(), fails the run.
+static uint64_t bench_forth(void)
+{
+	struct sf_bench_result r[SF_BENCH_NUM];
+	char line[SF_BENCH_LINE], name[16];
+	unsigned long steps, cycles, ref_calib;
+	uint32_t calib;
+	double slower;
+	uint64_t n = 0;
+	FILE *f;
+	int i;
+	calib = bench_calibrate();
+	if (sf_bench_run(r, BENCH_FORTH_SUITE_RUNS)) {
+		bench_fail("a suite program gave a wrong answer");
+	}
+	calib = MIN(calib, bench_calibrate());
+	for (i = 0; i < SF_BENCH_NUM; i++) {
+		sf_bench_format(&r[i], line, sizeof(line));
+		printf("    %s", line);
+		n += r[i].steps;
+	}
+	if (bench_ref_out) {
+		f = fopen(bench_ref_out, "w");
+		if (f == NULL) {
+			bench_fail("cannot write the reference");
+			return n;
+		}
+		fprintf(f, "calibrate 0 %lu\n", (unsigned long)calib);
+		for (i = 0; i < SF_BENCH_NUM; i++) {
+			fprintf(f, "%s %lu %lu\n", r[i].name,
+				(unsigned long)r[i].steps,
+				(unsigned long)r[i].cycles);
+		}
+		fclose(f);
+		bench_note("reference saved to %s", bench_ref_out);
+	}
+	if (bench_ref_in == NULL) {
+		return n;
+	}
+	f = fopen(bench_ref_in, "r");
+	if (f == NULL) {
+		bench_fail("no reference, run make forth-bench-ref first");
+		return n;
+	}
+	ref_calib = calib;
+	while (fscanf(f, "%15s %lu %lu", name, &steps, &cycles) == 3) {
+		if (strcmp(name, "calibrate") == 0) {
+			ref_calib = cycles;
+			continue;
+		}
+		for (i = 0; i < SF_BENCH_NUM; i++) {
+			if (strcmp(name, r[i].name) == 0) {
+				break;
+			}
+		}
+		if (i == SF_BENCH_NUM || !steps || !cycles) {
+			continue;
+		}
+		slower = 100.0 * r[i].cycles * ref_calib / calib / cycles - 100;
+		bench_note("%-7s prims %+6.1f%%, cycles %+6.1f%% against %s",
+			   name, 100.0 * r[i].steps / steps - 100, slower,
+			   bench_ref_in);
+		if (r[i].steps > steps) {
+			bench_fail("more dispatches than the reference");
+		}
+		if (slower > BENCH_FORTH_SLOWER) {
+			bench_fail("slower than the reference");
+		}
+	}
+	fclose(f);
+	return n;
+}
+
+static uint64_t bench_console_rx(void)
+{
+	uint8_t data[ATT_MTU_SIZE - 3];
+	uint8_t out[CONFIFO_BLOCKS_MAX * CONPOOL_BLOCK];
+	uint64_t bytes = 0;
+	int round, i, n;
+	for (i = 0; i < sizeof(data); i++) {
+		data[i] = i;
+	}
+	bench_links_up(BENCH_LINKS);
+	for (round = 0; round < BENCH_CONSOLE_ROUNDS; round++) {
+		for (i = 0; i < BENCH_LINKS; i++) {
+			struct ble_peri_slot *slot = bench_slot(bench_conn[i]);
+			host_att_write(bench_conn[i], CONSOLE_RNW_CHR_UUID,
+				       data, sizeof(data), ATT_WRITE_CMD);
+			n = fifo8_pop_buf(&slot->conrx_fifo, out, sizeof(out));
+			if (n != sizeof(data) || memcmp(out, data, n) != 0) {
+				bench_fail("console rx corrupted");
+			}
+			bytes += n;
+		}
+	}
+	bench_links_down(BENCH_LINKS);
+	return bytes;
+}
+
+// Every slot runs a script that emits a byte counter as fast as the
+// console takes it, first at the default MTU and then at the largest one
+// the buffers allow. The stack refusing notifications must not cost a
+// byte.
+static const sf_cell bench_console_stream[] = {
+	SF_OP_LIT, 0, SF_OP_DUP, SF_OP_EMIT, SF_OP_INC, SF_OP_BRANCH, -4,
+};
+
+static uint64_t bench_console_tx(void)
+{
+	static const uint16_t mtus[] = { ATT_MTU_SIZE, BLE_BUFF_MAX_LEN - 4 };
+	uint64_t bytes, notis, total = 0, rate = 0;
+	uint32_t t0, refused;
+	int m, i;
+	host_set_noti_sink(bench_noti_sink);
+	bench_rx_lost = 0;
+	for (m = 0; m < sizeof(mtus) / sizeof(mtus[0]); m++) {
+		bench_links_up(BENCH_LINKS);
+		for (i = 0; i < BENCH_LINKS; i++) {
+			struct ble_peri_slot *slot = bench_slot(bench_conn[i]);
+			host_ccc_enable(bench_conn[i], CONSOLE_RNW_CHR_UUID);
+			host_mtu_update(bench_conn[i], mtus[m]);
+			host_link_stats(bench_conn[i])->noti_bytes = 0;
+			host_link_stats(bench_conn[i])->noti_rejected = 0;
+			sf_task_reset(&slot->sft);
+			sf_task_start(&slot->sft, bench_console_stream);
+		}
+		sf_sched_wake();
+		t0 = host_now();
+		host_run(BENCH_STREAM_SECONDS * TICKS_PER_SECOND);
+		bytes = 0;
+		notis = 0;
+		refused = 0;
+		for (i = 0; i < BENCH_LINKS; i++) {
+			struct ble_peri_slot *slot = bench_slot(bench_conn[i]);
+			bytes += host_link_stats(bench_conn[i])->noti_bytes;
+			notis += host_link_stats(bench_conn[i])->noti_count;
+			refused += host_link_stats(bench_conn[i])->noti_rejected;
+			sf_task_reset(&slot->sft);
+		}
+		rate = bytes * TICKS_PER_SECOND / (host_now() - t0) /
+		       BENCH_LINKS;
+		bench_note("mtu %3u: %6llu B/s per link over the air, "
+			   "%llu B per notification, %u refused (virtual)",
+			   mtus[m], (unsigned long long)rate,
+			   (unsigned long long)bytes / MAX(notis, 1),
+			   (unsigned)refused);
+		bench_links_down(BENCH_LINKS);
+		total += bytes;
+	}
+	bench_note("%llu B lost in the notify path",
+		   (unsigned long long)bench_rx_lost);
+	if (bench_rx_lost) {
+		bench_fail("console tx lost bytes");
+	}
+	if (rate < BENCH_STREAM_RATE) {
+		bench_fail("console streams too slow at the largest mtu");
+	}
+	host_set_noti_sink(NULL);
+	return total;
+}
+
+// Slot 0 echoes its console while the others spin. The spinners must
+// split the CPU evenly, the echo must come back within a pass and once
+// only the echo is left waiting no passes may run.
+static const sf_cell bench_sched_echo[] = {
+	SF_OP_KEY, SF_OP_EMIT, SF_OP_BRANCH, -3,
+};
+
+static const sf_cell bench_sched_spin[] = {
+	SF_OP_LIT, 1, SF_OP_DROP, SF_OP_BRANCH, -4,
+};
+
+static uint64_t bench_sched(void)
+{
+	struct ble_peri_slot *echo;
+	uint32_t t, worst = 0, passes;
+	uint64_t steps = 0, lo = UINT64_MAX, hi = 0;
+	uint8_t c = 0, out;
+	int i, round;
+	bench_links_up(BENCH_LINKS);
+	for (i = 0; i < BENCH_LINKS; i++) {
+		struct ble_peri_slot *slot = bench_slot(bench_conn[i]);
+		slot->sfm.steps = 0;
+		slot->sfm.cycles = 0;
+		sf_task_reset(&slot->sft);
+		sf_task_start(&slot->sft,
+			      i ? bench_sched_spin : bench_sched_echo);
+	}
+	sf_sched_stats.pass_cycles_max = 0;
+	sf_sched_wake();
+	echo = bench_slot(bench_conn[0]);
+	for (round = 0; round < BENCH_SCHED_ROUNDS; round++) {
+		host_att_write(bench_conn[0], CONSOLE_RNW_CHR_UUID, &c, 1,
+			       ATT_WRITE_CMD);
+		t = host_now();
+		while (fifo8_used(&echo->contx_fifo) == 0 &&
+		       host_now() - t < TICKS_PER_SECOND) {
+			host_run(1);
+		}
+		worst = MAX(worst, host_now() - t);
+		if (fifo8_pop_buf(&echo->contx_fifo, &out, 1) != 1 ||
+		    out != c) {
+			bench_fail("echo script lost a byte");
+			break;
+		}
+		c++;
+		host_run(BENCH_SCHED_GAP);
+	}
+	for (i = 0; i < BENCH_LINKS; i++) {
+		struct ble_peri_slot *slot = bench_slot(bench_conn[i]);
+		steps += slot->sfm.steps;
+		if (i) {
+			lo = MIN(lo, slot->sfm.cycles);
+			hi = MAX(hi, slot->sfm.cycles);
+			sf_task_reset(&slot->sft);
+		}
+	}
+	bench_note("spinner cpu share min/max %.3f", (double)lo / hi);
+	bench_note("echo latency worst %u us, pass worst %u us (virtual)",
+		   (unsigned)worst * 625,
+		   (unsigned)(sf_sched_stats.pass_cycles_max / MCYCLE_PER_US));
+	if (lo * 5 < hi * 4) {
+		bench_fail("spinners did not share the cpu fairly");
+	}
+	host_run(1);
+	passes = sf_sched_stats.passes;
+	host_run(TICKS_PER_SECOND);
+	if (sf_sched_stats.passes != passes) {
+		bench_fail("scheduler kept running with no runnable task");
+	}
+	bench_links_down(BENCH_LINKS);
+	return steps;
+}
+
+// Slot 0 echoes its console with notifications on. Every byte typed has
+// to come back over the air by the first connection event after the
+// pass that echoed it, at varying phase against the connection events.
+static int bench_echo_got;
+static uint8_t bench_echo_byte;
+
+static void bench_echo_sink(uint16_t connHandle, uint16_t handle,
+			    uint8_t *data, uint16_t len)
+{
+	bench_echo_got += len;
+	bench_echo_byte = data[0];
+}
+
+static uint64_t bench_console_echo(void)
+{
+	struct ble_peri_slot *slot;
+	uint32_t t, lat, worst = 0, sum = 0;
+	uint8_t c;
+	int round;
+	bench_links_up(1);
+	slot = bench_slot(bench_conn[0]);
+	host_ccc_enable(bench_conn[0], CONSOLE_RNW_CHR_UUID);
+	host_set_noti_sink(bench_echo_sink);
+	sf_task_reset(&slot->sft);
+	sf_task_start(&slot->sft, bench_sched_echo);
+	sf_sched_wake();
+	host_run(1);
+	for (round = 0; round < BENCH_ECHO_ROUNDS; round++) {
+		c = round;
+		bench_echo_got = 0;
+		host_att_write(bench_conn[0], CONSOLE_RNW_CHR_UUID, &c, 1,
+			       ATT_WRITE_CMD);
+		t = host_now();
+		while (bench_echo_got == 0 &&
+		       host_now() - t < TICKS_PER_SECOND) {
+			host_run(1);
+		}
+		lat = host_now() - t;
+		if (bench_echo_got != 1 || bench_echo_byte != c) {
+			bench_fail("echo did not come back as one notification");
+			break;
+		}
+		worst = MAX(worst, lat);
+		sum += lat;
+		host_run(round % 7 + 1);
+	}
+	bench_note("key to air avg %u us, worst %u us at %u us interval "
+		   "(virtual)",
+		   (unsigned)(sum * 625 / BENCH_ECHO_ROUNDS),
+		   (unsigned)worst * 625, BENCH_INTERVAL * 1250);
+	if (worst > BENCH_INTERVAL * 2) {
+		bench_fail("echo waited past the next connection event");
+	}
+	sf_task_reset(&slot->sft);
+	host_set_noti_sink(NULL);
+	bench_links_down(1);
+	return round;
+}
+
+// A client pastes into slot 0's echoing console with write commands, as
+// many per connection event as it may, but never past the credit limit
+// the CTL notifications gave it. Nothing may be dropped and the echo
+// must come back whole. Then it ignores the credits and the overrun has
+// to show in the dropped count.
+static uint16_t bench_ctl_handle;
+static uint32_t bench_credit_limit;
+static int bench_credit_notis;
+
+static uint32_t bench_le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void bench_paste_sink(uint16_t connHandle, uint16_t handle,
+			     uint8_t *data, uint16_t len)
+{
+	if (handle != bench_ctl_handle) {
+		bench_noti_sink(connHandle, handle, data, len);
+		return;
+	}
+	if (len == CONSOLE_CTL_LEN) {
+		bench_credit_limit = bench_le32(data + 2);
+		bench_credit_notis++;
+	}
+}
+
+// write n bytes of the counter stream, as many as fit one write each
+static uint32_t bench_paste(uint16_t conn, uint32_t sent, int64_t n)
+{
+	uint8_t data[BLE_BUFF_MAX_LEN];
+	int i, k, len;
+	for (k = 0; k < BENCH_PASTE_WRITES && n > 0; k++) {
+		len = MIN(n, host_link_stats(conn)->mtu - 3);
+		for (i = 0; i < len; i++) {
+			data[i] = sent + i;
+		}
+		host_att_write(conn, CONSOLE_RNW_CHR_UUID, data, len,
+			       ATT_WRITE_CMD);
+		sent += len;
+		n -= len;
+	}
+	return sent;
+}
+
+static uint64_t bench_console_paste(void)
+{
+	struct ble_peri_slot *slot;
+	uint8_t ctl[CONSOLE_CTL_LEN];
+	uint16_t conn, len = sizeof(ctl);
+	uint32_t sent = 0, events, t0, t1, echoed, blast;
+	bench_ctl_handle = host_att_handle(CONSOLE_CTL_CHR_UUID);
+	bench_links_up(1);
+	conn = bench_conn[0];
+	slot = bench_slot(conn);
+	host_mtu_update(conn, BLE_BUFF_MAX_LEN - 4);
+	host_ccc_enable(conn, CONSOLE_RNW_CHR_UUID);
+	host_set_noti_sink(bench_paste_sink);
+	bench_rx_lost = 0;
+	bench_credit_limit = 0;
+	bench_credit_notis = 0;
+	sf_task_reset(&slot->sft);
+	sf_task_start(&slot->sft, bench_sched_echo);
+	sf_sched_wake();
+	host_ccc_enable(conn, CONSOLE_CTL_CHR_UUID);
+	t0 = host_now();
+	events = host_link_stats(conn)->conn_events;
+	while (sent < BENCH_PASTE_BYTES &&
+	       host_now() - t0 < 60 * TICKS_PER_SECOND) {
+		host_run(1);
+		if (host_link_stats(conn)->conn_events == events) {
+			continue;
+		}
+		events = host_link_stats(conn)->conn_events;
+		sent = bench_paste(conn, sent,
+				   MIN((int64_t)bench_credit_limit - sent,
+				       BENCH_PASTE_BYTES - sent));
+	}
+	t1 = host_now();
+	host_run(TICKS_PER_SECOND);
+	echoed = host_link_stats(conn)->noti_bytes -
+		 bench_credit_notis * CONSOLE_CTL_LEN;
+	host_att_read(conn, CONSOLE_CTL_CHR_UUID, ctl, &len, sizeof(ctl));
+	bench_note("%u B pasted at %llu B/s with %d credit notifications, "
+		   "%u accepted %u dropped (virtual)",
+		   (unsigned)sent,
+		   (unsigned long long)sent * TICKS_PER_SECOND /
+			   MAX(t1 - t0, 1),
+		   bench_credit_notis, (unsigned)bench_le32(ctl + 6),
+		   (unsigned)bench_le32(ctl + 10));
+	bench_note("rx fifo grew to %u B, pool peak %u of %u blocks",
+		   slot->conrx_fifo.size, ConsolePool.peak, ConsolePool.num);
+	if (sent != BENCH_PASTE_BYTES || bench_le32(ctl + 6) != sent ||
+	    bench_le32(ctl + 10) != 0) {
+		bench_fail("paste within credits lost bytes on the way in");
+	}
+	if (echoed != sent || bench_rx_lost) {
+		bench_fail("echo of the paste came back incomplete");
+	}
+
+	// and now without looking at the credits
+	for (blast = 0; blast < BENCH_PASTE_BYTES / 16;) {
+		blast = bench_paste(conn, blast, BENCH_PASTE_BYTES);
+		host_run(BENCH_INTERVAL * 2);
+	}
+	len = sizeof(ctl);
+	host_att_read(conn, CONSOLE_CTL_CHR_UUID, ctl, &len, sizeof(ctl));
+	bench_note("%u B blasted past the credits, %u dropped",
+		   (unsigned)blast, (unsigned)bench_le32(ctl + 10));
+	if (bench_le32(ctl + 10) == 0 ||
+	    bench_le32(ctl + 6) + bench_le32(ctl + 10) != sent + blast) {
+		bench_fail("overrun bytes not counted");
+	}
+	sf_task_reset(&slot->sft);
+	host_set_noti_sink(NULL);
+	bench_links_down(1);
+	return sent;
+}
+
+// start a bench from an empty dictionary and native code space, there is
+// no forget and the benches would fill them up between them
+static void bench_forth_reset(void)
+{
+	sf_dict_reset();
+	sf_native_reset();
+}
+
+// Type a line into slot 0's console as a client would, in write sized
+// pieces, and collect the interpreter's reply up to the end of its line.
+// Returns the virtual ticks from the last piece to the reply.
+static uint32_t bench_console_line(const char *line, char *out, int size)
+{
+	struct ble_peri_slot *slot = bench_slot(bench_conn[0]);
+	int len = strlen(line), n = 0, i;
+	uint32_t t;
+	for (i = 0; i < len; i += ATT_MTU_SIZE - 3) {
+		host_att_write(bench_conn[0], CONSOLE_RNW_CHR_UUID,
+			       (uint8_t *)line + i,
+			       MIN(len - i, ATT_MTU_SIZE - 3), ATT_WRITE_CMD);
+		host_run(0);
+	}
+	t = host_now();
+	while (host_now() - t < TICKS_PER_SECOND) {
+		n += fifo8_pop_buf(&slot->contx_fifo, (uint8_t *)out + n,
+				   size - 1 - n);
+		if (n && out[n - 1] == '\n') {
+			break;
+		}
+		host_run(1);
+	}
+	out[n] = 0;
+	return host_now() - t;
+}
+
+static const char *const bench_dict_lines[][2] = {
+	{ "w7 w100 + c42 + .\n", "149  ok\n" },
+	{ ": sq dup * ; 7 sq .\n", "49  ok\n" },
+	{ ": fact 1 swap 1+ 1 do i * loop ; 5 fact .\n", "120  ok\n" },
+	{ ": ab dup 0< if negate then ; -5 ab . 6 ab .\n", "5 6  ok\n" },
+	{ ": sgn 0< if -1 else 1 then ; -3 sgn . 3 sgn .\n",
+	  "-1 1  ok\n" },
+	{ ": cnt 0 begin 1+ dup 10 = until ; cnt .\n", "10  ok\n" },
+	{ ": odd 0 begin dup 7 < while 1+ repeat ; odd .\n", "7  ok\n" },
+	{ "variable v $2a v ! v @ . ( comment ) \\ rest\n", "42  ok\n" },
+	{ ": down 0 10 do i -3 +loop ; down . . . .\n", "1 4 7 10  ok\n" },
+	// a step of a quarter of the cell range wraps index - limit from
+	// the largest cell to the smallest and keeps looping
+	{ ": h -1 1 rshift 2 / 1+ ; : wrap 0 0 h do 1+ h +loop ; wrap .\n",
+	  "3  ok\n" },
+	{ ": Shout 72 EMIT 105 emit ; shout\n", "Hi ok\n" },
+	{ "1 0 /\n", "div0\n" },
+	{ "frob\n", "frob ?\n" },
+	{ ": half 2 / ; -9 half .\n", "-4  ok\n" },
+	{ "depth .\n", "0  ok\n" },
+};
+
+// Define a few hundred words over the console, check that the
+// interpreter compiles and runs code correctly and time the lookups.
+static uint64_t bench_forth_dict(void)
+{
+	static char names[BENCH_DICT_COLONS * 2][8];
+	char line[64], out[64];
+	uint32_t worst = 0, cycles;
+	struct sf_word w;
+	uint64_t t;
+	int i, n;
+	bench_forth_reset();
+	bench_links_up(1);
+	for (i = 0; i < BENCH_DICT_COLONS; i++) {
+		snprintf(line, sizeof(line), ": w%d %d ;\n", i, i);
+		bench_console_line(line, out, sizeof(out));
+	}
+	for (i = 0; i < BENCH_DICT_CONSTS; i++) {
+		snprintf(line, sizeof(line), "%d constant c%d\n", i, i);
+		bench_console_line(line, out, sizeof(out));
+	}
+	bench_note("%d user words defined", sf_dict_words());
+	cycles = bench_slot(bench_conn[0])->sfm.cycles;
+	n = sizeof(bench_dict_lines) / sizeof(bench_dict_lines[0]);
+	for (i = 0; i < n; i++) {
+		worst = MAX(worst, bench_console_line(bench_dict_lines[i][0],
+						      out, sizeof(out)));
+		if (strcmp(out, bench_dict_lines[i][1]) != 0) {
+			bench_note("%s-> %s", bench_dict_lines[i][0], out);
+			bench_fail("interpreter gave a wrong answer");
+		}
+	}
+	cycles = bench_slot(bench_conn[0])->sfm.cycles - cycles;
+	bench_note("%.1f us interpreting per line, reply within %u us "
+		   "(virtual)",
+		   (double)cycles / n / MCYCLE_PER_US, (unsigned)worst * 625);
+	for (i = 0; i < BENCH_DICT_COLONS * 2; i++) {
+		snprintf(names[i], sizeof(names[i]), "%c%d", (i & 1) ? 'w' : 'c',
+			 i >> 1);
+	}
+	t = bench_ns();
+	for (i = 0; i < BENCH_DICT_LOOKUPS; i++) {
+		// a user word, then a built-in
+		const char *name = names[i % (BENCH_DICT_COLONS * 2)];
+		if (!sf_dict_find(name, strlen(name), &w) ||
+		    !sf_dict_find("swap", 4, &w) || w.kind != SF_W_PRIM ||
+		    w.value != SF_OP_SWAP) {
+			bench_fail("lookup missed");
+			break;
+		}
+	}
+	t = bench_ns() - t;
+	bench_links_down(1);
+	return (uint64_t)i * 2;
+}
+
+static const char *const bench_fuse_words[][2] = {
+	{ ": bits 0 swap begin dup while dup 1 and rot + swap 1 rshift "
+	  "repeat drop ;\n", "$7fff bits . 12345 bits .\n" },
+	{ ": mx over over < if swap then drop ;\n", "3 8 mx . -3 -8 mx .\n" },
+	{ ": sum 0 200 0 do v @ + loop ;\n", "3 v ! sum .\n" },
+	{ ": clz 0 begin 1 + over over rshift 0= until nip ;\n",
+	  "1000 clz . 7 clz .\n" },
+	{ ": pr 2 begin over over dup * < 0= while over over mod 0=\n"
+	  "if drop drop 0 exit then 1 + repeat drop drop 1 ;\n"
+	  ": primes 0 1000 2 do i pr + loop ;\n", "primes .\n" },
+};
+
+#ifdef SF_PROFILE
+static const char *const bench_op_names[SF_OP_NUM + 1] = {
+#define BENCH_OP_NAME(op, name) name,
+	SF_PRIMITIVES(BENCH_OP_NAME)
+#undef BENCH_OP_NAME
+	"(call)",
+};
+
+static int bench_gram_cmp(const void *a, const void *b)
+{
+	return ((const struct sf_gram *)b)->count -
+	       ((const struct sf_gram *)a)->count;
+}
+
+// the most frequent pairs and triples of a machine
+static void bench_prof_print(struct sf_machine *m, int n)
+{
+	static struct sf_gram g[SF_PROF_GRAMS];
+	int i, k;
+	memcpy(g, m->prof.gram, sizeof(g));
+	qsort(g, SF_PROF_GRAMS, sizeof(g[0]), bench_gram_cmp);
+	for (i = 0; i < n && g[i].count; i++) {
+		printf("    %8u ", (unsigned)g[i].count);
+		for (k = g[i].key >> 24; k > 0; k--) {
+			printf(" %s", bench_op_names[g[i].key >> 8 * (k - 1) &
+						     0xff]);
+		}
+		printf("\n");
+	}
+	if (m->prof.lost) {
+		bench_note("%u grams did not fit", (unsigned)m->prof.lost);
+	}
+}
+#endif
+
+// Compile the same words without and with the peephole pass, answers must
+// match and the fused code should need fewer dispatches. An SF_PROFILE=1
+// build also prints the n-grams the unfused code executed.
+static uint64_t bench_fuse(void)
+{
+	static char ref[sizeof(bench_fuse_words) /
+			sizeof(bench_fuse_words[0])][64];
+	struct sf_machine *m;
+	char out[64];
+	uint32_t steps[2] = { 0, 0 }, s;
+	int i, fuse, n;
+	bench_forth_reset();
+	bench_links_up(1);
+	m = &bench_slot(bench_conn[0])->sfm;
+	bench_console_line("variable v\n", out, sizeof(out));
+	n = sizeof(bench_fuse_words) / sizeof(bench_fuse_words[0]);
+	for (fuse = 0; fuse < 2; fuse++) {
+		sf_outer_fuse(fuse);
+#ifdef SF_PROFILE
+		sf_prof_reset(m);
+#endif
+		for (i = 0; i < n; i++) {
+			bench_console_line(bench_fuse_words[i][0], out,
+					   sizeof(out));
+			s = m->steps;
+			bench_console_line(bench_fuse_words[i][1],
+					   fuse ? out : ref[i], sizeof(out));
+			steps[fuse] += m->steps - s;
+			if (fuse && strcmp(out, ref[i]) != 0) {
+				bench_note("%s-> %s, unfused %s",
+					   bench_fuse_words[i][1], out, ref[i]);
+				bench_fail("fused code gave a different answer");
+			}
+		}
+#ifdef SF_PROFILE
+		if (!fuse) {
+			bench_prof_print(m, 16);
+		}
+#endif
+	}
+	sf_outer_fuse(1);
+	bench_note("%u dispatches unfused, %u fused (%.0f%% fewer)",
+		   (unsigned)steps[0], (unsigned)steps[1],
+		   100.0 - 100.0 * steps[1] / steps[0]);
+	bench_links_down(1);
+	return steps[1];
+}
+
+static const char *const bench_native_words[][2] = {
+	{ ": tri 0 swap 0 do i + loop ;\n", "1000 tri .\n" },
+	{ ": fib 0 1 rot 0 do over + swap loop drop ;\n", "40 fib .\n" },
+	{ ": gcd begin dup while swap over mod repeat drop ;\n",
+	  "1071 462 gcd .\n" },
+	{ ": mx over over < if swap then drop ;\n", "3 8 mx . -3 -8 mx .\n" },
+	{ ": dn 0 10 do i -3 +loop ;\n", "dn . . . .\n" },
+	// cells are 64 bits wide on the host, keep clear of bit 31
+	{ ": mix $1234567 xor 3 lshift 1 rshift 7 - -100 + ;\n",
+	  "5 mix . 99 mix .\n" },
+	{ ": grid 0 4 0 do 3 0 do i j * + loop loop ;\n", "grid .\n" },
+	{ ": sq dup * ;\n", "7 sq .\n" },
+	{ ": sq2 sq sq 1 - ;\n", "3 sq2 .\n" },
+	{ ": deep 1 2 3 4 5 6 7 8 9 + + + + + + + + ;\n", "deep depth . .\n" },
+	{ ": clz 0 begin 1 + over over rshift 0= until nip ;\n",
+	  "1000 clz . 7 clz .\n" },
+	{ ": nz 0= if 1 else 2 then $12345 + ;\n", "0 nz . 5 nz .\n" },
+};
+
+static const char *const bench_native_faults[][2] = {
+	{ ": spin begin again ; native spin\n", "native\n" },
+	{ ": dd drop drop ; native 1 dd\n", "native\n" },
+	{ ": z 0 / ; native 1 z\n", "native\n" },
+	{ ": hi 72 emit ; native\n", "native not possible\n" },
+	{ "native\n", "native not possible\n" },
+};
+
+// A word compiled from a known thread, for an exact listing: 5 + folds
+// into one addi, 3 0 do i + loop keeps its frame on the machine stack.
+static const sf_cell bench_native_probe[] = {
+	SF_OP_LIT, 5, SF_OP_ADD, SF_OP_LIT, 3, SF_OP_LIT, 0, SF_OP_DO,
+	SF_OP_I, SF_OP_ADD, SF_OP_LOOP, -3, SF_OP_EXIT,
+};
+
+static const char *const bench_native_probe_asm[] = {
+	"addi sp, sp, -16",	// prologue
+	"sw ra, 12(sp)",
+	"addi t0, t0, 5",	// 5 +
+	"addi a0, a0, -4",
+	"sw t0, 0(a0)",
+	"li t0, 3",	// 3 0
+	"addi a0, a0, -4",
+	"sw t0, 0(a0)",
+	"li t0, 0",
+	"sw t0, 0(sp)",	// do
+	"lw t1, 0(a0)",
+	"sw t1, 4(sp)",
+	"lw t0, 4(a0)",
+	"addi a0, a0, 8",
+	"bltu a0, a1, 84",	// loop start
+	"bltu a2, a0, 80",
+	"addi a0, a0, -4",	// i +
+	"sw t0, 0(a0)",
+	"lw t0, 0(sp)",
+	"lw t1, 0(a0)",
+	"addi a0, a0, 4",
+	"add t0, t1, t0",
+	"lw t1, 0(sp)",	// loop
+	"lw t2, 4(sp)",
+	"addi t1, t1, 1",
+	"sw t1, 0(sp)",
+	"beq t1, t2, 16",
+	"addi a3, a3, -1",
+	"beqz a3, 28",
+	"j -60",
+	"bltu a0, a1, 20",	// epilogue
+	"bltu a2, a0, 16",
+	"lw ra, 12(sp)",
+	"addi sp, sp, 16",
+	"ret",
+	"li a0, 0",	// fault
+	"j -16",
+};
+
+// Check the generated encodings against an independent disassembler, the
+// emulator alone would agree with its own bugs. Everything compiled must
+// decode, and the probe word must decode to exactly the listing above,
+// registers, offsets and all.
+static void bench_native_disasm(int verbose)
+{
+	char in[] = "/tmp/fw_host_nativeXXXXXX";
+	char out[] = "/tmp/fw_host_nativeXXXXXX";
+	const uint32_t *code;
+	char cmd[256], buf[160], *p;
+	int size, start, i, n = 0, bad = 0, fd;
+	int lines = sizeof(bench_native_probe_asm) /
+		    sizeof(bench_native_probe_asm[0]);
+	void *fn;
+	FILE *f;
+	if (system("command -v llvm-mc >/dev/null 2>&1") != 0) {
+		bench_fail("llvm-mc not found, encodings not cross checked");
+		return;
+	}
+	fn = sf_native_compile(bench_native_probe,
+			       sizeof(bench_native_probe) /
+				       sizeof(bench_native_probe[0]));
+	code = sf_native_code(&size);
+	if (fn == NULL) {
+		bench_fail("probe word not compiled");
+		return;
+	}
+	start = (const uint32_t *)fn - code;
+	fd = mkstemp(in);
+	if (fd < 0 || (f = fdopen(fd, "w")) == NULL) {
+		bench_fail("no temporary file for llvm-mc");
+		return;
+	}
+	for (i = 0; i < size * 4; i++) {
+		fprintf(f, "0x%02x%c", ((uint8_t *)code)[i],
+			(i & 3) == 3 ? '\n' : ' ');
+	}
+	fclose(f);
+	fd = mkstemp(out);
+	if (fd < 0) {
+		unlink(in);
+		bench_fail("no temporary file for llvm-mc");
+		return;
+	}
+	close(fd);
+	snprintf(cmd, sizeof(cmd),
+		 "llvm-mc --disassemble -triple=riscv32 -mattr=+m <%s >%s 2>&1",
+		 in, out);
+	bad = system(cmd) != 0;
+	f = fopen(out, "r");
+	while (f && fgets(buf, sizeof(buf), f)) {
+		// "\taddi\tt0, t0, 5" to "addi t0, t0, 5"
+		for (p = buf; *p == '\t' || *p == ' '; p++) {
+		}
+		p[strcspn(p, "\n")] = 0;
+		if (*p == '.' || *p == 0) {
+			continue;
+		}
+		if (strstr(p, "invalid") || strstr(p, "warning")) {
+			bad = 1;
+		}
+		if (strchr(p, '\t')) {
+			*strchr(p, '\t') = ' ';
+		}
+		if (n >= start && n < start + lines &&
+		    strcmp(p, bench_native_probe_asm[n - start]) != 0) {
+			bench_note("probe +%d: %s, want %s", n - start, p,
+				   bench_native_probe_asm[n - start]);
+			bad = 1;
+		}
+		if (verbose) {
+			printf("\t%4d %s\n", n, p);
+		}
+		n++;
+	}
+	if (f) {
+		fclose(f);
+	}
+	unlink(in);
+	unlink(out);
+	if (bad || n != size || start + lines != size) {
+		bench_fail("llvm-mc disagrees with the generated code");
+	}
+	bench_note("%d instructions cross checked with llvm-mc, %d exactly",
+		   size, lines);
+}
+
+// Run each word threaded, compile it to native code and run it again:
+// the answers must match. Reports threaded steps against native steps
+// plus the emulated rv32 instructions, which is what the MCU would run.
+static uint64_t bench_native(void)
+{
+	struct sf_machine *m;
+	char ref[64], out[64];
+	uint32_t steps[2];
+	uint64_t insns;
+	int i, n;
+	bench_forth_reset();
+	bench_links_up(1);
+	m = &bench_slot(bench_conn[0])->sfm;
+	n = sizeof(bench_native_words) / sizeof(bench_native_words[0]);
+	for (i = 0; i < n; i++) {
+		bench_console_line(bench_native_words[i][0], out, sizeof(out));
+		steps[0] = m->steps;
+		bench_console_line(bench_native_words[i][1], ref, sizeof(ref));
+		steps[0] = m->steps - steps[0];
+		bench_console_line("native\n", out, sizeof(out));
+		if (strcmp(out, " ok\n") != 0) {
+			bench_note("%s-> %s", bench_native_words[i][0], out);
+			bench_fail("word not compiled");
+			continue;
+		}
+		steps[1] = m->steps;
+		insns = host_rv32_retired();
+		bench_console_line(bench_native_words[i][1], out, sizeof(out));
+		steps[1] = m->steps - steps[1];
+		insns = host_rv32_retired() - insns;
+		if (strcmp(out, ref) != 0) {
+			bench_note("%s-> %s, threaded %s", bench_native_words[i][1],
+				   out, ref);
+			bench_fail("native code gave a different answer");
+		}
+		bench_note("%-12.*s %6u steps threaded, %3u steps + %6llu insns "
+			   "native", (int)strcspn(bench_native_words[i][0] + 2, " "),
+			   bench_native_words[i][0] + 2, (unsigned)steps[0],
+			   (unsigned)steps[1], (unsigned long long)insns);
+	}
+	for (i = 0; i < sizeof(bench_native_faults) /
+			sizeof(bench_native_faults[0]); i++) {
+		bench_console_line(bench_native_faults[i][0], out, sizeof(out));
+		if (strcmp(out, bench_native_faults[i][1]) != 0) {
+			bench_note("%s-> %s", bench_native_faults[i][0], out);
+			bench_fail("native fault not caught");
+		}
+	}
+	bench_native_disasm(bench_verbose);
+	bench_links_down(1);
+	return n;
+}
+
+static uint64_t bench_tmos_idle(void)
+{
+	uint32_t d0, w0, w;
+	uint64_t n;
+	bench_links_up(BENCH_LINKS);
+	d0 = host_dispatches();
+	w0 = host_wakeups();
+	host_run(BENCH_IDLE_SECONDS * TICKS_PER_SECOND);
+	n = host_dispatches() - d0;
+	w = host_wakeups() - w0;
+	bench_note("%.1f dispatches/s, %.2f wakeups/s with %d idle links "
+		   "(virtual)", (double)n / BENCH_IDLE_SECONDS,
+		   (double)w / BENCH_IDLE_SECONDS, BENCH_LINKS);
+	if (n > BENCH_IDLE_SECONDS * BENCH_LINKS * BENCH_IDLE_WAKEUPS) {
+		bench_fail("idle links keep waking up");
+	}
+	// the rssi round of all links is one wakeup
+	if (w > BENCH_IDLE_SECONDS) {
+		bench_fail("idle links wake up one by one");
+	}
+	bench_links_down(BENCH_LINKS);
+	return n;
+}
+
+// timer wakeups and soft timer runs per second over the next seconds
+static void bench_timer_rate(const char *what, int seconds, double *wake,
+			     double *runs)
+{
+	uint32_t w = host_wakeups(), r = peri_timers.runs;
+	host_run(seconds * TICKS_PER_SECOND);
+	*wake = (double)(host_wakeups() - w) / seconds;
+	*runs = (double)(peri_timers.runs - r) / seconds;
+	bench_note("%-26s %6.1f wakeups/s for %6.1f timer runs/s (virtual)",
+		   what, *wake, *runs);
+}
+
+// Every link notifies the clock and reads its RSSI. Links on the same
+// interval must share their wakeups, on two intervals the slack still
+// merges most, and with the notifications off only the RSSI round is
+// left, one wakeup for all links.
+static uint64_t bench_timers(void)
+{
+	uint32_t runs0 = peri_timers.runs;
+	double wake, runs;
+	int i;
+	// the links stay on the intervals they are put on
+	host_set_central_limits(0, 0);
+	bench_links_up(BENCH_LINKS);
+	for (i = 0; i < BENCH_LINKS; i++) {
+		host_ccc_enable(bench_conn[i], SYSCLOCK_RN_CHR_UUID);
+	}
+	bench_timer_rate("clock on, one interval", BENCH_TIMER_SECONDS,
+			 &wake, &runs);
+	if (wake * BENCH_LINKS > runs * 1.1) {
+		bench_fail("links on one interval did not share wakeups");
+	}
+	for (i = 0; i < BENCH_LINKS; i += 2) {
+		host_conn_param_update(bench_conn[i], BENCH_INTERVAL + 3, 0,
+				       100);
+	}
+	bench_timer_rate("clock on, two intervals", BENCH_TIMER_SECONDS,
+			 &wake, &runs);
+	if (wake * BENCH_LINKS > runs * 2) {
+		bench_fail("links on two intervals did not share wakeups");
+	}
+	for (i = 0; i < BENCH_LINKS; i++) {
+		host_ccc_disable(bench_conn[i], SYSCLOCK_RN_CHR_UUID);
+	}
+	host_run(TICKS_PER_SECOND);
+	bench_timer_rate("clock off", BENCH_TIMER_SECONDS * 6, &wake, &runs);
+	if (wake > 1) {
+		bench_fail("quiet links still wake up apart");
+	}
+	bench_note("%u of %u timer runs found nothing to do",
+		   (unsigned)peri_timers.stops, (unsigned)peri_timers.runs);
+	bench_links_down(BENCH_LINKS);
+	host_set_central_limits(0, 0xffff);
+	if (peri_timers.head != NULL) {
+		bench_fail("timers left running without links");
+	}
+	return peri_timers.runs - runs0;
+}
+
+// connection events per second the peripheral woke for on every link,
+// over the next seconds of virtual time
+static double bench_cp_radio(int seconds)
+{
+	uint32_t n = 0;
+	int i;
+	for (i = 0; i < BENCH_LINKS; i++) {
+		n -= host_link_stats(bench_conn[i])->radio_events;
+	}
+	host_run(seconds * TICKS_PER_SECOND);
+	for (i = 0; i < BENCH_LINKS; i++) {
+		n += host_link_stats(bench_conn[i])->radio_events;
+	}
+	return (double)n / seconds / BENCH_LINKS;
+}
+
+static int bench_cp_all(int profile)
+{
+	int i;
+	for (i = 0; i < BENCH_LINKS; i++) {
+		if (bench_slot(bench_conn[i])->cp.profile != profile) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void bench_cp_key(uint16_t conn)
+{
+	uint8_t c = ' ';
+	host_att_write(conn, CONSOLE_RNW_CHR_UUID, &c, 1, ATT_WRITE_CMD);
+}
+
+// The links start typing fast and must drop to the idle profile once
+// quiet, with the radio waking far less. A key brings one back within a
+// few connection events, keys a little slower than the idle timeout
+// keep it there without a request each. A central refusing both
+// profiles gets a backed off trickle of requests, and the counters
+// read over sysinfo match the manager's.
+static uint64_t bench_conn_param(void)
+{
+	struct ble_conn_param *cp;
+	uint8_t value[CONNPARAM_LEN];
+	uint16_t len, requests;
+	double active, idle;
+	uint32_t t;
+	int i;
+	bench_links_up(BENCH_LINKS);
+	active = bench_cp_radio(2);
+	if (!bench_cp_all(CONN_PROFILE_ACTIVE)) {
+		bench_fail("links not in the active profile");
+	}
+	host_run(10 * TICKS_PER_SECOND);
+	if (!bench_cp_all(CONN_PROFILE_IDLE)) {
+		bench_fail("quiet links did not go idle");
+	}
+	idle = bench_cp_radio(10);
+	bench_note("radio wakeups per link %.1f/s active, %.1f/s idle "
+		   "(virtual)", active, idle);
+	if (idle * 10 > active) {
+		bench_fail("idle profile saves too little");
+	}
+	cp = &bench_slot(bench_conn[0])->cp;
+	bench_cp_key(bench_conn[0]);
+	t = host_now();
+	while (cp->profile != CONN_PROFILE_ACTIVE &&
+	       host_now() - t < TICKS_PER_SECOND) {
+		host_run(1);
+	}
+	bench_note("idle to active %u us after the first key, interval "
+		   "%u us", (unsigned)(host_now() - t) * 625,
+		   host_link_stats(bench_conn[0])->interval * 1250);
+	if (cp->profile != CONN_PROFILE_ACTIVE) {
+		bench_fail("a key did not bring the link back");
+	}
+	requests = cp->requests;
+	for (i = 0; i < 10; i++) {
+		host_run(3 * TICKS_PER_SECOND);
+		bench_cp_key(bench_conn[0]);
+	}
+	if (cp->requests != requests || cp->profile != CONN_PROFILE_ACTIVE) {
+		bench_fail("steady typing flapped the profile");
+	}
+
+	// a central that wants 15ms or more and little latency
+	host_disconnect(bench_conn[0], 0x13);
+	host_set_central_limits(12, 4);
+	bench_conn[0] = host_connect(24);
+	cp = &bench_slot(bench_conn[0])->cp;
+	for (i = 0; i < BENCH_CP_PICKY_SECONDS; i++) {
+		host_run(TICKS_PER_SECOND);
+		bench_cp_key(bench_conn[0]);
+	}
+	bench_note("picky central: %u requests in %u s, %u refused",
+		   cp->requests, BENCH_CP_PICKY_SECONDS, cp->rejected);
+	if (cp->requests > BENCH_CP_PICKY_REQUESTS || cp->rejected == 0 ||
+	    cp->profile != CONN_PROFILE_NONE) {
+		bench_fail("refused requests not backed off");
+	}
+	host_set_central_limits(0, 0xffff);
+	host_run(200 * TICKS_PER_SECOND);
+	if (cp->profile != CONN_PROFILE_IDLE || cp->rejects) {
+		bench_fail("no recovery once the central agreed");
+	}
+	if (host_att_read(bench_conn[0], CONNPARAM_R_CHR_UUID, value, &len,
+			  sizeof(value)) != SUCCESS || len != CONNPARAM_LEN ||
+	    value[0] != cp->profile ||
+	    (value[8] | value[9] << 8) != cp->requests ||
+	    (value[10] | value[11] << 8) != cp->rejected ||
+	    (value[14] | value[15] << 8) != cp->to_idle) {
+		bench_fail("sysinfo counters differ");
+	}
+	bench_links_down(BENCH_LINKS);
+	return cp->requests;
+}
+
+// the slot lookups against a scan of the table
+static int bench_slots_check(void)
+{
+	int slotp, i, used = 0, bad = 0;
+	for (slotp = 0; slotp < PERIPHERAL_MAX_CONNECTION; slotp++) {
+		struct ble_peri_slot *slot = &ble_peri_slots[slotp];
+		bad |= ble_peri_slots_find_by_taskID(slot->taskID) != slotp;
+		if (slot->state == 0) {
+			continue;
+		}
+		used++;
+		bad |= ble_peri_slots_find_by_connHandle(slot->connHandle) !=
+		       slotp;
+	}
+	for (i = 0; i < HOST_MAX_LINKS; i++) {
+		slotp = ble_peri_slots_find_by_connHandle(i);
+		if (host_link_up(i)) {
+			bad |= slotp < 0 || ble_peri_slots[slotp].connHandle != i;
+		} else {
+			bad |= slotp >= 0;
+		}
+	}
+	bad |= ble_peri_slots_find_by_connHandle(GAP_CONNHANDLE_INIT) >= 0;
+	bad |= ble_peri_slots_used() != used;
+	bad |= ble_peri_slots_free() != PERIPHERAL_MAX_CONNECTION - used;
+	bad |= ble_peri_slots_is_full() != (used == PERIPHERAL_MAX_CONNECTION);
+	slotp = ble_peri_slots_find_free();
+	bad |= used < PERIPHERAL_MAX_CONNECTION &&
+	       (slotp < 0 || ble_peri_slots[slotp].state != 0);
+	bad |= used == PERIPHERAL_MAX_CONNECTION && slotp >= 0;
+	return bad;
+}
+
+// Every link up, then links dropped and taken again in random order
+// with the table checked after each step, then the lookups the GATT
+// callbacks and TMOS events do timed over all the links.
+static uint64_t bench_slots(void)
+{
+	volatile int sink = 0;
+	uint16_t extra;
+	uint64_t n, t;
+	int i, k, bad = 0;
+	if (BENCH_LINKS < BENCH_SLOTS_MIN) {
+		bench_note("only %d links, build with HOST_LINKS=%d or more "
+			   "to load the table", BENCH_LINKS, BENCH_SLOTS_MIN);
+	}
+	bench_links_up(BENCH_LINKS);
+	bad |= bench_slots_check();
+	// one over the table is turned away at the next connection event
+	extra = host_connect(BENCH_INTERVAL);
+	bad |= bench_slot(extra) != NULL;
+	host_run(BENCH_INTERVAL * 4);
+	bad |= host_link_up(extra);
+	bad |= bench_slots_check();
+	srand(1);
+	for (k = 0; k < BENCH_SLOTS_CHURN; k++) {
+		i = rand() % BENCH_LINKS;
+		host_disconnect(bench_conn[i], 0x13);
+		bad |= bench_slots_check();
+		if (rand() & 1) {
+			i = rand() % BENCH_LINKS;
+			host_disconnect(bench_conn[i], 0x13);
+			bad |= bench_slots_check();
+		}
+		for (i = 0; i < BENCH_LINKS; i++) {
+			if (bench_slot(bench_conn[i]) == NULL) {
+				bench_conn[i] = host_connect(BENCH_INTERVAL);
+				bad |= bench_slot(bench_conn[i]) == NULL;
+			}
+		}
+		bad |= bench_slots_check();
+		host_run(BENCH_INTERVAL);
+	}
+	if (bad) {
+		bench_fail("slot table out of step with the links");
+	}
+	t = bench_ns();
+	for (n = 0; n < BENCH_SLOTS_LOOKUPS; n++) {
+		sink += ble_peri_slots_find_by_connHandle(
+			bench_conn[n % BENCH_LINKS]);
+	}
+	t = bench_ns() - t;
+	bench_note("find_by_connHandle %.2f ns", (double)t / n);
+	t = bench_ns();
+	for (n = 0; n < BENCH_SLOTS_LOOKUPS; n++) {
+		sink += ble_peri_slots_find_by_taskID(
+			ble_peri_slots[n % BENCH_LINKS].taskID);
+	}
+	t = bench_ns() - t;
+	bench_note("find_by_taskID %.2f ns, %d links", (double)t / n,
+		   BENCH_LINKS);
+	bench_links_down(BENCH_LINKS);
+	if (ble_peri_slots_used() || bench_slots_check()) {
+		bench_fail("slots not all returned");
+	}
+	return 2 * n;
+}
+
+static const char *const bench_power_names[POWER_STATES] = {
+	"run", "idle", "halt", "sleep",
+};
+
+// RTC cycles in each state over the next seconds of virtual time
+static uint64_t bench_power_run(int seconds, uint64_t *rtc)
+{
+	uint64_t total = 0;
+	int i;
+	for (i = 0; i < POWER_STATES; i++) {
+		rtc[i] = PowerStats.rtc[i];
+	}
+	host_run(seconds * TICKS_PER_SECOND);
+	for (i = 0; i < POWER_STATES; i++) {
+		rtc[i] = PowerStats.rtc[i] - rtc[i];
+		total += rtc[i];
+	}
+	return total;
+}
+
+// Sleep is off at boot. Switched on over sysinfo, idle links leave the
+// CPU asleep nearly all the time. Switched off again only the run time
+// grows, the figures read back match the manager's, and a crystal slower
+// to start than WAKE_UP_RTC_MAX_TIME shows up as late wake-ups.
+static uint64_t bench_power(void)
+{
+	uint8_t value[POWER_VALUE_LEN], off = 0, on = 1;
+	uint64_t rtc[POWER_STATES], total;
+	uint32_t sleeps = PowerStats.entries[POWER_SLEEP], late;
+	uint16_t len;
+	int i;
+	bench_links_up(BENCH_LINKS);
+	if (PowerStats.enabled) {
+		bench_fail("sleep on before it was asked for");
+	}
+	host_att_write(bench_conn[0], POWER_RW_CHR_UUID, &on, 1,
+		       ATT_WRITE_REQ);
+	host_run(10 * TICKS_PER_SECOND);
+	total = bench_power_run(BENCH_POWER_SECONDS, rtc);
+	for (i = 0; i < POWER_STATES; i++) {
+		bench_note("%-5s %5.1f%% %8.1f ms (virtual)",
+			   bench_power_names[i], 100.0 * rtc[i] / total,
+			   rtc[i] * 1000.0 / FREQ_RTC);
+	}
+	bench_note("wake-up %u us last, %u us worst, %u late",
+		   (unsigned)RTC_TO_US(PowerStats.wake_last),
+		   (unsigned)RTC_TO_US(PowerStats.wake_worst),
+		   (unsigned)PowerStats.late);
+	if (rtc[POWER_SLEEP] * 100 < total * BENCH_POWER_SLEEP) {
+		bench_fail("idle links keep the CPU awake");
+	}
+	if (PowerStats.late) {
+		bench_fail("wake-ups overran the deadline");
+	}
+	if (host_att_read(bench_conn[0], POWER_RW_CHR_UUID, value, &len,
+			  sizeof(value)) != SUCCESS || len != POWER_VALUE_LEN ||
+	    value[0] != 1 ||
+	    bench_le32(&value[2 + POWER_SLEEP * 4]) !=
+		    PowerStats.rtc[POWER_SLEEP] * 1000 / FREQ_RTC ||
+	    (value[18] | value[19] << 8) !=
+		    RTC_TO_US(PowerStats.wake_worst) ||
+	    bench_le32(&value[24]) != peri_timers.wakeups ||
+	    bench_le32(&value[28]) != peri_timers.runs) {
+		bench_fail("sysinfo power figures differ");
+	}
+
+	host_att_write(bench_conn[0], POWER_RW_CHR_UUID, &off, 1,
+		       ATT_WRITE_REQ);
+	host_run(0);
+	total = bench_power_run(10, rtc);
+	if (PowerStats.enabled || rtc[POWER_IDLE] || rtc[POWER_HALT] ||
+	    rtc[POWER_SLEEP]) {
+		bench_fail("switched off and still sleeping");
+	}
+	host_att_write(bench_conn[0], POWER_RW_CHR_UUID, &on, 1,
+		       ATT_WRITE_REQ);
+
+	// the crystal takes longer than the stack allows for
+	host_set_hse_startup(WAKE_UP_RTC_MAX_TIME + US_TO_RTC(500));
+	late = PowerStats.late;
+	host_run(10 * TICKS_PER_SECOND);
+	bench_note("slow crystal: %u late wake-ups, %u us worst",
+		   (unsigned)(PowerStats.late - late),
+		   (unsigned)RTC_TO_US(PowerStats.wake_worst));
+	if (PowerStats.late == late ||
+	    PowerStats.wake_worst <= WAKE_UP_RTC_MAX_TIME) {
+		bench_fail("late wake-ups not seen");
+	}
+	host_set_hse_startup(US_TO_RTC(1200));
+	// back to the boot default for the benches after
+	host_att_write(bench_conn[0], POWER_RW_CHR_UUID, &off, 1,
+		       ATT_WRITE_REQ);
+	bench_links_down(BENCH_LINKS);
+	return PowerStats.entries[POWER_SLEEP] - sleeps;
+}
+
+static const char *const bench_prof_names[PROF_SITES] = {
+	"evt_msg", "evt_start", "evt_param", "evt_phy", "evt_forth",
+	"evt_contx", "evt_timer", "evt_trace", "evt_keys", "evt_other",
+	"sysinfo_rd", "sysinfo_wr", "console_rd", "console_wr",
+};
+
+// the perf characteristic read back with a client's long read
+static int bench_prof_read(uint16_t mtu, uint8_t *value)
+{
+	uint16_t len;
+	host_mtu_update(bench_conn[0], mtu);
+	host_run(0);
+	if (host_att_read_long(bench_conn[0], PERF_RW_CHR_UUID, value, &len,
+			       PROF_VALUE_LEN) != SUCCESS ||
+	    len != PROF_VALUE_LEN || value[0] != PROF_SITES ||
+	    value[1] != PROF_BUCKETS || value[2] != PROF_SHIFT) {
+		bench_fail("perf characteristic unreadable");
+		return 0;
+	}
+	return 1;
+}
+
+// Every link types and listens to the clock for a while, then the
+// handler profile is read over sysinfo in MTU sized pieces. A second
+// read at another MTU only adds its own pieces to the sysinfo read
+// site, and the histograms add up to the counts. -d saves the value
+// for host/prof_decode.py.
+static uint64_t bench_prof(void)
+{
+	static uint8_t a[PROF_VALUE_LEN], b[PROF_VALUE_LEN];
+	const uint8_t *site;
+	uint32_t count, hist, reads;
+	uint8_t zero = 0, key = ' ';
+	uint64_t n = 0;
+	int i, k, off;
+	FILE *f;
+	bench_links_up(BENCH_LINKS);
+	for (i = 0; i < BENCH_LINKS; i++) {
+		host_ccc_enable(bench_conn[i], SYSCLOCK_RN_CHR_UUID);
+	}
+	host_att_write(bench_conn[0], PERF_RW_CHR_UUID, &zero, 1,
+		       ATT_WRITE_REQ);
+	for (k = 0; k < BENCH_PROF_SECONDS * 10; k++) {
+		for (i = 0; i < BENCH_LINKS; i++) {
+			host_att_write(bench_conn[i], CONSOLE_RNW_CHR_UUID,
+				       &key, 1, ATT_WRITE_CMD);
+		}
+		host_run(TICKS_PER_SECOND / 10);
+	}
+	if (!bench_prof_read(ATT_MTU_SIZE, a) || !bench_prof_read(247, b)) {
+		bench_links_down(BENCH_LINKS);
+		return 0;
+	}
+	reads = (PROF_VALUE_LEN + ATT_MTU_SIZE - 2) / (ATT_MTU_SIZE - 1);
+	for (i = 0; i < PROF_SITES; i++) {
+		off = 4 + i * PROF_SITE_LEN;
+		site = &b[off];
+		count = bench_le32(site);
+		for (k = 0, hist = 0; k < PROF_BUCKETS; k++) {
+			hist += site[16 + k * 2] | site[17 + k * 2] << 8;
+		}
+		if (i == PROF_SYSINFO_READ) {
+			if (count != bench_le32(&a[off]) + reads) {
+				bench_fail("perf reads miscounted");
+			}
+		} else if (i != PROF_EVT_MSG && // the MTU exchange
+			   i != PROF_EVT_TRACE && // and the frames it logs
+			   memcmp(&a[off], site, PROF_SITE_LEN) != 0) {
+			bench_fail("perf snapshot changed between reads");
+		}
+		if (hist != count) {
+			bench_fail("perf histogram does not add up");
+		}
+		n += count;
+		if (count) {
+			bench_note("%-10s %7u calls %8.2f us avg %8.2f us max",
+				   bench_prof_names[i], (unsigned)count,
+				   (bench_le32(site + 8) +
+				    (double)bench_le32(site + 12) * 4294967296.0) /
+					   count / MCYCLE_PER_US,
+				   (double)bench_le32(site + 4) /
+					   MCYCLE_PER_US);
+		}
+	}
+	if (bench_le32(&b[4 + PROF_EVT_FORTH * PROF_SITE_LEN]) == 0 ||
+	    bench_le32(&b[4 + PROF_EVT_TIMER * PROF_SITE_LEN]) == 0 ||
+	    bench_le32(&b[4 + PROF_CONSOLE_WRITE * PROF_SITE_LEN]) == 0) {
+		bench_fail("busy handlers not profiled");
+	}
+	if (bench_dump_out) {
+		f = fopen(bench_dump_out, "wb");
+		if (f == NULL || fwrite(b, 1, sizeof(b), f) != sizeof(b)) {
+			bench_fail("cannot save the perf value");
+		} else {
+			bench_note("perf value saved to %s", bench_dump_out);
+		}
+		if (f) {
+			fclose(f);
+		}
+	}
+	host_att_write(bench_conn[0], PERF_RW_CHR_UUID, &zero, 1,
+		       ATT_WRITE_REQ);
+	for (i = 0; i < PROF_SITES; i++) {
+		if (PeriProf[i].count != (i == PROF_SYSINFO_WRITE)) {
+			bench_fail("perf table not cleared");
+			break;
+		}
+	}
+	for (i = 0; i < BENCH_LINKS; i++) {
+		host_ccc_disable(bench_conn[i], SYSCLOCK_RN_CHR_UUID);
+	}
+	bench_links_down(BENCH_LINKS);
+	return n;
+}
+
+static uint8_t bench_uart_buf[BENCH_UART_CAPTURE];
+static int bench_uart_len;
+
+static void bench_uart_sink(const uint8_t *data, int len)
+{
+	len = MIN(len, BENCH_UART_CAPTURE - bench_uart_len);
+	memcpy(bench_uart_buf + bench_uart_len, data, len);
+	bench_uart_len += len;
+}
+
+// until the trace and UART1 rings are empty, and a tick more for the
+// last bytes in the hardware fifo
+static void bench_uart_drain(void)
+{
+	uint32_t t = host_now();
+	while ((trace_pending() || uart1_pending()) &&
+	       host_now() - t < TICKS_PER_SECOND) {
+		host_run(1);
+	}
+	host_run(1);
+}
+
+// uart1_write() against the time the CPU would wait on the fifo for the
+// same bytes, which go out at the line rate behind the caller's back. A
+// burst beyond the ring keeps its newest bytes, and so does one that
+// catches the ring still sending.
+static uint64_t bench_uart(void)
+{
+	static uint8_t line[BENCH_UART_LINE], burst[BENCH_UART_BURST];
+	uint32_t t0, cyc, ticks, dropped, want;
+	int k, over;
+	for (k = 0; k < BENCH_UART_LINE; k++) {
+		line[k] = k < BENCH_UART_LINE - 2 ? 'a' + k % 26 : "\n\r"[k & 1];
+	}
+	for (k = 0; k < BENCH_UART_BURST; k++) {
+		burst[k] = k ^ k >> 8;
+	}
+	host_set_uart_sink(bench_uart_sink);
+	bench_uart_drain();
+	bench_uart_len = 0;
+	t0 = mcycle();
+	for (k = 0; k < BENCH_UART_LINES; k++) {
+		uart1_write(line, sizeof(line));
+	}
+	cyc = mcycle() - t0;
+	ticks = host_now();
+	bench_uart_drain();
+	ticks = host_now() - ticks - 1;
+	want = (BENCH_UART_LINES * BENCH_UART_LINE * 10 * TICKS_PER_SECOND +
+		UART1_BAUD - 1) / UART1_BAUD;
+	bench_note("write %.3f us per %d B line, the fifo would take %.0f us",
+		   (double)cyc / BENCH_UART_LINES / MCYCLE_PER_US,
+		   BENCH_UART_LINE, BENCH_UART_LINE * 10 * 1e6 / UART1_BAUD);
+	bench_note("%d lines out in %u ticks, %u at the line rate",
+		   BENCH_UART_LINES, (unsigned)ticks, (unsigned)want);
+	for (k = 0; k < BENCH_UART_LINES; k++) {
+		if (bench_uart_len != BENCH_UART_LINES * BENCH_UART_LINE ||
+		    memcmp(bench_uart_buf + k * BENCH_UART_LINE, line,
+			   BENCH_UART_LINE) != 0) {
+			bench_fail("lines garbled");
+			break;
+		}
+	}
+	if (ticks < want || ticks > want + 1) {
+		bench_fail("lines not sent at the line rate");
+	}
+
+	bench_uart_len = 0;
+	dropped = Uart1Tx.dropped;
+	uart1_write(burst, BENCH_UART_BURST);
+	bench_uart_drain();
+	dropped = Uart1Tx.dropped - dropped;
+	bench_note("burst of %d: %d B out, %u dropped", BENCH_UART_BURST,
+		   bench_uart_len, (unsigned)dropped);
+	if (dropped != BENCH_UART_BURST - UART1_TX_SIZE ||
+	    bench_uart_len != UART1_TX_SIZE ||
+	    memcmp(bench_uart_buf, burst + dropped, UART1_TX_SIZE) != 0) {
+		bench_fail("burst did not keep its newest bytes");
+	}
+
+	// the fifo takes the head of the first write at once
+	bench_uart_len = 0;
+	dropped = Uart1Tx.dropped;
+	uart1_write(burst, 1000);
+	uart1_write(burst + 1000, 100);
+	bench_uart_drain();
+	dropped = Uart1Tx.dropped - dropped;
+	over = 1100 - UART1_FIFO - UART1_TX_SIZE;
+	if (dropped != over || bench_uart_len != 1100 - over ||
+	    memcmp(bench_uart_buf, burst, UART1_FIFO) != 0 ||
+	    memcmp(bench_uart_buf + UART1_FIFO, burst + UART1_FIFO + over,
+		   UART1_TX_SIZE) != 0) {
+		bench_fail("queued bytes not dropped oldest first");
+	}
+	host_set_uart_sink(NULL);
+	return BENCH_UART_LINES;
+}
+
+static int bench_trace_null(const uint8_t *p, int len)
+{
+	return len;
+}
+
+static uint8_t bench_trace_buf[BENCH_UART_CAPTURE];
+static int bench_trace_len;
+
+// the capture with the escapes of the line undone, in frames
+static int bench_trace_frames(void)
+{
+	int i, n = 0;
+	for (i = 0; i < bench_uart_len; i++) {
+		if (bench_uart_buf[i] == TRACE_ESC && i + 1 < bench_uart_len) {
+			bench_trace_buf[n++] = bench_uart_buf[++i] ^ 0x20;
+		} else {
+			bench_trace_buf[n++] = bench_uart_buf[i];
+		}
+	}
+	bench_trace_len = n;
+	return n / (TRACE_HEAD + 12);
+}
+
+// The frames in the capture must be the bench's own, in order and with
+// their arguments, the seq of the first one is returned.
+static int bench_trace_check(int frames, uint32_t base, const char *from)
+{
+	static const char fmt[] = "bench %d of %u from %s\n";
+	const uint8_t *p = bench_trace_buf;
+	int k, seq;
+	bench_trace_frames();
+	seq = p[1];
+	for (k = 0; k < frames; k++, p += TRACE_HEAD + 12) {
+		if (p + TRACE_HEAD + 12 > bench_trace_buf + bench_trace_len ||
+		    p[0] != TRACE_SYNC || p[1] != (uint8_t)(seq + k) ||
+		    strcmp(__start_trace_fmt + (p[2] | p[3] << 8), fmt) != 0 ||
+		    p[4] != 3 || bench_le32(p + TRACE_HEAD) != base + k ||
+		    bench_le32(p + TRACE_HEAD + 8) !=
+			    (uint32_t)(uintptr_t)from) {
+			bench_fail("trace frames differ");
+			return -1;
+		}
+	}
+	if (p != bench_trace_buf + bench_trace_len) {
+		bench_fail("trace capture has extra bytes");
+	}
+	return seq;
+}
+
+// TRACE() against formatting the same line, and the UART time either
+// takes at 921600 baud. Frames logged between events come out in order
+// on the next drain, a flood beyond the ring is counted as dropped and
+// shows as a gap in seq. -d saves the capture for host/trace_decode.py.
+static uint64_t bench_trace(void)
+{
+	char line[64];
+	uint32_t t0, trace_cyc, print_cyc, dropped;
+	int k, len = 0, seq;
+	bench_uart_drain();
+	t0 = mcycle();
+	for (k = 0; k < BENCH_TRACE_CALLS; k++) {
+		TRACE("bench %d of %u from %s\n", k, BENCH_TRACE_CALLS,
+		      __func__);
+		if ((k & 15) == 15) {
+			trace_drain(bench_trace_null);
+		}
+	}
+	trace_cyc = mcycle() - t0;
+	t0 = mcycle();
+	for (k = 0; k < BENCH_TRACE_CALLS; k++) {
+		len = snprintf(line, sizeof(line), "bench %d of %u from %s\n",
+			       k, BENCH_TRACE_CALLS, __func__);
+		__asm__ volatile("" : : "r"(line) : "memory");
+	}
+	print_cyc = mcycle() - t0;
+	bench_note("TRACE %.3f us and %d B, printf %.3f us and %d B, "
+		   "%.0f us on the UART",
+		   (double)trace_cyc / BENCH_TRACE_CALLS / MCYCLE_PER_US,
+		   TRACE_HEAD + 12,
+		   (double)print_cyc / BENCH_TRACE_CALLS / MCYCLE_PER_US, len,
+		   len * 10 * 1e6 / UART1_BAUD);
+
+	host_set_uart_sink(bench_uart_sink);
+	bench_uart_len = 0;
+	for (k = 0; k < BENCH_TRACE_FRAMES; k++) {
+		TRACE("bench %d of %u from %s\n", k, BENCH_TRACE_FRAMES,
+		      __func__);
+	}
+	bench_uart_drain();
+	bench_trace_check(BENCH_TRACE_FRAMES, 0, __func__);
+	if (bench_dump_out) {
+		FILE *f = fopen(bench_dump_out, "wb");
+		if (f == NULL || fwrite(bench_uart_buf, 1, bench_uart_len,
+					f) != bench_uart_len) {
+			bench_fail("cannot save the trace capture");
+		} else {
+			bench_note("trace capture saved to %s",
+				   bench_dump_out);
+		}
+		if (f) {
+			fclose(f);
+		}
+	}
+
+	bench_uart_len = 0;
+	dropped = trace_ring.dropped;
+	for (k = 0; k < BENCH_TRACE_FLOOD; k++) {
+		TRACE("bench %d of %u from %s\n", k, BENCH_TRACE_FLOOD,
+		      __func__);
+	}
+	bench_uart_drain();
+	k = bench_trace_frames();
+	seq = bench_trace_check(k, 0, __func__);
+	dropped = trace_ring.dropped - dropped;
+	bench_note("flood of %d: %d frames out, %u dropped", BENCH_TRACE_FLOOD,
+		   k, (unsigned)dropped);
+	bench_uart_len = 0;
+	TRACE("bench %d of %u from %s\n", BENCH_TRACE_FLOOD, 0, __func__);
+	bench_uart_drain();
+	if (k + dropped != BENCH_TRACE_FLOOD || dropped == 0 ||
+	    bench_trace_check(1, BENCH_TRACE_FLOOD, __func__) !=
+		    (uint8_t)(seq + BENCH_TRACE_FLOOD)) {
+		bench_fail("dropped frames not counted");
+	}
+	host_set_uart_sink(NULL);
+	return BENCH_TRACE_CALLS;
+}
+
+// A terminal on the other end of the UART1 pty: raw, and pausing on the
+// console's XOFF the way a terminal program set to software flow control
+// does. The line discipline of the pty does the pausing.
+static int bench_pty_open(void)
+{
+	const char *name = host_uart1_pty();
+	struct termios tio;
+	int fd;
+	if (name == NULL ||
+	    (fd = open(name, O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0) {
+		return -1;
+	}
+	tcgetattr(fd, &tio);
+	cfmakeraw(&tio);
+	tio.c_iflag |= IXON;
+	tcsetattr(fd, TCSANOW, &tio);
+	return fd;
+}
+
+// Send from p what the terminal's UART would have got out by now, no
+// more than BENCH_UARTCON_AHEAD ahead of what the device took.
+static uint32_t bench_pty_send(int fd, const uint8_t *p, uint32_t sent,
+			       uint32_t len, uint32_t base)
+{
+	uint32_t taken = Uart1Rx.received + Uart1Rx.overrun - base;
+	int n = MIN(len - sent, (int64_t)taken + BENCH_UARTCON_AHEAD - sent);
+	if (n > 0 && (n = write(fd, p + sent, n)) > 0) {
+		sent += n;
+	}
+	return sent;
+}
+
+// The UART console through a pty, from the terminal's side. A paste into
+// an echoing task comes back whole at close to the line rate, against
+// the one over BLE in console_paste. Then a script goes to the outer
+// interpreter while a spinning task holds it up: XOFF has to pause the
+// terminal before anything is lost, XON let it go on, and every line
+// gets its " ok".
+static uint64_t bench_console_uart(void)
+{
+	static uint8_t paste[BENCH_PASTE_BYTES], script[BENCH_UARTCON_LINES * 7];
+	struct uart_console *con = &UartConsole;
+	uint8_t buf[256];
+	uint32_t sent = 0, got = 0, t0, t1, rate, xoff = 0, stopped = 0, base;
+	int fd, n, i, k, oks = 0, bad = 0;
+	const char *ok = " ok\n";
+	for (k = 0; k < BENCH_PASTE_BYTES; k++) {
+		paste[k] = ' ' + k % 95;
+	}
+	for (k = 0; k < BENCH_UARTCON_LINES; k++) {
+		memcpy(script + k * 7, "1 drop\n", 7);
+	}
+	bench_uart_drain();
+	fd = bench_pty_open();
+	if (fd < 0) {
+		bench_fail("no pty");
+		return 0;
+	}
+	sf_task_reset(&con->sft);
+	sf_task_start(&con->sft, bench_sched_echo);
+	sf_sched_wake();
+	base = Uart1Rx.received + Uart1Rx.overrun;
+	t0 = host_now();
+	while (got < BENCH_PASTE_BYTES &&
+	       host_now() - t0 < 60 * TICKS_PER_SECOND) {
+		sent = bench_pty_send(fd, paste, sent, BENCH_PASTE_BYTES,
+				      base);
+		host_run(1);
+		while ((n = read(fd, buf, sizeof(buf))) > 0) {
+			bad |= got + n > BENCH_PASTE_BYTES ||
+			       memcmp(buf, paste + got, n) != 0;
+			got += n;
+		}
+	}
+	t1 = host_now();
+	rate = (uint64_t)got * TICKS_PER_SECOND / MAX(t1 - t0, 1);
+	bench_note("%u B pasted and echoed at %u B/s, the line does %u B/s",
+		   (unsigned)got, (unsigned)rate, UART1_BAUD / 10);
+	if (bad || got != BENCH_PASTE_BYTES) {
+		bench_fail("echo of the paste came back garbled");
+	}
+	if (rate < UART1_BAUD / 10 * 8 / 10) {
+		bench_fail("paste well below the line rate");
+	}
+
+	sf_task_reset(&con->sft);
+	sf_task_start(&con->sft, bench_sched_spin);
+	sf_sched_wake();
+	sent = 0;
+	k = 0;
+	base = Uart1Rx.received + Uart1Rx.overrun;
+	t0 = host_now();
+	while (oks < BENCH_UARTCON_LINES &&
+	       host_now() - t0 < 60 * TICKS_PER_SECOND) {
+		sent = bench_pty_send(fd, script, sent, sizeof(script), base);
+		host_run(1);
+		if (Uart1Rx.stopped) {
+			stopped = 1;
+		}
+		if (host_now() - t0 == BENCH_UARTCON_HOLD) {
+			xoff = Uart1Rx.stopped;
+			sf_task_reset(&con->sft);
+			sf_sched_wake();
+		}
+		while ((n = read(fd, buf, sizeof(buf))) > 0) {
+			for (i = 0; i < n; i++, k++) {
+				bad |= buf[i] != ok[k % 4];
+			}
+		}
+		oks = k / 4;
+	}
+	bench_note("%d lines with the interpreter held up %u ticks, "
+		   "%u B overrun", BENCH_UARTCON_LINES, BENCH_UARTCON_HOLD,
+		   (unsigned)(Uart1Rx.overrun + host_uart1_overrun()));
+	if (!xoff || !stopped || Uart1Rx.stopped) {
+		bench_fail("no XOFF while held up or no XON after");
+	}
+	if (bad || oks != BENCH_UARTCON_LINES || Uart1Rx.overrun ||
+	    host_uart1_overrun()) {
+		bench_fail("script lost lines");
+	}
+	host_uart1_pty_close();
+	close(fd);
+	return got;
+}
+
+// What matrix_debounce() does, a key at a time
+struct bench_key {
+	uint8_t down;
+	uint8_t count;
+};
+
+static int bench_matrix_ref(struct bench_key *k, const uint32_t *raw,
+			    uint8_t *ev)
+{
+	int i, now, n = 0;
+	for (i = 0; i < MATRIX_KEYS; i++) {
+		now = raw[i >> 5] >> (i & 31) & 1;
+		if (now == k[i].down) {
+			k[i].count = 0;
+		} else if (++k[i].count == MATRIX_DEBOUNCE) {
+			k[i].down = now;
+			k[i].count = 0;
+			ev[n++] = i | (now ? MATRIX_DOWN : 0);
+		}
+	}
+	return n;
+}
+
+// Random presses and bounces through the host ports: the word parallel
+// counters must give the events of the per-key reference, scan by scan,
+// in a few microseconds a scan. Then typing on the parked matrix: the
+// first key wakes the chip from sleep and is in within a millisecond,
+// bounces and all, the next one during the burst after MATRIX_DEBOUNCE
+// scans, and once the keys are up the matrix parks and scans no more.
+static uint64_t bench_matrix(void)
+{
+	static struct bench_key ref[MATRIX_KEYS];
+	uint32_t raw[MATRIX_WORDS] = { 0 };
+	uint8_t want[MATRIX_KEYS], got[MATRIX_EVENTS];
+	uint32_t t, cyc = 0, ref_cyc = 0, bounces = 0, at[4], scans, changes;
+	uint32_t first, second, sleeps, tick = US_TO_RTC(625);
+	int i, n, m, ev, key = -1, bad = 0;
+	memset(ref, 0, sizeof(ref));
+	peripheralMatrixEnable(0);
+	matrix_init();
+	srand(2);
+	for (i = 0; i < BENCH_MATRIX_SCANS; i++) {
+		if (key >= 0 && rand() % 4 == 0) {
+			bounces++;
+		} else if (rand() % 8 == 0) {
+			key = rand() % BENCH_MATRIX_HOT;
+		} else {
+			key = -1;
+		}
+		if (key >= 0) {
+			raw[key >> 5] ^= 1u << (key & 31);
+			host_key(key, raw[key >> 5] >> (key & 31) & 1);
+		}
+		t = mcycle();
+		matrix_scan();
+		cyc += mcycle() - t;
+		t = mcycle();
+		n = bench_matrix_ref(ref, raw, want);
+		ref_cyc += mcycle() - t;
+		for (m = 0; (ev = matrix_event()) >= 0; m++) {
+			got[m % MATRIX_EVENTS] = ev;
+		}
+		bad |= m != n || memcmp(got, want, n) != 0;
+	}
+	bench_note("%u scans, %u changes, %u bounces", BENCH_MATRIX_SCANS,
+		   (unsigned)Matrix.changes, (unsigned)bounces);
+	bench_note("%.1f cycles a scan, a key at a time %.1f",
+		   (double)cyc / BENCH_MATRIX_SCANS,
+		   (double)ref_cyc / BENCH_MATRIX_SCANS);
+	if (bad || Matrix.dropped) {
+		bench_fail("events differ from the per-key debounce");
+	}
+	if (cyc / BENCH_MATRIX_SCANS > BENCH_MATRIX_BUDGET) {
+		bench_fail("scan over budget");
+	}
+	for (i = 0; i < MATRIX_KEYS; i++) {
+		host_key(i, 0);
+	}
+	matrix_init();
+
+	// sleep as a central would have switched it on
+	peripheralPowerEnable(1);
+	peripheralMatrixEnable(1);
+	host_run(1);
+	scans = Matrix.scans;
+	// past the five seconds the UART keeps the clocks on after a byte
+	host_run(6 * TICKS_PER_SECOND);
+	bad = Matrix.scans != scans;
+	sleeps = PowerStats.entries[POWER_SLEEP];
+	t = RTC_GetCycle32k();
+	host_key_at(3300, 37, 1);
+	host_key_at(3400, 37, 0);
+	host_key_at(3500, 37, 1);
+	host_key_at(20000, 38, 1);
+	host_key_at(40000, 38, 0);
+	host_key_at(60000, 37, 0);
+	host_key_at(60150, 37, 1);
+	host_key_at(60300, 37, 0);
+	// 8ms in one go, so the chip sleeps until the key
+	host_run(TICKS_PER_SECOND / 125);
+	at[0] = Matrix.last;
+	sleeps = PowerStats.entries[POWER_SLEEP] - sleeps;
+	for (i = 0, n = Matrix.changes; n < 4 && i < TICKS_PER_SECOND; i++) {
+		changes = Matrix.changes;
+		host_run(1);
+		if (Matrix.changes != changes) {
+			at[n++] = Matrix.last;
+		}
+	}
+	host_run(MATRIX_PARK_SCANS * MATRIX_SCAN_TICKS + 1);
+	first = at[0] - t - US_TO_RTC(3300);
+	second = at[1] - t - US_TO_RTC(20000);
+	bench_note("first key in %u us from sleep, the next after %u us, "
+		   "%u scans", (unsigned)RTC_TO_US(first),
+		   (unsigned)RTC_TO_US(second),
+		   (unsigned)(Matrix.scans - scans));
+	if (bad || !sleeps || n != 4 || Matrix.changes != 4) {
+		bench_fail("parked matrix scanned or keys lost");
+	}
+	if (first >= US_TO_RTC(1000) ||
+	    second < (MATRIX_DEBOUNCE - 1) * tick * MATRIX_SCAN_TICKS ||
+	    second > (MATRIX_DEBOUNCE + 1) * tick * MATRIX_SCAN_TICKS) {
+		bench_fail("keys late");
+	}
+	scans = Matrix.scans;
+	host_run(10 * TICKS_PER_SECOND);
+	if (!Matrix.parked || Matrix.scans != scans ||
+	    spsc_used(&Matrix.events) || peri_timers.head != NULL) {
+		bench_fail("matrix not parked after the burst");
+	}
+	peripheralPowerEnable(0);
+	return BENCH_MATRIX_SCANS;
+}
+
+// HID reports as the central gets them
+struct bench_hid_rx {
+	uint32_t rtc;
+	uint16_t handle;
+	uint8_t report[KEYMAP_REPORT_LEN];
+};
+
+static struct bench_hid_rx bench_hid_log[HOST_MAX_LINKS][BENCH_HID_LOG];
+static int bench_hid_num[HOST_MAX_LINKS];
+static int bench_hid_over;
+
+static void bench_hid_sink(uint16_t connHandle, uint16_t handle,
+			   uint8_t *data, uint16_t len)
+{
+	struct bench_hid_rx *rx;
+	if (bench_hid_num[connHandle] == BENCH_HID_LOG ||
+	    len > KEYMAP_REPORT_LEN) {
+		bench_hid_over++;
+		return;
+	}
+	rx = &bench_hid_log[connHandle][bench_hid_num[connHandle]++];
+	rx->rtc = RTC_GetCycle32k();
+	rx->handle = handle;
+	memset(rx->report, 0, sizeof(rx->report));
+	memcpy(rx->report, data, len);
+}
+
+// every link got the reports of the first, n of them
+static int bench_hid_same(int n)
+{
+	uint16_t c0 = bench_conn[0], c;
+	int i, j;
+	for (i = 0; i < BENCH_LINKS; i++) {
+		c = bench_conn[i];
+		if (bench_hid_num[c] != n) {
+			return 0;
+		}
+		for (j = 0; j < n; j++) {
+			if (memcmp(bench_hid_log[c][j].report,
+				   bench_hid_log[c0][j].report,
+				   KEYMAP_REPORT_LEN) != 0) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+static int bench_hid_has(uint16_t conn, uint8_t usage)
+{
+	int i;
+	for (i = 0; i < bench_hid_num[conn]; i++) {
+		if (memchr(&bench_hid_log[conn][i].report[2], usage,
+			   KEYMAP_ROLLOVER)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// The keymap first, modifiers, order and rollover. Then single keys at
+// random phases to links a few ticks apart: each must reach every link
+// as the same press and release reports, and the press in a connection
+// interval plus the debounce from the key closing, parked matrix or
+// not. Keys a millisecond apart share a report, a tap while the link
+// is held or out of buffers still shows, a link in boot protocol gets
+// the same reports on the boot input, and the LEDs written read back.
+static uint64_t bench_hid(void)
+{
+	static const uint8_t want_mix[KEYMAP_REPORT_LEN] = { 0x02, 0, 0x04,
+							     0x29 };
+	static const uint8_t want_three[KEYMAP_REPORT_LEN] = { 0, 0, 0x04,
+							       0x16, 0x07 };
+	struct keymap_state k;
+	uint8_t report[KEYMAP_REPORT_LEN], want[KEYMAP_REPORT_LEN];
+	uint8_t buf[128], value, leds = 0x05, usage;
+	uint16_t len, c, report_h, boot_h;
+	uint32_t t, d, lat, worst = 0, n = 0;
+	uint64_t sum = 0;
+	int i, j, key, bad = 0;
+
+	memset(&k, 0, sizeof(k));
+	keymap_apply(&k, BENCH_HID_KEY_LSHIFT | MATRIX_DOWN);
+	keymap_apply(&k, BENCH_HID_KEY_A | MATRIX_DOWN);
+	keymap_apply(&k, BENCH_HID_KEY_ESC | MATRIX_DOWN);
+	keymap_report(&k, report);
+	bad |= memcmp(report, want_mix, sizeof(report)) != 0;
+	for (i = 0; i < KEYMAP_ROLLOVER; i++) {
+		keymap_apply(&k, (2 * 16 + 1 + i) | MATRIX_DOWN);
+	}
+	keymap_report(&k, report);
+	bad |= report[0] != 0x02 || report[2] != HID_USAGE_ROLLOVER ||
+	       report[7] != HID_USAGE_ROLLOVER;
+	for (i = 0; i < KEYMAP_ROLLOVER; i++) {
+		keymap_apply(&k, 2 * 16 + 1 + i);
+	}
+	keymap_report(&k, report);
+	bad |= memcmp(report, want_mix, sizeof(report)) != 0;
+	if (bad) {
+		bench_fail("keymap reports wrong");
+	}
+
+	host_set_noti_sink(bench_hid_sink);
+	bench_links_up(BENCH_LINKS);
+	// a few ticks apart, a key meets each link at another phase
+	for (i = 0; i < BENCH_LINKS; i++) {
+		host_run(3);
+		host_conn_param_update(bench_conn[i], BENCH_INTERVAL, 0, 100);
+		host_ccc_enable(bench_conn[i], HID_REPORT_CHR_UUID);
+	}
+	report_h = host_att_handle(HID_REPORT_CHR_UUID);
+	boot_h = host_att_handle(HID_BOOT_IN_CHR_UUID);
+	if (host_att_read_long(bench_conn[0], HID_REPORT_MAP_CHR_UUID, buf,
+			       &len, sizeof(buf)) != SUCCESS ||
+	    len != HID_REPORT_MAP_LEN || buf[0] != 0x05 ||
+	    buf[len - 1] != 0xC0) {
+		bench_fail("report map unreadable");
+	}
+	host_run(TICKS_PER_SECOND / 5);
+	memset(bench_hid_num, 0, sizeof(bench_hid_num));
+	bench_hid_over = 0;
+
+	srand(3);
+	bad = 0;
+	for (i = 0; i < BENCH_HID_KEYS; i++) {
+		do {
+			key = rand() % MATRIX_KEYS;
+			usage = Keymap[key / MATRIX_COLS][key % MATRIX_COLS];
+		} while (usage == 0 || usage >= HID_USAGE_LCTRL);
+		memset(want, 0, sizeof(want));
+		want[2] = usage;
+		d = rand() % (BENCH_INTERVAL * 1250);
+		t = RTC_GetCycle32k() + US_TO_RTC(d);
+		host_key_at(d, key, 1);
+		host_key_at(d + BENCH_HID_HOLD, key, 0);
+		host_run(2 * BENCH_HID_HOLD / 625);
+		bad |= !bench_hid_same(2);
+		for (j = 0; j < BENCH_LINKS; j++) {
+			c = bench_conn[j];
+			if (bench_hid_num[c] < 1 ||
+			    memcmp(bench_hid_log[c][0].report, want,
+				   sizeof(want)) != 0) {
+				bad = 1;
+				continue;
+			}
+			lat = bench_hid_log[c][0].rtc - t;
+			sum += lat;
+			worst = MAX(worst, lat);
+			n++;
+		}
+		memset(bench_hid_num, 0, sizeof(bench_hid_num));
+		if (i % BENCH_HID_PARKED == 0) {
+			host_run(MATRIX_PARK_SCANS * MATRIX_SCAN_TICKS +
+				 TICKS_PER_SECOND / 20);
+		}
+	}
+	bench_note("key to air %u us mean, %u us worst over %u reports",
+		   (unsigned)RTC_TO_US(n ? sum / n : 0),
+		   (unsigned)RTC_TO_US(worst), (unsigned)n);
+	if (bad || bench_hid_over) {
+		bench_fail("reports lost or differ between links");
+	}
+	if (worst > US_TO_RTC(BENCH_HID_LATENCY)) {
+		bench_fail("keys late on air");
+	}
+
+	// three keys while the first report waits for the air
+	host_key_at(0, BENCH_HID_KEY_A, 1);
+	host_key_at(1000, BENCH_HID_KEY_S, 1);
+	host_key_at(2000, BENCH_HID_KEY_D, 1);
+	host_run(TICKS_PER_SECOND / 25);
+	c = bench_conn[0];
+	if (!bench_hid_same(2) ||
+	    memcmp(bench_hid_log[c][1].report, want_three,
+		   sizeof(want_three)) != 0) {
+		bench_fail("changes not coalesced");
+	}
+	memset(bench_hid_num, 0, sizeof(bench_hid_num));
+	host_key_at(0, BENCH_HID_KEY_A, 0);
+	host_key_at(0, BENCH_HID_KEY_S, 0);
+	host_key_at(0, BENCH_HID_KEY_D, 0);
+	host_run(TICKS_PER_SECOND / 25);
+	memset(bench_hid_num, 0, sizeof(bench_hid_num));
+	// a tap while the press waits for the air
+	host_key_at(0, BENCH_HID_KEY_A, 1);
+	host_key_at(1500, BENCH_HID_KEY_F, 1);
+	host_key_at(5000, BENCH_HID_KEY_F, 0);
+	host_key_at(20000, BENCH_HID_KEY_A, 0);
+	host_run(TICKS_PER_SECOND / 25);
+	if (!bench_hid_same(4) || !bench_hid_has(c, 0x09) ||
+	    bench_hid_log[c][2].report[3] != 0) {
+		bench_fail("tap lost");
+	}
+	memset(bench_hid_num, 0, sizeof(bench_hid_num));
+	// a tap when the links are out of buffers, its release waits for
+	// the press to find one
+	bad = 0;
+	host_set_tx_per_event(0);
+	for (i = 0; i < BLE_BUFF_NUM; i++) {
+		host_key_at(i * 20000, BENCH_HID_KEY_A, !(i & 1));
+	}
+	host_key_at(BLE_BUFF_NUM * 20000, BENCH_HID_KEY_F, 1);
+	host_key_at(BLE_BUFF_NUM * 20000 + 3500, BENCH_HID_KEY_F, 0);
+	host_run(TICKS_PER_SECOND / 5);
+	host_set_tx_per_event(BLE_TX_NUM_EVENT);
+	host_key_at(0, BENCH_HID_KEY_A, 0);
+	host_run(TICKS_PER_SECOND / 10);
+	for (j = 0; j < BENCH_LINKS; j++) {
+		bad |= !bench_hid_has(bench_conn[j], 0x09);
+	}
+	if (bad || bench_hid_log[c][bench_hid_num[c] - 1].report[2] != 0) {
+		bench_fail("tap lost without buffers");
+	}
+	memset(bench_hid_num, 0, sizeof(bench_hid_num));
+
+	value = HID_PROTOCOL_BOOT;
+	host_att_write(c, HID_PROTOCOL_CHR_UUID, &value, 1, ATT_WRITE_CMD);
+	host_ccc_enable(c, HID_BOOT_IN_CHR_UUID);
+	host_key_at(0, BENCH_HID_KEY_A, 1);
+	host_key_at(BENCH_HID_HOLD, BENCH_HID_KEY_A, 0);
+	host_run(2 * BENCH_HID_HOLD / 625);
+	if (!bench_hid_same(2) || bench_hid_log[c][0].handle != boot_h ||
+	    bench_hid_log[bench_conn[1]][0].handle != report_h) {
+		bench_fail("boot protocol reports wrong");
+	}
+	host_att_write(bench_conn[1], HID_BOOT_OUT_CHR_UUID, &leds, 1,
+		       ATT_WRITE_REQ);
+	if (host_att_read(bench_conn[1], HID_BOOT_OUT_CHR_UUID, buf, &len,
+			  sizeof(buf)) != SUCCESS ||
+	    len != 1 || buf[0] != leds || bench_slot(bench_conn[0])->hid_leds) {
+		bench_fail("LEDs not kept per link");
+	}
+
+	// the services HOGP wants next to HID, the battery notified once a
+	// sample finds it moved
+	if (host_att_read(c, DEVINFO_PNP_ID_CHR_UUID, buf, &len,
+			  sizeof(buf)) != SUCCESS ||
+	    len != 7 || buf[0] != 0x02) {
+		bench_fail("PnP ID unreadable");
+	}
+	if (host_att_read(c, BATTERY_LEVEL_CHR_UUID, buf, &len,
+			  sizeof(buf)) != SUCCESS ||
+	    len != 1 || buf[0] != 100) {
+		bench_fail("battery level wrong");
+	}
+	memset(bench_hid_num, 0, sizeof(bench_hid_num));
+	host_ccc_enable(c, BATTERY_LEVEL_CHR_UUID);
+	host_run(BENCH_BATTERY_PERIOD);
+	host_set_vdd(2500);
+	host_run(BENCH_BATTERY_PERIOD);
+	host_set_vdd(3000);
+	if (bench_hid_num[c] != 2 ||
+	    bench_hid_log[c][0].handle !=
+		    host_att_handle(BATTERY_LEVEL_CHR_UUID) ||
+	    bench_hid_log[c][0].report[0] != 100 ||
+	    bench_hid_log[c][1].report[0] != 50 ||
+	    bench_hid_num[bench_conn[1]] != 0) {
+		bench_fail("battery level not notified");
+	}
+	host_set_noti_sink(NULL);
+	bench_links_down(BENCH_LINKS);
+	return BENCH_HID_KEYS;
+}
+
+static const struct bench benches[] = {
+	{ "fifo8", "B", bench_fifo8 },
+	{ "fifo8_buf", "B", bench_fifo8_buf },
+	{ "spsc_threads", "B", bench_spsc_threads },
+	{ "stepforth", "step", bench_stepforth },
+	{ "forth", "prim", bench_forth },
+	{ "console_rx", "B", bench_console_rx },
+	{ "console_tx", "B", bench_console_tx },
+	{ "sched", "step", bench_sched },
+	{ "console_echo", "key", bench_console_echo },
+	{ "console_paste", "B", bench_console_paste },
+	{ "forth_dict", "lookup", bench_forth_dict },
+	{ "fuse", "step", bench_fuse },
+	{ "native", "word", bench_native },
+	{ "timers", "run", bench_timers },
+	{ "conn_param", "req", bench_conn_param },
+	{ "slots", "lookup", bench_slots },
+	{ "tmos_idle", "disp", bench_tmos_idle },
+	{ "power", "sleep", bench_power },
+	{ "prof", "call", bench_prof },
+	{ "trace", "call", bench_trace },
+	{ "uart", "write", bench_uart },
+	{ "console_uart", "B", bench_console_uart },
+	{ "matrix", "scan", bench_matrix },
+	{ "hid", "key", bench_hid },
+};
+
+int main(int argc, char **argv)
+{
+	int i, verbose = 0;
+	const char *only = NULL;
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-v") == 0) {
+			verbose = 1;
+		} else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+			bench_ref_in = argv[++i];
+		} else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+			bench_ref_out = argv[++i];
+		} else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+			bench_dump_out = argv[++i];
+		} else {
+			only = argv[i];
+		}
+	}
+	bench_verbose = verbose;
+	host_set_quiet(!verbose);
+	host_boot();
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		uint64_t t, n;
+		if (only && strcmp(only, benches[i].name) != 0) {
+			continue;
+		}
+		printf("%s\n", benches[i].name);
+		t = bench_ns();
+		n = benches[i].fn();
+		t = bench_ns() - t;
+		printf("    %llu %s, %.2f ns/%s\n", (unsigned long long)n,
+		       benches[i].unit, n ? (double)t / n : 0.0,
+		       benches[i].unit);
+	}
+	return bench_failed;
+}
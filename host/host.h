@@ -0,0 +1,70 @@
+#ifndef _HOST_H_
+#define _HOST_H_
+
+// Simulation controls for the host port layer (host/port.c). Time is
+// virtual and counted in TMOS ticks of 625us, nothing advances unless
+// host_run() is called.
+
+#include <stdint.h>
+#include "CH58xBLE_LIB.h"
+
+enum {
+	HOST_MAX_LINKS = 16,
+	HOST_DEFAULT_INTERVAL = 24, // x 1.25ms = 30ms
+};
+
+struct host_link_stats {
+	uint32_t conn_events;
+	uint32_t noti_count;
+	uint32_t noti_bytes;
+	uint32_t noti_rejected;
+	uint32_t radio_events; // the ones the peripheral did not sleep through
+	uint32_t param_refused; // parameter requests the central ignored
+	uint16_t interval;
+	uint16_t latency;
+	uint16_t mtu;
+};
+
+typedef void (*host_noti_sink_t)(uint16_t connHandle, uint16_t handle,
+				 uint8_t *data, uint16_t len);
+typedef void (*host_uart_sink_t)(const uint8_t *data, int len);
+
+void host_set_quiet(int quiet);
+void host_set_uart_sink(host_uart_sink_t sink);
+const char *host_uart1_pty(void);
+void host_uart1_pty_close(void);
+uint32_t host_uart1_overrun(void);
+void host_key(int key, int down);
+void host_key_at(uint32_t us, int key, int down);
+void host_boot(void);
+uint32_t host_now(void);
+void host_run(uint32_t ticks);
+uint32_t host_dispatches(void);
+uint32_t host_wakeups(void);
+void host_set_hse_startup(uint32_t cycles);
+void host_set_vdd(uint16_t mv);
+uint64_t host_rv32_retired(void);
+
+uint16_t host_connect(uint16_t interval);
+void host_disconnect(uint16_t connHandle, uint8_t reason);
+void host_conn_param_update(uint16_t connHandle, uint16_t interval,
+			    uint16_t latency, uint16_t timeout);
+void host_mtu_update(uint16_t connHandle, uint16_t mtu);
+void host_set_tx_per_event(int n);
+void host_set_central_limits(uint16_t interval_min, uint16_t latency_max);
+void host_set_noti_sink(host_noti_sink_t sink);
+int host_link_up(uint16_t connHandle);
+struct host_link_stats *host_link_stats(uint16_t connHandle);
+int host_gatt_buffers_in_use(void);
+
+bStatus_t host_att_write(uint16_t connHandle, uint16_t uuid, uint8_t *data,
+			 uint16_t len, uint8_t method);
+bStatus_t host_att_read(uint16_t connHandle, uint16_t uuid, uint8_t *buf,
+			uint16_t *len, uint16_t maxLen);
+bStatus_t host_att_read_long(uint16_t connHandle, uint16_t uuid,
+			     uint8_t *buf, uint16_t *len, uint16_t maxLen);
+bStatus_t host_ccc_enable(uint16_t connHandle, uint16_t uuid);
+bStatus_t host_ccc_disable(uint16_t connHandle, uint16_t uuid);
+uint16_t host_att_handle(uint16_t uuid);
+
+#endif
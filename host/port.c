@@ -0,0 +1,1418 @@
+// posix_openpt() and the pty calls
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "CH58xBLE_LIB.h"
+#include "CONFIG.h"
+#include "HAL.h"
+#include "host.h"
+#include "mcycle.h"
+#include "uart1.h"
+#include "matrix.h"
+
+// In-process stand-ins for TMOS, GAPRole and GATTServApp. Everything runs
+// on a virtual clock counted in 625us ticks, link layer connection events
+// are modelled per link so notifications leave the device at the pace a
+// real controller would allow. Handlers are charged the host time they
+// take, so code that keeps the CPU busy moves the virtual clock too.
+
+uint8_t chip_uid[8] = { 0x48, 0x4F, 0x53, 0x54, 0x00, 0x00, 0x58, 0x2 };
+uint16_t chip_uid_sum = 0;
+
+extern void Peripheral_Init(void);
+
+enum {
+	HOST_MAX_TASKS = 32,
+	HOST_MAX_SERVICES = 8,
+	HOST_MAX_CHARCFGS = 16,
+	HOST_MAX_DISPATCH = (1 << 20),
+	HOST_RSSI = -50,
+	HOST_CYCLES_PER_TICK = 625 * MCYCLE_PER_US,
+	HOST_RTC_PER_TICK = 20, // 32kHz cycles
+	HOST_UART_BYTE = 10 * 1000000 * MCYCLE_PER_US / UART1_BAUD,
+	HOST_MAX_KEYS_AT = 64,
+	// from a pin edge in sleep to its handler, the core restarts on the
+	// RC oscillator well before the crystal is up, assumed
+	HOST_GPIO_WAKE = 200 * MCYCLE_PER_US,
+};
+
+static int quiet;
+
+int host_printf(const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+	if (quiet) {
+		return 0;
+	}
+	va_start(ap, fmt);
+	ret = vprintf(fmt, ap);
+	va_end(ap);
+	return ret;
+}
+
+void host_set_quiet(int q)
+{
+	quiet = q;
+}
+
+// UART1, the line sends a byte every ten bit times of the virtual clock
+// and the THR empty interrupt comes when the fifo runs dry. Bytes reach
+// the sink as they enter the fifo. With -v the line is stderr, so the
+// trace frames keep clear of the bench's own output on stdout. Once
+// host_uart1_pty() opened one the line is a pty both ways: what the
+// other end writes arrives a byte time apart, and the interrupt comes at
+// the fifo trigger level or when the line goes quiet.
+
+static host_uart_sink_t uart_sink;
+static int uart_fifo, uart_irq, uart_in_irq;
+static uint64_t uart_clock; // the line is busy up to here
+static int uart_pty = -1;
+static uint8_t uart_rx[UART1_FIFO];
+static int uart_rx_num;
+static uint64_t uart_rx_clock;
+static uint32_t uart_rx_overrun;
+
+void host_set_uart_sink(host_uart_sink_t sink)
+{
+	uart_sink = sink;
+}
+
+static uint64_t host_cycles(void);
+
+int host_uart1_room(void)
+{
+	return uart_fifo < UART1_FIFO;
+}
+
+void host_uart1_put(uint8_t c)
+{
+	uint64_t t = host_cycles();
+	// an idle line starts now, a refill from the interrupt where the
+	// last byte left
+	if (uart_fifo == 0 && !uart_in_irq && uart_clock < t) {
+		uart_clock = t;
+	}
+	uart_fifo++;
+	if (uart_sink) {
+		uart_sink(&c, 1);
+	} else if (uart_pty >= 0) {
+		// the other end stopped reading, the byte is lost
+		if (write(uart_pty, &c, 1) != 1) {
+			uart_rx_overrun++;
+		}
+	} else if (!quiet) {
+		fputc(c, stderr);
+	}
+}
+
+void host_uart1_irq(int on)
+{
+	uart_irq = on;
+}
+
+int host_uart1_received(void)
+{
+	return uart_rx_num;
+}
+
+uint8_t host_uart1_get(void)
+{
+	uint8_t c = uart_rx[0];
+	memmove(uart_rx, uart_rx + 1, --uart_rx_num);
+	return c;
+}
+
+// The device end of a new pty, the name of the other end is returned for
+// a terminal or a bench to open.
+const char *host_uart1_pty(void)
+{
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0 || grantpt(fd) || unlockpt(fd)) {
+		return NULL;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	uart_pty = fd;
+	uart_rx_num = 0;
+	uart_rx_clock = host_cycles();
+	return ptsname(fd);
+}
+
+void host_uart1_pty_close(void)
+{
+	if (uart_pty >= 0) {
+		close(uart_pty);
+	}
+	uart_pty = -1;
+	uart_rx_num = 0;
+}
+
+// bytes the fifo had no room for, or the pty for
+uint32_t host_uart1_overrun(void)
+{
+	return uart_rx_overrun;
+}
+
+static void host_uart_rx_service(uint64_t t)
+{
+	uint8_t c;
+	if (uart_pty < 0) {
+		return;
+	}
+	while (uart_rx_clock + HOST_UART_BYTE <= t) {
+		if (read(uart_pty, &c, 1) != 1) {
+			uart_rx_clock = t;
+			break;
+		}
+		uart_rx_clock += HOST_UART_BYTE;
+		if (uart_rx_num < UART1_FIFO) {
+			uart_rx[uart_rx_num++] = c;
+		} else {
+			uart_rx_overrun++;
+		}
+		if (uart_rx_num >= UART1_RX_TRIGGER) {
+			UART1_IRQHandler();
+		}
+	}
+	// the receive timeout
+	if (uart_rx_num) {
+		UART1_IRQHandler();
+	}
+}
+
+static void host_uart_service(void)
+{
+	uint64_t t = host_cycles();
+	while (uart_fifo && uart_clock + HOST_UART_BYTE <= t) {
+		uart_clock += HOST_UART_BYTE;
+		if (--uart_fifo == 0 && uart_irq) {
+			uart_in_irq = 1;
+			UART1_IRQHandler();
+			uart_in_irq = 0;
+		}
+	}
+	host_uart_rx_service(t);
+}
+
+// The key matrix ports. A key down pulls its column low while its row
+// is driven low, one row while scanning or all of them while parked. A
+// column going low with the interrupt armed calls the handler there and
+// then, from sleep too, see host_key_at().
+
+static uint32_t host_keys[MATRIX_WORDS];
+static int host_row = -1;
+static int host_rows_parked, host_gpio_irq;
+static uint32_t host_gpio_wake; // cycles, while the core is stopped
+
+static void host_set_cycles(uint64_t t);
+
+uint32_t host_matrix_sense(void)
+{
+	uint32_t cols = 0;
+	int r;
+	for (r = 0; r < MATRIX_ROWS; r++) {
+		if (host_rows_parked || r == host_row) {
+			cols |= host_keys[r >> 1] >> (r & 1) * 16 & 0xffff;
+		}
+	}
+	return ~cols & MATRIX_COL_PINS;
+}
+
+// nonzero when the change interrupted
+static int host_key_change(int key, int down)
+{
+	uint32_t bit = 1u << (key & 31), before = host_matrix_sense();
+	if (down) {
+		host_keys[key >> 5] |= bit;
+	} else {
+		host_keys[key >> 5] &= ~bit;
+	}
+	if (host_gpio_irq && (before & ~host_matrix_sense())) {
+		host_set_cycles(host_cycles() + host_gpio_wake);
+		GPIOB_IRQHandler();
+		return 1;
+	}
+	return 0;
+}
+
+void host_key(int key, int down)
+{
+	host_key_change(key, down);
+}
+
+void host_matrix_select(int row)
+{
+	host_row = row;
+}
+
+void host_matrix_release(int row)
+{
+	host_row = -1;
+}
+
+void host_matrix_park(int on)
+{
+	host_rows_parked = on;
+}
+
+void host_matrix_irq(int on)
+{
+	host_gpio_irq = on;
+}
+
+// TMOS
+
+struct host_msg {
+	struct host_msg *next;
+	uint8_t dest;
+	uint8_t data[] __attribute__((aligned(8)));
+};
+
+#define HOST_MSG(p) \
+	((struct host_msg *)((uint8_t *)(p)-offsetof(struct host_msg, data)))
+
+struct host_task {
+	pTaskEventHandlerFn cb;
+	uint16_t events;
+	uint16_t timer_active;
+	uint32_t deadline[16];
+	struct host_msg *msg_head;
+	struct host_msg *msg_tail;
+};
+
+static struct host_task tasks[HOST_MAX_TASKS];
+static int tasks_num;
+static uint32_t now;
+static uint32_t dispatches;
+static uint32_t wakeups; // ticks a TMOS timer fired on
+static uint32_t wakeup_tick;
+static uint32_t cycles_carry;
+
+static int host_due(uint32_t deadline)
+{
+	return (int32_t)(deadline - now) <= 0;
+}
+
+tmosTaskID TMOS_ProcessEventRegister(pTaskEventHandlerFn eventCb)
+{
+	if (tasks_num >= HOST_MAX_TASKS) {
+		return INVALID_TASK_ID;
+	}
+	tasks[tasks_num].cb = eventCb;
+	return tasks_num++;
+}
+
+bStatus_t tmos_set_event(tmosTaskID taskID, tmosEvents event)
+{
+	if (taskID >= tasks_num) {
+		return INVALID_TASK;
+	}
+	tasks[taskID].events |= event;
+	return SUCCESS;
+}
+
+bStatus_t tmos_clear_event(tmosTaskID taskID, tmosEvents event)
+{
+	if (taskID >= tasks_num) {
+		return INVALID_TASK;
+	}
+	tasks[taskID].events &= ~event;
+	return SUCCESS;
+}
+
+bStatus_t tmos_start_task(tmosTaskID taskID, tmosEvents event,
+			  tmosTimer time)
+{
+	int bit;
+	if (taskID >= tasks_num) {
+		return INVALID_TASK;
+	}
+	for (bit = 0; bit < 16; bit++) {
+		if (event & (1 << bit)) {
+			tasks[taskID].deadline[bit] = now + time;
+			tasks[taskID].timer_active |= (1 << bit);
+		}
+	}
+	return SUCCESS;
+}
+
+bStatus_t tmos_stop_task(tmosTaskID taskID, tmosEvents event)
+{
+	if (taskID >= tasks_num) {
+		return INVALID_TASK;
+	}
+	tasks[taskID].timer_active &= ~event;
+	tasks[taskID].events &= ~event;
+	return SUCCESS;
+}
+
+tmosTimer tmos_get_task_timer(tmosTaskID taskID, tmosEvents event)
+{
+	int bit;
+	if (taskID >= tasks_num) {
+		return 0;
+	}
+	for (bit = 0; bit < 16; bit++) {
+		if ((event & (1 << bit)) &&
+		    (tasks[taskID].timer_active & (1 << bit))) {
+			return tasks[taskID].deadline[bit] - now;
+		}
+	}
+	return 0;
+}
+
+uint8_t *tmos_msg_allocate(uint16_t len)
+{
+	struct host_msg *m;
+	m = malloc(sizeof(struct host_msg) + len);
+	if (m == NULL) {
+		return NULL;
+	}
+	m->next = NULL;
+	return m->data;
+}
+
+bStatus_t tmos_msg_deallocate(uint8_t *msg_ptr)
+{
+	if (msg_ptr == NULL) {
+		return INVALID_MSG_POINTER;
+	}
+	free(HOST_MSG(msg_ptr));
+	return SUCCESS;
+}
+
+bStatus_t tmos_msg_send(tmosTaskID taskID, uint8_t *msg_ptr)
+{
+	struct host_msg *m;
+	if (msg_ptr == NULL) {
+		return INVALID_MSG_POINTER;
+	}
+	if (taskID >= tasks_num) {
+		tmos_msg_deallocate(msg_ptr);
+		return INVALID_TASK;
+	}
+	m = HOST_MSG(msg_ptr);
+	m->dest = taskID;
+	m->next = NULL;
+	if (tasks[taskID].msg_tail) {
+		tasks[taskID].msg_tail->next = m;
+	} else {
+		tasks[taskID].msg_head = m;
+	}
+	tasks[taskID].msg_tail = m;
+	tasks[taskID].events |= SYS_EVENT_MSG;
+	return SUCCESS;
+}
+
+uint8_t *tmos_msg_receive(tmosTaskID taskID)
+{
+	struct host_msg *m;
+	if (taskID >= tasks_num) {
+		return NULL;
+	}
+	m = tasks[taskID].msg_head;
+	if (m == NULL) {
+		return NULL;
+	}
+	tasks[taskID].msg_head = m->next;
+	if (tasks[taskID].msg_head == NULL) {
+		tasks[taskID].msg_tail = NULL;
+	} else {
+		// more messages waiting, come back for them
+		tasks[taskID].events |= SYS_EVENT_MSG;
+	}
+	return m->data;
+}
+
+void *tmos_memcpy(void *dst, const void *src, uint32_t len)
+{
+	return memcpy(dst, src, len);
+}
+
+void tmos_memset(void *pDst, uint8_t Value, uint32_t len)
+{
+	memset(pDst, Value, len);
+}
+
+uint32_t TMOS_GetSystemClock(void)
+{
+	return now;
+}
+
+static void host_fire_timers(void)
+{
+	int taskp, bit;
+	for (taskp = 0; taskp < tasks_num; taskp++) {
+		if (tasks[taskp].timer_active == 0) {
+			continue;
+		}
+		for (bit = 0; bit < 16; bit++) {
+			if ((tasks[taskp].timer_active & (1 << bit)) &&
+			    host_due(tasks[taskp].deadline[bit])) {
+				tasks[taskp].timer_active &= ~(1 << bit);
+				tasks[taskp].events |= (1 << bit);
+				if (wakeups == 0 || wakeup_tick != now) {
+					wakeups++;
+					wakeup_tick = now;
+				}
+			}
+		}
+	}
+}
+
+// thread cpu time rather than wall time so being preempted on the host
+// does not show up as firmware cycles
+uint32_t mcycle(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 * MCYCLE_PER_US +
+	       (uint64_t)ts.tv_nsec * MCYCLE_PER_US / 1000;
+}
+
+static uint64_t host_cycles(void)
+{
+	return (uint64_t)now * HOST_CYCLES_PER_TICK + cycles_carry;
+}
+
+static void host_charge(uint32_t cycles)
+{
+	cycles_carry += cycles;
+	now += cycles_carry / HOST_CYCLES_PER_TICK;
+	cycles_carry %= HOST_CYCLES_PER_TICK;
+}
+
+static int host_dispatch_one(void)
+{
+	int taskp;
+	uint16_t events;
+	uint32_t t0;
+	for (taskp = 0; taskp < tasks_num; taskp++) {
+		if (tasks[taskp].events) {
+			events = tasks[taskp].events;
+			tasks[taskp].events = 0;
+			t0 = mcycle();
+			events = tasks[taskp].cb(taskp, events);
+			host_charge(mcycle() - t0);
+			tasks[taskp].events |= events;
+			dispatches++;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void TMOS_SystemProcess(void)
+{
+	host_fire_timers();
+	host_dispatch_one();
+}
+
+uint32_t host_now(void)
+{
+	return now;
+}
+
+uint32_t host_dispatches(void)
+{
+	return dispatches;
+}
+
+uint32_t host_wakeups(void)
+{
+	return wakeups;
+}
+
+// RTC and low power, the RTC counts off the virtual clock and the
+// handler cycles not yet worth a tick. The low power calls skip the clock
+// ahead to the trigger, sleep and halt plus the time the crystal takes
+// to start.
+
+volatile uint32_t RTCTigFlag;
+static uint32_t rtc_trig;
+static uint32_t hse_startup = US_TO_RTC(1200);
+
+static uint64_t host_rtc(void)
+{
+	return (uint64_t)now * HOST_RTC_PER_TICK +
+	       cycles_carry * HOST_RTC_PER_TICK / HOST_CYCLES_PER_TICK;
+}
+
+uint32_t RTC_GetCycle32k(void)
+{
+	return host_rtc() % RTC_TIMER_MAX_VALUE;
+}
+
+void RTC_SetTignTime(uint32_t time)
+{
+	rtc_trig = time;
+	RTCTigFlag = 0;
+}
+
+static void host_set_cycles(uint64_t t)
+{
+	now = t / HOST_CYCLES_PER_TICK;
+	cycles_carry = t % HOST_CYCLES_PER_TICK;
+}
+
+// Key changes the bench lined up ahead, in virtual cycles
+static struct host_key_at {
+	uint64_t at;
+	int key;
+	int down;
+} host_keys_at[HOST_MAX_KEYS_AT];
+static int host_keys_at_num;
+
+void host_key_at(uint32_t us, int key, int down)
+{
+	uint64_t at = host_cycles() + (uint64_t)us * MCYCLE_PER_US;
+	int i = host_keys_at_num;
+	if (i == HOST_MAX_KEYS_AT) {
+		return;
+	}
+	for (; i > 0 && host_keys_at[i - 1].at > at; i--) {
+		host_keys_at[i] = host_keys_at[i - 1];
+	}
+	host_keys_at[i] = (struct host_key_at){ at, key, down };
+	host_keys_at_num++;
+}
+
+// Changes due before end, the clock moved to each. Stops after one that
+// interrupted and returns nonzero.
+static int host_keys_service(uint64_t end)
+{
+	struct host_key_at k;
+	while (host_keys_at_num && host_keys_at[0].at < end) {
+		k = host_keys_at[0];
+		memmove(host_keys_at, host_keys_at + 1,
+			--host_keys_at_num * sizeof(host_keys_at[0]));
+		if (k.at > host_cycles()) {
+			host_set_cycles(k.at);
+		}
+		if (host_key_change(k.key, k.down)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// A trigger that is not ahead of the RTC never fires. A key interrupt
+// before the trigger ends the wait early, from halt or sleep only after
+// the core is running again.
+static void host_rtc_wait(uint32_t extra, uint32_t wake)
+{
+	uint32_t rtc = RTC_GetCycle32k();
+	uint32_t gap = rtc_trig - rtc;
+	uint64_t t;
+	if (rtc_trig < rtc) {
+		gap = rtc_trig + (RTC_TIMER_MAX_VALUE - rtc);
+	}
+	if (gap == 0 || gap > RTC_TIMER_MAX_VALUE / 2) {
+		return;
+	}
+	t = host_rtc() + gap;
+	host_gpio_wake = wake;
+	if (host_keys_service(t * HOST_CYCLES_PER_TICK / HOST_RTC_PER_TICK)) {
+		host_gpio_wake = 0;
+		return;
+	}
+	host_gpio_wake = 0;
+	t += extra;
+	now = t / HOST_RTC_PER_TICK;
+	cycles_carry = t % HOST_RTC_PER_TICK * HOST_CYCLES_PER_TICK /
+		       HOST_RTC_PER_TICK;
+	RTCTigFlag = 1;
+}
+
+void LowPower_Idle(void)
+{
+	host_rtc_wait(0, 0);
+}
+
+void LowPower_Halt(void)
+{
+	host_rtc_wait(hse_startup, HOST_GPIO_WAKE);
+}
+
+void LowPower_Sleep(uint8_t rm)
+{
+	host_rtc_wait(hse_startup, HOST_GPIO_WAKE);
+}
+
+void HSECFG_Current(int c)
+{
+}
+
+void SYS_DisableAllIrq(uint32_t *pirqv)
+{
+}
+
+void SYS_RecoverIrq(uint32_t irq_status)
+{
+}
+
+void host_set_hse_startup(uint32_t cycles)
+{
+	hse_startup = cycles;
+}
+
+// ADC, VDD on the internal channel at -12dB, (adc / 512 - 3) * 1.05V
+
+static uint16_t host_vdd = 3000; // mV
+
+void host_set_vdd(uint16_t mv)
+{
+	host_vdd = mv;
+}
+
+void ADC_InterBATSampInit(void)
+{
+}
+
+uint16_t ADC_ExcutSingleConver(void)
+{
+	// rounded up, so it reads back at least host_vdd
+	return (host_vdd * 512 + 1049) / 1050 + 3 * 512;
+}
+
+// the stack's sleep callback with the wake-up time it asks for ahead of
+// the tick the next timer or link event is due on
+static void host_sleep(uint32_t next)
+{
+	uint64_t t = (uint64_t)next * HOST_RTC_PER_TICK +
+		     RTC_TIMER_MAX_VALUE - WAKE_UP_RTC_MAX_TIME;
+	CH58X_LowPower(t % RTC_TIMER_MAX_VALUE);
+}
+
+// Link layer
+
+struct host_noti {
+	uint16_t handle;
+	uint16_t len;
+	uint8_t *buf;
+};
+
+struct host_link {
+	int used;
+	int terminate;
+	int update;
+	int skipped; // connection events slept through in a row
+	uint16_t req_min;
+	uint16_t req_max;
+	uint16_t req_latency;
+	uint16_t req_timeout;
+	uint16_t timeout;
+	uint32_t next_event;
+	int nq;
+	struct host_noti q[BLE_BUFF_NUM];
+	struct host_link_stats stats;
+};
+
+static struct host_link links[HOST_MAX_LINKS];
+static int tx_per_event = BLE_TX_NUM_EVENT;
+static uint16_t central_interval_min;
+static uint16_t central_latency_max = 0xffff;
+static host_noti_sink_t noti_sink;
+static int gatt_buffers;
+
+static gapRolesCBs_t *role_cbs;
+static uint8_t role_task = INVALID_TASK_ID;
+static uint8_t adv_enabled;
+
+static struct host_link *host_link_get(uint16_t connHandle)
+{
+	if (connHandle >= HOST_MAX_LINKS || !links[connHandle].used) {
+		return NULL;
+	}
+	return &links[connHandle];
+}
+
+void host_set_central_limits(uint16_t interval_min, uint16_t latency_max)
+{
+	central_interval_min = interval_min;
+	central_latency_max = latency_max;
+}
+
+void host_set_tx_per_event(int n)
+{
+	tx_per_event = n;
+}
+
+void host_set_noti_sink(host_noti_sink_t sink)
+{
+	noti_sink = sink;
+}
+
+int host_link_up(uint16_t connHandle)
+{
+	return host_link_get(connHandle) != NULL;
+}
+
+struct host_link_stats *host_link_stats(uint16_t connHandle)
+{
+	if (connHandle >= HOST_MAX_LINKS) {
+		return NULL;
+	}
+	return &links[connHandle].stats;
+}
+
+int host_gatt_buffers_in_use(void)
+{
+	return gatt_buffers;
+}
+
+static void host_link_event(uint16_t connHandle)
+{
+	struct host_link *l = &links[connHandle];
+	int n;
+	l->stats.conn_events++;
+	// with slave latency the peripheral only wakes when it has
+	// something to send or it is out of events to skip
+	if (l->nq == 0 && l->skipped < l->stats.latency) {
+		l->skipped++;
+		l->next_event += l->stats.interval * 2;
+		return;
+	}
+	l->skipped = 0;
+	l->stats.radio_events++;
+	for (n = 0; n < tx_per_event && l->nq; n++) {
+		struct host_noti *p = &l->q[0];
+		l->stats.noti_count++;
+		l->stats.noti_bytes += p->len;
+		if (noti_sink) {
+			noti_sink(connHandle, p->handle, p->buf, p->len);
+		}
+		free(p->buf);
+		gatt_buffers--;
+		l->nq--;
+		memmove(&l->q[0], &l->q[1], l->nq * sizeof(l->q[0]));
+	}
+	l->next_event += l->stats.interval * 2;
+}
+
+uint16_t host_connect(uint16_t interval)
+{
+	gapRoleEvent_t ev;
+	uint16_t connHandle;
+	for (connHandle = 0; connHandle < HOST_MAX_LINKS; connHandle++) {
+		if (!links[connHandle].used) {
+			break;
+		}
+	}
+	if (connHandle == HOST_MAX_LINKS) {
+		return INVALID_CONNHANDLE;
+	}
+	memset(&links[connHandle], 0, sizeof(links[connHandle]));
+	links[connHandle].used = 1;
+	links[connHandle].stats.interval = interval;
+	links[connHandle].stats.mtu = ATT_MTU_SIZE;
+	links[connHandle].timeout = 100;
+	links[connHandle].next_event = now + interval * 2;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.linkCmpl.hdr.event = GAP_MSG_EVENT;
+	ev.linkCmpl.hdr.status = SUCCESS;
+	ev.linkCmpl.opcode = GAP_LINK_ESTABLISHED_EVENT;
+	ev.linkCmpl.connectionHandle = connHandle;
+	ev.linkCmpl.connInterval = interval;
+	ev.linkCmpl.connTimeout = links[connHandle].timeout;
+	if (role_cbs && role_cbs->pfnStateChange) {
+		role_cbs->pfnStateChange(GAPROLE_CONNECTED, &ev);
+	}
+	return connHandle;
+}
+
+static void host_charcfg_drop(uint16_t connHandle);
+
+void host_disconnect(uint16_t connHandle, uint8_t reason)
+{
+	struct host_link *l = host_link_get(connHandle);
+	gapRoleEvent_t ev;
+	if (l == NULL) {
+		return;
+	}
+	while (l->nq) {
+		free(l->q[--l->nq].buf);
+		gatt_buffers--;
+	}
+	l->used = 0;
+	host_charcfg_drop(connHandle);
+
+	memset(&ev, 0, sizeof(ev));
+	ev.linkTerminate.hdr.event = GAP_MSG_EVENT;
+	ev.linkTerminate.opcode = GAP_LINK_TERMINATED_EVENT;
+	ev.linkTerminate.connectionHandle = connHandle;
+	ev.linkTerminate.reason = reason;
+	if (role_cbs && role_cbs->pfnStateChange) {
+		role_cbs->pfnStateChange(adv_enabled ? GAPROLE_ADVERTISING :
+						       GAPROLE_WAITING,
+					 &ev);
+	}
+}
+
+void host_conn_param_update(uint16_t connHandle, uint16_t interval,
+			    uint16_t latency, uint16_t timeout)
+{
+	struct host_link *l = host_link_get(connHandle);
+	if (l == NULL) {
+		return;
+	}
+	l->stats.interval = interval;
+	l->stats.latency = latency;
+	l->timeout = timeout;
+	l->next_event = now + interval * 2;
+	if (role_cbs && role_cbs->pfnParamUpdate) {
+		role_cbs->pfnParamUpdate(connHandle, interval, latency,
+					 timeout);
+	}
+}
+
+void host_mtu_update(uint16_t connHandle, uint16_t mtu)
+{
+	struct host_link *l = host_link_get(connHandle);
+	gattMsgEvent_t ev;
+	uint8_t *msg;
+	if (l == NULL) {
+		return;
+	}
+	// the server side offers what its buffers hold
+	l->stats.mtu = MIN(mtu, BLE_BUFF_MAX_LEN - 4);
+	memset(&ev, 0, sizeof(ev));
+	ev.hdr.event = GATT_MSG_EVENT;
+	ev.connHandle = connHandle;
+	ev.method = ATT_MTU_UPDATED_EVENT;
+	ev.msg.exchangeMTUReq.clientRxMTU = mtu;
+	msg = tmos_msg_allocate(sizeof(ev));
+	memcpy(msg, &ev, sizeof(ev));
+	tmos_msg_send(role_task, msg);
+}
+
+// apply requests the firmware made from inside a callback, the central
+// answers them between connection events
+static void host_links_service(void)
+{
+	uint16_t connHandle;
+	for (connHandle = 0; connHandle < HOST_MAX_LINKS; connHandle++) {
+		struct host_link *l = &links[connHandle];
+		if (!l->used) {
+			continue;
+		}
+		if (l->terminate) {
+			host_disconnect(connHandle, 0x16);
+			continue;
+		}
+		if (l->update) {
+			l->update = 0;
+			// the central takes the fastest interval it is
+			// offered, or refuses silently what it won't do
+			if (l->req_max < central_interval_min ||
+			    l->req_latency > central_latency_max) {
+				l->stats.param_refused++;
+				continue;
+			}
+			host_conn_param_update(
+				connHandle, MAX(l->req_min, central_interval_min),
+				l->req_latency, l->req_timeout);
+		}
+	}
+}
+
+static void host_fire_links(void)
+{
+	uint16_t connHandle;
+	for (connHandle = 0; connHandle < HOST_MAX_LINKS; connHandle++) {
+		if (links[connHandle].used &&
+		    host_due(links[connHandle].next_event)) {
+			host_link_event(connHandle);
+		}
+	}
+}
+
+static uint32_t host_next_deadline(uint32_t limit)
+{
+	uint32_t next = limit - now;
+	int taskp, bit;
+	uint16_t connHandle;
+	for (taskp = 0; taskp < tasks_num; taskp++) {
+		for (bit = 0; bit < 16; bit++) {
+			if ((tasks[taskp].timer_active & (1 << bit)) &&
+			    (tasks[taskp].deadline[bit] - now < next)) {
+				next = tasks[taskp].deadline[bit] - now;
+			}
+		}
+	}
+	for (connHandle = 0; connHandle < HOST_MAX_LINKS; connHandle++) {
+		if (links[connHandle].used &&
+		    (links[connHandle].next_event - now < next)) {
+			next = links[connHandle].next_event - now;
+		}
+	}
+	return now + next;
+}
+
+// stops early once busy handlers have pushed the clock to end, timers
+// due by then fire on the next call
+static void host_process(uint32_t end)
+{
+	int cnt = 0;
+	do {
+		if ((int32_t)(now - end) > 0) {
+			break;
+		}
+		host_uart_service();
+		host_keys_service(host_cycles() + 1);
+		host_fire_timers();
+		host_fire_links();
+		host_links_service();
+		if (++cnt > HOST_MAX_DISPATCH) {
+			host_printf("host: dispatch storm at tick %u\n\r",
+				    (unsigned)now);
+			break;
+		}
+	} while (host_dispatch_one());
+}
+
+void host_run(uint32_t ticks)
+{
+	uint32_t end = now + ticks, next;
+	while (1) {
+		host_process(end);
+		if ((int32_t)(now - end) >= 0) {
+			break;
+		}
+		next = host_next_deadline(end);
+#if (defined(HAL_SLEEP)) && (HAL_SLEEP == TRUE)
+		host_sleep(next);
+#endif
+		// a late wake-up leaves the clock past next, a key change
+		// due before it moves the clock there instead
+		if ((int32_t)(next - now) > 0 &&
+		    !host_keys_service((uint64_t)next * HOST_CYCLES_PER_TICK)) {
+			now = next;
+		}
+	}
+}
+
+void host_boot(void)
+{
+	int i;
+	chip_uid_sum = 0;
+	for (i = 0; i < 8; i++) {
+		chip_uid_sum += chip_uid[i];
+	}
+	uart1_init();
+	HAL_SleepInit();
+	GAPRole_PeripheralInit();
+	Peripheral_Init();
+	host_run(0);
+}
+
+// GAP
+
+bStatus_t GAPRole_PeripheralInit(void)
+{
+	return SUCCESS;
+}
+
+bStatus_t GAPRole_CentralInit(void)
+{
+	return SUCCESS;
+}
+
+bStatus_t GAPRole_PeripheralStartDevice(uint8_t taskid, gapBondCBs_t *pCB,
+					gapRolesCBs_t *pAppCallbacks)
+{
+	gapRoleEvent_t ev;
+	role_task = taskid;
+	role_cbs = pAppCallbacks;
+	memset(&ev, 0, sizeof(ev));
+	ev.gap.hdr.event = GAP_MSG_EVENT;
+	ev.gap.opcode = GAP_DEVICE_INIT_DONE_EVENT;
+	role_cbs->pfnStateChange(GAPROLE_STARTED, &ev);
+	if (adv_enabled) {
+		ev.gap.opcode = GAP_MAKE_DISCOVERABLE_DONE_EVENT;
+		role_cbs->pfnStateChange(GAPROLE_ADVERTISING, &ev);
+	}
+	return SUCCESS;
+}
+
+bStatus_t GAPRole_SetParameter(uint16_t param, uint16_t len, void *pValue)
+{
+	if (param == GAPROLE_ADVERT_ENABLED) {
+		adv_enabled = *(uint8_t *)pValue;
+	}
+	return SUCCESS;
+}
+
+bStatus_t GAPRole_TerminateLink(uint16_t connHandle)
+{
+	struct host_link *l = host_link_get(connHandle);
+	if (l == NULL) {
+		return bleNotConnected;
+	}
+	l->terminate = 1;
+	return SUCCESS;
+}
+
+bStatus_t GAPRole_PeripheralConnParamUpdateReq(uint16_t connHandle,
+					       uint16_t minConnInterval,
+					       uint16_t maxConnInterval,
+					       uint16_t latency,
+					       uint16_t connTimeout,
+					       uint8_t taskId)
+{
+	struct host_link *l = host_link_get(connHandle);
+	if (l == NULL) {
+		return bleNotConnected;
+	}
+	l->update = 1;
+	l->req_min = minConnInterval;
+	l->req_max = maxConnInterval;
+	l->req_latency = latency;
+	l->req_timeout = connTimeout;
+	return SUCCESS;
+}
+
+bStatus_t GAPRole_UpdatePHY(uint16_t connHandle, uint8_t all_phys,
+			    uint8_t tx_phys, uint8_t rx_phys,
+			    uint16_t phy_options)
+{
+	return host_link_get(connHandle) ? SUCCESS : bleNotConnected;
+}
+
+bStatus_t GAPRole_ReadRssiCmd(uint16_t connHandle)
+{
+	if (host_link_get(connHandle) == NULL) {
+		return bleNotConnected;
+	}
+	if (role_cbs && role_cbs->pfnRssiRead) {
+		role_cbs->pfnRssiRead(connHandle, HOST_RSSI);
+	}
+	return SUCCESS;
+}
+
+bStatus_t GAPRole_BroadcasterSetCB(gapRolesBroadcasterCBs_t *pAppCallbacks)
+{
+	return SUCCESS;
+}
+
+bStatus_t GAP_SetParamValue(uint16_t paramID, uint16_t paramValue)
+{
+	return SUCCESS;
+}
+
+// Links here stand for a bonded host, already encrypted, so the
+// encrypted permits are not checked any more than the plain ones.
+bStatus_t GAPBondMgr_SetParameter(uint16_t param, uint8_t len, void *pValue)
+{
+	return SUCCESS;
+}
+
+bStatus_t GGS_AddService(uint32_t services)
+{
+	return SUCCESS;
+}
+
+bStatus_t GGS_SetParameter(uint8_t param, uint8_t len, void *value)
+{
+	return SUCCESS;
+}
+
+// GATT
+
+const uint8_t primaryServiceUUID[ATT_BT_UUID_SIZE] = { 0x00, 0x28 };
+const uint8_t characterUUID[ATT_BT_UUID_SIZE] = { 0x03, 0x28 };
+const uint8_t charUserDescUUID[ATT_BT_UUID_SIZE] = { 0x01, 0x29 };
+const uint8_t clientCharCfgUUID[ATT_BT_UUID_SIZE] = { 0x02, 0x29 };
+
+struct host_service {
+	gattAttribute_t *attrs;
+	uint16_t num;
+	gattServiceCBs_t *cbs;
+};
+
+static struct host_service services[HOST_MAX_SERVICES];
+static int services_num;
+static gattCharCfg_t *charcfgs[HOST_MAX_CHARCFGS];
+static int charcfgs_num;
+static uint16_t next_handle = 1;
+
+bStatus_t GATTServApp_AddService(uint32_t services)
+{
+	return SUCCESS;
+}
+
+bStatus_t GATTServApp_RegisterService(gattAttribute_t *pAttrs,
+				      uint16_t numAttrs, uint8_t encKeySize,
+				      gattServiceCBs_t *pServiceCBs)
+{
+	int i;
+	if (services_num >= HOST_MAX_SERVICES) {
+		return bleNoResources;
+	}
+	for (i = 0; i < numAttrs; i++) {
+		pAttrs[i].handle = next_handle++;
+	}
+	services[services_num].attrs = pAttrs;
+	services[services_num].num = numAttrs;
+	services[services_num].cbs = pServiceCBs;
+	services_num++;
+	return SUCCESS;
+}
+
+void GATTServApp_InitCharCfg(uint16_t connHandle, gattCharCfg_t *charCfgTbl)
+{
+	int i;
+	if (connHandle == INVALID_CONNHANDLE) {
+		for (i = 0; i < charcfgs_num; i++) {
+			if (charcfgs[i] == charCfgTbl) {
+				break;
+			}
+		}
+		if (i == charcfgs_num && charcfgs_num < HOST_MAX_CHARCFGS) {
+			charcfgs[charcfgs_num++] = charCfgTbl;
+		}
+	}
+	for (i = 0; i < PERIPHERAL_MAX_CONNECTION; i++) {
+		if (connHandle == INVALID_CONNHANDLE ||
+		    charCfgTbl[i].connHandle == connHandle) {
+			charCfgTbl[i].connHandle = INVALID_CONNHANDLE;
+			charCfgTbl[i].value = 0;
+		}
+	}
+}
+
+static void host_charcfg_drop(uint16_t connHandle)
+{
+	int i;
+	for (i = 0; i < charcfgs_num; i++) {
+		GATTServApp_InitCharCfg(connHandle, charcfgs[i]);
+	}
+}
+
+uint16_t GATTServApp_ReadCharCfg(uint16_t connHandle,
+				 gattCharCfg_t *charCfgTbl)
+{
+	int i;
+	for (i = 0; i < PERIPHERAL_MAX_CONNECTION; i++) {
+		if (charCfgTbl[i].connHandle == connHandle) {
+			return charCfgTbl[i].value;
+		}
+	}
+	return 0;
+}
+
+bStatus_t GATTServApp_ProcessCCCWriteReq(uint16_t connHandle,
+					 gattAttribute_t *pAttr,
+					 uint8_t *pValue, uint16_t len,
+					 uint16_t offset, uint16_t validCfg)
+{
+	gattCharCfg_t *tbl = (gattCharCfg_t *)pAttr->pValue;
+	uint16_t value;
+	int i;
+	if (offset != 0) {
+		return ATT_ERR_ATTR_NOT_LONG;
+	}
+	if (len != 2) {
+		return ATT_ERR_INVALID_VALUE_SIZE;
+	}
+	value = BUILD_UINT16(pValue[0], pValue[1]);
+	if (value & ~validCfg) {
+		return ATT_ERR_INVALID_VALUE;
+	}
+	for (i = 0; i < PERIPHERAL_MAX_CONNECTION; i++) {
+		if (tbl[i].connHandle == connHandle) {
+			break;
+		}
+	}
+	if (i == PERIPHERAL_MAX_CONNECTION) {
+		for (i = 0; i < PERIPHERAL_MAX_CONNECTION; i++) {
+			if (tbl[i].connHandle == INVALID_CONNHANDLE) {
+				break;
+			}
+		}
+	}
+	if (i == PERIPHERAL_MAX_CONNECTION) {
+		return ATT_ERR_INSUFFICIENT_RESOURCES;
+	}
+	tbl[i].connHandle = connHandle;
+	tbl[i].value = value;
+	return SUCCESS;
+}
+
+void *GATT_bm_alloc(uint16_t connHandle, uint8_t opcode, uint16_t size,
+		    uint16_t *pSizeAlloc, uint8_t flag)
+{
+	void *p = malloc(size ? size : 1);
+	if (p == NULL) {
+		return NULL;
+	}
+	gatt_buffers++;
+	if (pSizeAlloc) {
+		*pSizeAlloc = size;
+	}
+	return p;
+}
+
+void GATT_bm_free(gattMsg_t *pMsg, uint8_t opcode)
+{
+	if (pMsg->handleValueNoti.pValue == NULL) {
+		return;
+	}
+	free(pMsg->handleValueNoti.pValue);
+	pMsg->handleValueNoti.pValue = NULL;
+	gatt_buffers--;
+}
+
+bStatus_t GATT_Notification(uint16_t connHandle, attHandleValueNoti_t *pNoti,
+			    uint8_t authenticated)
+{
+	struct host_link *l = host_link_get(connHandle);
+	if (l == NULL) {
+		return bleNotConnected;
+	}
+	if (pNoti->len > l->stats.mtu - 3) {
+		return bleInvalidPDU;
+	}
+	if (l->nq >= BLE_BUFF_NUM) {
+		l->stats.noti_rejected++;
+		return blePending;
+	}
+	l->q[l->nq].handle = pNoti->handle;
+	l->q[l->nq].len = pNoti->len;
+	l->q[l->nq].buf = pNoti->pValue;
+	l->nq++;
+	return SUCCESS;
+}
+
+// ATT client side
+
+static gattAttribute_t *host_find_attr(uint16_t uuid, int ccc,
+				       struct host_service **svc)
+{
+	int s, i;
+	for (s = 0; s < services_num; s++) {
+		for (i = 0; i < services[s].num; i++) {
+			gattAttribute_t *a = &services[s].attrs[i];
+			if (a->type.len != ATT_BT_UUID_SIZE ||
+			    BUILD_UINT16(a->type.uuid[0], a->type.uuid[1]) !=
+				    uuid) {
+				continue;
+			}
+			*svc = &services[s];
+			if (!ccc) {
+				return a;
+			}
+			// the CCC descriptor follows its value, before the
+			// next characteristic declaration
+			for (i++; i < services[s].num; i++) {
+				a = &services[s].attrs[i];
+				if (a->type.uuid == characterUUID) {
+					break;
+				}
+				if (a->type.uuid == clientCharCfgUUID) {
+					return a;
+				}
+			}
+			return NULL;
+		}
+	}
+	return NULL;
+}
+
+bStatus_t host_att_write(uint16_t connHandle, uint16_t uuid, uint8_t *data,
+			 uint16_t len, uint8_t method)
+{
+	struct host_service *svc;
+	gattAttribute_t *a = host_find_attr(uuid, 0, &svc);
+	if (a == NULL) {
+		return ATT_ERR_ATTR_NOT_FOUND;
+	}
+	if (svc->cbs->pfnWriteAttrCB == NULL) {
+		return ATT_ERR_WRITE_NOT_PERMITTED;
+	}
+	return svc->cbs->pfnWriteAttrCB(connHandle, a, data, len, 0, method);
+}
+
+bStatus_t host_att_read(uint16_t connHandle, uint16_t uuid, uint8_t *buf,
+			uint16_t *len, uint16_t maxLen)
+{
+	struct host_service *svc;
+	gattAttribute_t *a = host_find_attr(uuid, 0, &svc);
+	if (a == NULL) {
+		return ATT_ERR_ATTR_NOT_FOUND;
+	}
+	if (svc->cbs->pfnReadAttrCB == NULL) {
+		return ATT_ERR_READ_NOT_PERMITTED;
+	}
+	return svc->cbs->pfnReadAttrCB(connHandle, a, buf, len, 0, maxLen,
+				       ATT_READ_REQ);
+}
+
+// a client's long read, a read then blobs of an MTU less the opcode
+// until one comes back short
+bStatus_t host_att_read_long(uint16_t connHandle, uint16_t uuid,
+			     uint8_t *buf, uint16_t *len, uint16_t maxLen)
+{
+	struct host_service *svc;
+	gattAttribute_t *a = host_find_attr(uuid, 0, &svc);
+	struct host_link *l = host_link_get(connHandle);
+	uint16_t chunk, n;
+	bStatus_t status;
+	if (a == NULL || l == NULL) {
+		return ATT_ERR_ATTR_NOT_FOUND;
+	}
+	chunk = l->stats.mtu - 1;
+	*len = 0;
+	do {
+		n = 0;
+		status = svc->cbs->pfnReadAttrCB(
+			connHandle, a, buf + *len, &n, *len,
+			MIN(chunk, maxLen - *len),
+			*len ? ATT_READ_BLOB_REQ : ATT_READ_REQ);
+		if (status != SUCCESS) {
+			return status;
+		}
+		*len += n;
+	} while (n == chunk && *len < maxLen);
+	return SUCCESS;
+}
+
+// value handle, for telling notifications apart in a sink
+uint16_t host_att_handle(uint16_t uuid)
+{
+	struct host_service *svc;
+	gattAttribute_t *a = host_find_attr(uuid, 0, &svc);
+	if (a == NULL) {
+		return 0;
+	}
+	return a->handle;
+}
+
+static bStatus_t host_ccc_write(uint16_t connHandle, uint16_t uuid,
+				uint16_t cfg)
+{
+	struct host_service *svc;
+	uint8_t value[2] = { LO_UINT16(cfg), HI_UINT16(cfg) };
+	gattAttribute_t *a = host_find_attr(uuid, 1, &svc);
+	if (a == NULL) {
+		return ATT_ERR_ATTR_NOT_FOUND;
+	}
+	return svc->cbs->pfnWriteAttrCB(connHandle, a, value, sizeof(value),
+					0, ATT_WRITE_REQ);
+}
+
+bStatus_t host_ccc_enable(uint16_t connHandle, uint16_t uuid)
+{
+	return host_ccc_write(connHandle, uuid, GATT_CLIENT_CFG_NOTIFY);
+}
+
+bStatus_t host_ccc_disable(uint16_t connHandle, uint16_t uuid)
+{
+	return host_ccc_write(connHandle, uuid, 0);
+}
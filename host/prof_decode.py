@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+# Decode the handler profile read from the sysinfo characteristic 0xFFE6.
+# Takes the raw value in a file or as hex on the command line or stdin,
+# the way BLE client apps copy it out ("0D-0A-09-3C...", "0x0d0a..").
+# Site names follow the PROF_* enum in ble/ble.h.
+
+import struct
+import sys
+
+SITES = [
+    "evt_msg", "evt_start", "evt_param", "evt_phy", "evt_forth",
+    "evt_contx", "evt_timer", "evt_trace", "evt_keys", "evt_other",
+    "sysinfo_rd", "sysinfo_wr", "console_rd", "console_wr",
+]
+
+
+def load(args):
+    if args:
+        try:
+            with open(args[0], "rb") as f:
+                return f.read()
+        except OSError:
+            text = " ".join(args)
+    else:
+        text = sys.stdin.read()
+    text = text.strip().lower().replace("0x", "")
+    return bytes.fromhex("".join(c for c in text if c in "0123456789abcdef"))
+
+
+def bucket_label(k, shift, per_us):
+    if k == 0:
+        return "<%.0fus" % ((1 << shift) / per_us)
+    return ">=%.0fus" % ((1 << (shift + k - 1)) / per_us)
+
+
+def main():
+    data = load(sys.argv[1:])
+    if len(data) < 4:
+        sys.exit("prof_decode: value too short")
+    sites, buckets, shift, per_us = data[:4]
+    size = 16 + 2 * buckets
+    if len(data) < 4 + sites * size:
+        sys.exit("prof_decode: %d bytes, want %d" %
+                 (len(data), 4 + sites * size))
+    print("%-10s %8s %10s %10s  %s" % ("site", "calls", "avg us", "max us",
+                                       "histogram"))
+    for i in range(sites):
+        off = 4 + i * size
+        count, worst, total = struct.unpack_from("<IIQ", data, off)
+        hist = struct.unpack_from("<%dH" % buckets, data, off + 16)
+        if count == 0:
+            continue
+        name = SITES[i] if i < len(SITES) else "site%d" % i
+        spread = " ".join("%s:%d" % (bucket_label(k, shift, per_us), n)
+                          for k, n in enumerate(hist) if n)
+        print("%-10s %8d %10.2f %10.2f  %s" %
+              (name, count, total / count / per_us, worst / per_us, spread))
+
+
+if __name__ == "__main__":
+    main()
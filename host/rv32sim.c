@@ -0,0 +1,250 @@
+#include <string.h>
+#include "sf_native.h"
+#include "host.h"
+
+// RV32IM interpreter for the code sf_native.c generates, so the native
+// compiler runs on the host too. The code buffer, a 32-bit copy of the
+// task's data stack and a small machine stack are mapped at fixed
+// addresses; any other access, an unknown instruction or running away
+// counts as a fault just like a bounds check in the generated code.
+
+enum {
+	RV_CODE = 0x20000000,
+	RV_DATA = 0x30000000,
+	RV_STACK = 0x40000000,
+	RV_STACK_SIZE = 1024,
+	RV_RETURN = 0x7ffffff0,
+	RV_DATA_MAX = SF_PS_SIZE + 2 * SF_STACK_GUARD,
+	RV_STEP_MAX = 1 << 26,
+};
+
+struct rv32 {
+	uint32_t x[32];
+	uint32_t pc;
+	const uint32_t *code;
+	int size;
+	int32_t data[RV_DATA_MAX];
+	int data_num;
+	uint8_t stack[RV_STACK_SIZE];
+};
+
+static struct rv32 rv;
+static uint64_t retired;
+
+static uint8_t *rv_mem(struct rv32 *r, uint32_t addr, int len, int store)
+{
+	if (addr & (len - 1)) {
+		return NULL;
+	}
+	if (addr - RV_DATA < (uint32_t)r->data_num * 4) {
+		return (uint8_t *)r->data + (addr - RV_DATA);
+	}
+	if (addr - RV_STACK < RV_STACK_SIZE) {
+		return r->stack + (addr - RV_STACK);
+	}
+	if (!store && addr - RV_CODE < (uint32_t)r->size * 4) {
+		return (uint8_t *)r->code + (addr - RV_CODE);
+	}
+	return NULL;
+}
+
+static int32_t rv_sext(uint32_t x, int bits)
+{
+	return (int32_t)(x << (32 - bits)) >> (32 - bits);
+}
+
+static uint32_t rv_alu(uint32_t f3, uint32_t f7, uint32_t a, uint32_t b,
+		       int reg)
+{
+	if (reg && f7 == 1) {
+		switch (f3) {
+		case 0: return a * b;
+		case 1: return (int64_t)(int32_t)a * (int32_t)b >> 32;
+		case 2: return (int64_t)(int32_t)a * (uint64_t)b >> 32;
+		case 3: return (uint64_t)a * b >> 32;
+		case 4:
+			if (b == 0) {
+				return -1;
+			}
+			if ((int32_t)a == INT32_MIN && (int32_t)b == -1) {
+				return a;
+			}
+			return (int32_t)a / (int32_t)b;
+		case 5: return b ? a / b : (uint32_t)-1;
+		case 6:
+			if (b == 0) {
+				return a;
+			}
+			if ((int32_t)a == INT32_MIN && (int32_t)b == -1) {
+				return 0;
+			}
+			return (int32_t)a % (int32_t)b;
+		default: return b ? a % b : a;
+		}
+	}
+	switch (f3) {
+	case 0: return (reg && f7 == 0x20) ? a - b : a + b;
+	case 1: return a << (b & 31);
+	case 2: return (int32_t)a < (int32_t)b;
+	case 3: return a < b;
+	case 4: return a ^ b;
+	case 5:
+		if (f7 & 0x20) {
+			return (int32_t)a >> (b & 31);
+		}
+		return a >> (b & 31);
+	case 6: return a | b;
+	default: return a & b;
+	}
+}
+
+// run from pc until the return to RV_RETURN, 0 if it faulted on the way
+static int rv_run(struct rv32 *r)
+{
+	uint32_t insn, op, rd, rs1, rs2, f3, f7, a, b, addr, next;
+	uint8_t *p;
+	int32_t imm;
+	int steps, take;
+
+	for (steps = 0; steps < RV_STEP_MAX; steps++) {
+		if (r->pc == RV_RETURN) {
+			return 1;
+		}
+		if ((r->pc & 3) || r->pc - RV_CODE >= (uint32_t)r->size * 4) {
+			return 0;
+		}
+		insn = r->code[(r->pc - RV_CODE) / 4];
+		op = insn & 0x7f;
+		rd = insn >> 7 & 31;
+		f3 = insn >> 12 & 7;
+		rs1 = insn >> 15 & 31;
+		rs2 = insn >> 20 & 31;
+		f7 = insn >> 25;
+		a = r->x[rs1];
+		b = r->x[rs2];
+		next = r->pc + 4;
+		retired++;
+		switch (op) {
+		case 0x37: // lui
+			r->x[rd] = insn & 0xfffff000;
+			break;
+		case 0x17: // auipc
+			r->x[rd] = r->pc + (insn & 0xfffff000);
+			break;
+		case 0x6f: // jal
+			imm = rv_sext((insn >> 31) << 20 | (insn >> 12 & 0xff) << 12 |
+				      (insn >> 20 & 1) << 11 |
+				      (insn >> 21 & 0x3ff) << 1, 21);
+			r->x[rd] = next;
+			next = r->pc + imm;
+			break;
+		case 0x67: // jalr
+			r->x[rd] = next;
+			next = (a + rv_sext(insn >> 20, 12)) & ~1u;
+			break;
+		case 0x63:
+			imm = rv_sext((insn >> 31) << 12 | (insn >> 7 & 1) << 11 |
+				      (insn >> 25 & 0x3f) << 5 |
+				      (insn >> 8 & 0xf) << 1, 13);
+			switch (f3) {
+			case 0: take = a == b; break;
+			case 1: take = a != b; break;
+			case 4: take = (int32_t)a < (int32_t)b; break;
+			case 5: take = (int32_t)a >= (int32_t)b; break;
+			case 6: take = a < b; break;
+			case 7: take = a >= b; break;
+			default: return 0;
+			}
+			if (take) {
+				next = r->pc + imm;
+			}
+			break;
+		case 0x03:
+			addr = a + rv_sext(insn >> 20, 12);
+			p = rv_mem(r, addr, 1 << (f3 & 3), 0);
+			if (p == NULL) {
+				return 0;
+			}
+			switch (f3) {
+			case 0: r->x[rd] = (int8_t)p[0]; break;
+			case 1: r->x[rd] = (int16_t)(p[0] | p[1] << 8); break;
+			case 2: memcpy(&r->x[rd], p, 4); break;
+			case 4: r->x[rd] = p[0]; break;
+			case 5: r->x[rd] = p[0] | p[1] << 8; break;
+			default: return 0;
+			}
+			break;
+		case 0x23:
+			addr = a + rv_sext(f7 << 5 | rd, 12);
+			if (f3 > 2 || (p = rv_mem(r, addr, 1 << f3, 1)) == NULL) {
+				return 0;
+			}
+			memcpy(p, &b, 1 << f3);
+			break;
+		case 0x13:
+			imm = rv_sext(insn >> 20, 12);
+			if (f3 == 1 || f3 == 5) {
+				r->x[rd] = rv_alu(f3, f7, a, imm & 31, 0);
+			} else {
+				r->x[rd] = rv_alu(f3, 0, a, imm, 0);
+			}
+			break;
+		case 0x33:
+			r->x[rd] = rv_alu(f3, f7, a, b, 1);
+			break;
+		case 0x0f: // fence, fence.i
+			break;
+		default:
+			return 0;
+		}
+		r->x[0] = 0;
+		r->pc = next;
+	}
+	return 0;
+}
+
+// Stands in for the call through the trampoline at code[0]. The cells
+// from lo to hi and their guards are copied in and back as 32 bits.
+sf_cell *sf_native_sim(const uint32_t *code, int size, void *fn, sf_cell *sp,
+		       sf_cell *lo, sf_cell *hi, int32_t fuel)
+{
+	struct rv32 *r = &rv;
+	sf_cell *base = lo - SF_STACK_GUARD;
+	uint32_t a0;
+	int i;
+
+	r->data_num = hi - lo + 2 * SF_STACK_GUARD;
+	if (r->data_num > RV_DATA_MAX) {
+		return NULL;
+	}
+	for (i = 0; i < r->data_num; i++) {
+		r->data[i] = base[i];
+	}
+	memset(r->x, 0, sizeof(r->x));
+	r->code = code;
+	r->size = size;
+	r->x[1] = RV_RETURN;
+	r->x[2] = RV_STACK + RV_STACK_SIZE;
+	r->x[10] = RV_DATA + (sp - base) * 4;
+	r->x[11] = RV_DATA + (lo - base) * 4;
+	r->x[12] = RV_DATA + (hi - base) * 4;
+	r->x[13] = fuel;
+	r->x[14] = RV_CODE + ((uint32_t *)fn - code) * 4;
+	r->pc = RV_CODE;
+	if (!rv_run(r) || r->x[2] != RV_STACK + RV_STACK_SIZE) {
+		return NULL;
+	}
+	a0 = r->x[10];
+	if (a0 == 0) {
+		return NULL;
+	}
+	for (i = 0; i < r->data_num; i++) {
+		base[i] = r->data[i];
+	}
+	return base + (a0 - RV_DATA) / 4;
+}
+
+uint64_t host_rv32_retired(void)
+{
+	return retired;
+}
@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+# Decode TRACE() frames (lib/trace.h) from a UART capture against the ELF
+# that sent them, fw.elf for a board or fw_host for the host build:
+#
+#   trace_decode.py fw.elf capture.bin
+#   ./fw_host -v console_tx 2>&1 >/dev/null | trace_decode.py fw_host
+#
+# Bytes outside frames, the text printed while booting and the UART
+# console's, pass through. Frames carry 0x11, 0x13 and ESC escaped for
+# the console's XON/XOFF. Times are RTC cycles since boot, printed in
+# seconds.
+
+import re
+import struct
+import sys
+
+SYNC = 0xA5
+ESC = 0x7D
+HEAD = 9
+ARGS_MAX = 6
+RTC_HZ = 32000
+
+CONV = re.compile(r"%([-+ #0]*)(\d*)(?:\.(\d+))?(hh|h|ll|l|z)?([diouxXcsp%])")
+
+
+class Elf:
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        d = self.data
+        if d[:4] != b"\x7fELF":
+            sys.exit("trace_decode: %s is not an ELF" % path)
+        wide = d[4] == 2
+        end = "<" if d[5] == 1 else ">"
+        if wide:
+            shoff, = struct.unpack_from(end + "Q", d, 0x28)
+            shentsize, shnum, shstrndx = struct.unpack_from(end + "HHH", d,
+                                                            0x3A)
+            fmt = end + "IIQQQQ"
+        else:
+            shoff, = struct.unpack_from(end + "I", d, 0x20)
+            shentsize, shnum, shstrndx = struct.unpack_from(end + "HHH", d,
+                                                            0x2E)
+            fmt = end + "IIIIII"
+        secs = []
+        for i in range(shnum):
+            name, kind, flags, addr, off, size = struct.unpack_from(
+                fmt, d, shoff + i * shentsize)
+            secs.append((name, kind, flags, addr, off, size))
+        names = secs[shstrndx]
+        self.sections = {}
+        self.loaded = []
+        for name, kind, flags, addr, off, size in secs:
+            start = names[4] + name
+            name = d[start:d.index(b"\0", start)].decode()
+            body = d[off:off + size] if kind != 8 else b""  # not NOBITS
+            self.sections[name] = body
+            if flags & 2 and body:  # SHF_ALLOC
+                self.loaded.append((addr, body))
+
+    def string(self, addr):
+        for base, body in self.loaded:
+            if base <= addr < base + len(body):
+                end = body.find(b"\0", addr - base)
+                return body[addr - base:end].decode("latin-1")
+        return None
+
+
+def fmt_string(fmts, fid):
+    end = fmts.find(b"\0", fid)
+    return fmts[fid:end].decode("latin-1")
+
+
+def format_frame(elf, fmt, args):
+    args = list(args)
+
+    def conv(m):
+        flags, width, prec, _, kind = m.groups()
+        if kind == "%":
+            return "%"
+        x = args.pop(0) if args else 0
+        spec = "%" + flags + width + ("." + prec if prec else "")
+        if kind in "di":
+            return (spec + "d") % (x - (1 << 32) if x >> 31 else x)
+        if kind == "s":
+            s = elf.string(x)
+            return (spec + "s") % (s if s is not None else "<%#x>" % x)
+        if kind == "c":
+            return (spec + "c") % chr(x & 0xFF)
+        if kind == "p":
+            return "%#x" % x
+        return (spec + kind) % x
+
+    return CONV.sub(conv, fmt)
+
+
+def argc_of(fmt):
+    return sum(1 for m in CONV.finditer(fmt) if m.group(5) != "%")
+
+
+def take(data, i, n):
+    """n frame bytes from i on with the escapes undone, and where they end"""
+    got = bytearray()
+    while len(got) < n and i < len(data):
+        c = data[i]
+        i += 1
+        if c == ESC:
+            if i == len(data):
+                break
+            c = data[i] ^ 0x20
+            i += 1
+        got.append(c)
+    return bytes(got), i
+
+
+def decode(elf, data, out):
+    fmts = elf.sections.get("trace_fmt")
+    if fmts is None:
+        sys.exit("trace_decode: no trace_fmt section")
+    seq = None
+    i = 0
+    while i < len(data):
+        head, j = take(data, i + 1, HEAD - 1)
+        if data[i] != SYNC or len(head) < HEAD - 1:
+            out.write(chr(data[i]))
+            i += 1
+            continue
+        fseq, fid, argc, time = struct.unpack_from("<BHBI", head)
+        valid = (fid < len(fmts) and (fid == 0 or fmts[fid - 1] == 0) and
+                 argc <= ARGS_MAX)
+        fmt = fmt_string(fmts, fid) if valid else ""
+        body, j = take(data, j, argc * 4)
+        if not valid or argc_of(fmt) != argc or len(body) < argc * 4:
+            out.write(chr(data[i]))
+            i += 1
+            continue
+        args = struct.unpack_from("<%dI" % argc, body)
+        if seq is not None and fseq != (seq + 1) & 0xFF:
+            out.write("[%12s] %d frames dropped\n" % ("",
+                                                      (fseq - seq - 1) & 0xFF))
+        seq = fseq
+        text = format_frame(elf, fmt, args).rstrip("\r\n")
+        out.write("[%12.6f] %s\n" % (time / RTC_HZ, text))
+        i = j
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit("usage: trace_decode.py ELF [CAPTURE]")
+    elf = Elf(sys.argv[1])
+    if len(sys.argv) > 2:
+        with open(sys.argv[2], "rb") as f:
+            data = f.read()
+    else:
+        data = sys.stdin.buffer.read()
+    decode(elf, data, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
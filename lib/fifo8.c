@@ -1,5 +1,13 @@
+#include <string.h>
 #include "fifo8.h"
 
+void fifo8_init(struct fifo8 *p, uint8_t *buf, uint8_t size) {
+	p->buf = buf;
+	p->size = size;
+	p->mask = (size & (size - 1)) ? 0 : (size - 1);
+	fifo8_reset(p);
+}
+
 void fifo8_reset(struct fifo8 *p) {
 	p->head = 0;
 	p->num = 0;
@@ -13,18 +21,130 @@ int fifo8_free(struct fifo8 *p) {
 	return p->size - p->num;
 }
 
-// CH582 have hardware division instruction, so use % instead &
+// CH582 have hardware division instruction, but a divide still takes
+// tens of cycles, power of two sized fifo (set up by fifo8_init) use &
+
+static inline int fifo8_wrap(struct fifo8 *p, int idx) {
+	if (p->mask) {
+		return idx & p->mask;
+	}
+	return idx % p->size;
+}
 
 void fifo8_push(struct fifo8 *p, uint8_t data) {
-	p->buf[(p->head + p->num) % p->size] = data;
+	p->buf[fifo8_wrap(p, p->head + p->num)] = data;
 	p->num++;
 }
 
 int fifo8_pop(struct fifo8 *p) {
 	uint8_t ret;
 
-	ret = p->buf[p->head++];
-	p->head %= p->size;
+	ret = p->buf[p->head];
+	p->head = fifo8_wrap(p, p->head + 1);
 	p->num--;
 	return ret;
 }
+
+// span operations, head + num never reach 2 * size so one compare is
+// enough to wrap, and a span splits into at most two memcpy
+
+int fifo8_push_buf(struct fifo8 *p, const uint8_t *data, int len) {
+	int tail, n;
+
+	if (len > p->size - p->num) {
+		len = p->size - p->num;
+	}
+	tail = p->head + p->num;
+	if (tail >= p->size) {
+		tail -= p->size;
+	}
+	n = p->size - tail;
+	if (n > len) {
+		n = len;
+	}
+	memcpy(&p->buf[tail], data, n);
+	memcpy(p->buf, data + n, len - n);
+	p->num += len;
+	return len;
+}
+
+// copy out without consuming, for a consumer that may have to retry
+int fifo8_peek_buf(struct fifo8 *p, uint8_t *data, int len) {
+	int n;
+
+	if (len > p->num) {
+		len = p->num;
+	}
+	n = p->size - p->head;
+	if (n > len) {
+		n = len;
+	}
+	memcpy(data, &p->buf[p->head], n);
+	memcpy(data + n, p->buf, len - n);
+	return len;
+}
+
+int fifo8_pop_buf(struct fifo8 *p, uint8_t *data, int len) {
+	len = fifo8_peek_buf(p, data, len);
+	fifo8_drop(p, len);
+	return len;
+}
+
+// readable bytes starting at head without crossing the wrap point,
+// consume them with fifo8_drop once they are handed off
+int fifo8_peek_contig(struct fifo8 *p, uint8_t **data) {
+	int n;
+
+	*data = &p->buf[p->head];
+	n = p->size - p->head;
+	if (n > p->num) {
+		n = p->num;
+	}
+	return n;
+}
+
+static void fifo8_reverse(uint8_t *a, int n) {
+	uint8_t t;
+	int i;
+
+	for (i = 0; i < n / 2; i++) {
+		t = a[i];
+		a[i] = a[n - 1 - i];
+		a[n - 1 - i] = t;
+	}
+}
+
+// carry the contents over to another buffer, which must hold them
+void fifo8_move(struct fifo8 *p, uint8_t *buf, uint8_t size) {
+	int num;
+
+	num = fifo8_peek_buf(p, buf, size);
+	fifo8_init(p, buf, size);
+	p->num = num;
+}
+
+// move the readable bytes to the start of the buffer, so the buffer
+// itself can be handed on in one piece
+void fifo8_compact(struct fifo8 *p) {
+	if (p->head == 0) {
+		return;
+	}
+	fifo8_reverse(p->buf, p->head);
+	fifo8_reverse(p->buf + p->head, p->size - p->head);
+	fifo8_reverse(p->buf, p->size);
+	p->head = 0;
+}
+
+void fifo8_drop(struct fifo8 *p, int len) {
+	int head;
+
+	if (len > p->num) {
+		len = p->num;
+	}
+	head = p->head + len;
+	if (head >= p->size) {
+		head -= p->size;
+	}
+	p->head = head;
+	p->num -= len;
+}
@@ -7,12 +7,21 @@ struct fifo8 {
 	uint8_t *buf;
 	uint8_t head;
 	uint8_t num;
+	uint8_t mask; // size - 1 when size is a power of two, else 0
 };
 
+void fifo8_init(struct fifo8 *p, uint8_t *buf, uint8_t size);
 void fifo8_reset(struct fifo8 *p);
 int fifo8_used(struct fifo8 *p);
 int fifo8_free(struct fifo8 *p);
 void fifo8_push(struct fifo8 *p, uint8_t data);
 int fifo8_pop(struct fifo8 *p);
+int fifo8_push_buf(struct fifo8 *p, const uint8_t *data, int len);
+int fifo8_pop_buf(struct fifo8 *p, uint8_t *data, int len);
+int fifo8_peek_buf(struct fifo8 *p, uint8_t *data, int len);
+int fifo8_peek_contig(struct fifo8 *p, uint8_t **data);
+void fifo8_drop(struct fifo8 *p, int len);
+void fifo8_compact(struct fifo8 *p);
+void fifo8_move(struct fifo8 *p, uint8_t *buf, uint8_t size);
 
 #endif
@@ -0,0 +1,22 @@
+#ifndef _MCYCLE_H_
+#define _MCYCLE_H_
+#include <stdint.h>
+
+// free running core cycle counter, wraps every ~71s at 60MHz so only
+// differences are meaningful
+enum {
+	MCYCLE_PER_US = 60,
+};
+
+#ifdef __riscv
+static inline uint32_t mcycle(void) {
+	uint32_t c;
+
+	__asm__ volatile("csrr %0, mcycle" : "=r"(c));
+	return c;
+}
+#else
+uint32_t mcycle(void); // provided by the host port
+#endif
+
+#endif
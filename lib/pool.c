@@ -0,0 +1,69 @@
+#include <string.h>
+#include "pool.h"
+
+void pool_init(struct pool *p, void *mem, uint32_t *map, int block,
+	       int num) {
+	p->mem = mem;
+	p->map = map;
+	p->block = block;
+	p->num = num;
+	p->used = 0;
+	p->peak = 0;
+	p->fails = 0;
+	memset(map, 0, POOL_MAP_WORDS(num) * sizeof(uint32_t));
+}
+
+static inline int pool_taken(struct pool *p, int i) {
+	return p->map[i >> 5] >> (i & 31) & 1;
+}
+
+static void pool_mark(struct pool *p, int i, int n, int taken) {
+	for (; n--; i++) {
+		if (taken) {
+			p->map[i >> 5] |= 1u << (i & 31);
+		} else {
+			p->map[i >> 5] &= ~(1u << (i & 31));
+		}
+	}
+}
+
+// first fit, a full map word is skipped in one step
+void *pool_alloc(struct pool *p, int n) {
+	int i = 0, run = 0;
+
+	if (n <= 0 || n > p->num - p->used) {
+		p->fails++;
+		return NULL;
+	}
+	while (i < p->num) {
+		if ((i & 31) == 0 && p->map[i >> 5] == 0xffffffff) {
+			i += 32;
+			run = 0;
+			continue;
+		}
+		run = pool_taken(p, i) ? 0 : run + 1;
+		i++;
+		if (run == n) {
+			pool_mark(p, i - n, n, 1);
+			p->used += n;
+			if (p->used > p->peak) {
+				p->peak = p->used;
+			}
+			return p->mem + (i - n) * p->block;
+		}
+	}
+	p->fails++;
+	return NULL;
+}
+
+void pool_free(struct pool *p, void *ptr, int n) {
+	if (ptr == NULL) {
+		return;
+	}
+	pool_mark(p, ((uint8_t *)ptr - p->mem) / p->block, n, 0);
+	p->used -= n;
+}
+
+int pool_free_blocks(struct pool *p) {
+	return p->num - p->used;
+}
@@ -0,0 +1,28 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+#include <stdint.h>
+
+// Fixed-block allocator over a static arena. A bit per block marks it
+// taken; an allocation is a run of adjacent blocks so the caller gets
+// one flat buffer, freed again with the same count. No locking, call
+// it from one context only.
+
+#define POOL_MAP_WORDS(num) (((num) + 31) / 32)
+
+struct pool {
+	uint8_t *mem;
+	uint32_t *map;
+	uint16_t block; // bytes per block
+	uint16_t num; // blocks in the arena
+	uint16_t used;
+	uint16_t peak;
+	uint32_t fails;
+};
+
+void pool_init(struct pool *p, void *mem, uint32_t *map, int block,
+	       int num);
+void *pool_alloc(struct pool *p, int n);
+void pool_free(struct pool *p, void *ptr, int n);
+int pool_free_blocks(struct pool *p);
+
+#endif
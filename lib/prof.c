@@ -0,0 +1,56 @@
+#include <string.h>
+#include "prof.h"
+
+int prof_bucket(uint32_t cycles) {
+	int b;
+
+	cycles >>= PROF_SHIFT;
+	if (cycles == 0) {
+		return 0;
+	}
+	b = 32 - __builtin_clz(cycles);
+	return b < PROF_BUCKETS ? b : PROF_BUCKETS - 1;
+}
+
+void prof_add(struct prof_site *s, uint32_t cycles) {
+	uint16_t *h = &s->hist[prof_bucket(cycles)];
+
+	if (s->count != UINT32_MAX) {
+		s->count++;
+	}
+	s->total += cycles;
+	if (cycles > s->max) {
+		s->max = cycles;
+	}
+	if (*h != UINT16_MAX) {
+		(*h)++;
+	}
+}
+
+void prof_reset(struct prof_site *s, int n) {
+	memset(s, 0, sizeof(*s) * n);
+}
+
+static uint8_t *prof_le(uint8_t *p, uint64_t x, int len) {
+	while (len--) {
+		*p++ = x;
+		x >>= 8;
+	}
+	return p;
+}
+
+// n sites little endian, u32 count, u32 max, u64 total and the u16
+// buckets, PROF_SITE_LEN bytes each
+int prof_encode(const struct prof_site *s, int n, uint8_t *p) {
+	int i, k;
+
+	for (i = 0; i < n; i++, s++) {
+		p = prof_le(p, s->count, 4);
+		p = prof_le(p, s->max, 4);
+		p = prof_le(p, s->total, 8);
+		for (k = 0; k < PROF_BUCKETS; k++) {
+			p = prof_le(p, s->hist[k], 2);
+		}
+	}
+	return n * PROF_SITE_LEN;
+}
@@ -0,0 +1,34 @@
+#ifndef _PROF_H_
+#define _PROF_H_
+#include <stdint.h>
+#include "mcycle.h"
+
+// Cycle profiler for code sites picked by the caller. A site keeps its
+// call count, total and worst cycles and a log2 histogram, bucket 0 for
+// under 2^PROF_SHIFT cycles and the last one for everything from
+// 2^(PROF_SHIFT + PROF_BUCKETS - 2) up. Counts saturate instead of
+// wrapping. No locking, bracket sites of one context only.
+
+enum {
+	PROF_BUCKETS = 10,
+	PROF_SHIFT = 9, // 8.5us at 60MHz
+	PROF_SITE_LEN = 16 + PROF_BUCKETS * 2, // prof_encode() bytes per site
+};
+
+struct prof_site {
+	uint32_t count;
+	uint32_t max;
+	uint64_t total;
+	uint16_t hist[PROF_BUCKETS];
+};
+
+int prof_bucket(uint32_t cycles);
+void prof_add(struct prof_site *s, uint32_t cycles);
+void prof_reset(struct prof_site *s, int n);
+int prof_encode(const struct prof_site *s, int n, uint8_t *p);
+
+static inline void prof_end(struct prof_site *s, uint32_t start) {
+	prof_add(s, mcycle() - start);
+}
+
+#endif
@@ -0,0 +1,110 @@
+#include <string.h>
+#include "spsc.h"
+
+// acquire on the index owned by the other side, release when publishing
+// our own, on rv32 this puts a fence between the data and index access
+
+static inline uint16_t spsc_load(uint16_t *idx) {
+	return __atomic_load_n(idx, __ATOMIC_ACQUIRE);
+}
+
+static inline void spsc_store(uint16_t *idx, uint16_t val) {
+	__atomic_store_n(idx, val, __ATOMIC_RELEASE);
+}
+
+void spsc_init(struct spsc *p, uint8_t *buf, uint16_t size) {
+	p->buf = buf;
+	p->size = size;
+	p->mask = size - 1;
+	p->head = 0;
+	p->tail = 0;
+}
+
+int spsc_used(struct spsc *p) {
+	return (uint16_t)(spsc_load(&p->tail) - spsc_load(&p->head));
+}
+
+int spsc_free(struct spsc *p) {
+	return p->size - spsc_used(p);
+}
+
+// producer side
+
+int spsc_push(struct spsc *p, uint8_t data) {
+	uint16_t tail = p->tail;
+
+	if ((uint16_t)(tail - spsc_load(&p->head)) == p->size) {
+		return 0;
+	}
+	p->buf[tail & p->mask] = data;
+	spsc_store(&p->tail, tail + 1);
+	return 1;
+}
+
+int spsc_push_buf(struct spsc *p, const uint8_t *data, int len) {
+	uint16_t tail = p->tail;
+	int room, off, n;
+
+	room = p->size - (uint16_t)(tail - spsc_load(&p->head));
+	if (len > room) {
+		len = room;
+	}
+	off = tail & p->mask;
+	n = p->size - off;
+	if (n > len) {
+		n = len;
+	}
+	memcpy(&p->buf[off], data, n);
+	memcpy(p->buf, data + n, len - n);
+	spsc_store(&p->tail, tail + len);
+	return len;
+}
+
+// consumer side
+
+int spsc_pop(struct spsc *p) {
+	uint16_t head = p->head;
+	uint8_t ret;
+
+	if (head == spsc_load(&p->tail)) {
+		return -1;
+	}
+	ret = p->buf[head & p->mask];
+	spsc_store(&p->head, head + 1);
+	return ret;
+}
+
+int spsc_pop_buf(struct spsc *p, uint8_t *data, int len) {
+	uint16_t head = p->head;
+	int used, off, n;
+
+	used = (uint16_t)(spsc_load(&p->tail) - head);
+	if (len > used) {
+		len = used;
+	}
+	off = head & p->mask;
+	n = p->size - off;
+	if (n > len) {
+		n = len;
+	}
+	memcpy(data, &p->buf[off], n);
+	memcpy(data + n, p->buf, len - n);
+	spsc_store(&p->head, head + len);
+	return len;
+}
+
+// the used bytes up to the end of the buffer, for handing straight to a
+// writer that may take fewer, spsc_skip() then drops what it took
+int spsc_peek(struct spsc *p, uint8_t **data) {
+	uint16_t head = p->head;
+	int used, off;
+
+	used = (uint16_t)(spsc_load(&p->tail) - head);
+	off = head & p->mask;
+	*data = &p->buf[off];
+	return used < p->size - off ? used : p->size - off;
+}
+
+void spsc_skip(struct spsc *p, int len) {
+	spsc_store(&p->head, p->head + len);
+}
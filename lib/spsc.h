@@ -0,0 +1,29 @@
+#ifndef _SPSC_H_
+#define _SPSC_H_
+#include <stdint.h>
+
+// Lock-free single producer / single consumer byte ring. The producer
+// only writes tail and the consumer only writes head, so one side may
+// run in an interrupt handler without masking interrupts on the other.
+// Indices run free and wrap at 2^16, size must be a power of two and at
+// most 32768.
+
+struct spsc {
+	uint8_t *buf;
+	uint16_t size;
+	uint16_t mask;
+	uint16_t head; // consumer
+	uint16_t tail; // producer
+};
+
+void spsc_init(struct spsc *p, uint8_t *buf, uint16_t size);
+int spsc_used(struct spsc *p);
+int spsc_free(struct spsc *p);
+int spsc_push(struct spsc *p, uint8_t data);
+int spsc_pop(struct spsc *p);
+int spsc_push_buf(struct spsc *p, const uint8_t *data, int len);
+int spsc_pop_buf(struct spsc *p, uint8_t *data, int len);
+int spsc_peek(struct spsc *p, uint8_t **data);
+void spsc_skip(struct spsc *p, int len);
+
+#endif
@@ -0,0 +1,98 @@
+#include <stddef.h>
+#include "stimer.h"
+
+void stimer_init(struct stimer_list *l) {
+	l->head = NULL;
+	l->wakeups = 0;
+	l->runs = 0;
+	l->stops = 0;
+}
+
+void stimer_setup(struct stimer *t, int (*fn)(int arg), int arg) {
+	t->next = NULL;
+	t->fn = fn;
+	t->arg = arg;
+	t->armed = 0;
+}
+
+// (re)arm t on the grid of its period, a period of 0 stops it
+void stimer_start(struct stimer_list *l, struct stimer *t, uint32_t now,
+		  uint32_t period, uint32_t slack) {
+	if (period == 0) {
+		stimer_stop(l, t);
+		return;
+	}
+	t->period = period;
+	t->slack = slack < period ? slack : period - 1;
+	t->due = (now / period + 1) * period;
+	if (!t->armed) {
+		t->armed = 1;
+		t->next = l->head;
+		l->head = t;
+	}
+}
+
+void stimer_stop(struct stimer_list *l, struct stimer *t) {
+	struct stimer **pp;
+
+	if (!t->armed) {
+		return;
+	}
+	for (pp = &l->head; *pp; pp = &(*pp)->next) {
+		if (*pp == t) {
+			*pp = t->next;
+			break;
+		}
+	}
+	t->armed = 0;
+}
+
+// ticks until the earliest timer is due, 0 when nothing is armed
+int stimer_next(struct stimer_list *l, uint32_t now, uint32_t *delay) {
+	struct stimer *t;
+	int32_t d, best = INT32_MAX;
+
+	for (t = l->head; t; t = t->next) {
+		d = t->due - now;
+		if (d < best) {
+			best = d;
+		}
+	}
+	if (l->head == NULL) {
+		return 0;
+	}
+	*delay = best > 0 ? best : 0;
+	return 1;
+}
+
+// Run every timer due by now plus its slack, returns how many ran. A
+// callback may start or stop any timer, the list is walked again after
+// each run until a pass runs nothing.
+int stimer_run(struct stimer_list *l, uint32_t now) {
+	struct stimer *t;
+	int n = 0, ran;
+
+	do {
+		ran = 0;
+		for (t = l->head; t; t = t->next) {
+			if ((int32_t)(t->due - now) > (int32_t)t->slack) {
+				continue;
+			}
+			// next period on the grid before the callback, so it
+			// can stop or restart its own timer
+			while ((int32_t)(t->due - now) <= (int32_t)t->slack) {
+				t->due += t->period;
+			}
+			n++;
+			if (!t->fn(t->arg)) {
+				stimer_stop(l, t);
+				l->stops++;
+			}
+			ran = 1;
+			break;
+		}
+	} while (ran);
+	l->runs += n;
+	l->wakeups += n > 0;
+	return n;
+}
@@ -0,0 +1,37 @@
+#ifndef _STIMER_H_
+#define _STIMER_H_
+#include <stdint.h>
+
+// Periodic soft timers multiplexed onto one hardware or OS timer. A
+// timer is due on multiples of its period counted from tick 0, so all
+// timers of one period fall due together, and one due within its slack
+// of a wakeup runs early to share it. A callback returning 0 had no
+// work and stops its timer until it is started again. Times are in the
+// caller's ticks. No locking, call it from one context only.
+
+struct stimer {
+	struct stimer *next;
+	int (*fn)(int arg);
+	int arg;
+	uint32_t due;
+	uint32_t period;
+	uint32_t slack; // may run this much early, less than period
+	uint8_t armed;
+};
+
+struct stimer_list {
+	struct stimer *head;
+	uint32_t wakeups; // stimer_run() calls that ran anything
+	uint32_t runs;
+	uint32_t stops; // callbacks that found nothing to do
+};
+
+void stimer_init(struct stimer_list *l);
+void stimer_setup(struct stimer *t, int (*fn)(int arg), int arg);
+void stimer_start(struct stimer_list *l, struct stimer *t, uint32_t now,
+		  uint32_t period, uint32_t slack);
+void stimer_stop(struct stimer_list *l, struct stimer *t);
+int stimer_next(struct stimer_list *l, uint32_t now, uint32_t *delay);
+int stimer_run(struct stimer_list *l, uint32_t now);
+
+#endif
@@ -0,0 +1,94 @@
+#include <stddef.h>
+#include "trace.h"
+
+struct trace trace_ring;
+
+void trace_init(uint8_t *buf, uint16_t size, uint32_t (*clock)(void),
+		void (*wake)(void)) {
+	struct trace *t = &trace_ring;
+
+	spsc_init(&t->ring, buf, size);
+	t->clock = clock;
+	t->wake = wake;
+	t->seq = 0;
+	t->frames = 0;
+	t->dropped = 0;
+}
+
+static uint8_t *trace_le32(uint8_t *p, uint32_t x) {
+	p[0] = x;
+	p[1] = x >> 8;
+	p[2] = x >> 16;
+	p[3] = x >> 24;
+	return p + 4;
+}
+
+void trace_log(uint16_t id, int argc, const uint32_t *argv) {
+	struct trace *t = &trace_ring;
+	uint8_t f[TRACE_FRAME_MAX], *p = f;
+	int i, empty;
+
+	t->frames++;
+	if (spsc_free(&t->ring) < TRACE_HEAD + argc * 4) {
+		t->seq++;
+		t->dropped++;
+		return;
+	}
+	*p++ = TRACE_SYNC;
+	*p++ = t->seq++;
+	*p++ = id;
+	*p++ = id >> 8;
+	*p++ = argc;
+	p = trace_le32(p, t->clock ? t->clock() : 0);
+	for (i = 0; i < argc; i++) {
+		p = trace_le32(p, argv[i]);
+	}
+	empty = spsc_used(&t->ring) == 0;
+	spsc_push_buf(&t->ring, f, p - f);
+	if (empty && t->wake) {
+		t->wake();
+	}
+}
+
+// hand the ring to write() until it takes less than offered, returns
+// the bytes it took
+int trace_drain(int (*write)(const uint8_t *p, int len)) {
+	struct trace *t = &trace_ring;
+	uint8_t *p;
+	int n, w, total = 0;
+
+	while ((n = spsc_peek(&t->ring, &p)) > 0) {
+		w = write(p, n);
+		spsc_skip(&t->ring, w);
+		total += w;
+		if (w < n) {
+			break;
+		}
+	}
+	return total;
+}
+
+int trace_pending(void) {
+	return spsc_used(&trace_ring.ring);
+}
+
+// Escape as much of p as fits size bytes of out, returns the bytes put
+// out and the ones of p they took in *taken.
+int trace_escape(const uint8_t *p, int len, uint8_t *out, int size,
+		 int *taken) {
+	int i, n = 0;
+
+	for (i = 0; i < len && n < size; i++) {
+		if (p[i] == 0x11 || p[i] == 0x13 || p[i] == TRACE_ESC) {
+			if (n + 2 > size) {
+				break;
+			}
+			out[n++] = TRACE_ESC;
+			out[n++] = p[i] ^ 0x20;
+		} else {
+			out[n++] = p[i];
+		}
+	}
+	*taken = i;
+	return n;
+}
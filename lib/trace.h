@@ -0,0 +1,78 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+#include <stdint.h>
+#include "spsc.h"
+
+// Deferred debug log. TRACE() keeps its format string in the trace_fmt
+// section and puts only the string's offset there and the raw argument
+// words into a RAM ring, a frame of a few bytes instead of formatted
+// text. The ring is drained to a byte sink when there is time and
+// host/trace_decode.py formats the frames with the strings from the
+// ELF. The target link script keeps the section out of flash. Arguments
+// are stored as 32-bit words, %s only works for strings in the ELF. No
+// locking, log from one context only.
+//
+// Frame, little endian: TRACE_SYNC, u8 seq, u16 id, u8 argc, u32 time,
+// then argc u32 words. seq counts every TRACE(), dropped frames leave a
+// gap in it. On a line with XON/XOFF flow control trace_escape() sends
+// those two and TRACE_ESC itself as TRACE_ESC, c ^ 0x20.
+
+enum {
+	TRACE_SYNC = 0xA5,
+	TRACE_ARGS_MAX = 6,
+	TRACE_HEAD = 9,
+	TRACE_FRAME_MAX = TRACE_HEAD + TRACE_ARGS_MAX * 4,
+	TRACE_ESC = 0x7D,
+};
+
+struct trace {
+	struct spsc ring;
+	uint32_t (*clock)(void); // frame time stamps
+	void (*wake)(void); // called when the ring stops being empty
+	uint8_t seq;
+	uint32_t frames;
+	uint32_t dropped; // the ring was full
+};
+
+extern struct trace trace_ring;
+
+void trace_init(uint8_t *buf, uint16_t size, uint32_t (*clock)(void),
+		void (*wake)(void));
+void trace_log(uint16_t id, int argc, const uint32_t *argv);
+int trace_drain(int (*write)(const uint8_t *p, int len));
+int trace_pending(void);
+int trace_escape(const uint8_t *p, int len, uint8_t *out, int size,
+		 int *taken);
+
+#define TRACE_CAT_(a, b) a##b
+#define TRACE_CAT(a, b) TRACE_CAT_(a, b)
+#define TRACE_NARGS_(_, a, b, c, d, e, f, n, ...) n
+#define TRACE_NARGS(...) TRACE_NARGS_(_, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define TRACE_W(x) ((uint32_t)(uintptr_t)(x))
+#define TRACE_MAP0()
+#define TRACE_MAP1(a) TRACE_W(a)
+#define TRACE_MAP2(a, ...) TRACE_W(a), TRACE_MAP1(__VA_ARGS__)
+#define TRACE_MAP3(a, ...) TRACE_W(a), TRACE_MAP2(__VA_ARGS__)
+#define TRACE_MAP4(a, ...) TRACE_W(a), TRACE_MAP3(__VA_ARGS__)
+#define TRACE_MAP5(a, ...) TRACE_W(a), TRACE_MAP4(__VA_ARGS__)
+#define TRACE_MAP6(a, ...) TRACE_W(a), TRACE_MAP5(__VA_ARGS__)
+#define TRACE_MAP(...) \
+	TRACE_CAT(TRACE_MAP, TRACE_NARGS(__VA_ARGS__))(__VA_ARGS__)
+
+#ifdef DEBUG
+extern const char __start_trace_fmt[];
+#define TRACE(fmt, ...)                                                      \
+	do {                                                                 \
+		static const char trace_fmt_[]                               \
+			__attribute__((section("trace_fmt"), used)) = fmt;  \
+		const uint32_t trace_argv_[] = { 0, TRACE_MAP(__VA_ARGS__) }; \
+		trace_log(trace_fmt_ - __start_trace_fmt,                    \
+			  TRACE_NARGS(__VA_ARGS__), trace_argv_ + 1);        \
+	} while (0)
+#else
+#define TRACE(fmt, ...) \
+	do {            \
+	} while (0)
+#endif
+
+#endif